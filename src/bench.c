@@ -0,0 +1,1434 @@
+/*
+ * bench.c - Micro-benchmarks for the lab data structures
+ *
+ * Usage: ./run_bench [name] [args...]
+ * With no name every benchmark runs with its default (small) size.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lab5.h"
+
+char *strdup(const char *s);
+
+/* ========== Timing helpers ========== */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Log2 latency histogram: bucket b holds samples in [2^b, 2^(b+1)) ns. */
+#define HIST_BUCKETS 40
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} LatencyHist;
+
+static void hist_add(LatencyHist *h, uint64_t ns) {
+    int b = 0;
+    while (b < HIST_BUCKETS - 1 && (ns >> (b + 1)) != 0) b++;
+    h->counts[b]++;
+    h->total++;
+    if (ns > h->max) h->max = ns;
+}
+
+/* Upper bound of the bucket containing the given percentile. */
+static uint64_t hist_percentile(const LatencyHist *h, double pct) {
+    uint64_t target = (uint64_t)(h->total * pct / 100.0);
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen > target) return (uint64_t)2 << b;
+    }
+    return h->max;
+}
+
+static void hist_print(const char *label, const LatencyHist *h) {
+    printf("  %-22s n=%-9llu p50<=%-6llu p99<=%-6llu p99.9<=%-7llu max=%llu ns\n",
+           label, (unsigned long long)h->total,
+           (unsigned long long)hist_percentile(h, 50.0),
+           (unsigned long long)hist_percentile(h, 99.0),
+           (unsigned long long)hist_percentile(h, 99.9),
+           (unsigned long long)h->max);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* ========== Hash growth latency ========== */
+
+/* Insert keys into a tiny table and report h_put/h_get_ids latency per
+ * decade of table size. With incremental rehashing p99 should stay flat
+ * as the table grows; only the max reflects the occasional bucket calloc. */
+static void bench_hash_growth(long maxKeys) {
+    printf("hash-growth: %ld keys, starting from 31 buckets\n", maxKeys);
+
+    Hash h;
+    h_init(&h, 31);
+
+    char key[64];
+    long decadeStart = 1000;
+    LatencyHist put = {0}, get = {0};
+
+    for (long i = 0; i < maxKeys; i++) {
+        snprintf(key, sizeof(key), "does_it_have_trait_%ld", i);
+
+        uint64_t t0 = now_ns();
+        h_put(&h, key, (int)(i & 0x7fffffff));
+        uint64_t t1 = now_ns();
+        hist_add(&put, t1 - t0);
+
+        snprintf(key, sizeof(key), "does_it_have_trait_%ld", (i * 7919) % (i + 1));
+        int count;
+        t0 = now_ns();
+        h_get_ids(&h, key, &count);
+        t1 = now_ns();
+        hist_add(&get, t1 - t0);
+
+        if (i + 1 == decadeStart * 10 || i + 1 == maxKeys) {
+            char label[64];
+            if (i + 1 >= decadeStart) {
+                snprintf(label, sizeof(label), "h_put  %ld-%ld", decadeStart, i + 1);
+                hist_print(label, &put);
+                snprintf(label, sizeof(label), "h_get  %ld-%ld", decadeStart, i + 1);
+                hist_print(label, &get);
+            }
+            memset(&put, 0, sizeof(put));
+            memset(&get, 0, sizeof(get));
+            decadeStart *= 10;
+        } else if (i + 1 == decadeStart) {
+            memset(&put, 0, sizeof(put)); // first decade starts at 1k keys
+            memset(&get, 0, sizeof(get));
+        }
+    }
+    printf("  final: %d keys in %d buckets%s\n", h.size, h.nbuckets,
+           h_rehashing(&h) ? " (resize in progress)" : "");
+    h_free(&h);
+}
+
+/* ========== Canonicalize throughput ========== */
+
+/* Canonicalize a large buffer of question-like text with every available
+ * implementation and report throughput in GB/s. */
+static void bench_canonicalize(long bytes) {
+    static const char *words[] = {
+        "Does", "it", "live", "in", "water?", "Can", "it", "FLY?", "Is", "it",
+        "bigger", "than", "a", "breadbox?", "Does", "it", "have", "4", "legs?"
+    };
+    const int nwords = (int)(sizeof(words) / sizeof(words[0]));
+
+    char *text = malloc((size_t)bytes + 32);
+    if (!text) return;
+    long len = 0;
+    for (int w = 0; len + 16 < bytes; w = (w + 1) % nwords) {
+        len += sprintf(text + len, "%s ", words[w]);
+    }
+    text[len] = '\0';
+
+    printf("canonicalize: %ld bytes of question text\n", len);
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    CanonImpl best = canonicalize_best_impl();
+
+    for (int impl = CANON_SCALAR; impl <= (int)best; impl++) {
+        int reps = 0;
+        uint64_t t0 = now_ns(), t1;
+        do {
+            free(canonicalize_with(text, (CanonImpl)impl));
+            reps++;
+            t1 = now_ns();
+        } while (t1 - t0 < 500000000ull); // run for ~0.5 s
+        double gbps = (double)len * reps / (double)(t1 - t0);
+        printf("  %-6s %8.3f GB/s\n", names[impl], gbps);
+    }
+    free(text);
+}
+
+/* ========== Hash function quality ========== */
+
+/* Build the benchmark corpus: every question in the saved tree plus
+ * synthetic variants in the same phrasing, so the keys look like the
+ * canonicalized questions the attribute index actually stores. */
+static char **load_question_corpus(const char *treeFile, int want, int *outCount) {
+    static const char *lead[] = {"does_it", "can_it", "is_it", "does_it_usually", "has_it"};
+    static const char *verb[] = {"live_in", "eat", "have", "like", "hunt", "avoid", "sleep_in"};
+    static const char *noun[] = {"water", "trees", "fur", "feathers", "fish", "grass",
+                                 "the_desert", "snow", "insects", "four_legs", "a_tail"};
+
+    char **keys = malloc(sizeof(char *) * (size_t)want);
+    int n = 0;
+
+    Node *saved = g_root;
+    g_root = NULL;
+    if (load_tree(treeFile)) {
+        Queue q;
+        q_init(&q);
+        q_enqueue(&q, g_root, 0);
+        Node *cur;
+        int id;
+        while (n < want && q_dequeue(&q, &cur, &id)) {
+            if (!cur->isQuestion) continue;
+            keys[n++] = canonicalize(cur->text);
+            q_enqueue(&q, cur->yes, 0);
+            q_enqueue(&q, cur->no, 0);
+        }
+        q_free(&q);
+        free_tree(g_root);
+    }
+    g_root = saved;
+    int real = n;
+
+    char buf[128];
+    for (long i = 0; n < want; i++) {
+        snprintf(buf, sizeof(buf), "%s_%s_%s_%ld", lead[i % 5], verb[(i / 5) % 7],
+                 noun[(i / 35) % 11], i / 385);
+        keys[n++] = strdup(buf);
+    }
+    printf("  corpus: %d questions from %s + %d synthetic variants\n", real, treeFile, n - real);
+    *outCount = n;
+    return keys;
+}
+
+static void chain_stats(const Hash *h, int n, const char *label) {
+    long sumSq = 0;
+    int maxChain = 0, empty = 0;
+    for (int b = 0; b < h->nbuckets; b++) {
+        int c = 0;
+        for (Entry *e = h->buckets[b]; e; e = e->next) c++;
+        sumSq += (long)c * (c + 1) / 2;
+        if (c > maxChain) maxChain = c;
+        if (c == 0) empty++;
+    }
+    double load = (double)n / h->nbuckets;
+    printf("  %-28s avg probes %.3f (ideal %.3f)  max chain %-3d empty %.1f%%\n",
+           label, (double)sumSq / n, 1.0 + load / 2.0, maxChain,
+           100.0 * empty / h->nbuckets);
+}
+
+static void bench_hash_quality(const char *treeFile, int n) {
+    printf("hash-quality: %d keys\n", n);
+    int count;
+    char **keys = load_question_corpus(treeFile, n, &count);
+
+    static const struct { const char *name; HashFn fn; } fns[] = {
+        {"djb2", h_hash_djb2}, {"wyhash", h_hash_wy}
+    };
+    /* A small prime and a power of two at load factor ~1 */
+    int sizes[2] = {count | 1, 1};
+    while (sizes[1] < count) sizes[1] <<= 1;
+
+    for (int f = 0; f < 2; f++) {
+        for (int s = 0; s < 2; s++) {
+            Hash h;
+            h_init_with(&h, sizes[s], fns[f].fn);
+            for (int i = 0; i < count; i++) h_put(&h, keys[i], i);
+            char label[64];
+            snprintf(label, sizeof(label), "%s %% %d buckets", fns[f].name, sizes[s]);
+            chain_stats(&h, count, label);
+            h_free(&h);
+        }
+    }
+
+    size_t totalBytes = 0;
+    size_t *lens = malloc(sizeof(size_t) * (size_t)count);
+    for (int i = 0; i < count; i++) {
+        lens[i] = strlen(keys[i]);
+        totalBytes += lens[i];
+    }
+    for (int f = 0; f < 2; f++) {
+        volatile uint64_t sink = 0;
+        int reps = 0;
+        uint64_t t0 = now_ns(), t1;
+        do {
+            for (int i = 0; i < count; i++) sink ^= fns[f].fn(keys[i], lens[i]);
+            reps++;
+            t1 = now_ns();
+        } while (t1 - t0 < 300000000ull);
+        double secs = (double)(t1 - t0) / 1e9;
+        printf("  %-7s %7.2f ns/key %7.3f GB/s\n", fns[f].name,
+               secs * 1e9 / ((double)count * reps), (double)totalBytes * reps / secs / 1e9);
+    }
+
+    free(lens);
+    for (int i = 0; i < count; i++) free(keys[i]);
+    free(keys);
+}
+
+/* ========== Posting list queries ========== */
+
+/* Multi-attribute query "lives in water AND has fins AND NOT mammal" over
+ * n animals, with attribute densities typical of the tree: a dense random
+ * attribute (bitmaps), a sparse one (arrays) and a contiguous one (runs). */
+static void bench_postings(int n) {
+    printf("postings: %d animals\n", n);
+    IdList water, fins, mammal, tmp, out;
+    idl_init(&water);
+    idl_init(&fins);
+    idl_init(&mammal);
+    idl_init(&tmp);
+    idl_init(&out);
+
+    srand(42);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        if (rand() % 3 == 0) idl_add(&water, i);
+        if (rand() % 40 == 0) idl_add(&fins, i);
+    }
+    idl_add_range(&mammal, 0, n / 2);
+    idl_optimize(&water);
+    idl_optimize(&fins);
+    idl_optimize(&mammal);
+    uint64_t t1 = now_ns();
+    printf("  build: %.1f ms (water %d, fins %d, mammal %d ids)\n",
+           (t1 - t0) / 1e6, water.count, fins.count, mammal.count);
+
+    int reps = 0;
+    t0 = now_ns();
+    do {
+        idl_and(&water, &fins, &tmp);
+        idl_andnot(&tmp, &mammal, &out);
+        reps++;
+        t1 = now_ns();
+    } while (t1 - t0 < 300000000ull);
+    printf("  water AND fins AND NOT mammal: %d matches, %.1f us/query\n",
+           out.count, (t1 - t0) / 1e3 / reps);
+
+    reps = 0;
+    t0 = now_ns();
+    do {
+        idl_or(&water, &fins, &out);
+        reps++;
+        t1 = now_ns();
+    } while (t1 - t0 < 300000000ull);
+    printf("  water OR fins: %d matches, %.1f us/query\n", out.count, (t1 - t0) / 1e3 / reps);
+
+    volatile int hits = 0;
+    t0 = now_ns();
+    for (int i = 0; i < 1000000; i++) hits += idl_contains(&water, (int)(((uint64_t)i * 2654435761u) % (unsigned)n));
+    t1 = now_ns();
+    printf("  idl_contains: %.1f ns/lookup\n", (t1 - t0) / 1e6);
+
+    idl_free(&water);
+    idl_free(&fins);
+    idl_free(&mammal);
+    idl_free(&tmp);
+    idl_free(&out);
+}
+
+/* ========== Concurrent hash mix ========== */
+
+/* 95% lookups / 5% inserts over a shared key set, comparing CHash against
+ * the plain Hash behind one global mutex (the only safe way to share it).
+ * Each thread runs for a fixed wall time; throughput is total ops/s. */
+
+#define MIX_KEYS 4096
+#define MIX_MS 300
+
+typedef struct {
+    int useCHash;
+    CHash *ch;
+    Hash *h;
+    pthread_mutex_t *lock;
+    char **keys;
+    unsigned seed;
+    volatile int *stop;
+    long ops;
+} MixWorker;
+
+static void *mix_worker(void *arg) {
+    MixWorker *w = arg;
+    unsigned x = w->seed;
+    long ops = 0;
+    volatile int sink = 0;
+    while (!*w->stop) {
+        for (int i = 0; i < 256; i++) {
+            x = x * 1103515245u + 12345u;
+            const char *key = w->keys[(x >> 8) % MIX_KEYS];
+            int id = (int)((x >> 4) & 0xffff);
+            int write = (x >> 24) % 100 < 5;
+            if (w->useCHash) {
+                if (write) ch_put(w->ch, key, id);
+                else sink += ch_contains(w->ch, key, id);
+            } else {
+                pthread_mutex_lock(w->lock);
+                if (write) h_put(w->h, key, id);
+                else sink += h_contains(w->h, key, id);
+                pthread_mutex_unlock(w->lock);
+            }
+        }
+        ops += 256;
+    }
+    (void)sink;
+    w->ops = ops;
+    ebr_thread_exit();
+    return NULL;
+}
+
+static double mix_run(int useCHash, int nthreads, char **keys) {
+    CHash ch;
+    Hash h = {NULL, 0, 0, NULL, 0, 0, NULL};
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    ch_init(&ch, 64);
+    h_init(&h, 31);
+    for (int i = 0; i < MIX_KEYS; i++) { // preload so reads mostly hit
+        ch_put(&ch, keys[i], i);
+        h_put(&h, keys[i], i);
+    }
+
+    volatile int stop = 0;
+    MixWorker w[16];
+    pthread_t tid[16];
+    for (int t = 0; t < nthreads; t++) {
+        w[t] = (MixWorker){useCHash, &ch, &h, &lock, keys, 7u * (unsigned)t + 1, &stop, 0};
+        pthread_create(&tid[t], NULL, mix_worker, &w[t]);
+    }
+    struct timespec ts = {0, MIX_MS * 1000000L};
+    nanosleep(&ts, NULL);
+    stop = 1;
+    long total = 0;
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(tid[t], NULL);
+        total += w[t].ops;
+    }
+    ch_free(&ch);
+    h_free(&h);
+    return total / (MIX_MS / 1000.0);
+}
+
+static void bench_chash(int maxThreads) {
+    printf("chash: 95%% reads / 5%% writes over %d keys, %d ms per run\n", MIX_KEYS, MIX_MS);
+    char **keys = malloc(MIX_KEYS * sizeof(char *));
+    char buf[48];
+    for (int i = 0; i < MIX_KEYS; i++) {
+        snprintf(buf, sizeof buf, "does it have attribute %d=yes", i);
+        keys[i] = strdup(buf);
+    }
+    if (maxThreads > 16) maxThreads = 16;
+    for (int t = 1; t <= maxThreads; t *= 2) {
+        double locked = mix_run(0, t, keys);
+        double striped = mix_run(1, t, keys);
+        printf("  %2d threads: global mutex %8.2f Mops/s, chash %8.2f Mops/s (%.2fx)\n",
+               t, locked / 1e6, striped / 1e6, striped / locked);
+    }
+    for (int i = 0; i < MIX_KEYS; i++) free(keys[i]);
+    free(keys);
+}
+
+/* One key collecting n ids in shuffled order, the shape a common answer
+ * ("is it alive? = yes") takes in a large tree. Each insert lands in the
+ * middle of the id list. */
+static void bench_chash_hot(int n) {
+    printf("chash-hot: %d ids under one key\n", n);
+    int *ids = malloc((size_t)n * sizeof(int));
+    for (int i = 0; i < n; i++) ids[i] = i;
+    unsigned x = 12345u;
+    for (int i = n - 1; i > 0; i--) {
+        x = x * 1103515245u + 12345u;
+        int j = (int)((x >> 8) % (unsigned)(i + 1));
+        int tmp = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp;
+    }
+
+    CHash ch;
+    ch_init(&ch, 64);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) ch_put(&ch, "is it alive=yes", ids[i]);
+    uint64_t t1 = now_ns();
+    int found = 0;
+    for (int i = 0; i < n; i++) found += ch_contains(&ch, "is it alive=yes", ids[i]);
+    uint64_t t2 = now_ns();
+    ch_free(&ch);
+
+    printf("  insert %8.1f ms (%6.0f ns/id), lookup %6.1f ms (%4.0f ns/id), %d found\n",
+           (t1 - t0) / 1e6, (double)(t1 - t0) / n, (t2 - t1) / 1e6, (double)(t2 - t1) / n, found);
+    free(ids);
+}
+
+/* ========== Load with a saved index ========== */
+
+/* Balanced synthetic tree over animals [lo, hi). Questions repeat across
+ * subtrees (as they do in a real tree) so keys have realistic fan-in. */
+static Node *synthetic_tree(int lo, int hi, int depth) {
+    char buf[64];
+    if (hi - lo == 1) {
+        snprintf(buf, sizeof buf, "Animal number %d", lo);
+        return create_animal_node(buf);
+    }
+    snprintf(buf, sizeof buf, "Does it have trait %d at level %d?", (lo / 3) % 97, depth);
+    Node *q = create_question_node(buf);
+    int mid = lo + (hi - lo) / 2;
+    q->yes = synthetic_tree(lo, mid, depth + 1);
+    q->no = synthetic_tree(mid, hi, depth + 1);
+    return q;
+}
+
+/* Time from load_tree to the first answered attribute query, with and
+ * without the index section in the file. */
+static void bench_load_index(int n) {
+    printf("load-index: %d animals\n", n);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+    const char *with = "bench_with_index.dat", *without = "bench_no_index.dat";
+    if (!save_tree_with(with, 1) || !save_tree_with(without, 0)) {
+        printf("  save failed\n");
+        return;
+    }
+
+    IdList out;
+    idl_init(&out);
+    const char *files[2] = {without, with};
+    const char *labels[2] = {"rebuild index", "saved index"};
+    double ms[2];
+    for (int i = 0; i < 2; i++) {
+        free_tree(g_root); // a fresh process has no tree to tear down
+        g_root = NULL;
+        h_free(&g_index);
+        uint64_t t0 = now_ns();
+        int ok = load_tree(files[i]);
+        int hits = index_query("does it have trait 0 at level 3", 1, &out);
+        uint64_t t1 = now_ns();
+        ms[i] = (t1 - t0) / 1e6;
+        printf("  %-14s load + first query: %8.1f ms (%s, %d hits)\n",
+               labels[i], ms[i], ok ? "ok" : "FAILED", hits);
+    }
+    printf("  speedup: %.1fx\n", ms[0] / ms[1]);
+
+    idl_free(&out);
+    remove(with);
+    remove(without);
+    free_tree(g_root);
+    h_free(&g_index);
+    g_root = saved;
+}
+
+/* Rebuild the attribute index of a random tree whose questions are all
+ * different, then of one drawing from only 1000 texts, so most questions
+ * add their range to a posting list that already exists. */
+static int rebuildTexts;
+
+static void rebuild_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    (void)depth;
+    int t = rebuildTexts ? tree_rand(rng) % rebuildTexts : count;
+    snprintf(question, TREE_TEXT_MAX, "Does it have trait %d?", t);
+    snprintf(animal, TREE_TEXT_MAX, "Animal %d", count);
+}
+
+static void bench_rebuild(int n) {
+    printf("rebuild: %d animals\n", n);
+    Node *saved = g_root;
+    int texts[2] = {0, 1000};
+    for (int i = 0; i < 2; i++) {
+        rebuildTexts = texts[i];
+        g_root = build_random_tree(n, 29, rebuild_text, NULL);
+        index_rebuild(); // warm up the allocator
+        uint64_t t0 = now_ns();
+        index_rebuild();
+        uint64_t t1 = now_ns();
+        printf("  %-22s index_rebuild: %8.1f ms\n", i == 0 ? "unique questions" : "1000 distinct texts",
+               (t1 - t0) / 1e6);
+        free_tree(g_root);
+    }
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Near-duplicate question lookup ========== */
+
+static const char *SIM_VERBS[] = {
+    "Does it", "Can it", "Is it able to", "Will it", "Would it", "Does your animal",
+    "Is it known to", "Could it"
+};
+static const char *SIM_ACTIONS[] = {
+    "eat", "chase", "avoid", "hunt", "carry", "live near", "sleep in", "build",
+    "smell like", "fear", "dig up", "climb", "swim in", "hide under", "guard", "collect"
+};
+
+/* Deterministic pseudo-word of 4-8 random letters, so the corpus has a
+ * large vocabulary and a realistic spread of trigram frequencies. */
+static void sim_word(unsigned x, char *out) {
+    int len = 4 + (int)(x % 5);
+    for (int i = 0; i < len; i++) {
+        x = x * 1103515245u + 12345u;
+        out[i] = (char)('a' + (x >> 16) % 26);
+    }
+    out[len] = '\0';
+}
+
+static void sim_question(unsigned i, char *buf, size_t len) {
+    char obj[16], adj[16];
+    sim_word(i * 2654435761u, obj);
+    sim_word(i * 40503u + 7, adj);
+    snprintf(buf, len, "%s %s %s %s?", SIM_VERBS[i % 8], SIM_ACTIONS[(i / 8) % 16], adj, obj);
+}
+
+/* Build the trigram index over n generated questions, then time lookups of
+ * reworded variants ("Can it" for "Does it", dropped punctuation). */
+static void bench_similar(int n) {
+    printf("similar: %d questions\n", n);
+    char buf[128];
+    sim_reset();
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        sim_question((unsigned)i, buf, sizeof buf);
+        sim_add(buf);
+    }
+    uint64_t t1 = now_ns();
+    printf("  build: %.1f ms (%.2f us/question)\n", (t1 - t0) / 1e6, (t1 - t0) / 1e3 / n);
+
+    LatencyHist hist = {{0}, 0, 0};
+    SimMatch m[3];
+    int hits = 0, queries = 20000;
+    for (int q = 0; q < queries; q++) {
+        unsigned i = (unsigned)((uint64_t)q * 7919u % (unsigned)n);
+        sim_question(i, buf, sizeof buf);
+        char variant[160];
+        const char *rest = strchr(buf + 3, ' ');  // skip the lead verb's first word
+        snprintf(variant, sizeof variant, "%s%s", (i % 2) ? "can it" : "does it", rest ? rest : buf);
+        variant[strlen(variant) - 1] = '\0';     // drop the '?'
+        t0 = now_ns();
+        int found = sim_find(variant, 0.5, m, 3);
+        hist_add(&hist, now_ns() - t0);
+        hits += found > 0;
+    }
+    hist_print("sim_find", &hist);
+    printf("  %d/%d reworded queries found a match\n", hits, queries);
+    sim_reset();
+}
+
+/* ========== Integrity check ========== */
+
+/* Full integrity check of a tree with n animals (2n - 1 nodes) for
+ * doubling thread counts. */
+static void bench_integrity(int n, int maxThreads) {
+    printf("integrity: %d nodes\n", 2 * n - 1);
+    Node *root = synthetic_tree(0, n, 0);
+    if (maxThreads > 64) maxThreads = 64;
+    for (int t = 1; t <= maxThreads; t *= 2) {
+        IntegrityReport rep;
+        uint64_t best = UINT64_MAX;
+        int ok = 1;
+        for (int run = 0; run < 3; run++) {
+            uint64_t t0 = now_ns();
+            ok &= check_integrity_report(root, t, &rep);
+            uint64_t dt = now_ns() - t0;
+            if (dt < best) best = dt;
+            integrity_report_free(&rep);
+        }
+        printf("  %2d threads: %8.1f ms (%.0f Mnodes/s)%s\n", t, best / 1e6,
+               (2.0 * n - 1) / (best / 1e3), ok ? "" : " FAILED");
+    }
+
+    /* One learned question, validated incrementally. */
+    Node *saved = g_root;
+    g_root = root;
+    index_rebuild(); // parent links
+    Node *leaf = root;
+    while (leaf->isQuestion) leaf = leaf->no;
+    Node *q = create_question_node("Is it new?");
+    Node *animal = create_animal_node("New animal");
+    q->yes = animal;
+    q->no = leaf;
+    q->parent = leaf->parent;
+    leaf->parent->no = q;
+    leaf->parent = q;
+    animal->parent = q;
+    Edit e = {EDIT_INSERT_SPLIT, q->parent, 0, leaf, q, animal};
+    integrity_on_learn(&e);
+    uint64_t t0 = now_ns();
+    int ok = check_changes(NULL);
+    printf("  check_changes after one learn: %.1f us%s\n", (now_ns() - t0) / 1e3, ok ? "" : " FAILED");
+    free_tree(root);
+    h_free(&g_index);
+    g_root = saved;
+}
+
+/* ========== Animal names ========== */
+
+/* Lazy build of the name map and lookup latency for random animals. */
+static void bench_names(int n) {
+    printf("names: %d animals\n", n);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+
+    char buf[64];
+    int id;
+    uint64_t t0 = now_ns();
+    names_lookup("Animal number 0", &id, 1); // builds the map
+    printf("  build: %.1f ms\n", (now_ns() - t0) / 1e6);
+
+    LatencyHist hist = {{0}, 0, 0};
+    int hits = 0, queries = 200000;
+    uint64_t *ns = malloc((size_t)queries * sizeof(uint64_t));
+    unsigned x = 99;
+    for (int q = 0; q < queries; q++) {
+        x = x * 1103515245u + 12345u;
+        snprintf(buf, sizeof buf, "animal NUMBER %u", (x >> 4) % (unsigned)n);
+        t0 = now_ns();
+        Node *leaf = names_find(buf);
+        ns[q] = now_ns() - t0;
+        hist_add(&hist, ns[q]);
+        hits += leaf != NULL;
+    }
+    hist_print("names_find", &hist);
+    // the log2 buckets cannot tell 600 ns from 1 us, so sort for exact ranks
+    qsort(ns, (size_t)queries, sizeof(uint64_t), cmp_u64);
+    printf("  exact: p50=%llu p99=%llu p99.9=%llu ns\n",
+           (unsigned long long)ns[queries / 2],
+           (unsigned long long)ns[(long)queries * 99 / 100],
+           (unsigned long long)ns[(long)queries * 999 / 1000]);
+    printf("  %d/%d found\n", hits, queries);
+    free(ns);
+
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Animal paths ========== */
+
+/* LCA layout build time and batch query throughput over random pairs. */
+static void bench_paths(int n) {
+    printf("paths: %d animals\n", n);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+
+    PathInfo one;
+    uint64_t t0 = now_ns();
+    path_query(0, n - 1, &one); // builds the layout
+    uint64_t t1 = now_ns();
+    printf("  build: %.1f ms\n", (t1 - t0) / 1e6);
+
+    long count = 4000000;
+    int *pairs = malloc((size_t)count * 2 * sizeof(int));
+    PathInfo *out = malloc((size_t)count * sizeof(PathInfo));
+    unsigned x = 12345;
+    for (long i = 0; i < 2 * count; i++) {
+        x = x * 1103515245u + 12345u;
+        pairs[i] = (int)((x >> 8) % (unsigned)n);
+    }
+    t0 = now_ns();
+    long found = path_query_batch(pairs, count, out);
+    t1 = now_ns();
+    printf("  batch: %ld pairs in %.1f ms (%.1f ns/pair, %ld answered)\n",
+           count, (t1 - t0) / 1e6, (double)(t1 - t0) / count, found);
+
+    free(pairs);
+    free(out);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Compiled classifier ========== */
+
+/* A tree grown the way play grows one: every animal splits a random leaf,
+ * so nodes sit wherever malloc had room at the time. Question text
+ * repeats across subtrees (7 traits per depth) but not along a path. */
+static void learned_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    snprintf(question, TREE_TEXT_MAX, "Does it have trait %d at level %d?", tree_rand(rng) % 7, depth);
+    snprintf(animal, TREE_TEXT_MAX, "Animal number %d", count);
+}
+
+static Node *learned_tree(int n, unsigned seed) {
+    return build_random_tree(n, seed, learned_text, NULL);
+}
+
+/* Classify random animals by walking Node pointers (answers in path
+ * order, as a player gives them) and by running the compiled program
+ * (answers by question id). Both must land on the same animal. The
+ * balanced tree is allocated in preorder, the best case for pointers;
+ * the learned one is allocated in the order play would. */
+static void bench_program(int n, long queries) {
+    printf("program: %d animals, %ld classifications\n", n, queries);
+    Node *saved = g_root;
+    const char *shapes[2] = {"balanced", "learned"};
+    for (int shape = 0; shape < 2; shape++) {
+        g_root = shape == 0 ? synthetic_tree(0, n, 0) : learned_tree(n, 44);
+        index_rebuild();
+
+        uint64_t t0 = now_ns();
+        const DecisionProgram *p = prog_current();
+        uint64_t t1 = now_ns();
+        printf("  %s: compile %.1f ms (%d instructions, %d questions)\n", shapes[shape],
+               (t1 - t0) / 1e6, p->count, p->questionCount);
+
+        int distinct = 1 << 14, words = prog_answer_words(p), maxDepth = 0;
+        uint64_t *vectors = malloc((size_t)distinct * words * sizeof(uint64_t));
+        unsigned char *paths = malloc((size_t)distinct * 256);
+        int *want = malloc((size_t)distinct * sizeof(int));
+        unsigned x = 4404;
+        for (int i = 0; i < distinct; i++) {
+            x = x * 1103515245u + 12345u;
+            Node *leaf = index_animal((int)((x >> 4) % (unsigned)n));
+            want[i] = leaf->id;
+            prog_answers(p, leaf, vectors + (size_t)i * words);
+            int depth = 0;
+            for (Node *c = leaf; c->parent; c = c->parent) depth++;
+            if (depth > maxDepth) maxDepth = depth;
+            for (Node *c = leaf; c->parent && depth <= 256; c = c->parent) {
+                paths[(size_t)i * 256 + --depth] = c->parent->yes == c;
+            }
+        }
+        if (maxDepth > 256) {
+            printf("  tree too deep for the pointer walk (%d)\n", maxDepth);
+        } else {
+            long right[2] = {0, 0};
+            double ns[2];
+            t0 = now_ns();
+            for (long i = 0; i < queries; i++) {
+                int v = (int)(i & (distinct - 1));
+                const unsigned char *a = paths + (size_t)v * 256;
+                const Node *c = g_root;
+                while (c->isQuestion) c = *a++ ? c->yes : c->no;
+                right[0] += c->id == want[v];
+            }
+            t1 = now_ns();
+            ns[0] = (double)(t1 - t0) / queries;
+            t0 = now_ns();
+            for (long i = 0; i < queries; i++) {
+                int v = (int)(i & (distinct - 1));
+                right[1] += prog_classify(p, vectors + (size_t)v * words) == want[v];
+            }
+            t1 = now_ns();
+            ns[1] = (double)(t1 - t0) / queries;
+            printf("    pointer walk: %6.1f ns/classification (%ld right, depth <= %d)\n", ns[0],
+                   right[0], maxDepth);
+            printf("    program:      %6.1f ns/classification (%ld right)\n", ns[1], right[1]);
+            printf("    speedup: %.2fx\n", ns[0] / ns[1]);
+        }
+        free(vectors);
+        free(paths);
+        free(want);
+
+        if (shape == 1) { // one teach marks it stale; the next use recompiles
+            GameSession s;
+            engine_begin(&s);
+            while (s.state == GAME_ASKING) engine_answer(&s, 1);
+            engine_confirm(&s, 0);
+            engine_teach(&s, "Bench animal", "Was it added by the benchmark?", 1);
+            t0 = now_ns();
+            p = prog_current();
+            t1 = now_ns();
+            printf("  recompile after teach: %.1f ms (%d instructions)\n", (t1 - t0) / 1e6, p->count);
+            engine_drop_history(&g_undo, &g_redo);
+        }
+        free_tree(g_root);
+    }
+    g_root = saved;
+    index_rebuild();
+}
+
+/* Offline evaluation: count known animals (attribute vectors, one in a
+ * hundred with a wrong answer) pushed through the program one at a time
+ * and in batches on 1 and threads threads. */
+static void bench_batch(int n, long count, int threads) {
+    printf("batch: %d animals, %ld vectors\n", n, count);
+    Node *saved = g_root;
+    g_root = learned_tree(n, 45);
+    index_rebuild();
+    const DecisionProgram *p = prog_current();
+    int words = prog_answer_words(p);
+
+    /* a pool of distinct animals, repeated to fill the batch */
+    int pool = n < 1 << 16 ? n : 1 << 16;
+    uint64_t *vectors = malloc((size_t)count * words * sizeof(uint64_t));
+    int32_t *expected = malloc((size_t)count * sizeof(int32_t));
+    int32_t *out = malloc((size_t)count * sizeof(int32_t));
+    if (vectors == NULL || expected == NULL || out == NULL) {
+        printf("  out of memory\n");
+        free(vectors);
+        free(expected);
+        free(out);
+        free_tree(g_root);
+        g_root = saved;
+        index_rebuild();
+        return;
+    }
+    unsigned x = 4505;
+    for (int i = 0; i < pool; i++) {
+        x = x * 1103515245u + 12345u;
+        Node *leaf = index_animal((int)((x >> 4) % (unsigned)n));
+        prog_answers(p, leaf, vectors + (size_t)i * words);
+        expected[i] = leaf->id;
+        if (i % 100 == 0 && leaf->parent) {
+            int q = prog_question_id(p, leaf->parent->text);
+            vectors[(size_t)i * words + (q >> 6)] ^= 1ull << (q & 63);
+        }
+    }
+    for (long i = pool; i < count; i++) {
+        memcpy(vectors + (size_t)i * words, vectors + (size_t)(i % pool) * words, (size_t)words * sizeof(uint64_t));
+        expected[i] = expected[i % pool];
+    }
+
+    uint64_t t0 = now_ns();
+    long right = 0;
+    for (long i = 0; i < count; i++) right += prog_classify(p, vectors + (size_t)i * words) == expected[i];
+    uint64_t t1 = now_ns();
+    printf("  one at a time:  %7.1f M/s (%ld right)\n", count / ((t1 - t0) / 1e3), right);
+    int counts[2] = {1, threads};
+    for (int i = 0; i < 2; i++) {
+        t0 = now_ns();
+        prog_classify_batch(p, vectors, words, count, out, counts[i]);
+        t1 = now_ns();
+        long same = 0;
+        for (long k = 0; k < count; k++) same += out[k] == expected[k];
+        printf("  batch, %2d thread(s): %7.1f M/s (%ld right)\n", counts[i], count / ((t1 - t0) / 1e3), same);
+    }
+    ProgEval eval;
+    t0 = now_ns();
+    prog_evaluate(p, vectors, words, expected, count, threads, &eval);
+    t1 = now_ns();
+    printf("  evaluate: %.1f ms, accuracy %.4f, %d animals misclassified\n", (t1 - t0) / 1e6,
+           (double)eval.correct / eval.total, eval.missed.count);
+    prog_eval_free(&eval);
+
+    free(vectors);
+    free(expected);
+    free(out);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Tree statistics ========== */
+
+/* One stats pass over a balanced tree, sequential and threaded. */
+static void bench_stats(int n, int threads) {
+    printf("stats: %d animals\n", n);
+    Node *root = synthetic_tree(0, n, 0);
+    int counts[2] = {1, threads};
+    for (int i = 0; i < 2; i++) {
+        TreeStats st;
+        uint64_t t0 = now_ns();
+        tree_stats(root, counts[i], &st);
+        uint64_t t1 = now_ns();
+        printf("  %2d thread(s): %.1f ms (%ld nodes, height %d, avg depth %.2f)\n",
+               counts[i], (t1 - t0) / 1e6, st.nodes, st.height, st.avgDepth);
+        tree_stats_free(&st);
+    }
+    free_tree(root);
+}
+
+/* ========== Tree layout ========== */
+
+/* SVG and DOT layouts of learned trees of growing size, written to
+ * /dev/null: the time per node should stay flat if the layout is linear. */
+static void bench_layout(int n) {
+    printf("layout: up to %d animals\n", n);
+    FILE *sink = fopen("/dev/null", "w");
+    if (sink == NULL) return;
+    for (int size = n / 16 > 0 ? n / 16 : 1; size <= n; size *= 4) {
+        Node *root = learned_tree(size, 49);
+        long nodes = 2L * size - 1;
+        LayoutOptions opts[3] = {{LAYOUT_SVG, -1}, {LAYOUT_DOT, -1}, {LAYOUT_SVG, 12}};
+        const char *names[3] = {"svg", "dot", "svg, depth <= 12"};
+        printf("  %d animals:\n", size);
+        for (int i = 0; i < 3; i++) {
+            uint64_t t0 = now_ns();
+            int ok = layout_write(root, sink, &opts[i]);
+            uint64_t t1 = now_ns();
+            printf("    %-17s %8.1f ms, %6.1f ns/node%s\n", names[i], (t1 - t0) / 1e6,
+                   (double)(t1 - t0) / nodes, ok ? "" : " (failed)");
+        }
+        free_tree(root);
+    }
+    fclose(sink);
+}
+
+/* ========== Tree search ========== */
+
+/* Type each query a character at a time as the tree view would: every
+ * keystroke compiles the query and jumps to the next match after a
+ * random selection. Then step n/N through the matches of the full query.
+ * The view redraws after each, so each one should take well under 10 ms. */
+static void bench_search(int n) {
+    printf("search: %d animals\n", n);
+    Node *saved = g_root;
+    g_root = learned_tree(n, 50);
+    index_rebuild();
+    long nodes = 2L * n - 1;
+    Node **order = malloc((size_t)nodes * sizeof(Node *));
+    Node **stack = malloc((size_t)nodes * sizeof(Node *));
+    long count = 0, sp = 0;
+    stack[sp++] = g_root;
+    while (sp > 0) {
+        Node *c = stack[--sp];
+        order[count++] = c;
+        if (c->isQuestion) {
+            stack[sp++] = c->no;
+            stack[sp++] = c->yes;
+        }
+    }
+    free(stack);
+
+    uint64_t t0 = now_ns();
+    search_ready();
+    uint64_t t1 = now_ns();
+    printf("  index build %.1f ms (%.1f ns/node)\n", (t1 - t0) / 1e6, (double)(t1 - t0) / nodes);
+
+    char last[32];
+    snprintf(last, sizeof last, "animal number %d", n - 1);
+    const char *queries[] = {"does it have trait 3 at level 1", "trait 6 at level 40", "level 7", "animal number 12345",
+                             last, "zebra", "at level 2", "number"};
+    unsigned x = 5050;
+    SearchQuery q;
+    for (size_t i = 0; i < sizeof queries / sizeof queries[0]; i++) {
+        const char *full = queries[i];
+        double worst = 0, sum = 0;
+        int keys = 0;
+        char typed[64];
+        for (size_t len = 1; len <= strlen(full); len++, keys++) {
+            snprintf(typed, sizeof typed, "%.*s", (int)len, full);
+            x = x * 1103515245u + 12345u;
+            Node *from = order[(x >> 4) % (unsigned)count];
+            uint64_t a = now_ns();
+            search_compile(&q, typed);
+            search_next(&q, from, 0);
+            double ms = (now_ns() - a) / 1e6;
+            sum += ms;
+            if (ms > worst) worst = ms;
+        }
+        double stepWorst = 0, stepSum = 0;
+        int steps = 200;
+        for (int k = 0; k < steps; k++) {
+            x = x * 1103515245u + 12345u;
+            Node *from = order[(x >> 4) % (unsigned)count];
+            uint64_t a = now_ns();
+            search_next(&q, from, k & 1);
+            double ms = (now_ns() - a) / 1e6;
+            stepSum += ms;
+            if (ms > stepWorst) stepWorst = ms;
+        }
+        char hits[32];
+        if (q.hits >= 0) snprintf(hits, sizeof hits, "%ld hits", q.hits);
+        else snprintf(hits, sizeof hits, "hits not counted");
+        printf("  \"%s\" (%s): keystroke mean %.3f max %.3f ms, n/N mean %.3f max %.3f ms\n", full, hits,
+               sum / keys, worst, stepSum / steps, stepWorst);
+    }
+    free(order);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Game engine ========== */
+
+/* Simulated players: each game answers its way down to a random animal
+ * (answers precomputed from parent links) and confirms the guess. */
+static void bench_engine(int n, int games) {
+    printf("engine: %d animals, %d games\n", n, games);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+
+    int maxDepth = 64;
+    unsigned char *answers = malloc((size_t)games * maxDepth);
+    int *lengths = malloc((size_t)games * sizeof(int));
+    unsigned x = 2024;
+    for (int g = 0; g < games; g++) {
+        x = x * 1103515245u + 12345u;
+        Node *leaf = index_animal((int)((x >> 4) % (unsigned)n));
+        int len = 0;
+        unsigned char path[64];
+        for (Node *c = leaf; c->parent && len < maxDepth; c = c->parent) {
+            path[len++] = c->parent->yes == c;
+        }
+        for (int i = 0; i < len; i++) answers[(size_t)g * maxDepth + i] = path[len - 1 - i];
+        lengths[g] = len;
+    }
+
+    long steps = 0, won = 0;
+    uint64_t t0 = now_ns();
+    for (int g = 0; g < games; g++) {
+        GameSession s;
+        engine_begin(&s);
+        const unsigned char *a = answers + (size_t)g * maxDepth;
+        for (int i = 0; s.state == GAME_ASKING; i++) engine_answer(&s, a[i]);
+        won += engine_confirm(&s, 1) == GAME_WON;
+        steps += s.steps;
+    }
+    uint64_t t1 = now_ns();
+    printf("  %ld answer steps in %.1f ms (%.1f M steps/s, %.0f ns/game, %ld won)\n",
+           steps, (t1 - t0) / 1e6, steps / ((t1 - t0) / 1e3), (double)(t1 - t0) / games, won);
+
+    free(answers);
+    free(lengths);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Session replay ========== */
+
+/* Replay every session of a recording against the tree in treeFile (NULL:
+ * the two-animal starting tree), once timing every engine call and once
+ * for throughput, and check both end with the recorded tree. */
+static void bench_replay_log(const char *logFile, const char *treeFile) {
+    RecordReader r;
+    if (!rec_open(&r, logFile)) {
+        printf("  cannot open %s\n", logFile);
+        return;
+    }
+    /* decode everything first so only the engine is timed */
+    int cap = 1024, count = 0, got, maxSteps = 0, edits = 0;
+    long steps = 0;
+    RecordedSession *all = malloc((size_t)cap * sizeof(RecordedSession));
+    while (all && (got = rec_next(&r, &all[count])) == 1) {
+        steps += all[count].steps;
+        edits += all[count].edit != 0;
+        if (all[count].steps > maxSteps) maxSteps = all[count].steps;
+        if (++count == cap) {
+            cap *= 2;
+            all = realloc(all, (size_t)cap * sizeof(RecordedSession));
+        }
+    }
+    rec_close_reader(&r);
+    if (all == NULL || got < 0) {
+        printf("  %s is truncated or corrupt\n", logFile);
+        return;
+    }
+    printf("  %d sessions, %d undos/redos, %ld answers\n", count - edits, edits, steps);
+
+    Node *saved = g_root;
+    uint64_t *stepNs = malloc(((size_t)maxSteps + 1) * sizeof(uint64_t));
+    for (int pass = 0; pass < 2; pass++) {
+        g_root = NULL;
+        if (treeFile ? !load_tree(treeFile) : (g_root = create_question_node("Does it live in water?")) == NULL) {
+            printf("  cannot load %s\n", treeFile);
+            break;
+        }
+        if (!treeFile) {
+            g_root->yes = create_animal_node("Fish");
+            g_root->no = create_animal_node("Dog");
+            index_rebuild();
+        }
+        es_clear(&g_undo);
+        es_clear(&g_redo);
+        uint64_t sum;
+        tree_checksum(g_root, &sum);
+        if (pass == 0 && sum != r.startSum) printf("  WARNING: the recording starts from a different tree\n");
+
+        LatencyHist hist = {{0}, 0, 0};
+        long calls = 0, diverged = 0;
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < count; i++) {
+            int c = rec_replay(&all[i], pass == 0 ? now_ns : NULL, stepNs);
+            if (c < 0) {
+                diverged++;
+                continue;
+            }
+            calls += c;
+            for (int k = 0; pass == 0 && k < c; k++) hist_add(&hist, stepNs[k]);
+        }
+        uint64_t t1 = now_ns();
+        if (pass == 0) {
+            hist_print("engine call", &hist);
+        } else {
+            printf("  throughput: %ld calls in %.1f ms (%.1f M calls/s, %.0f sessions/s)\n",
+                   calls, (t1 - t0) / 1e6, calls / ((t1 - t0) / 1e3), count / ((t1 - t0) / 1e9));
+        }
+        tree_checksum(g_root, &sum);
+        printf("  pass %d: %s%s\n", pass + 1, sum == r.endSum && r.ended ? "tree matches the recording" : "TREE DIFFERS from the recording",
+               diverged ? " (some sessions diverged)" : "");
+        free_tree(g_root);
+    }
+    for (int i = 0; i < count; i++) rec_session_free(&all[i]);
+    free(all);
+    free(stepNs);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* Record sessions of simulated players on an n-animal tree (one in ten
+ * teaches a new animal, one in fifty is undone and redone), then replay
+ * them. */
+static void bench_replay(int sessions, int n) {
+    printf("replay: %d sessions on %d animals\n", sessions, n);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+    const char *treeFile = "bench_replay.dat", *logFile = "bench_replay.rec";
+    Recorder rec;
+    if (!save_tree_with(treeFile, 0) || !rec_create(&rec, logFile)) {
+        printf("  cannot write %s / %s\n", treeFile, logFile);
+        return;
+    }
+    unsigned x = 40;
+    unsigned char path[256];
+    char animal[64], question[64];
+    for (int i = 0; i < sessions; i++) {
+        x = x * 1103515245u + 12345u;
+        Node *leaf = index_animal((int)((x >> 4) % (unsigned)index_animal_count()));
+        int len = 0;
+        for (Node *c = leaf; c->parent && len < 256; c = c->parent) path[len++] = c->parent->yes == c;
+
+        GameSession s;
+        engine_begin(&s);
+        engine_record(&s, &rec);
+        while (s.state == GAME_ASKING) engine_answer(&s, path[--len]);
+        if (i % 10 == 0) {
+            engine_confirm(&s, 0);
+            snprintf(animal, sizeof animal, "Recorded animal %d", i);
+            snprintf(question, sizeof question, "Is it recorded animal %d?", i);
+            engine_teach(&s, animal, question, (x >> 20) & 1);
+        } else {
+            engine_confirm(&s, 1);
+        }
+        if (i % 50 == 0) {
+            undo_last_edit();
+            rec_write_edit(&rec, 0);
+            redo_last_edit();
+            rec_write_edit(&rec, 1);
+        }
+    }
+    int ok = rec_close(&rec);
+    long size = 0;
+    FILE *f = fopen(logFile, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fclose(f);
+    }
+    printf("  recorded: %s, %ld bytes (%.1f bytes/session)\n", ok ? "ok" : "FAILED", size, (double)size / sessions);
+    free_tree(g_root);
+    g_root = saved;
+    bench_replay_log(logFile, treeFile);
+}
+
+/* ========== Game server ========== */
+
+/* Resident memory of the process in KB (0 if unknown). */
+static long resident_kb(void) {
+    long pages = 0, size;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld %ld", &size, &pages) != 2) pages = 0;
+    fclose(f);
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+typedef struct {
+    int fd;
+    int len;
+    char buf[256];
+    char prompt;          /* 'Q', 'G' or 'L' (learn) */
+} BenchPlayer;
+
+/* Read up to the next prompt line, skipping WON/OK. Returns 0 on error. */
+static int player_read(BenchPlayer *p) {
+    for (;;) {
+        char *nl = memchr(p->buf, '\n', (size_t)p->len);
+        if (nl) {
+            char kind = p->buf[0];
+            int used = (int)(nl - p->buf) + 1;
+            p->len -= used;
+            memmove(p->buf, nl + 1, (size_t)p->len);
+            if (kind == 'Q' || kind == 'G' || kind == 'L') {
+                p->prompt = kind;
+                return 1;
+            }
+            if (kind == 'E' || kind == 'B') return 0;
+            continue;
+        }
+        if (p->len == (int)sizeof p->buf) p->len = 0; // drop an overlong question
+        ssize_t k = read(p->fd, p->buf + p->len, sizeof p->buf - (size_t)p->len);
+        if (k <= 0) return 0;
+        p->len += (int)k;
+    }
+}
+
+/* Serve n animals to the given number of connected players and have them
+ * all answer in lockstep, one request each per round; every 100th guess
+ * is wrong and teaches a new animal. Reports the answer rate, round
+ * latency and memory per connection. */
+static void bench_server(int sessions, int rounds, int n) {
+    printf("server: %d sessions, %d rounds, %d animals\n", sessions, rounds, n);
+    Node *saved = g_root;
+    g_root = synthetic_tree(0, n, 0);
+    index_rebuild();
+    const char *path = "bench_server.sock";
+    GameServer srv;
+    BenchPlayer *players = calloc((size_t)sessions, sizeof(BenchPlayer));
+    if (players == NULL || !server_start(&srv, path)) {
+        printf("  cannot listen on %s\n", path);
+        free(players);
+        return;
+    }
+
+    long rss0 = resident_kb();
+    uint64_t t0 = now_ns();
+    int connected = 0;
+    for (; connected < sessions; connected++) {
+        players[connected].fd = server_connect(path);
+        if (players[connected].fd < 0 || !player_read(&players[connected])) break;
+    }
+    uint64_t t1 = now_ns();
+    printf("  %d connected in %.1f ms, %.1f KB resident each\n", connected, (t1 - t0) / 1e6,
+           connected ? (double)(resident_kb() - rss0) / connected : 0.0);
+
+    LatencyHist round = {{0}, 0, 0};
+    long steps = 0, taught = 0, guesses = 0;
+    unsigned x = 41;
+    char line[128];
+    t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        uint64_t rs = now_ns();
+        for (int i = 0; i < connected; i++) {
+            BenchPlayer *p = &players[i];
+            x = x * 1103515245u + 12345u;
+            int len;
+            if (p->prompt == 'Q') {
+                len = snprintf(line, sizeof line, "%c\n", (x >> 16) & 1 ? 'y' : 'n');
+            } else if (p->prompt == 'G') {
+                len = snprintf(line, sizeof line, "%c\n", ++guesses % 100 ? 'y' : 'n');
+            } else {
+                len = snprintf(line, sizeof line, "teach y Bench animal %d-%d\tIs it bench %d-%d?\n",
+                               i, r, i, r);
+                taught++;
+            }
+            steps += p->prompt != 'L';
+            if (write(p->fd, line, (size_t)len) != len) p->prompt = 0;
+        }
+        for (int i = 0; i < connected; i++) {
+            if (!player_read(&players[i])) {
+                printf("  player %d lost\n", i);
+                rounds = r + 1;
+                break;
+            }
+        }
+        hist_add(&round, now_ns() - rs);
+    }
+    t1 = now_ns();
+    printf("  %ld answers, %ld animals taught in %.1f ms (%.0f answers/s)\n", steps, taught,
+           (t1 - t0) / 1e6, steps / ((t1 - t0) / 1e9));
+    hist_print("round (all players)", &round);
+
+    for (int i = 0; i < connected; i++) close(players[i].fd);
+    free(players);
+    server_stop(&srv);
+    printf("  server counted %ld answers in %ld sessions\n", srv.steps, srv.sessions);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+}
+
+/* ========== Driver ========== */
+
+int main(int argc, char **argv) {
+    const char *which = argc > 1 ? argv[1] : "all";
+    es_init(&g_undo);
+    es_init(&g_redo);
+    int all = strcmp(which, "all") == 0;
+
+    if (all || strcmp(which, "hash-growth") == 0) {
+        long n = (!all && argc > 2) ? atol(argv[2]) : 1000000;
+        bench_hash_growth(n);
+    }
+    if (all || strcmp(which, "canonicalize") == 0) {
+        long n = (!all && argc > 2) ? atol(argv[2]) : 16L << 20;
+        bench_canonicalize(n);
+    }
+    if (all || strcmp(which, "hash-quality") == 0) {
+        const char *tree = (!all && argc > 2) ? argv[2] : "animals.dat";
+        int n = (!all && argc > 3) ? atoi(argv[3]) : 200000;
+        bench_hash_quality(tree, n);
+    }
+    if (all || strcmp(which, "postings") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 4000000;
+        bench_postings(n);
+    }
+    if (all || strcmp(which, "chash") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 8;
+        bench_chash(n);
+    }
+    if (all || strcmp(which, "chash-hot") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 100000;
+        bench_chash_hot(n);
+    }
+    if (all || strcmp(which, "load-index") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 200000;
+        bench_load_index(n);
+    }
+    if (all || strcmp(which, "rebuild") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 200000;
+        bench_rebuild(n);
+    }
+    if (all || strcmp(which, "similar") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 200000;
+        bench_similar(n);
+    }
+    if (all || strcmp(which, "names") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        bench_names(n);
+    }
+    if (all || strcmp(which, "paths") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        bench_paths(n);
+    }
+    if (all || strcmp(which, "program") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        long q = (!all && argc > 3) ? atol(argv[3]) : 4000000;
+        bench_program(n, q);
+    }
+    if (all || strcmp(which, "batch") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        long count = (!all && argc > 3) ? atol(argv[3]) : 4000000;
+        int t = (!all && argc > 4) ? atoi(argv[4]) : 8;
+        bench_batch(n, count, t);
+    }
+    if (all || strcmp(which, "stats") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 2000000;
+        int t = (!all && argc > 3) ? atoi(argv[3]) : 8;
+        bench_stats(n, t);
+    }
+    if (all || strcmp(which, "layout") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        bench_layout(n);
+    }
+    if (all || strcmp(which, "search") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        bench_search(n);
+    }
+    if (all || strcmp(which, "engine") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000000;
+        int g = (!all && argc > 3) ? atoi(argv[3]) : 1000000;
+        bench_engine(n, g);
+    }
+    if (all || strcmp(which, "replay") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 100000;
+        int animals = (!all && argc > 3) ? atoi(argv[3]) : 1000000;
+        bench_replay(n, animals);
+    }
+    if (!all && strcmp(which, "replay-log") == 0 && argc > 2) {
+        printf("replay-log: %s\n", argv[2]);
+        bench_replay_log(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    if (all || strcmp(which, "server") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 1000;
+        int rounds = (!all && argc > 3) ? atoi(argv[3]) : 100;
+        int animals = (!all && argc > 4) ? atoi(argv[4]) : 100000;
+        bench_server(n, rounds, animals);
+    }
+    if (all || strcmp(which, "integrity") == 0) {
+        int n = (!all && argc > 2) ? atoi(argv[2]) : 2000000;
+        int t = (!all && argc > 3) ? atoi(argv[3]) : 8;
+        bench_integrity(n, t);
+    }
+    return 0;
+}
@@ -0,0 +1,382 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lab5.h"
+
+char *strdup(const char *s);
+
+/* ========== Concurrent Attribute Hash ==========
+ * A variant of Hash that many threads can share.
+ *
+ * Readers take no locks: they enter an EBR read-side section, load the
+ * current table, walk the chain and read the entry's id chunks, all with
+ * acquire loads. Writers lock one of CH_STRIPES mutexes chosen by the low
+ * bits of the key hash; because bucket counts are powers of two no smaller
+ * than CH_STRIPES, every key in a bucket maps to the same stripe, so the
+ * stripe lock also serializes pushes onto that bucket's chain.
+ *
+ * Id lists are split into 64K chunks keyed by the high 16 bits of the id,
+ * like IdList containers: a sorted array of low halves up to CH_ARRAY_MAX
+ * values, a bitmap past that. Chunks are immutable. An insert copies only
+ * the chunk it lands in (at most 8 KB), swaps the chunk pointer with a
+ * release store and retires the old chunk through EBR; only an id in a new
+ * 64K range copies the entry's small chunk directory. A resize takes every
+ * stripe, builds a new table of fresh entries (sharing keys and id lists),
+ * publishes it and retires the old table. A reader that loaded the old
+ * table just before a resize may miss inserts that finish during its
+ * section, which is the same guarantee it would get from a reader that
+ * simply started earlier.
+ *
+ * Writers retire only after leaving their read-side section and dropping
+ * the stripe lock, so a retire that has to wait for readers never waits on
+ * the writer itself.
+ */
+
+#define CH_MAX_LOAD 2
+#define CH_ARRAY_MAX 4096          /* array chunk size before it becomes a bitmap */
+#define CH_BITMAP_WORDS 1024       /* 65536 bits */
+
+/* Ids (hi << 16) | low for one hi. words holds CH_BITMAP_WORDS bitmap
+ * words, or card sorted uint16_t low halves. */
+typedef struct CIdChunk {
+    int card;
+    int isBitmap;
+    uint64_t words[];
+} CIdChunk;
+
+typedef struct {
+    int hi;
+    CIdChunk *chunk;         /* atomic: replaced on every insert into it */
+} CIdSlot;
+
+/* Chunks sorted by hi; copied only when a new hi appears. */
+typedef struct CIdDir {
+    int n;
+    CIdSlot slots[];
+} CIdDir;
+
+struct CEntry {
+    char *key;
+    uint64_t hash;
+    CIdDir *ids;             /* atomic: replaced when a chunk is added */
+    struct CEntry *next;     /* atomic: written once before publication */
+};
+
+struct CTable {
+    int nbuckets;            /* power of two >= CH_STRIPES */
+    CEntry *buckets[];       /* atomic heads */
+};
+
+static CTable *ct_alloc(int nbuckets) {
+    CTable *t = calloc(1, sizeof(CTable) + (size_t)nbuckets * sizeof(CEntry *));
+    if (t) t->nbuckets = nbuckets;
+    return t;
+}
+
+void ch_init(CHash *h, int nbuckets) {
+    int n = CH_STRIPES;
+    while (n < nbuckets) n <<= 1;
+    h->table = ct_alloc(n);
+    h->size = 0;
+    for (int i = 0; i < CH_STRIPES; i++) pthread_mutex_init(&h->locks[i], NULL);
+}
+
+static CEntry *ch_lookup(const CTable *t, const char *key, uint64_t hash) {
+    CEntry *e = __atomic_load_n(&t->buckets[hash & (uint64_t)(t->nbuckets - 1)], __ATOMIC_ACQUIRE);
+    for (; e; e = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE)) {
+        if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+    }
+    return NULL;
+}
+
+/* ---------- Chunks ---------- */
+
+static const uint16_t *chunk_vals(const CIdChunk *c) {
+    return (const uint16_t *)c->words;
+}
+
+/* First position in vals[0..n) whose value is >= x. */
+static int vals_lower_bound(const uint16_t *vals, int n, uint16_t x) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (vals[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* First slot in d whose hi is >= hi (d may be NULL). */
+static int dir_lower_bound(const CIdDir *d, int hi) {
+    int lo = 0, top = d ? d->n : 0;
+    while (lo < top) {
+        int mid = (lo + top) >> 1;
+        if (d->slots[mid].hi < hi) lo = mid + 1;
+        else top = mid;
+    }
+    return lo;
+}
+
+static int chunk_contains(const CIdChunk *c, uint16_t low) {
+    if (c->isBitmap) return (int)((c->words[low >> 6] >> (low & 63)) & 1);
+    int pos = vals_lower_bound(chunk_vals(c), c->card, low);
+    return pos < c->card && chunk_vals(c)[pos] == low;
+}
+
+/* Copy of old (or a fresh chunk if NULL) with low added; low must not be
+ * present. NULL if out of memory. */
+static CIdChunk *chunk_with(const CIdChunk *old, uint16_t low) {
+    int n = old ? old->card : 0;
+    CIdChunk *c;
+    if (old && (old->isBitmap || n >= CH_ARRAY_MAX)) {
+        c = malloc(sizeof(CIdChunk) + CH_BITMAP_WORDS * sizeof(uint64_t));
+        if (c == NULL) return NULL;
+        if (old->isBitmap) {
+            memcpy(c->words, old->words, CH_BITMAP_WORDS * sizeof(uint64_t));
+        } else {
+            memset(c->words, 0, CH_BITMAP_WORDS * sizeof(uint64_t));
+            const uint16_t *v = chunk_vals(old);
+            for (int i = 0; i < n; i++) c->words[v[i] >> 6] |= 1ull << (v[i] & 63);
+        }
+        c->words[low >> 6] |= 1ull << (low & 63);
+        c->isBitmap = 1;
+    } else {
+        c = malloc(sizeof(CIdChunk) + (size_t)(n + 1) * sizeof(uint16_t));
+        if (c == NULL) return NULL;
+        uint16_t *v = (uint16_t *)c->words;
+        int pos = old ? vals_lower_bound(chunk_vals(old), n, low) : 0;
+        if (pos > 0) memcpy(v, chunk_vals(old), (size_t)pos * sizeof(uint16_t));
+        v[pos] = low;
+        if (n > pos) memcpy(v + pos + 1, chunk_vals(old) + pos, (size_t)(n - pos) * sizeof(uint16_t));
+        c->isBitmap = 0;
+    }
+    c->card = n + 1;
+    return c;
+}
+
+/* Append c's ids to out while fewer than max are written. */
+static void chunk_decode(const CIdChunk *c, int hi, int *out, int *written, int max) {
+    int base = hi << 16;
+    if (c->isBitmap) {
+        for (int w = 0; w < CH_BITMAP_WORDS && *written < max; w++) {
+            uint64_t bits = c->words[w];
+            while (bits && *written < max) {
+                out[(*written)++] = base + w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+            }
+        }
+    } else {
+        const uint16_t *v = chunk_vals(c);
+        for (int i = 0; i < c->card && *written < max; i++) out[(*written)++] = base + v[i];
+    }
+}
+
+static void dir_free(CIdDir *d) {
+    if (d == NULL) return;
+    for (int i = 0; i < d->n; i++) free(d->slots[i].chunk);
+    free(d);
+}
+
+/* ---------- Readers ---------- */
+
+/* Copy up to max of key's ids, ascending, into out and return how many are
+ * stored under key (0 if none). Each chunk is read from one snapshot. */
+int ch_get_ids(CHash *h, const char *key, int *out, int max) {
+    uint64_t hash = h_hash_wy(key, strlen(key));
+    int count = 0, written = 0;
+    ch_read_begin();
+    CTable *t = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+    CEntry *e = ch_lookup(t, key, hash);
+    CIdDir *d = e ? __atomic_load_n(&e->ids, __ATOMIC_ACQUIRE) : NULL;
+    for (int i = 0; d && i < d->n; i++) {
+        CIdChunk *c = __atomic_load_n(&d->slots[i].chunk, __ATOMIC_ACQUIRE);
+        count += c->card;
+        chunk_decode(c, d->slots[i].hi, out, &written, max);
+    }
+    ch_read_end();
+    return count;
+}
+
+int ch_contains(CHash *h, const char *key, int animalId) {
+    uint64_t hash = h_hash_wy(key, strlen(key));
+    int hi = animalId >> 16, found = 0;
+    ch_read_begin();
+    CTable *t = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+    CEntry *e = ch_lookup(t, key, hash);
+    CIdDir *d = e ? __atomic_load_n(&e->ids, __ATOMIC_ACQUIRE) : NULL;
+    int pos = dir_lower_bound(d, hi);
+    if (d && pos < d->n && d->slots[pos].hi == hi) {
+        CIdChunk *c = __atomic_load_n(&d->slots[pos].chunk, __ATOMIC_ACQUIRE);
+        found = chunk_contains(c, (uint16_t)(animalId & 0xffff));
+    }
+    ch_read_end();
+    return found;
+}
+
+void ch_read_begin(void) {
+    ebr_enter();
+}
+
+void ch_read_end(void) {
+    ebr_exit();
+}
+
+/* ---------- Writers ---------- */
+
+/* Add id to the list at *dirp (caller holds the stripe lock). Returns 1 if
+ * added and sets *stale to the chunk or directory it replaced, which the
+ * caller retires once it is out of its section; 0 if present or out of
+ * memory. */
+static int dir_add(CIdDir **dirp, int id, void **stale) {
+    CIdDir *d = *dirp;
+    int hi = id >> 16;
+    uint16_t low = (uint16_t)(id & 0xffff);
+    int pos = dir_lower_bound(d, hi);
+
+    if (d && pos < d->n && d->slots[pos].hi == hi) {
+        CIdChunk *old = d->slots[pos].chunk;
+        if (chunk_contains(old, low)) return 0;
+        CIdChunk *c = chunk_with(old, low);
+        if (c == NULL) return 0;
+        __atomic_store_n(&d->slots[pos].chunk, c, __ATOMIC_RELEASE);
+        *stale = old;
+        return 1;
+    }
+
+    int n = d ? d->n : 0;
+    CIdChunk *c = chunk_with(NULL, low);
+    CIdDir *nd = malloc(sizeof(CIdDir) + (size_t)(n + 1) * sizeof(CIdSlot));
+    if (c == NULL || nd == NULL) {
+        free(c);
+        free(nd);
+        return 0;
+    }
+    nd->n = n + 1;
+    if (pos > 0) memcpy(nd->slots, d->slots, (size_t)pos * sizeof(CIdSlot));
+    nd->slots[pos].hi = hi;
+    nd->slots[pos].chunk = c;
+    if (n > pos) memcpy(nd->slots + pos + 1, d->slots + pos, (size_t)(n - pos) * sizeof(CIdSlot));
+    __atomic_store_n(dirp, nd, __ATOMIC_RELEASE);
+    *stale = d; // its chunks now belong to nd
+    return 1;
+}
+
+/* Lock every stripe and rebuild the table at twice the size. The new
+ * table is built in full before it is published; if any allocation fails
+ * the resize is abandoned and retried by a later insert. */
+static void ch_grow(CHash *h) {
+    CTable *old = NULL;
+    for (int i = 0; i < CH_STRIPES; i++) pthread_mutex_lock(&h->locks[i]);
+
+    CTable *cur = h->table;
+    if (__atomic_load_n(&h->size, __ATOMIC_RELAXED) > cur->nbuckets * CH_MAX_LOAD) {
+        CTable *t = ct_alloc(cur->nbuckets * 2);
+        int ok = t != NULL;
+        for (int b = 0; ok && b < cur->nbuckets; b++) {
+            for (CEntry *e = cur->buckets[b]; e; e = e->next) {
+                CEntry *c = malloc(sizeof(CEntry));
+                if (c == NULL) {
+                    ok = 0;
+                    break;
+                }
+                *c = *e; // shares key and id list
+                uint64_t idx = c->hash & (uint64_t)(t->nbuckets - 1);
+                c->next = t->buckets[idx];
+                t->buckets[idx] = c;
+            }
+        }
+        if (ok) {
+            __atomic_store_n(&h->table, t, __ATOMIC_RELEASE);
+            old = cur;
+        } else if (t) { // never published: free the copies outright
+            for (int b = 0; b < t->nbuckets; b++) {
+                CEntry *e = t->buckets[b];
+                while (e) {
+                    CEntry *next = e->next;
+                    free(e);
+                    e = next;
+                }
+            }
+            free(t);
+        }
+    }
+
+    for (int i = CH_STRIPES - 1; i >= 0; i--) pthread_mutex_unlock(&h->locks[i]);
+
+    if (old) {
+        /* old entry structs and the old table go away after readers
+         * leave; keys and id lists now belong to the new entries */
+        for (int b = 0; b < old->nbuckets; b++) {
+            for (CEntry *e = old->buckets[b]; e; e = e->next) {
+                ebr_retire(e, free);
+            }
+        }
+        ebr_retire(old, free);
+    }
+}
+
+/* Add animalId under key. Returns 1 if it was added, 0 if already there. */
+int ch_put(CHash *h, const char *key, int animalId) {
+    uint64_t hash = h_hash_wy(key, strlen(key));
+    pthread_mutex_t *lock = &h->locks[hash & (CH_STRIPES - 1)];
+    int added = 0, grow = 0;
+    void *stale = NULL;
+
+    pthread_mutex_lock(lock);
+    ebr_enter(); // the table pointer can change under a concurrent resize
+    CTable *t = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+    CEntry *e = ch_lookup(t, key, hash);
+
+    if (e) {
+        added = dir_add(&e->ids, animalId, &stale);
+    } else {
+        CEntry *ne = malloc(sizeof(CEntry));
+        char *k = strdup(key);
+        CIdDir *d = NULL;
+        if (ne && k && dir_add(&d, animalId, &stale)) {
+            uint64_t idx = hash & (uint64_t)(t->nbuckets - 1);
+            ne->key = k;
+            ne->hash = hash;
+            ne->ids = d;
+            ne->next = t->buckets[idx];
+            __atomic_store_n(&t->buckets[idx], ne, __ATOMIC_RELEASE);
+            int size = __atomic_add_fetch(&h->size, 1, __ATOMIC_RELAXED);
+            grow = size > t->nbuckets * CH_MAX_LOAD;
+            added = 1;
+        } else {
+            free(ne);
+            free(k);
+        }
+    }
+    ebr_exit();
+    pthread_mutex_unlock(lock);
+
+    ebr_retire(stale, free); // outside the section: see the header comment
+    if (grow) ch_grow(h);
+    return added;
+}
+
+/* Free everything. No other thread may be using the table. */
+void ch_free(CHash *h) {
+    ebr_synchronize(); // retired chunks, directories and tables first
+    CTable *t = h->table;
+    if (t) {
+        for (int b = 0; b < t->nbuckets; b++) {
+            CEntry *e = t->buckets[b];
+            while (e) {
+                CEntry *next = e->next;
+                free(e->key);
+                dir_free(e->ids);
+                free(e);
+                e = next;
+            }
+        }
+        free(t);
+    }
+    for (int i = 0; i < CH_STRIPES; i++) pthread_mutex_destroy(&h->locks[i]);
+    h->table = NULL;
+    h->size = 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lab5.h"
+
+/* ========== Classifier Code Generation ==========
+ * Writes a compiled program (see program.c) out as a self-contained C99
+ * source file: the question texts, the animal names and the instructions
+ * become static const tables, and a classify function runs the same loop
+ * as prog_classify over them. Compiled into firmware it needs no parsing,
+ * no allocation and no startup work; the tables live in read-only data.
+ *
+ * Tables rather than nested if/else: a branch per node makes compilers
+ * choke on trees with hundreds of thousands of questions, while a table
+ * compiles in time linear in its size.
+ *
+ * Every public symbol starts with a caller-chosen prefix so several trees
+ * can be linked into one program.
+ */
+
+/* Emit s as a C string literal. Anything outside printable ASCII, quotes,
+ * backslashes and a '?' starting "??" (a trigraph) are escaped as octal. */
+static int put_literal(FILE *f, const char *s) {
+    if (fputc('"', f) == EOF) return 0;
+    for (const unsigned char *c = (const unsigned char *)s; *c; c++) {
+        int ok;
+        if (*c == '"' || *c == '\\' || (*c == '?' && c[1] == '?') || *c < 0x20 || *c >= 0x7f) {
+            ok = fprintf(f, "\\%03o", *c) > 0;
+        } else {
+            ok = fputc(*c, f) != EOF;
+        }
+        if (!ok) return 0;
+    }
+    return fputc('"', f) != EOF;
+}
+
+/* 1 if prefix is a C identifier. */
+static int valid_prefix(const char *prefix) {
+    if (!isalpha((unsigned char)prefix[0]) && prefix[0] != '_') return 0;
+    for (const char *c = prefix; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return 0;
+    }
+    return 1;
+}
+
+/* Write p as C source to f. Animal names come from the attribute index
+ * (index_animal), so p must be compiled from the current tree. source
+ * names the tree in the header comment (may be NULL). Returns 1 on
+ * success, 0 for a bad prefix or a write error. */
+int prog_emit_c(const DecisionProgram *p, FILE *f, const char *prefix, const char *source) {
+    if (!valid_prefix(prefix)) return 0;
+    int animals = index_animal_count();
+    char upper[64];
+    size_t len = strlen(prefix);
+    if (len >= sizeof upper) return 0;
+    for (size_t i = 0; i <= len; i++) upper[i] = (char)toupper((unsigned char)prefix[i]);
+
+    int ok = fprintf(f,
+        "/* Generated by guess_animal --emit-c%s%s: %d questions, %d instructions.\n"
+        " * Do not edit; regenerate from the tree instead.\n"
+        " *\n"
+        " * %s_classify takes one bit per question id (bit q of word q / 64 set\n"
+        " * for \"yes\") and returns the animal id it leads to, or -1 for an\n"
+        " * empty tree. */\n"
+        "#include <stdint.h>\n"
+        "#include <stddef.h>\n\n"
+        "#define %s_QUESTIONS %d\n"
+        "#define %s_ANIMALS %d\n"
+        "#define %s_ANSWER_WORDS %d\n\n",
+        source ? " from " : "", source ? source : "", p->questionCount, p->count, prefix,
+        upper, p->questionCount, upper, animals, upper, prog_answer_words(p)) > 0;
+
+    /* questions by id */
+    ok = ok && fprintf(f, "static const char *const %s_question_text[%d] = {\n", prefix,
+                       p->questionCount ? p->questionCount : 1) > 0;
+    for (int q = 0; ok && q < p->questionCount; q++) {
+        ok = fputs("    ", f) != EOF && put_literal(f, prog_question_text(p, q)) && fputs(",\n", f) != EOF;
+    }
+    if (ok && p->questionCount == 0) ok = fputs("    NULL\n", f) != EOF;
+    ok = ok && fputs("};\n\n", f) != EOF;
+
+    /* animals by id; ids no longer in the tree stay NULL */
+    ok = ok && fprintf(f, "static const char *const %s_animal_name[%d] = {\n", prefix, animals ? animals : 1) > 0;
+    for (int id = 0; ok && id < animals; id++) {
+        Node *leaf = index_animal(id);
+        ok = fputs("    ", f) != EOF && (leaf ? put_literal(f, leaf->text) : fputs("NULL", f) != EOF) &&
+             fputs(",\n", f) != EOF;
+    }
+    if (ok && animals == 0) ok = fputs("    NULL\n", f) != EOF;
+    ok = ok && fputs("};\n\n", f) != EOF;
+
+    /* instructions: question, yes, no; negative targets are -(id + 1) */
+    ok = ok && fprintf(f, "static const int32_t %s_code[%d][3] = {\n", prefix, p->count ? p->count : 1) > 0;
+    for (int k = 0; ok && k < p->count; k++) {
+        const ProgInsn *in = &p->code[k];
+        ok = fprintf(f, "    {%d, %d, %d},\n", in->question, in->yes, in->no) > 0;
+    }
+    if (ok && p->count == 0) ok = fputs("    {0, 0, 0}\n", f) != EOF;
+    ok = ok && fputs("};\n\n", f) != EOF;
+
+    /* an empty tree enters at INT32_MIN, which no C literal spells directly */
+    char entry[32];
+    if (p->entry == PROG_NONE) snprintf(entry, sizeof entry, "(-2147483647 - 1)");
+    else snprintf(entry, sizeof entry, "%d", p->entry);
+    ok = ok && fprintf(f,
+        "const char *%s_question(int q) {\n"
+        "    return q >= 0 && q < %s_QUESTIONS ? %s_question_text[q] : NULL;\n"
+        "}\n\n"
+        "const char *%s_animal(int id) {\n"
+        "    return id >= 0 && id < %s_ANIMALS ? %s_animal_name[id] : NULL;\n"
+        "}\n\n"
+        "int %s_classify(const uint64_t *answers) {\n"
+        "    int32_t pc = %s;\n"
+        "    if (pc == (-2147483647 - 1)) return -1;\n"
+        "    while (pc >= 0) {\n"
+        "        const int32_t *in = %s_code[pc];\n"
+        "        pc = (answers[in[0] >> 6] >> (in[0] & 63)) & 1 ? in[1] : in[2];\n"
+        "    }\n"
+        "    return -pc - 1;\n"
+        "}\n",
+        prefix, upper, prefix, prefix, upper, prefix, prefix, entry, prefix) > 0;
+    return ok;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdint.h>
 #include "lab5.h"
 
 /* ========== Node Functions ========== */
@@ -29,8 +30,12 @@ Node *create_question_node(const char *question) {
         return NULL;
     }
     node->isQuestion = 1;
+    node->refs = 1;
     node->yes = NULL;
     node->no = NULL;
+    node->parent = NULL;
+    node->id = -1;
+    node->visitMark = 0;
     return node;
 }
 
@@ -48,8 +53,12 @@ Node *create_animal_node(const char *animal) {
         return NULL;
     }
     nodeA->isQuestion = 0;
+    nodeA->refs = 1;
     nodeA->yes = NULL;
     nodeA->no = NULL;
+    nodeA->parent = NULL;
+    nodeA->id = -1; // assigned by the attribute index
+    nodeA->visitMark = 0;
     return nodeA;
 }
 /* TODO 3: Implement free_tree (recursive)
@@ -171,7 +180,7 @@ void es_init(EditStack *s) {
 void es_push(EditStack *s, Edit e) {
     // TODO: Implement this function
     if(s->size >= s->capacity){
-        s->capacity *= 2;
+        s->capacity = s->capacity ? s->capacity * 2 : 16; // {NULL, 0, 0} grows on first push
         s->edits = realloc(s->edits, s->capacity*sizeof(Edit));
     }
     s->edits[s->size] = e;
@@ -334,32 +343,174 @@ void q_free(Queue *q) {
  * - Null-terminate result
  * - Return the new string
  */
-char *canonicalize(const char *s) {
-    // TODO: Implement this function
+/* Scalar reference: canonicalize in[i..len) into out starting at j and
+ * return the new output length. The vector kernels use it for their tails. */
+static size_t canon_scalar_range(const unsigned char *in, size_t i, size_t len,
+                                 char *out, size_t j) {
+    for(; i<len; i++){
+        unsigned char c = in[i];
+        if(isalnum(c)){ // allow both letters and digits
+            out[j++] = (char)tolower(c); // convert to lowercase
+        }else if(isspace(c)){
+            out[j++] = '_'; // for whitespace replace with underscore
+        }
+        // anything else is punctuation: skip it
+    }
+    return j;
+}
 
-    char *result = malloc(strlen(s)+1*sizeof(char));
-    if (result==NULL){
-        return NULL; // if allocation fails return nULL
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CANON_HAVE_X86 1
+
+/* SSE2 kernel: classify, lowercase and compact 16 bytes per iteration.
+ * Letters are lowercased by OR-ing 0x20 into the uppercase lanes and
+ * whitespace lanes are replaced by '_'. When every lane is kept (the common
+ * case for question text) the block is stored as-is; otherwise the kept
+ * lanes are copied out one by one from the movemask. Bytes >= 0x80 are
+ * negative as signed chars, so they fall outside every range and are
+ * dropped exactly like the scalar path does in the C locale. */
+__attribute__((target("sse2")))
+static size_t canon_kernel_sse2(const unsigned char *in, size_t len, char *out) {
+    size_t i = 0, j = 0;
+    const __m128i A1 = _mm_set1_epi8('A' - 1), Z1 = _mm_set1_epi8('Z' + 1);
+    const __m128i a1 = _mm_set1_epi8('a' - 1), z1 = _mm_set1_epi8('z' + 1);
+    const __m128i d1 = _mm_set1_epi8('0' - 1), d9 = _mm_set1_epi8('9' + 1);
+    const __m128i ws0 = _mm_set1_epi8('\t' - 1), ws1 = _mm_set1_epi8('\r' + 1);
+    const __m128i sp = _mm_set1_epi8(' '), us = _mm_set1_epi8('_');
+    const __m128i bit5 = _mm_set1_epi8(0x20);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, A1), _mm_cmplt_epi8(v, Z1));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, a1), _mm_cmplt_epi8(v, z1));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, d1), _mm_cmplt_epi8(v, d9));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                        _mm_and_si128(_mm_cmpgt_epi8(v, ws0), _mm_cmplt_epi8(v, ws1)));
+
+        __m128i res = _mm_or_si128(v, _mm_and_si128(upper, bit5));
+        res = _mm_or_si128(_mm_andnot_si128(space, res), _mm_and_si128(space, us));
+
+        __m128i keep = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(keep);
+
+        if (mask == 0xFFFFu) {
+            _mm_storeu_si128((__m128i *)(out + j), res);
+            j += 16;
+        } else {
+            char tmp[16];
+            _mm_storeu_si128((__m128i *)tmp, res);
+            while (mask) {
+                out[j++] = tmp[__builtin_ctz(mask)];
+                mask &= mask - 1;
+            }
+        }
     }
-    int j=0; // index for result buffer
-    size_t len = strlen(s); // input string length
+    return canon_scalar_range(in, i, len, out, j);
+}
 
-    for(size_t i=0; i<len; i++){
-        if(isalnum(s[i])){ // allow both letters and digits
-            result[j++]=tolower(s[i]); // convert to lowercase
-        }else if(s[i] == ' '){
-            result[j++] = '_'; // for whitespace replace with udnerscore
+/* AVX2 kernel: same classification as SSE2 on 32 bytes per iteration.
+ * Partial blocks are compacted with BMI2 PEXT, which every AVX2 CPU we
+ * dispatch to also has. The 8-byte group stores never run past the input
+ * position, so they stay inside the len + 1 byte output buffer. */
+__attribute__((target("avx2,bmi2")))
+static size_t canon_kernel_avx2(const unsigned char *in, size_t len, char *out) {
+    size_t i = 0, j = 0;
+    const __m256i A1 = _mm256_set1_epi8('A' - 1), Z1 = _mm256_set1_epi8('Z' + 1);
+    const __m256i a1 = _mm256_set1_epi8('a' - 1), z1 = _mm256_set1_epi8('z' + 1);
+    const __m256i d1 = _mm256_set1_epi8('0' - 1), d9 = _mm256_set1_epi8('9' + 1);
+    const __m256i ws0 = _mm256_set1_epi8('\t' - 1), ws1 = _mm256_set1_epi8('\r' + 1);
+    const __m256i sp = _mm256_set1_epi8(' '), us = _mm256_set1_epi8('_');
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, A1), _mm256_cmpgt_epi8(Z1, v));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, a1), _mm256_cmpgt_epi8(z1, v));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, d1), _mm256_cmpgt_epi8(d9, v));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                        _mm256_and_si256(_mm256_cmpgt_epi8(v, ws0), _mm256_cmpgt_epi8(ws1, v)));
+
+        __m256i res = _mm256_or_si256(v, _mm256_and_si256(upper, bit5));
+        res = _mm256_blendv_epi8(res, us, space);
+
+        __m256i keep = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, space));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(keep);
+
+        if (mask == 0xFFFFFFFFu) {
+            _mm256_storeu_si256((__m256i *)(out + j), res);
+            j += 32;
+        } else {
+            /* Compact each 8-byte group with PEXT: expand the 8 mask bits
+             * to byte masks, extract the kept bytes, store the whole word
+             * and advance by the number of kept bytes. */
+            uint64_t words[4];
+            _mm256_storeu_si256((__m256i *)words, res);
+            for (int g = 0; g < 4; g++) {
+                unsigned m8 = (mask >> (8 * g)) & 0xFFu;
+                uint64_t sel = _pdep_u64(m8, 0x0101010101010101ull) * 0xFFu;
+                uint64_t packed = _pext_u64(words[g], sel);
+                memcpy(out + j, &packed, 8);
+                j += (size_t)__builtin_popcount(m8);
+            }
         }
-        else if(s[i] == '?'){ // ignore puncuation
-            result[i] = '\0';
-        }else{
-            result[i] = s[i];
+    }
+    return canon_scalar_range(in, i, len, out, j);
+}
+#endif
+
+/* Fastest implementation the running CPU supports (detected once). */
+CanonImpl canonicalize_best_impl(void) {
+    static int best = -1;
+    if (best < 0) {
+        best = CANON_SCALAR;
+#ifdef CANON_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) best = CANON_SSE2;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+            best = CANON_AVX2;
         }
+#endif
     }
-    result[strlen(s)+1] = '\0';;
+    return (CanonImpl)best;
+}
+
+static size_t canon_run(const char *s, size_t len, char *out, CanonImpl impl) {
+    const unsigned char *in = (const unsigned char *)s;
+    size_t j;
+    switch (impl) {
+#ifdef CANON_HAVE_X86
+        case CANON_AVX2: j = canon_kernel_avx2(in, len, out); break;
+        case CANON_SSE2: j = canon_kernel_sse2(in, len, out); break;
+#endif
+        default:         j = canon_scalar_range(in, 0, len, out, 0); break;
+    }
+    out[j] = '\0';
+    return j;
+}
+
+/* Canonicalize with a specific implementation; impl must not exceed
+ * canonicalize_best_impl(). Used directly by tests and benchmarks. */
+char *canonicalize_with(const char *s, CanonImpl impl) {
+    size_t len = strlen(s); // input string length
+    char *result = malloc(len + 1); // output is never longer than input
+    if (result == NULL) {
+        return NULL; // if allocation fails return NULL
+    }
+    canon_run(s, len, result, impl);
     return result;
 }
 
+/* canonicalize into a caller buffer of at least len + 1 bytes, for hot
+ * paths that cannot afford an allocation. Returns the output length. */
+size_t canonicalize_into(const char *s, size_t len, char *out) {
+    return canon_run(s, len, out, canonicalize_best_impl());
+}
+
+char *canonicalize(const char *s) {
+    return canonicalize_with(s, canonicalize_best_impl());
+}
+
 /* TODO 21: Implement h_hash (djb2 algorithm)
  * unsigned hash = 5381;
  * For each character c in the string:
@@ -376,6 +527,168 @@ unsigned h_hash(const char *s) {
     return hash;
 }
 
+/* djb2 behind the HashFn interface, kept for tables that need the
+ * historical bucket layout. */
+uint64_t h_hash_djb2(const char *key, size_t len) {
+    unsigned hash = 5381;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash*33) + (unsigned char)key[i];
+    }
+    return hash;
+}
+
+/* ---------- wyhash-style 64-bit hash ----------
+ * Reads the key 8 bytes at a time and mixes with a 64x64->128 multiply
+ * folded back to 64 bits, so long questions cost a few multiplies per 16
+ * bytes instead of one multiply-add per byte, and every output bit depends
+ * on every input bit (no clustering when reduced modulo a small prime).
+ */
+#define WY_S0 0xa0761d6478bd642full
+#define WY_S1 0xe7037ed1a0b428dbull
+#define WY_S2 0x8ebc6af09c88c6e3ull
+#define WY_S3 0x589965cc75374cc3ull
+
+static uint64_t wy_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+static uint64_t wy_r8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t wy_r4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+uint64_t h_hash_wy(const char *key, size_t len) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t seed = WY_S0;
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) { // two overlapping 4-byte reads from each end
+            size_t off = (len >> 3) << 2;
+            a = (wy_r4(p) << 32) | wy_r4(p + off);
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - off);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) { // three independent lanes for long keys
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mum(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+                see1 = wy_mum(wy_r8(p + 16) ^ WY_S2, wy_r8(p + 24) ^ see1);
+                see2 = wy_mum(wy_r8(p + 32) ^ WY_S3, wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mum(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wy_r8(p + i - 16); // last 16 bytes, possibly overlapping
+        b = wy_r8(p + i - 8);
+    }
+    return wy_mum(WY_S1 ^ len, wy_mum(a ^ WY_S1, b ^ seed));
+}
+
+/* ---------- Incremental resizing ----------
+ * Once size exceeds nbuckets * H_MAX_LOAD the bucket array is swapped for
+ * one roughly twice as large and the old array is kept in oldBuckets.
+ * Every subsequent operation migrates H_MIGRATE_STEP old buckets, so the
+ * cost of a resize is spread over the next nbuckets / H_MIGRATE_STEP calls
+ * instead of being paid at once. While a resize is in flight a key may live
+ * in either table: lookups check the new table first and fall back to the
+ * old bucket if it has not been migrated yet.
+ */
+#define H_MAX_LOAD 2
+#define H_MIGRATE_STEP 8
+
+static void h_migrate(Hash *h, int steps) {
+    while (h->oldBuckets && steps-- > 0) {
+        Entry *e = h->oldBuckets[h->rehashPos];
+        while (e) {
+            Entry *next = e->next;
+            int idx = e->hash % h->nbuckets;
+            e->next = h->buckets[idx];
+            h->buckets[idx] = e;
+            e = next;
+        }
+        h->oldBuckets[h->rehashPos] = NULL;
+
+        if (++h->rehashPos >= h->oldNbuckets) { // old table fully drained
+            free(h->oldBuckets);
+            h->oldBuckets = NULL;
+            h->oldNbuckets = 0;
+            h->rehashPos = 0;
+        }
+    }
+}
+
+static void h_maybe_grow(Hash *h) {
+    if (h->oldBuckets || h->size <= h->nbuckets * H_MAX_LOAD) return;
+
+    int newNbuckets = h->nbuckets * 2 + 1;
+    Entry **newBuckets = calloc(newNbuckets, sizeof(Entry *));
+    if (newBuckets == NULL) return; // keep working with longer chains
+
+    h->oldBuckets = h->buckets;
+    h->oldNbuckets = h->nbuckets;
+    h->rehashPos = 0;
+    h->buckets = newBuckets;
+    h->nbuckets = newNbuckets;
+}
+
+/* Find the entry for key in whichever table currently holds it. */
+static Entry *h_find(Hash *h, const char *key, uint64_t hash) {
+    h_migrate(h, H_MIGRATE_STEP);
+
+    for (Entry *e = h->buckets[hash % h->nbuckets]; e; e = e->next) {
+        if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+    }
+    if (h->oldBuckets) {
+        int oldIdx = hash % h->oldNbuckets;
+        if (oldIdx >= h->rehashPos) { // bucket not migrated yet
+            for (Entry *e = h->oldBuckets[oldIdx]; e; e = e->next) {
+                if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+static uint64_t h_key_hash(const Hash *h, const char *key) {
+    return h->hashFn(key, strlen(key));
+}
+
+/* Return 1 while an incremental resize is still draining the old table. */
+int h_rehashing(const Hash *h) {
+    return h->oldBuckets != NULL;
+}
+
 /* TODO 22: Implement h_init
  * - Allocate buckets array using calloc (initializes to NULL)
  * - Set nbuckets field
@@ -383,26 +696,84 @@ unsigned h_hash(const char *s) {
  */
 void h_init(Hash *h, int nbuckets) {
     // TODO: Implement this function
+    h_init_with(h, nbuckets, h_hash_wy);
+}
+
+/* Same as h_init with an explicit hash function (NULL means the default). */
+void h_init_with(Hash *h, int nbuckets, HashFn fn) {
+    h->hashFn = fn ? fn : h_hash_wy;
+    if (nbuckets < 1) nbuckets = 1;
     h->nbuckets = nbuckets;
     h->size = 0; // 0 initial entries
 
     h->buckets = calloc(nbuckets, sizeof(Entry *));
-    
+
+    h->oldBuckets = NULL; // no resize in progress
+    h->oldNbuckets = 0;
+    h->rehashPos = 0;
+}
+
+/* Find the entry for key, creating an empty one if it does not exist. */
+static Entry *h_entry(Hash *h, const char *key) {
+    uint64_t hash = h_key_hash(h, key);
+    Entry *e = h_find(h, key, hash);
+    if(e) return e; // key exists alr
+
+    Entry *newEntry = malloc(sizeof(Entry));
+    if(newEntry==NULL) return NULL;
+
+    newEntry->key = strdup(key); // copy key string
+    if(newEntry->key == NULL){
+        free (newEntry);
+        return NULL;
+    }
+    idl_init(&newEntry->vals); // empty posting list
+    newEntry->hash = hash;
+
+    // insert at head of chain in the current (newest) table
+    int idx = hash % h->nbuckets;
+    newEntry->next = h->buckets[idx];
+    h->buckets[idx] = newEntry;
+    h->size++; // increase size of hash table
+
+    h_maybe_grow(h);
+    return newEntry;
+}
+
+/* Link a new entry for key with a precomputed hash, taking ownership of
+ * key, without looking for an existing one. For bulk loading a table whose
+ * keys are known to be distinct (a saved index); the caller fills in the
+ * returned entry's posting list. Returns NULL on allocation failure. */
+Entry *h_adopt(Hash *h, char *key, uint64_t hash) {
+    Entry *newEntry = malloc(sizeof(Entry));
+    if(newEntry == NULL) return NULL;
+    newEntry->key = key;
+    newEntry->hash = hash;
+    idl_init(&newEntry->vals);
+
+    h_migrate(h, H_MIGRATE_STEP);
+    int idx = hash % h->nbuckets;
+    newEntry->next = h->buckets[idx];
+    h->buckets[idx] = newEntry;
+    h->size++;
+
+    h_maybe_grow(h);
+    return newEntry;
 }
 
 /* TODO 23: Implement h_put
  * Add animalId to the list for the given key
  * 
  * Steps:
- * 1. Compute bucket index: idx = h_hash(key) % nbuckets
+ * 1. Compute bucket index: idx = hashFn(key) % nbuckets
  * 2. Search the chain at buckets[idx] for an entry with matching key
  * 3. If found:
  *    - Check if animalId already exists in the vals list
  *    - If yes, return 0 (no change)
- *    - If no, add animalId to vals.ids array (resize if needed), return 1
+ *    - If no, add animalId to the vals posting list, return 1
  * 4. If not found:
  *    - Create new Entry with strdup(key)
- *    - Initialize vals with initial capacity (e.g., 4)
+ *    - Initialize an empty vals posting list
  *    - Add animalId as first element
  *    - Insert at head of chain (buckets[idx])
  *    - Increment h->size
@@ -410,58 +781,26 @@ void h_init(Hash *h, int nbuckets) {
  */
 int h_put(Hash *h, const char *key, int animalId) {
     // TODO: Implement this function
-    int idx = h_hash(key) % h->nbuckets; // find index for bucket
-    Entry *e = h->buckets[idx];
-
-    // traverse Linked List at this bucket
-    while(e){
-        if(strcmp(e->key, key) == 0){ // key exists alr
-            for(int i=0; i < e->vals.count; i++){ // check if animalId alr exists
-                if(e->vals.ids[i] == animalId){
-                    return 0;
-                }
-            }
-        if(e->vals.count >= e->vals.capacity){
-            int newMax = e->vals.capacity*2;
-            int *newIds = realloc(e->vals.ids, newMax*sizeof(int));
-            if(newIds==NULL) return 0; // failed to allocate
-            e->vals.ids = newIds;
-            e->vals.capacity = newMax;
-        }
-        //add animals to vals
-        e->vals.ids[e->vals.count++] = animalId;
-        return 1; // success 
-        }
-        e = e->next; // move to next entry
-    }
-
-    Entry *newEntry = malloc(sizeof(Entry));
-    if(newEntry==NULL) return 0;
-
-    newEntry->key = strdup(key); // copy key string
-    if(newEntry->key == NULL){
-        free (newEntry);
-        return 0;
-    }
+    Entry *e = h_entry(h, key);
+    if(e == NULL) return 0; // allocation failed
 
-    // initialize vals list
-    newEntry->vals.count = 1;
-    newEntry->vals.capacity = 4;
-    newEntry->vals.ids = malloc(newEntry->vals.capacity*sizeof(int));
-    if(newEntry->vals.ids==NULL){
-        free(newEntry->key);
-        free(newEntry);
-        return 0;
-    }
-    
-    newEntry->vals.ids[0] = animalId; // add first animal
+    // posting list rejects duplicates itself
+    return idl_add(&e->vals, animalId);
+}
 
-    // insert at head of chain
-    newEntry->next = h->buckets[idx];
-    h->buckets[idx] = newEntry;
-    h->size++; // increase size of hash table
-    return 1; // success
+/* Add every id in [lo, hi) under key in one step (used for index rebuilds,
+ * where a subtree's animals have consecutive ids). Returns ids added. */
+int h_put_range(Hash *h, const char *key, int lo, int hi) {
+    Entry *e = h_entry(h, key);
+    if(e == NULL) return 0;
+    return idl_add_range(&e->vals, lo, hi);
+}
 
+/* Remove animalId from key's list; the (possibly empty) entry stays. */
+int h_remove(Hash *h, const char *key, int animalId) {
+    Entry *e = h_find(h, key, h_key_hash(h, key));
+    if(e == NULL) return 0;
+    return idl_remove(&e->vals, animalId);
 }
 
 /* TODO 24: Implement h_contains
@@ -470,28 +809,16 @@ int h_put(Hash *h, const char *key, int animalId) {
  * Steps:
  * 1. Compute bucket index
  * 2. Search the chain for matching key
- * 3. If found, search vals.ids array for animalId
+ * 3. If found, look animalId up in the vals posting list
  * 4. Return 1 if found, 0 otherwise
  */
-int h_contains(const Hash *h, const char *key, int animalId) {
+int h_contains(Hash *h, const char *key, int animalId) {
     // TODO: Implement this function
+    Entry *e = h_find(h, key, h_key_hash(h, key));
+    if(e == NULL) return 0; // key not found
 
-    int idx = h_hash (key) % h->nbuckets; // find index for bucket
-    Entry *e = h->buckets[idx];
-
-    // search through animal list of animal IDs for a match
-    while(e){
-        if(strcmp(e->key, key) == 0){
-            for(int i=0; i < e->vals.count; i++){
-                if(e->vals.ids[i] == animalId){
-                    return 1; // key found in list
-                }
-            }
-        return 0; // key found but not in list
-        }
-    e = e->next; // move to next entry
-    }  
-    return 0; // key found
+    // O(log n) membership test in the posting list
+    return idl_contains(&e->vals, animalId);
 }
 
 /* TODO 25: Implement h_get_ids
@@ -504,23 +831,17 @@ int h_contains(const Hash *h, const char *key, int animalId) {
  * 2. Search chain for matching key
  * 3. If found:
  *    - Set *outCount = vals.count
- *    - Return vals.ids
+ *    - Return the decoded (sorted) ids of vals
  * 4. If not found:
  *    - Set *outCount = 0
  *    - Return NULL
  */
-int *h_get_ids(const Hash *h, const char *key, int *outCount) {
+int *h_get_ids(Hash *h, const char *key, int *outCount) {
     // TODO: Implement this function
-    int idx = h_hash(key) % h->nbuckets; // find index for bucket
-    Entry *e = h->buckets[idx];
-
-    // traverse chain for matching key
-    while(e){
-        if(strcmp(e->key, key)==0){
-            *outCount = e->vals.count; // output number of IDs
-            return e->vals.ids; // return pointer to IDs array
-        }
-        e = e->next; // move to next extry
+    Entry *e = h_find(h, key, h_key_hash(h, key));
+    if(e){
+        *outCount = e->vals.count; // output number of IDs
+        return idl_to_array(&e->vals); // sorted, valid until the key changes
     }
 
     // key not found
@@ -528,6 +849,28 @@ int *h_get_ids(const Hash *h, const char *key, int *outCount) {
     return NULL;
 }
 
+/* Posting list for key (for set algebra with idl_and/idl_or/idl_andnot),
+ * or NULL if the key is not present. */
+IdList *h_get_list(Hash *h, const char *key) {
+    Entry *e = h_find(h, key, h_key_hash(h, key));
+    return e ? &e->vals : NULL;
+}
+
+/* Free every entry in a bucket array of n chains. */
+static void h_free_buckets(Entry **buckets, int n) {
+    for(int i=0; i< n; i++){
+        Entry *e = buckets[i];
+        while(e){
+            Entry *temp = e; // store current entry
+            e = e->next; // move to next
+            free(temp->key); // free key string
+            idl_free(&temp->vals); // free posting list
+            free(temp); // free entry struct
+        }
+    }
+    free(buckets);
+}
+
 /* TODO 26: Implement h_free
  * Free all memory associated with the hash table
  * 
@@ -543,19 +886,14 @@ int *h_get_ids(const Hash *h, const char *key, int *outCount) {
  */
 void h_free(Hash *h) {
     // TODO: Implement this function
-    // free all entries in each bucket
-    for(int i=0; i< h->nbuckets; i++){
-        Entry *e = h->buckets[i];
-        while(e){
-            Entry *temp = e; // store current entry
-            e = e->next; // move to next
-            free(temp->key); // free key string
-            free(temp->vals.ids); // free ID
-            free(temp); // free entry struct
-        }
-    }
-    free(h->buckets); // free bucket and reset fields
-    h->buckets = NULL;
+    // free all entries in both tables (old one only exists mid-resize)
+    if (h->buckets) h_free_buckets(h->buckets, h->nbuckets);
+    if (h->oldBuckets) h_free_buckets(h->oldBuckets, h->oldNbuckets);
+
+    h->buckets = NULL; // reset fields
     h->size = 0;
     h->nbuckets = 0;
+    h->oldBuckets = NULL;
+    h->oldNbuckets = 0;
+    h->rehashPos = 0;
 }
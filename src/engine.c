@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lab5.h"
+
+extern Node *g_root;
+extern EditStack g_undo;
+extern EditStack g_redo;
+
+/* ========== Game Engine ==========
+ * The game without a user interface. A GameSession walks the tree one
+ * answer at a time; whoever drives it (the ncurses game in game.c, tests,
+ * simulations) shows the question or guess it exposes and feeds the
+ * player's reply back. Nothing here prints or reads input.
+ *
+ * A session holds only its position, so any number of them can be in
+ * flight over the same tree and each step is a single pointer move.
+ *
+ * Sessions on other threads keep answering while the tree is edited.
+ * Edits (teach, undo, redo) take writeLock, so they run one at a time,
+ * and change the tree by a single child-pointer store made after the new
+ * node is complete (release), which answering loads with acquire. A
+ * reader therefore sees the tree before or after an edit, never half of
+ * one. Nodes cut off by an undo are not freed, so a session standing on
+ * one stays valid; it just cannot teach there.
+ *
+ * Each session records its edits on its own undo/redo stacks (the global
+ * ones unless engine_history says otherwise). An edit can only be undone
+ * while nothing has been taught below it, and redone while its leaf is
+ * still in place.
+ */
+
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ---------- Reclaiming detached nodes ----------
+ * An undone edit keeps its question and leaf off the tree so it can be
+ * redone. Once the edit is dropped from its redo stack (its session taught
+ * something new, or let go of its history) they are garbage, but sessions
+ * may still stand on them: a session keeps its position between a
+ * player's answers, not just during one call. So sessions in progress are
+ * the readers of an epoch scheme like epoch.c's, with the same three
+ * epochs: each is counted in the epoch it began in, the epoch advances
+ * once nobody is left in the one before it, and a node retired in epoch e
+ * is freed when the epoch reaches e + 2. A session must not move to a
+ * newer epoch mid-game: its position may be a node retired in the old
+ * one, which the newer epoch no longer protects. So a step costs nothing,
+ * and a long game holds back reclaiming until it ends.
+ *
+ * Dropping an edit can free its nodes only when no other edit still
+ * refers to them: an edit taught below the undone question pins it (see
+ * Node.refs) until that edit is dropped too, and a question whose own
+ * edit is gone loses its parent link so attached() never walks into freed
+ * memory.
+ */
+
+static uint64_t reclaimEpoch = 2;     /* 0 means a session is not counted */
+static long inEpoch[3];               /* sessions in progress, by epoch % 3 */
+
+typedef struct {
+    Node *node;
+    uint64_t epoch;
+} Retired;
+
+static Retired *limbo = NULL;         /* under writeLock */
+static int limboCount = 0, limboCap = 0;
+
+/* Count the session in the current epoch. */
+static void session_join(GameSession *s) {
+    for (;;) {
+        uint64_t e = __atomic_load_n(&reclaimEpoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&inEpoch[e % 3], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&reclaimEpoch, __ATOMIC_SEQ_CST) == e) {
+            s->epoch = e;
+            return;
+        }
+        __atomic_sub_fetch(&inEpoch[e % 3], 1, __ATOMIC_SEQ_CST); // moved on; retry
+    }
+}
+
+static void session_leave(GameSession *s) {
+    if (s->epoch == 0) return;
+    __atomic_sub_fetch(&inEpoch[s->epoch % 3], 1, __ATOMIC_RELEASE);
+    s->epoch = 0;
+}
+
+/* Free what no session can reach any more. Caller holds writeLock. */
+static void reclaim_locked(void) {
+    for (int i = 0; i < 2 && limboCount > 0; i++) {
+        uint64_t e = __atomic_load_n(&reclaimEpoch, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&inEpoch[(e - 1) % 3], __ATOMIC_SEQ_CST) != 0) break;
+        __atomic_store_n(&reclaimEpoch, e + 1, __ATOMIC_SEQ_CST);
+    }
+    uint64_t e = __atomic_load_n(&reclaimEpoch, __ATOMIC_SEQ_CST);
+    int kept = 0;
+    for (int i = 0; i < limboCount; i++) {
+        if (limbo[i].epoch + 2 <= e) {
+            free(limbo[i].node->text);
+            free(limbo[i].node);
+        } else {
+            limbo[kept++] = limbo[i];
+        }
+    }
+    limboCount = kept;
+}
+
+/* Drop one reference to a node off the tree; the last one retires it.
+ * Caller holds writeLock. */
+static void unref(Node *n) {
+    if (--n->refs > 0) return;
+    if (limboCount == limboCap) {
+        int newCap = limboCap ? limboCap * 2 : 16;
+        Retired *nl = realloc(limbo, (size_t)newCap * sizeof(Retired));
+        if (nl == NULL) return; // leaked rather than freed under a reader
+        limbo = nl;
+        limboCap = newCap;
+    }
+    limbo[limboCount].node = n;
+    limbo[limboCount].epoch = __atomic_load_n(&reclaimEpoch, __ATOMIC_SEQ_CST);
+    limboCount++;
+}
+
+/* Forget an edit for good. An undone one takes its nodes with it.
+ * Caller holds writeLock. */
+static void drop_edit(const Edit *e, int undone) {
+    if (undone) {
+        e->newQuestion->parent = NULL; // never reattached
+        index_forget(e->newLeaf);
+        unref(e->newLeaf);
+        unref(e->newQuestion);
+    }
+    if (e->parent) unref(e->parent);
+}
+
+static void drop_redo_locked(EditStack *redo) {
+    for (int i = 0; i < redo->size; i++) drop_edit(&redo->edits[i], 1);
+    es_clear(redo);
+}
+
+/* Free the session history on undo/redo (e.g. when its player leaves);
+ * the undone edits' nodes are reclaimed. */
+void engine_drop_history(EditStack *undo, EditStack *redo) {
+    pthread_mutex_lock(&writeLock);
+    drop_redo_locked(redo);
+    for (int i = 0; i < undo->size; i++) drop_edit(&undo->edits[i], 0);
+    es_clear(undo);
+    reclaim_locked();
+    pthread_mutex_unlock(&writeLock);
+    es_free(undo);
+    es_free(redo);
+}
+
+/* Free whatever detached nodes no session can still reach. Returns how
+ * many are still waiting for sessions to move on. */
+int engine_reclaim(void) {
+    pthread_mutex_lock(&writeLock);
+    reclaim_locked();
+    int left = limboCount;
+    pthread_mutex_unlock(&writeLock);
+    return left;
+}
+
+/* Start a game at the root. Returns 0 if there is no tree. */
+int engine_begin(GameSession *s) {
+    s->parent = NULL;
+    s->parentAnswer = -1;
+    s->steps = 0;
+    s->rec = NULL;
+    s->trail = NULL;
+    s->trailCap = 0;
+    s->undo = &g_undo;
+    s->redo = &g_redo;
+    s->epoch = 0;
+    session_join(s); // before taking the root, which an undo may detach
+    s->cur = __atomic_load_n(&g_root, __ATOMIC_ACQUIRE);
+    if (s->cur == NULL) {
+        session_leave(s);
+        s->state = GAME_OVER;
+        return 0;
+    }
+    s->state = s->cur->isQuestion ? GAME_ASKING : GAME_GUESSING;
+    return 1;
+}
+
+/* Record the session's edits on undo/redo instead of the global stacks
+ * (call right after engine_begin). */
+void engine_history(GameSession *s, EditStack *undo, EditStack *redo) {
+    s->undo = undo;
+    s->redo = redo;
+}
+
+/* Record this session to rec when it ends (call right after
+ * engine_begin). Returns 0 if out of memory. */
+int engine_record(GameSession *s, Recorder *rec) {
+    s->trailCap = 64;
+    s->trail = calloc((size_t)s->trailCap / 8, 1);
+    if (s->trail == NULL) return 0;
+    s->rec = rec;
+    return 1;
+}
+
+/* Write the recorded session (if any) and stop recording it. */
+static void record_finish(GameSession *s, const char *animal, const char *question, int answerYes) {
+    if (s->rec == NULL) return;
+    rec_write(s->rec, s->state, s->trail, s->steps, animal, question, answerYes);
+    free(s->trail);
+    s->trail = NULL;
+    s->rec = NULL;
+}
+
+/* Done with the session, however far it got. A session ended before
+ * winning or being taught is recorded as it stands. Sessions abandoned
+ * mid-game without this hold back the reclaiming of undone nodes. */
+void engine_end(GameSession *s) {
+    record_finish(s, NULL, NULL, 0);
+    session_leave(s);
+}
+
+/* The question to ask, or NULL when the session is not asking. */
+const char *engine_question(const GameSession *s) {
+    return s->state == GAME_ASKING ? s->cur->text : NULL;
+}
+
+/* Follow the player's answer to the current question. */
+GameState engine_answer(GameSession *s, int yes) {
+    if (s->state != GAME_ASKING) return s->state;
+    if (s->rec) {
+        if (s->steps == s->trailCap) {
+            uint8_t *nt = realloc(s->trail, (size_t)s->trailCap / 4);
+            if (nt == NULL) {
+                s->rec->failed = 1; // the recording could not be replayed
+                free(s->trail);
+                s->trail = NULL;
+                s->rec = NULL;
+            } else {
+                memset(nt + s->trailCap / 8, 0, (size_t)s->trailCap / 8);
+                s->trail = nt;
+                s->trailCap *= 2;
+            }
+        }
+        if (s->rec && yes) s->trail[s->steps >> 3] |= (uint8_t)(1 << (s->steps & 7));
+    }
+    s->parent = s->cur;
+    s->parentAnswer = yes ? 1 : 0;
+    s->cur = __atomic_load_n(yes ? &s->cur->yes : &s->cur->no, __ATOMIC_ACQUIRE);
+    s->steps++;
+    s->state = s->cur->isQuestion ? GAME_ASKING : GAME_GUESSING;
+    return s->state;
+}
+
+/* The animal to guess, or NULL when the session is not guessing. */
+const char *engine_guess(const GameSession *s) {
+    return s->state == GAME_GUESSING ? s->cur->text : NULL;
+}
+
+/* Whether the guess was right: the game is won, or the engine waits to
+ * be taught the animal. */
+GameState engine_confirm(GameSession *s, int correct) {
+    if (s->state != GAME_GUESSING) return s->state;
+    s->state = correct ? GAME_WON : GAME_LEARNING;
+    if (correct) {
+        record_finish(s, NULL, NULL, 0);
+        session_leave(s);
+    }
+    return s->state;
+}
+
+/* The child slot of parent that answer leads to (the root for NULL). */
+static Node **child_slot(Node *parent, int answerYes) {
+    if (parent == NULL) return &g_root;
+    return answerYes == 1 ? &parent->yes : &parent->no;
+}
+
+/* Whether n is still reached from the root by its parent links: an undo
+ * cuts a subtree off at one child pointer and leaves its links as they
+ * were (until the edit is dropped). Caller holds writeLock. */
+static int attached(const Node *n) {
+    for (; n->parent; n = n->parent) {
+        if (n->parent->yes != n && n->parent->no != n) return 0;
+    }
+    return n == g_root;
+}
+
+/* Replace *slot with node; sessions see either the old or the new node. */
+static void publish(Node **slot, Node *node) {
+    __atomic_store_n(slot, node, __ATOMIC_RELEASE);
+}
+
+/* Teach the animal the player had in mind: question tells it apart from
+ * the wrong guess, and answerYes is the animal's answer to it. The new
+ * question replaces the guessed leaf, the edit goes on the session's undo
+ * stack and every index is updated. Returns 1 on success (the session
+ * then ends), 0 if out of memory or not learning, -1 if another session
+ * undid the edit that put the guessed leaf there. */
+int engine_teach(GameSession *s, const char *animal, const char *question, int answerYes) {
+    if (s->state != GAME_LEARNING) return 0;
+    Node *cur = s->cur, *parent = s->parent;
+    Node *qNode = create_question_node(question);
+    Node *ansNode = create_animal_node(animal);
+    if (!qNode || !ansNode) {
+        if (qNode) free_tree(qNode);
+        if (ansNode) free_tree(ansNode);
+        return 0;
+    }
+
+    //link new nodes
+    if (answerYes) {
+        qNode->yes = ansNode;
+        qNode->no = cur;
+    } else {
+        qNode->yes = cur;
+        qNode->no = ansNode;
+    }
+
+    qNode->parent = parent; // keep parent links current
+    ansNode->parent = qNode;
+
+    pthread_mutex_lock(&writeLock);
+    reclaim_locked();
+    Node **slot = child_slot(parent, s->parentAnswer);
+    if (*slot != cur || (parent && !attached(parent))) {
+        pthread_mutex_unlock(&writeLock);
+        free_tree(ansNode);
+        free(qNode->text);
+        free(qNode);
+        return -1;
+    }
+    publish(slot, qNode); // update parent pointer
+    cur->parent = qNode;
+    if (parent) parent->refs++; // the edit below pins it
+
+    Edit e;
+    e.type = EDIT_INSERT_SPLIT;
+    e.parent = parent;
+    e.wasYesChild = (parent == NULL) ? -1 : (s->parentAnswer ? 1 : 0);
+    e.oldLeaf = cur;
+    e.newQuestion = qNode;
+    e.newLeaf = ansNode;
+
+    es_push(s->undo, e);
+    drop_redo_locked(s->redo);
+    index_on_learn(&e); // update g_index with the new question
+    sim_on_learn(&e);
+    names_on_learn(&e);
+    integrity_on_learn(&e);
+    path_on_learn(&e);
+    prog_invalidate();
+    search_invalidate();
+    pthread_mutex_unlock(&writeLock);
+
+    s->state = GAME_OVER;
+    record_finish(s, animal, question, answerYes);
+    session_leave(s);
+    return 1;
+}
+
+/* Undo the newest edit on the global stacks. Returns 1 if undone. */
+int undo_last_edit() {
+    return engine_undo(&g_undo, &g_redo) > 0;
+}
+
+/* Undo the newest edit on undo and move it to redo. Returns 1 if undone,
+ * 0 if there is nothing to undo, -1 if something has been taught below
+ * it since (it stays on undo). */
+int engine_undo(EditStack *undo, EditStack *redo) {
+    //  * 1. Check if the undo stack is empty, return 0 if so
+
+    if(es_empty(undo)){
+        return 0;
+    }
+
+    pthread_mutex_lock(&writeLock);
+    reclaim_locked();
+    Edit edit = undo->edits[undo->size - 1];
+    Node *q = edit.newQuestion;
+    Node **slot = child_slot(edit.parent, edit.wasYesChild);
+    int leaves = (q->yes == edit.oldLeaf && q->no == edit.newLeaf) ||
+                 (q->yes == edit.newLeaf && q->no == edit.oldLeaf);
+    if(*slot != q || !leaves || (edit.parent && !attached(edit.parent))){
+        pthread_mutex_unlock(&writeLock);
+        return -1;
+    }
+
+    //  * 2. Pop edit from the undo stack
+
+    es_pop(undo);
+    publish(slot, edit.oldLeaf);
+    edit.oldLeaf->parent = edit.parent;
+    index_on_undo(&edit);
+    sim_on_undo(&edit);
+    names_on_undo(&edit);
+    integrity_on_undo(&edit);
+    path_on_undo(&edit);
+    prog_invalidate();
+    search_invalidate();
+    pthread_mutex_unlock(&writeLock);
+    
+    es_push (redo, edit);
+
+    return 1;
+}
+
+/* Redo the newest undone edit on the global stacks. Returns 1 if redone. */
+int redo_last_edit() {
+    return engine_redo(&g_undo, &g_redo) > 0;
+}
+
+/* Redo the newest edit on redo and move it back to undo. Returns 1 if
+ * redone, 0 if there is nothing to redo, -1 if its leaf has been taught
+ * past or cut off since (it stays on redo). */
+int engine_redo(EditStack *undo, EditStack *redo) {
+    if(es_empty(redo) == 1){
+        return 0;
+    }
+
+    pthread_mutex_lock(&writeLock);
+    reclaim_locked();
+    Edit edit = redo->edits[redo->size - 1];
+    Node **slot = child_slot(edit.parent, edit.wasYesChild);
+    if(*slot != edit.oldLeaf || (edit.parent && !attached(edit.parent))){
+        pthread_mutex_unlock(&writeLock);
+        return -1;
+    }
+    es_pop(redo);
+    edit.oldLeaf->parent = edit.newQuestion;
+    publish(slot, edit.newQuestion);
+    index_on_redo(&edit);
+    sim_on_redo(&edit);
+    names_on_redo(&edit);
+    integrity_on_redo(&edit);
+    path_on_redo(&edit);
+    prog_invalidate();
+    search_invalidate();
+    pthread_mutex_unlock(&writeLock);
+    es_push(undo, edit);
+    return 1;
+}
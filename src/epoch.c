@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "lab5.h"
+
+/* ========== Epoch-Based Reclamation ==========
+ * Lets readers walk shared structures without locks while writers unlink
+ * and later free nodes. A reader brackets each access with ebr_enter and
+ * ebr_exit, which publish the global epoch it observed. Writers hand
+ * unlinked memory to ebr_retire instead of freeing it. The global epoch
+ * only advances once every active reader has observed the current one, so
+ * anything retired in epoch e is unreachable by readers once the global
+ * epoch reaches e + 2, and is freed then.
+ *
+ * Reader cost is one load and two stores (one of them seq_cst) per
+ * section; retiring takes a mutex, which writers hold only briefly.
+ */
+
+#define EBR_MAX_THREADS 256
+#define EBR_COLLECT_EVERY 64
+
+typedef struct {
+    /* (epoch << 1) | 1 while inside a read-side section, 0 otherwise */
+    uint64_t state;
+    int inUse;
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];  /* one slot per line */
+} EbrSlot;
+
+typedef struct {
+    void *ptr;
+    void (*freeFn)(void *);
+    uint64_t epoch;
+} EbrRetired;
+
+static uint64_t globalEpoch = 2;
+static EbrSlot slots[EBR_MAX_THREADS];
+static int slotHigh = 0;  /* slots [0, slotHigh) have ever been used */
+
+static pthread_mutex_t retireLock = PTHREAD_MUTEX_INITIALIZER;
+static EbrRetired *retired = NULL;
+static int retiredCount = 0;
+static int retiredCapacity = 0;
+static int retiresSinceCollect = 0;
+
+static __thread int mySlot = -1;
+static __thread int myDepth = 0;
+
+/* Claim a reader slot for the calling thread (done lazily by ebr_enter). */
+static int ebr_slot(void) {
+    if (mySlot >= 0) return mySlot;
+    for (int i = 0; i < EBR_MAX_THREADS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&slots[i].inUse, &expected, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            mySlot = i;
+            int high = __atomic_load_n(&slotHigh, __ATOMIC_RELAXED);
+            while (high < i + 1 &&
+                   !__atomic_compare_exchange_n(&slotHigh, &high, i + 1, 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            }
+            return i;
+        }
+    }
+    fprintf(stderr, "ebr: more than %d reader threads\n", EBR_MAX_THREADS);
+    abort();
+}
+
+/* Release the calling thread's slot; call before a reader thread exits. */
+void ebr_thread_exit(void) {
+    if (mySlot < 0) return;
+    __atomic_store_n(&slots[mySlot].state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&slots[mySlot].inUse, 0, __ATOMIC_RELEASE);
+    mySlot = -1;
+    myDepth = 0;
+}
+
+/* Start a read-side section. Sections nest; only the outermost counts. */
+void ebr_enter(void) {
+    if (myDepth++ > 0) return;
+    int s = ebr_slot();
+    uint64_t e = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    /* seq_cst so the announcement is visible before any shared load */
+    __atomic_store_n(&slots[s].state, (e << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+void ebr_exit(void) {
+    if (--myDepth > 0) return;
+    __atomic_store_n(&slots[mySlot].state, 0, __ATOMIC_RELEASE);
+}
+
+/* Advance the global epoch if every active reader has caught up with it. */
+static int ebr_try_advance(void) {
+    uint64_t e = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    int high = __atomic_load_n(&slotHigh, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < high; i++) {
+        uint64_t st = __atomic_load_n(&slots[i].state, __ATOMIC_SEQ_CST);
+        if ((st & 1) && (st >> 1) != e) return 0; // straggler
+    }
+    return __atomic_compare_exchange_n(&globalEpoch, &e, e + 1, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* Free every retired object that no reader can still see.
+ * Caller holds retireLock. */
+static void ebr_collect_locked(void) {
+    ebr_try_advance();
+    uint64_t e = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    int kept = 0;
+    for (int i = 0; i < retiredCount; i++) {
+        if (retired[i].epoch + 2 <= e) {
+            retired[i].freeFn(retired[i].ptr);
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retiredCount = kept;
+    retiresSinceCollect = 0;
+}
+
+/* Defer freeFn(ptr) until no reader can hold a reference to ptr. The
+ * object must already be unreachable from the shared structure. */
+void ebr_retire(void *ptr, void (*freeFn)(void *)) {
+    if (ptr == NULL) return;
+    pthread_mutex_lock(&retireLock);
+    if (retiredCount >= retiredCapacity) {
+        int newCap = retiredCapacity ? retiredCapacity * 2 : 64;
+        EbrRetired *nr = realloc(retired, (size_t)newCap * sizeof(EbrRetired));
+        if (nr == NULL) { // cannot defer: wait out the readers instead
+            pthread_mutex_unlock(&retireLock);
+            if (myDepth > 0) return; // we are one of them; leaked rather than spin forever
+            ebr_synchronize();
+            freeFn(ptr);
+            return;
+        }
+        retired = nr;
+        retiredCapacity = newCap;
+    }
+    retired[retiredCount].ptr = ptr;
+    retired[retiredCount].freeFn = freeFn;
+    retired[retiredCount].epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    retiredCount++;
+    if (++retiresSinceCollect >= EBR_COLLECT_EVERY) ebr_collect_locked();
+    pthread_mutex_unlock(&retireLock);
+}
+
+/* Opportunistically free whatever has become safe. */
+void ebr_collect(void) {
+    pthread_mutex_lock(&retireLock);
+    ebr_collect_locked();
+    pthread_mutex_unlock(&retireLock);
+}
+
+/* Block until every object retired before the call has been freed. Two
+ * epoch advances guarantee that every reader that could have seen one has
+ * left, so writers retiring meanwhile cannot hold this up. Must not be
+ * called from inside a read-side section. */
+void ebr_synchronize(void) {
+    uint64_t target = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE) + 2;
+    for (;;) {
+        pthread_mutex_lock(&retireLock);
+        ebr_collect_locked(); // frees epoch + 2 <= target once we get there
+        int done = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE) >= target;
+        pthread_mutex_unlock(&retireLock);
+        if (done) return;
+        sched_yield();
+    }
+}
+
+/* Number of objects waiting for a grace period (for tests and stats). */
+int ebr_pending(void) {
+    pthread_mutex_lock(&retireLock);
+    int n = retiredCount;
+    pthread_mutex_unlock(&retireLock);
+    return n;
+}
@@ -4,298 +4,179 @@
 #include <ncurses.h>
 #include "lab5.h"
 
-extern Node *g_root;
-extern EditStack g_undo;
-extern EditStack g_redo;
-extern Hash g_index;
 char *strdup(const char *s);
 
+/* Minimum similarity for offering an existing question during learning. */
+#define SIM_SUGGEST_SCORE 0.5
+
+static Recorder *recorder = NULL;  /* where games are recorded, if anywhere */
+
+void play_set_recorder(Recorder *rec) {
+    recorder = rec;
+}
+
 
 /* TODO 31: Implement play_game
- * Main game loop using iterative traversal with a stack
+ * Main game loop: the ncurses frontend of the game engine (engine.c)
  * 
  * Key requirements:
- * - Use FrameStack (NO recursion!)
- * - Push frames for each decision point
- * - Track parent and answer for learning
+ * - The engine walks the tree (NO recursion!); this only does the I/O
+ * - The session tracks parent and answer for learning
  * 
  * Steps:
  * 1. Initialize and display game UI
- * 2. Initialize FrameStack
- * 3. Push root frame with answeredYes = -1
- * 4. Set parent = NULL, parentAnswer = -1
- * 5. While stack not empty:
- *    a. Pop current frame
- *    b. If current node is a question:
- *       - Display question and get user's answer (y/n)
- *       - Set parent = current node
- *       - Set parentAnswer = answer
- *       - Push appropriate child (yes or no) onto stack
- *    c. If current node is a leaf (animal):
- *       - Ask "Is it a [animal]?"
- *       - If correct: celebrate and break
- *       - If wrong: LEARNING PHASE
- *         i. Get correct animal name from user
- *         ii. Get distinguishing question
- *         iii. Get answer for new animal (y/n for the question)
- *         iv. Create new question node and new animal node
- *         v. Link them: if newAnswer is yes, newQuestion->yes = newAnimal
- *         vi. Update parent pointer (or g_root if parent is NULL)
- *         vii. Create Edit record and push to g_undo
- *         viii. Clear g_redo stack
- *         ix. Update g_index with canonicalized question
- * 6. Free stack
+ * 2. Begin a session at the root
+ * 3. While the engine is asking:
+ *    - Display question and get user's answer (y/n)
+ *    - Pass the answer to the engine
+ * 4. Ask "Is it a [animal]?" with the engine's guess
+ *    - If correct: celebrate and return
+ *    - If wrong: LEARNING PHASE
+ *      i. Get correct animal name from user
+ *      ii. Get distinguishing question
+ *      iii. Get answer for new animal (y/n for the question)
+ *      iv. Let the engine teach it (nodes, undo record, indexes)
  */
-void play_game() {
-    clear();
-    attron(COLOR_PAIR(5) | A_BOLD);
-    mvprintw(0, 0, "%-80s", " Playing 20 Questions");
-    attroff(COLOR_PAIR(5) | A_BOLD);
-
-    mvprintw(2, 2, "Think of an animal, and I'll try to guess it!");
-    mvprintw(3, 2, "Press any key to start...");
-    refresh();
-    getch();
 
-    Node *parent = NULL; // track parent node for learning phase
-    int parentAnswer = -1; // record whether last answer was yes/no
-
-
-    // Initialize stack
-    FrameStack stack;
-    fs_init(&stack);
-    fs_push(&stack, g_root, -1);
-
-    // flag to exit game
-    int done = 0;
-
-    // begin traversal
-    while (!fs_empty(&stack) && !done) {
-        Frame currentFrame = fs_pop(&stack);
-        Node *cur = currentFrame.node;
-
-        if (!cur) break;
-
-        // Question node
-        if (cur->isQuestion) {
-            char prompt[256];
-            snprintf(prompt, sizeof(prompt), "%s (y/n): ", cur->text);
-            int answer = get_yes_no(6, 2, prompt);
-
-            // track parent and which branch selected
-            parent = cur;
-
-            if(answer){
-                parentAnswer = 1;
-            }else{
-                parentAnswer = 0;
-            }
-
-            // Push next node (yes/no) branch onto the stack
-            Node *next = (answer == 1) ? cur->yes : cur->no;
-            fs_push(&stack, next, answer);
-
-            mvprintw(6, 2, "%-76s", ""); // clear input line
-            refresh();
-        } 
-
-         // Leaf node (animal)
-
-        else{
-        char prompt[256];
-        snprintf(prompt, sizeof(prompt), "Is it a %s? (y/n): ", cur->text);
-        int correct = get_yes_no(6, 2, prompt);
-        mvprintw(6, 2, "%-76s", ""); 
-
-        // If guess is correct
-        if (correct) {
-            attron(COLOR_PAIR(3) | A_BOLD);
-            mvprintw(8, 2, "Yay! I guessed it!");
-            attroff(COLOR_PAIR(3) | A_BOLD);
-            mvprintw(10, 2, "Press any key to return...");
-            refresh();
-            getch();
-            done = 1;
-        } 
-
-        // LEARNING PHASE (Wrong Guess)        
-        else {
-            //ask for correct animal name
-        char *newAnimal_in = get_input(8, 2, "What animal were you thinking of? ");
-        if (!newAnimal_in || newAnimal_in[0] == '\0') {
-            mvprintw(10, 2, "No animal provided. Press any key to return...");
-            refresh();
-            getch();
-            break;
-        }
-
-        
-        char *newAnimalCopy = strdup(newAnimal_in);
-        if (!newAnimalCopy) {
-            mvprintw(12, 2, "No animal provided. Press any key to return...");
-            refresh();
-            getch();
-            break;
-        }
+/* The learning phase after a wrong guess; row is the first free line. */
+static void learn_animal(GameSession *s, int row) {
+    //ask for correct animal name
+    char *newAnimal_in = get_input(row, 2, "What animal were you thinking of? ");
+    if (!newAnimal_in || newAnimal_in[0] == '\0') {
+        mvprintw(row + 2, 2, "No animal provided. Press any key to return...");
+        refresh();
+        getch();
+        return;
+    }
 
-        // ask for a question to distinguish your animal from current animal list
-        char *prompt_q = get_input(9, 2, "Provide a (yes/no) question to distinguish it: ");
-        if (!prompt_q || prompt_q[0] == '\0') {
-            free(newAnimalCopy);
-            mvprintw(11, 2, "No question provided. Press any key to return...");
-            refresh();
-            getch();
-            break;
-        }
-        
-        char *prompt_qCopy = strdup(prompt_q);
-        if (!prompt_qCopy) {
+    char *newAnimalCopy = strdup(newAnimal_in);
+    if (!newAnimalCopy) {
+        mvprintw(row + 4, 2, "No animal provided. Press any key to return...");
+        refresh();
+        getch();
+        return;
+    }
+    row++;
+
+    // the same animal taught twice makes two leaves that can never
+    // both be guessed; check before asking for a question
+    Node *known = names_find(newAnimalCopy);
+    if (known) {
+        mvprintw(row++, 2, "I already know a %.40s; that leaf is %s.", known->text,
+                 known == s->cur ? "the one I just guessed" : "elsewhere in the tree");
+        if (!get_yes_no(row++, 2, "Teach it again anyway? (y/n): ")) {
             free(newAnimalCopy);
-            mvprintw(12, 2, "No question provided. Press any key to return...");
+            mvprintw(row + 1, 2, "Nothing learned. Press any key to return...");
             refresh();
             getch();
-            break;
+            return;
         }
-        
-        // ask what the correct ans is for the new animal
-        int answeredYes = get_yes_no(10, 2, "For your animal, what is the answer? (y/n): ");
-
-        // create new node for question and animal
-        Node *qNode = create_question_node(prompt_qCopy);
-        Node *ansNode = create_animal_node(newAnimalCopy);
+    }
 
-        free (prompt_qCopy); // free copy
-        free (newAnimalCopy); // free copy
+    // ask for a question to distinguish your animal from current animal list
+    char *prompt_q = get_input(row, 2, "Provide a (yes/no) question to distinguish it: ");
+    if (!prompt_q || prompt_q[0] == '\0') {
+        free(newAnimalCopy);
+        mvprintw(row + 2, 2, "No question provided. Press any key to return...");
+        refresh();
+        getch();
+        return;
+    }
 
-        if (!qNode || !ansNode) {
-            mvprintw(10, 2, "Error creating nodes. Press any key to return...");
-            refresh();
-            getch();
-            if (qNode) free_tree(qNode);
-            if (ansNode) free_tree(ansNode);
-            break;
-        }
+    char *prompt_qCopy = strdup(prompt_q);
+    if (!prompt_qCopy) {
+        free(newAnimalCopy);
+        mvprintw(row + 3, 2, "No question provided. Press any key to return...");
+        refresh();
+        getch();
+        return;
+    }
 
-        //link new nodes
-        if (answeredYes) {
-            qNode->yes = ansNode;
-            qNode->no = cur;
-        } else {
-            qNode->yes = cur;
-            qNode->no = ansNode;
+    // offer to reuse a near-identical question already in the tree
+    row++;
+    SimMatch matches[3];
+    int nMatches = sim_find(prompt_qCopy, SIM_SUGGEST_SCORE, matches, 3);
+    if (nMatches > 0) {
+        mvprintw(row++, 2, "Similar questions I already ask:");
+        for (int i = 0; i < nMatches; i++) {
+            mvprintw(row++, 4, "%d) %.60s", i + 1, matches[i].text);
         }
-
-        if (!parent) { // update parent pointer 
-            g_root = qNode;
-        } else if (parentAnswer == 1) {
-            parent->yes = qNode;
-        } else {
-            parent->no = qNode;
+        char *pick = get_input(row++, 2, "Reuse one? (number, or Enter to keep yours): ");
+        int k = pick ? atoi(pick) : 0;
+        if (k >= 1 && k <= nMatches) {
+            char *reused = strdup(matches[k - 1].text);
+            if (reused) {
+                free(prompt_qCopy);
+                prompt_qCopy = reused;
+            }
         }
+        row++;
+    }
 
-        Edit e;
-        e.type = EDIT_INSERT_SPLIT;
-        e.parent = parent;
-        e.wasYesChild = (parent == NULL) ? -1 : (parentAnswer ? 1 : 0);       
-        e.oldLeaf = cur;
-        e.newQuestion = qNode;
-        e.newLeaf = ansNode;
+    // ask what the correct ans is for the new animal
+    int answeredYes = get_yes_no(row, 2, "For your animal, what is the answer? (y/n): ");
 
-        es_push(&g_undo, e);
-        es_clear(&g_redo);
+    int learned = engine_teach(s, newAnimalCopy, prompt_qCopy, answeredYes);
+    free(prompt_qCopy); // free copy
+    free(newAnimalCopy); // free copy
 
-        attron(COLOR_PAIR(3) | A_BOLD);
-        mvprintw(12, 2, "Thanks! I'll remember that.");
-        attroff(COLOR_PAIR(3) | A_BOLD);
-        mvprintw(14, 2, "Press any key to return...");
+    if (learned <= 0) {
+        mvprintw(row + 2, 2, "Error creating nodes. Press any key to return...");
         refresh();
         getch();
+        return;
     }
-}
-    }
-
 
-    fs_free(&stack); // free mem
+    attron(COLOR_PAIR(3) | A_BOLD);
+    mvprintw(row + 2, 2, "Thanks! I'll remember that.");
+    attroff(COLOR_PAIR(3) | A_BOLD);
+    mvprintw(row + 4, 2, "Press any key to return...");
+    refresh();
+    getch();
 }
-/* TODO 32: Implement undo_last_edit
- * Undo the most recent tree modification
- * 
- * Steps:
- * 1. Check if g_undo stack is empty, return 0 if so
- * 2. Pop edit from g_undo
- * 3. Restore the tree structure:
- *    - If edit.parent is NULL:
- *      - Set g_root = edit.oldLeaf
- *    - Else if edit.wasYesChild:
- *      - Set edit.parent->yes = edit.oldLeaf
- *    - Else:
- *      - Set edit.parent->no = edit.oldLeaf
- * 4. Push edit to g_redo stack
- * 5. Return 1
- * 
- * Note: We don't free newQuestion/newLeaf because they might be redone
- */
-int undo_last_edit() {
-    // TODO: Implement this function
 
-    //  * 1. Check if g_undo stack is empty, return 0 if so
+void play_game() {
+    erase();
+    attron(COLOR_PAIR(5) | A_BOLD);
+    mvprintw(0, 0, "%-80s", " Playing 20 Questions");
+    attroff(COLOR_PAIR(5) | A_BOLD);
 
-    if(es_empty(&g_undo)){
-        return 0;
-    }
+    mvprintw(2, 2, "Think of an animal, and I'll try to guess it!");
+    mvprintw(3, 2, "Press any key to start...");
+    refresh();
+    getch();
 
-    //  * 2. Pop edit from g_undo
+    GameSession session;
+    if (!engine_begin(&session)) return;
+    if (recorder) engine_record(&session, recorder);
 
-    Edit edit = es_pop(&g_undo);
+    char prompt[256];
+    while (session.state == GAME_ASKING) {
+        snprintf(prompt, sizeof(prompt), "%s (y/n): ", engine_question(&session));
+        int answer = get_yes_no(6, 2, prompt);
+        engine_answer(&session, answer);
 
-    if(edit.parent == NULL){
-        g_root = edit.oldLeaf;
-    }
-    else if(edit.wasYesChild == 1){
-        edit.parent->yes = edit.oldLeaf;
-    }
-    else{
-        edit.parent->no = edit.oldLeaf;
+        mvprintw(6, 2, "%-76s", ""); // clear input line
+        refresh();
     }
-    
-    es_push (&g_redo, edit);
 
-    return 1;
-}
+    // Leaf node (animal)
+    snprintf(prompt, sizeof(prompt), "Is it a %s? (y/n): ", engine_guess(&session));
+    int correct = get_yes_no(6, 2, prompt);
+    mvprintw(6, 2, "%-76s", "");
 
-/* TODO 33: Implement redo_last_edit
- * Redo a previously undone edit
- * 
- * Steps:
- * 1. Check if g_redo stack is empty, return 0 if so
- * 2. Pop edit from g_redo
- * 3. Reapply the tree modification:
- *    - If edit.parent is NULL:
- *      - Set g_root = edit.newQuestion
- *    - Else if edit.wasYesChild:
- *      - Set edit.parent->yes = edit.newQuestion
- *    - Else:
- *      - Set edit.parent->no = edit.newQuestion
- * 4. Push edit back to g_undo stack
- * 5. Return 1
- */
-int redo_last_edit() {
-    // TODO: Implement this function
-    if(es_empty(&g_redo) == 1){
-        return 0;
+    // If guess is correct
+    if (engine_confirm(&session, correct) == GAME_WON) {
+        attron(COLOR_PAIR(3) | A_BOLD);
+        mvprintw(8, 2, "Yay! I guessed it!");
+        attroff(COLOR_PAIR(3) | A_BOLD);
+        mvprintw(10, 2, "Press any key to return...");
+        refresh();
+        getch();
+        return;
     }
 
-    Edit edit = es_pop(&g_redo);
-
-    if(edit.parent == NULL){
-        g_root = edit.newQuestion;
-    }
-    else if(edit.wasYesChild==1){
-        edit.parent->yes = edit.newQuestion;
-    }
-    else{
-        edit.parent->no = edit.newQuestion;
-    }
-    es_push(&g_undo, edit);
-    return 1;
+    // LEARNING PHASE (Wrong Guess)
+    learn_animal(&session, 8);
+    engine_end(&session); // records a game that ended without teaching
 }
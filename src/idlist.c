@@ -0,0 +1,847 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lab5.h"
+
+/* ========== Posting Lists ==========
+ * Roaring-style compressed id sets. An id is split into a 16-bit container
+ * key (high half) and a 16-bit value (low half). Containers are kept sorted
+ * by key, so locating the container for an id is a binary search, and the
+ * value is then found by binary search (array, run) or a bit test (bitmap):
+ * membership is O(log n) overall.
+ *
+ * Container choice:
+ * - array:  sorted uint16 values, used while card <= IDC_ARRAY_MAX
+ * - bitmap: 1024 x 64-bit words, used for dense containers
+ * - run:    (start, length - 1) pairs, produced by idl_add_range and
+ *           idl_optimize when runs are the smallest encoding
+ */
+
+#define IDC_ARRAY_MAX 4096
+#define IDC_BITMAP_WORDS 1024
+
+enum { OP_AND, OP_OR, OP_ANDNOT };
+
+/* ---------- Bitmap kernels ----------
+ * Word-wise AND/OR/ANDNOT of two full bitmaps plus a population count of
+ * the result. The AVX2 kernel does 256 bits per instruction; it is chosen
+ * once at runtime like the canonicalize kernels.
+ */
+static int bits_op_scalar(const uint64_t *a, const uint64_t *b, uint64_t *out, int op) {
+    int card = 0;
+    for (int i = 0; i < IDC_BITMAP_WORDS; i++) {
+        uint64_t w = op == OP_AND ? (a[i] & b[i]) : op == OP_OR ? (a[i] | b[i]) : (a[i] & ~b[i]);
+        out[i] = w;
+        card += __builtin_popcountll(w);
+    }
+    return card;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IDL_HAVE_X86 1
+
+__attribute__((target("avx2,popcnt")))
+static int bits_op_avx2(const uint64_t *a, const uint64_t *b, uint64_t *out, int op) {
+    for (int i = 0; i < IDC_BITMAP_WORDS; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i r = op == OP_AND ? _mm256_and_si256(va, vb)
+                  : op == OP_OR  ? _mm256_or_si256(va, vb)
+                  : _mm256_andnot_si256(vb, va);
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    long long card = 0;
+    for (int i = 0; i < IDC_BITMAP_WORDS; i++) {
+        card += _mm_popcnt_u64(out[i]);
+    }
+    return (int)card;
+}
+#endif
+
+static int bits_op(const uint64_t *a, const uint64_t *b, uint64_t *out, int op) {
+#ifdef IDL_HAVE_X86
+    static int useAvx2 = -1;
+    if (useAvx2 < 0) {
+        __builtin_cpu_init();
+        useAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (useAvx2) return bits_op_avx2(a, b, out, op);
+#endif
+    return bits_op_scalar(a, b, out, op);
+}
+
+/* ---------- Small helpers ---------- */
+
+/* Binary search a sorted uint16 array: index if found, else -(pos + 1). */
+static int arr_search(const uint16_t *v, int n, uint16_t x) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (v[mid] < x) lo = mid + 1;
+        else if (v[mid] > x) hi = mid - 1;
+        else return mid;
+    }
+    return -(lo + 1);
+}
+
+/* Index of the last run starting at or before x, or -1. */
+static int run_search(const uint16_t *runs, int n, uint16_t x) {
+    int lo = 0, hi = n - 1, best = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (runs[2 * mid] <= x) {
+            best = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return best;
+}
+
+static int ensure_vals(IdContainer *c, int need) {
+    if (need <= c->cap) return 1;
+    int newCap = c->cap ? c->cap * 2 : 4;
+    while (newCap < need) newCap *= 2;
+    /* runs use two slots per entry */
+    size_t slots = (size_t)newCap * (c->type == IDC_RUN ? 2 : 1);
+    uint16_t *nv = realloc(c->vals, slots * sizeof(uint16_t));
+    if (nv == NULL) return 0;
+    c->vals = nv;
+    c->cap = newCap;
+    return 1;
+}
+
+static void cont_release(IdContainer *c) {
+    free(c->vals);
+    free(c->bits);
+    c->vals = NULL;
+    c->bits = NULL;
+    c->n = c->cap = c->card = 0;
+}
+
+static int cont_contains(const IdContainer *c, uint16_t x) {
+    switch (c->type) {
+        case IDC_ARRAY:
+            return arr_search(c->vals, c->n, x) >= 0;
+        case IDC_BITMAP:
+            return (c->bits[x >> 6] >> (x & 63)) & 1;
+        default: {
+            int r = run_search(c->vals, c->n, x);
+            return r >= 0 && x <= c->vals[2 * r] + c->vals[2 * r + 1];
+        }
+    }
+}
+
+/* Expand any container into a full bitmap. */
+static void cont_fill_bits(const IdContainer *c, uint64_t *bits) {
+    if (c->type == IDC_BITMAP) {
+        memcpy(bits, c->bits, IDC_BITMAP_WORDS * sizeof(uint64_t));
+        return;
+    }
+    memset(bits, 0, IDC_BITMAP_WORDS * sizeof(uint64_t));
+    if (c->type == IDC_ARRAY) {
+        for (int i = 0; i < c->n; i++) {
+            bits[c->vals[i] >> 6] |= 1ull << (c->vals[i] & 63);
+        }
+        return;
+    }
+    for (int r = 0; r < c->n; r++) {
+        uint32_t start = c->vals[2 * r], end = start + c->vals[2 * r + 1];
+        for (uint32_t x = start; x <= end; x++) {
+            bits[x >> 6] |= 1ull << (x & 63);
+        }
+    }
+}
+
+static int to_bitmap(IdContainer *c) {
+    if (c->type == IDC_BITMAP) return 1;
+    uint64_t *bits = malloc(IDC_BITMAP_WORDS * sizeof(uint64_t));
+    if (bits == NULL) return 0;
+    cont_fill_bits(c, bits);
+    int card = c->card;
+    cont_release(c);
+    c->type = IDC_BITMAP;
+    c->bits = bits;
+    c->card = card;
+    return 1;
+}
+
+static int to_array(IdContainer *c) {
+    if (c->type == IDC_ARRAY) return 1;
+    uint16_t *vals = malloc((size_t)(c->card ? c->card : 1) * sizeof(uint16_t));
+    if (vals == NULL) return 0;
+    int n = 0;
+    if (c->type == IDC_BITMAP) {
+        for (int w = 0; w < IDC_BITMAP_WORDS; w++) {
+            uint64_t word = c->bits[w];
+            while (word) {
+                vals[n++] = (uint16_t)(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    } else {
+        for (int r = 0; r < c->n; r++) {
+            uint32_t start = c->vals[2 * r], end = start + c->vals[2 * r + 1];
+            for (uint32_t x = start; x <= end; x++) vals[n++] = (uint16_t)x;
+        }
+    }
+    cont_release(c);
+    c->type = IDC_ARRAY;
+    c->vals = vals;
+    c->n = c->cap = c->card = n;
+    return 1;
+}
+
+/* Leave run encoding before a point mutation. */
+static int from_run(IdContainer *c) {
+    if (c->type != IDC_RUN) return 1;
+    return c->card < IDC_ARRAY_MAX ? to_array(c) : to_bitmap(c);
+}
+
+static int count_runs(const IdContainer *c) {
+    int runs = 0;
+    if (c->type == IDC_RUN) return c->n;
+    if (c->type == IDC_ARRAY) {
+        for (int i = 0; i < c->n; i++) {
+            if (i == 0 || c->vals[i] != c->vals[i - 1] + 1) runs++;
+        }
+        return runs;
+    }
+    for (int w = 0; w < IDC_BITMAP_WORDS; w++) {
+        uint64_t word = c->bits[w];
+        uint64_t prevTop = w ? (c->bits[w - 1] >> 63) : 0;
+        /* a run starts at every set bit whose predecessor is clear */
+        runs += __builtin_popcountll(word & ~((word << 1) | prevTop));
+    }
+    return runs;
+}
+
+/* Append x (ascending) to the run list being built in runs. */
+static void run_push(uint16_t *runs, int *n, int32_t *start, int32_t *prev, int32_t x) {
+    if (x != *prev + 1) {
+        if (*start >= 0) {
+            runs[2 * *n] = (uint16_t)*start;
+            runs[2 * *n + 1] = (uint16_t)(*prev - *start);
+            (*n)++;
+        }
+        *start = x;
+    }
+    *prev = x;
+}
+
+static int to_run(IdContainer *c, int nruns) {
+    uint16_t *runs = malloc((size_t)(nruns ? nruns : 1) * 2 * sizeof(uint16_t));
+    if (runs == NULL) return 0;
+    int n = 0;
+    int32_t start = -1, prev = -2;
+
+    if (c->type == IDC_ARRAY) {
+        for (int i = 0; i < c->n; i++) run_push(runs, &n, &start, &prev, c->vals[i]);
+    } else {
+        for (int w = 0; w < IDC_BITMAP_WORDS; w++) {
+            uint64_t word = c->bits[w];
+            while (word) {
+                run_push(runs, &n, &start, &prev, w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+    run_push(runs, &n, &start, &prev, -1); // flush the last run
+
+    int card = c->card;
+    cont_release(c);
+    c->type = IDC_RUN;
+    c->vals = runs;
+    c->n = c->cap = n;
+    c->card = card;
+    return 1;
+}
+
+/* ---------- Container point updates ---------- */
+
+static int cont_add(IdContainer *c, uint16_t x) {
+    if (c->type == IDC_RUN) {
+        int r = run_search(c->vals, c->n, x);
+        if (r >= 0 && x <= c->vals[2 * r] + c->vals[2 * r + 1]) return 0;
+        /* cheap cases: x extends run r or the next run by one */
+        if (r >= 0 && x == c->vals[2 * r] + c->vals[2 * r + 1] + 1 &&
+            (r + 1 >= c->n || c->vals[2 * (r + 1)] > x + 1)) {
+            c->vals[2 * r + 1]++;
+            c->card++;
+            return 1;
+        }
+        if (r + 1 < c->n && c->vals[2 * (r + 1)] == x + 1 &&
+            (r < 0 || c->vals[2 * r] + c->vals[2 * r + 1] + 1 < x)) {
+            c->vals[2 * (r + 1)]--;
+            c->vals[2 * (r + 1) + 1]++;
+            c->card++;
+            return 1;
+        }
+        if (!from_run(c)) return 0;
+    }
+
+    if (c->type == IDC_BITMAP) {
+        uint64_t bit = 1ull << (x & 63);
+        if (c->bits[x >> 6] & bit) return 0;
+        c->bits[x >> 6] |= bit;
+        c->card++;
+        return 1;
+    }
+
+    int pos = arr_search(c->vals, c->n, x);
+    if (pos >= 0) return 0;
+    pos = -(pos + 1);
+    if (c->n >= IDC_ARRAY_MAX) { // too dense for an array
+        if (!to_bitmap(c)) return 0;
+        return cont_add(c, x);
+    }
+    if (!ensure_vals(c, c->n + 1)) return 0;
+    memmove(c->vals + pos + 1, c->vals + pos, (size_t)(c->n - pos) * sizeof(uint16_t));
+    c->vals[pos] = x;
+    c->n++;
+    c->card++;
+    return 1;
+}
+
+static int cont_remove(IdContainer *c, uint16_t x) {
+    if (!cont_contains(c, x)) return 0;
+    if (!from_run(c)) return 0;
+
+    if (c->type == IDC_BITMAP) {
+        c->bits[x >> 6] &= ~(1ull << (x & 63));
+        c->card--;
+        if (c->card <= IDC_ARRAY_MAX) to_array(c);
+        return 1;
+    }
+    int pos = arr_search(c->vals, c->n, x);
+    memmove(c->vals + pos, c->vals + pos + 1, (size_t)(c->n - pos - 1) * sizeof(uint16_t));
+    c->n--;
+    c->card--;
+    return 1;
+}
+
+/* Add every value in [s, e] to c in its current encoding: runs merge with
+ * the runs they touch, an array takes the values in place while it stays
+ * within IDC_ARRAY_MAX, and a bitmap sets whole words and counts only the
+ * new bits. Returns how many values were added, or -1 if out of memory. */
+static int cont_add_range(IdContainer *c, uint16_t s, uint16_t e) {
+    uint32_t span = (uint32_t)e - s + 1;
+    if (c->type == IDC_RUN) {
+        /* runs [i, j] overlap or adjoin [s, e] and become one */
+        int i = run_search(c->vals, c->n, s);
+        if (i < 0 || (uint32_t)c->vals[2 * i] + c->vals[2 * i + 1] + 1 < s) i++;
+        int j = i - 1;
+        while (j + 1 < c->n && c->vals[2 * (j + 1)] <= (uint32_t)e + 1) j++;
+        uint32_t start = s, end = e, covered = 0;
+        for (int r = i; r <= j; r++) {
+            uint32_t rs = c->vals[2 * r], re = rs + c->vals[2 * r + 1];
+            if (rs < start) start = rs;
+            if (re > end) end = re;
+            covered += re - rs + 1;
+        }
+        if (j < i) { // touches nothing: a new run at i
+            if (!ensure_vals(c, c->n + 1)) return -1;
+            memmove(c->vals + 2 * (i + 1), c->vals + 2 * i, (size_t)(c->n - i) * 2 * sizeof(uint16_t));
+            c->n++;
+            j = i;
+        } else if (j > i) {
+            memmove(c->vals + 2 * (i + 1), c->vals + 2 * (j + 1), (size_t)(c->n - j - 1) * 2 * sizeof(uint16_t));
+            c->n -= j - i;
+        }
+        c->vals[2 * i] = (uint16_t)start;
+        c->vals[2 * i + 1] = (uint16_t)(end - start);
+        int added = (int)(end - start + 1 - covered);
+        c->card += added;
+        /* past this many runs a bitmap (or array) is smaller */
+        if (c->n > IDC_BITMAP_WORDS * 2 && !from_run(c)) return -1;
+        return added;
+    }
+
+    if (c->type == IDC_ARRAY) {
+        int lo = arr_search(c->vals, c->n, s), hi = arr_search(c->vals, c->n, e);
+        lo = lo >= 0 ? lo : -(lo + 1);
+        hi = hi >= 0 ? hi + 1 : -(hi + 1);  /* [lo, hi) already in range */
+        int added = (int)span - (hi - lo);
+        if (c->card + added <= IDC_ARRAY_MAX) {
+            if (!ensure_vals(c, c->n + added)) return -1;
+            memmove(c->vals + lo + span, c->vals + hi, (size_t)(c->n - hi) * sizeof(uint16_t));
+            for (uint32_t k = 0; k < span; k++) c->vals[lo + k] = (uint16_t)(s + k);
+            c->n += added;
+            c->card += added;
+            return added;
+        }
+        if (!to_bitmap(c)) return -1;
+    }
+
+    int wa = s >> 6, wb = e >> 6, before = 0, after = 0;
+    for (int w = wa; w <= wb; w++) {
+        uint64_t mask = ~0ull;
+        if (w == wa) mask &= ~0ull << (s & 63);
+        if (w == wb) mask &= ~0ull >> (63 - (e & 63));
+        before += __builtin_popcountll(c->bits[w]);
+        c->bits[w] |= mask;
+        after += __builtin_popcountll(c->bits[w]);
+    }
+    c->card += after - before;
+    return after - before;
+}
+
+/* ---------- List-level operations ---------- */
+
+static void invalidate(IdList *l) {
+    free(l->ids);
+    l->ids = NULL;
+}
+
+/* Container index for key, or -(insert position + 1). */
+static int cont_find(const IdList *l, uint16_t key) {
+    int lo = 0, hi = l->nconts - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (l->conts[mid].key < key) lo = mid + 1;
+        else if (l->conts[mid].key > key) hi = mid - 1;
+        else return mid;
+    }
+    return -(lo + 1);
+}
+
+static IdContainer *cont_insert_at(IdList *l, int pos, uint16_t key) {
+    if (l->nconts >= l->capacity) {
+        int newCap = l->capacity ? l->capacity * 2 : 4;
+        IdContainer *nc = realloc(l->conts, (size_t)newCap * sizeof(IdContainer));
+        if (nc == NULL) return NULL;
+        l->conts = nc;
+        l->capacity = newCap;
+    }
+    memmove(l->conts + pos + 1, l->conts + pos, (size_t)(l->nconts - pos) * sizeof(IdContainer));
+    l->nconts++;
+    IdContainer *c = &l->conts[pos];
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    c->type = IDC_ARRAY;
+    return c;
+}
+
+static void cont_drop(IdList *l, int pos) {
+    cont_release(&l->conts[pos]);
+    memmove(l->conts + pos, l->conts + pos + 1, (size_t)(l->nconts - pos - 1) * sizeof(IdContainer));
+    l->nconts--;
+}
+
+void idl_init(IdList *l) {
+    l->conts = NULL;
+    l->nconts = 0;
+    l->capacity = 0;
+    l->count = 0;
+    l->ids = NULL;
+}
+
+void idl_free(IdList *l) {
+    for (int i = 0; i < l->nconts; i++) cont_release(&l->conts[i]);
+    free(l->conts);
+    free(l->ids);
+    idl_init(l);
+}
+
+/* Add id; returns 1 if it was not already present. */
+int idl_add(IdList *l, int id) {
+    if (id < 0) return 0;
+    uint16_t key = (uint16_t)((uint32_t)id >> 16);
+    int pos = cont_find(l, key);
+    IdContainer *c;
+    if (pos >= 0) {
+        c = &l->conts[pos];
+    } else {
+        c = cont_insert_at(l, -(pos + 1), key);
+        if (c == NULL) return 0;
+    }
+    if (!cont_add(c, (uint16_t)id)) {
+        if (c->card == 0) cont_drop(l, (int)(c - l->conts));
+        return 0;
+    }
+    l->count++;
+    invalidate(l);
+    return 1;
+}
+
+/* Add every id in [lo, hi); returns the number of ids added. Containers
+ * that do not exist yet are created as single runs; existing ones take
+ * the range in their own encoding (see cont_add_range). */
+int idl_add_range(IdList *l, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi <= lo) return 0;
+    int added = 0;
+    uint32_t x = (uint32_t)lo;
+    while (x < (uint32_t)hi) {
+        uint16_t key = (uint16_t)(x >> 16);
+        uint32_t last = ((uint32_t)key << 16) | 0xFFFFu;
+        if (last > (uint32_t)hi - 1) last = (uint32_t)hi - 1;
+        uint16_t s = (uint16_t)x, e = (uint16_t)last;
+
+        int pos = cont_find(l, key);
+        if (pos < 0) {
+            IdContainer *c = cont_insert_at(l, -(pos + 1), key);
+            if (c == NULL) break;
+            c->type = IDC_RUN;
+            if (!ensure_vals(c, 1)) {
+                cont_drop(l, -(pos + 1));
+                break;
+            }
+            c->vals[0] = s;
+            c->vals[1] = (uint16_t)(e - s);
+            c->n = 1;
+            c->card = e - s + 1;
+            added += c->card;
+        } else {
+            int got = cont_add_range(&l->conts[pos], s, e);
+            if (got < 0) break;
+            added += got;
+        }
+        x = last + 1;
+    }
+    l->count += added;
+    if (added) invalidate(l);
+    return added;
+}
+
+/* Remove id; returns 1 if it was present. */
+int idl_remove(IdList *l, int id) {
+    if (id < 0) return 0;
+    int pos = cont_find(l, (uint16_t)((uint32_t)id >> 16));
+    if (pos < 0) return 0;
+    if (!cont_remove(&l->conts[pos], (uint16_t)id)) return 0;
+    if (l->conts[pos].card == 0) cont_drop(l, pos);
+    l->count--;
+    invalidate(l);
+    return 1;
+}
+
+int idl_contains(const IdList *l, int id) {
+    if (id < 0) return 0;
+    int pos = cont_find(l, (uint16_t)((uint32_t)id >> 16));
+    return pos >= 0 && cont_contains(&l->conts[pos], (uint16_t)id);
+}
+
+/* Sorted ids as a plain int array, cached until the list next changes. */
+int *idl_to_array(IdList *l) {
+    if (l->ids || l->count == 0) return l->ids;
+    l->ids = malloc((size_t)l->count * sizeof(int));
+    if (l->ids == NULL) return NULL;
+    idl_decode(l, l->ids);
+    return l->ids;
+}
+
+/* Write the sorted ids into out (room for l->count ints) without caching
+ * them; for scans over many lists that would not fit in memory decoded.
+ * Returns the number of ids written. */
+int idl_decode(const IdList *l, int *out) {
+    int n = 0;
+    for (int i = 0; i < l->nconts; i++) {
+        const IdContainer *c = &l->conts[i];
+        int base = (int)c->key << 16;
+        if (c->type == IDC_ARRAY) {
+            for (int k = 0; k < c->n; k++) out[n++] = base | c->vals[k];
+        } else if (c->type == IDC_RUN) {
+            for (int r = 0; r < c->n; r++) {
+                int start = c->vals[2 * r], end = start + c->vals[2 * r + 1];
+                for (int x = start; x <= end; x++) out[n++] = base | x;
+            }
+        } else {
+            for (int w = 0; w < IDC_BITMAP_WORDS; w++) {
+                uint64_t word = c->bits[w];
+                while (word) {
+                    out[n++] = base | (w * 64 + __builtin_ctzll(word));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/* Re-encode every container in whichever form is smallest. */
+void idl_optimize(IdList *l) {
+    for (int i = 0; i < l->nconts; i++) {
+        IdContainer *c = &l->conts[i];
+        int runs = count_runs(c);
+        size_t runBytes = 2 + 4 * (size_t)runs;
+        size_t arrBytes = 2 * (size_t)c->card;
+        size_t bmpBytes = IDC_BITMAP_WORDS * sizeof(uint64_t);
+
+        if (runBytes < arrBytes && runBytes < bmpBytes) {
+            if (c->type != IDC_RUN) to_run(c, runs);
+        } else if (c->card <= IDC_ARRAY_MAX) {
+            to_array(c);
+        } else {
+            to_bitmap(c);
+        }
+    }
+}
+
+static int cont_copy(const IdContainer *src, IdContainer *dst) {
+    *dst = *src;
+    dst->vals = NULL;
+    dst->bits = NULL;
+    if (src->type == IDC_BITMAP) {
+        dst->bits = malloc(IDC_BITMAP_WORDS * sizeof(uint64_t));
+        if (dst->bits == NULL) return 0;
+        memcpy(dst->bits, src->bits, IDC_BITMAP_WORDS * sizeof(uint64_t));
+    } else if (src->n > 0) {
+        size_t slots = (size_t)src->n * (src->type == IDC_RUN ? 2 : 1);
+        dst->vals = malloc(slots * sizeof(uint16_t));
+        if (dst->vals == NULL) return 0;
+        memcpy(dst->vals, src->vals, slots * sizeof(uint16_t));
+        dst->cap = src->n;
+    }
+    return 1;
+}
+
+void idl_copy(const IdList *src, IdList *dst) {
+    idl_free(dst);
+    if (src->nconts == 0) return;
+    dst->conts = malloc((size_t)src->nconts * sizeof(IdContainer));
+    if (dst->conts == NULL) return;
+    dst->capacity = src->nconts;
+    for (int i = 0; i < src->nconts; i++) {
+        if (!cont_copy(&src->conts[i], &dst->conts[dst->nconts])) break;
+        dst->count += dst->conts[dst->nconts].card;
+        dst->nconts++;
+    }
+}
+
+/* ---------- Set algebra ---------- */
+
+/* Combine two containers with the same key into res. Array/array and
+ * array/anything-else intersections and differences work on the sorted
+ * array directly; everything else goes through the bitmap kernel. */
+static int cont_op(const IdContainer *a, const IdContainer *b, int op, IdContainer *res) {
+    memset(res, 0, sizeof(*res));
+    res->key = a->key;
+    res->type = IDC_ARRAY;
+
+    if (op == OP_AND && a->type != IDC_ARRAY && b->type == IDC_ARRAY) {
+        const IdContainer *t = a; a = b; b = t; // filter the array side
+    }
+
+    if (a->type == IDC_ARRAY && (op != OP_OR || b->type == IDC_ARRAY)) {
+        int maxOut = op == OP_OR ? a->n + b->n : a->n;
+        if (!ensure_vals(res, maxOut ? maxOut : 1)) return -1;
+        int n = 0;
+        if (b->type == IDC_ARRAY) { // merge
+            int i = 0, j = 0;
+            while (i < a->n && j < b->n) {
+                uint16_t x = a->vals[i], y = b->vals[j];
+                if (x < y) { if (op != OP_AND) res->vals[n++] = x; i++; }
+                else if (x > y) { if (op == OP_OR) res->vals[n++] = y; j++; }
+                else { if (op != OP_ANDNOT) res->vals[n++] = x; i++; j++; }
+            }
+            if (op != OP_AND) while (i < a->n) res->vals[n++] = a->vals[i++];
+            if (op == OP_OR) while (j < b->n) res->vals[n++] = b->vals[j++];
+        } else { // filter a by membership in b, branch-free on the outcome
+            int want = op == OP_AND;
+            if (b->type == IDC_BITMAP) {
+                for (int i = 0; i < a->n; i++) {
+                    uint16_t x = a->vals[i];
+                    res->vals[n] = x;
+                    n += (int)((b->bits[x >> 6] >> (x & 63)) & 1) == want;
+                }
+            } else {
+                for (int i = 0; i < a->n; i++) {
+                    res->vals[n] = a->vals[i];
+                    n += cont_contains(b, a->vals[i]) == want;
+                }
+            }
+        }
+        res->n = res->card = n;
+        if (n > IDC_ARRAY_MAX && !to_bitmap(res)) return -1;
+        return n;
+    }
+
+    uint64_t tmpA[IDC_BITMAP_WORDS], tmpB[IDC_BITMAP_WORDS];
+    const uint64_t *ba = a->bits, *bb = b->bits;
+    if (a->type != IDC_BITMAP) { cont_fill_bits(a, tmpA); ba = tmpA; }
+    if (b->type != IDC_BITMAP) { cont_fill_bits(b, tmpB); bb = tmpB; }
+
+    res->bits = malloc(IDC_BITMAP_WORDS * sizeof(uint64_t));
+    if (res->bits == NULL) return -1;
+    res->type = IDC_BITMAP;
+    res->card = bits_op(ba, bb, res->bits, op);
+    if (res->card <= IDC_ARRAY_MAX && !to_array(res)) return -1;
+    return res->card;
+}
+
+static int push_cont(IdList *out, const IdContainer *c) {
+    if (out->nconts >= out->capacity) {
+        int newCap = out->capacity ? out->capacity * 2 : 4;
+        IdContainer *nc = realloc(out->conts, (size_t)newCap * sizeof(IdContainer));
+        if (nc == NULL) return 0;
+        out->conts = nc;
+        out->capacity = newCap;
+    }
+    out->conts[out->nconts++] = *c;
+    out->count += c->card;
+    return 1;
+}
+
+/* out must be initialized and must not alias a or b. */
+static void idl_combine(const IdList *a, const IdList *b, IdList *out, int op) {
+    idl_free(out);
+    int i = 0, j = 0;
+    while (i < a->nconts || j < b->nconts) {
+        IdContainer res;
+        const IdContainer *ca = i < a->nconts ? &a->conts[i] : NULL;
+        const IdContainer *cb = j < b->nconts ? &b->conts[j] : NULL;
+
+        if (cb == NULL || (ca && ca->key < cb->key)) { // only in a
+            i++;
+            if (op == OP_AND) continue;
+            if (!cont_copy(ca, &res)) break;
+        } else if (ca == NULL || cb->key < ca->key) { // only in b
+            j++;
+            if (op != OP_OR) continue;
+            if (!cont_copy(cb, &res)) break;
+        } else {
+            i++;
+            j++;
+            int card = cont_op(ca, cb, op, &res);
+            if (card <= 0) {
+                cont_release(&res);
+                if (card < 0) break;
+                continue;
+            }
+        }
+        if (!push_cont(out, &res)) {
+            cont_release(&res);
+            break;
+        }
+    }
+}
+
+void idl_and(const IdList *a, const IdList *b, IdList *out) {
+    idl_combine(a, b, out, OP_AND);
+}
+
+void idl_or(const IdList *a, const IdList *b, IdList *out) {
+    idl_combine(a, b, out, OP_OR);
+}
+
+void idl_andnot(const IdList *a, const IdList *b, IdList *out) {
+    idl_combine(a, b, out, OP_ANDNOT);
+}
+
+/* ---------- Serialization ----------
+ * Containers are written as-is so a saved index can be loaded without
+ * re-encoding: nconts (4 bytes), then for each container key (2), type
+ * (1), a pad byte, card (4), n (4) and the raw payload: n uint16 values
+ * (2n for runs) or the 1024 bitmap words. Native byte order, like the
+ * rest of the tree file.
+ */
+
+#define IDL_CONT_HEADER 12
+
+static size_t cont_payload_bytes(const IdContainer *c) {
+    if (c->type == IDC_BITMAP) return IDC_BITMAP_WORDS * sizeof(uint64_t);
+    return (size_t)c->n * (c->type == IDC_RUN ? 2 : 1) * sizeof(uint16_t);
+}
+
+size_t idl_serialized_size(const IdList *l) {
+    size_t bytes = sizeof(int32_t);
+    for (int i = 0; i < l->nconts; i++) {
+        bytes += IDL_CONT_HEADER + cont_payload_bytes(&l->conts[i]);
+    }
+    return bytes;
+}
+
+/* Write l into out, which must hold idl_serialized_size(l) bytes.
+ * Returns the number of bytes written. */
+size_t idl_serialize(const IdList *l, unsigned char *out) {
+    unsigned char *p = out;
+    int32_t nconts = l->nconts;
+    memcpy(p, &nconts, sizeof nconts);
+    p += sizeof nconts;
+    for (int i = 0; i < l->nconts; i++) {
+        const IdContainer *c = &l->conts[i];
+        int32_t card = c->card, n = c->type == IDC_BITMAP ? 0 : c->n;
+        memcpy(p, &c->key, 2);
+        p[2] = c->type;
+        p[3] = 0;
+        memcpy(p + 4, &card, 4);
+        memcpy(p + 8, &n, 4);
+        p += IDL_CONT_HEADER;
+        size_t payload = cont_payload_bytes(c);
+        if (payload) memcpy(p, c->type == IDC_BITMAP ? (const void *)c->bits : (const void *)c->vals, payload);
+        p += payload;
+    }
+    return (size_t)(p - out);
+}
+
+/* Rebuild a list written by idl_serialize from at most len bytes of buf
+ * into l (which must be initialized). Sets *used to the bytes consumed.
+ * Returns 1 on success, 0 if the data is truncated or malformed. */
+int idl_deserialize(IdList *l, const unsigned char *buf, size_t len, size_t *used) {
+    idl_free(l);
+    const unsigned char *p = buf, *end = buf + len;
+    int32_t nconts;
+    if (len < sizeof nconts) return 0;
+    memcpy(&nconts, p, sizeof nconts);
+    p += sizeof nconts;
+    if (nconts < 0 || nconts > 65536) return 0;
+    if (nconts == 0) {
+        *used = (size_t)(p - buf);
+        return 1;
+    }
+
+    l->conts = calloc((size_t)nconts, sizeof(IdContainer));
+    if (l->conts == NULL) return 0;
+    l->capacity = nconts;
+
+    for (int i = 0; i < nconts; i++) {
+        if (end - p < IDL_CONT_HEADER) goto bad;
+        IdContainer *c = &l->conts[i];
+        int32_t card, n;
+        memcpy(&c->key, p, 2);
+        c->type = p[2];
+        memcpy(&card, p + 4, 4);
+        memcpy(&n, p + 8, 4);
+        p += IDL_CONT_HEADER;
+
+        if (i > 0 && c->key <= l->conts[i - 1].key) goto bad; // keys must ascend
+        if (card < 1 || card > 65536 || n < 0) goto bad;
+        if (c->type == IDC_ARRAY) {
+            if (n != card || n > IDC_ARRAY_MAX) goto bad;
+        } else if (c->type == IDC_RUN) {
+            if (n < 1 || n > 32768) goto bad;
+        } else if (c->type == IDC_BITMAP) {
+            n = 0;
+        } else {
+            goto bad;
+        }
+        c->card = card;
+        c->n = n;
+        l->nconts = i + 1; // from here on idl_free releases this container
+
+        size_t payload = cont_payload_bytes(c);
+        if ((size_t)(end - p) < payload) goto bad;
+        if (c->type == IDC_BITMAP) {
+            c->bits = malloc(payload);
+            if (c->bits == NULL) goto bad;
+            memcpy(c->bits, p, payload);
+        } else {
+            c->vals = malloc(payload);
+            if (c->vals == NULL) goto bad;
+            memcpy(c->vals, p, payload);
+            c->cap = n;
+        }
+        p += payload;
+        l->count += card;
+    }
+    *used = (size_t)(p - buf);
+    return 1;
+
+bad:
+    idl_free(l);
+    return 0;
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+extern Hash g_index;
+
+/* ========== Attribute Index ==========
+ * g_index is an inverted index from "<canonical question>=yes|no" to the
+ * ids of every animal below that branch, so "which animals have attribute
+ * X" is a single hash lookup instead of a tree walk.
+ *
+ * index_rebuild numbers the leaves in DFS order. Every subtree then owns a
+ * contiguous block of ids, so each question contributes exactly two range
+ * inserts ([lo, mid) for yes, [mid, hi) for no) and the whole build is one
+ * linear pass. Later edits add or remove single ids along the edited path.
+ */
+
+#define INDEX_INITIAL_BUCKETS 31
+
+/* id -> leaf. Undone animals keep their slot so a redo can reuse the id. */
+static Node **animals = NULL;
+static int animalCount = 0;
+static int animalCapacity = 0;
+
+/* 1 if leaf currently owns its id (ids from before a rebuild are stale). */
+static int registered(const Node *leaf) {
+    return leaf->id >= 0 && leaf->id < animalCount && animals[leaf->id] == leaf;
+}
+
+static int register_animal(Node *leaf) {
+    if (animalCount >= animalCapacity) {
+        int newCap = animalCapacity ? animalCapacity * 2 : 64;
+        Node **na = realloc(animals, (size_t)newCap * sizeof(Node *));
+        if (na == NULL) return -1;
+        animals = na;
+        animalCapacity = newCap;
+    }
+    animals[animalCount] = leaf;
+    leaf->id = animalCount;
+    return animalCount++;
+}
+
+/* Build the index key for a question and branch. Caller frees. */
+char *index_key(const char *question, int answerYes) {
+    char *canon = canonicalize(question);
+    if (canon == NULL) return NULL;
+    size_t len = strlen(canon);
+    char *key = malloc(len + 5);
+    if (key != NULL) {
+        memcpy(key, canon, len);
+        strcpy(key + len, answerYes ? "=yes" : "=no");
+    }
+    free(canon);
+    return key;
+}
+
+static void put_id(const Node *question, int answerYes, int id) {
+    char *key = index_key(question->text, answerYes);
+    if (key) h_put(&g_index, key, id);
+    free(key);
+}
+
+static void remove_id(const Node *question, int answerYes, int id) {
+    char *key = index_key(question->text, answerYes);
+    if (key) h_remove(&g_index, key, id);
+    free(key);
+}
+
+/* ---------- Full rebuild ---------- */
+
+typedef struct {
+    Node *node;
+    int state;  /* 0 = enter, 1 = yes subtree done, 2 = no subtree done */
+    int lo;     /* first leaf id below this node */
+    int mid;    /* first leaf id of the no subtree */
+} BuildFrame;
+
+/* Rebuild g_index from g_root in one iterative DFS. Also renumbers the
+ * animals and repairs parent links, so it doubles as the post-load fixup. */
+void index_rebuild(void) {
+    h_free(&g_index);
+    h_init(&g_index, INDEX_INITIAL_BUCKETS);
+    animalCount = 0;
+    sim_reset(); // new tree: the question set is rebuilt on first use
+    names_reset();
+    path_invalidate();
+    prog_invalidate();
+    search_invalidate();
+    if (g_root == NULL) return;
+    g_root->parent = NULL;
+
+    int cap = 64, top = 0;
+    BuildFrame *stack = malloc((size_t)cap * sizeof(BuildFrame));
+    if (stack == NULL) return;
+    stack[top++] = (BuildFrame){g_root, 0, 0, 0};
+
+    while (top > 0) {
+        BuildFrame *f = &stack[top - 1];
+        Node *n = f->node;
+
+        if (!n->isQuestion) {
+            register_animal(n);
+            top--;
+            continue;
+        }
+
+        Node *child = NULL;
+        if (f->state == 0) {
+            f->lo = animalCount;
+            f->state = 1;
+            child = n->yes;
+        } else if (f->state == 1) {
+            f->mid = animalCount;
+            f->state = 2;
+            child = n->no;
+        } else {
+            char *yesKey = index_key(n->text, 1);
+            char *noKey = index_key(n->text, 0);
+            if (yesKey && f->mid > f->lo) h_put_range(&g_index, yesKey, f->lo, f->mid);
+            if (noKey && animalCount > f->mid) h_put_range(&g_index, noKey, f->mid, animalCount);
+            free(yesKey);
+            free(noKey);
+            top--;
+            continue;
+        }
+
+        if (child == NULL) continue; // malformed question: skip missing branch
+        child->parent = n;
+        if (top >= cap) {
+            cap *= 2;
+            BuildFrame *ns = realloc(stack, (size_t)cap * sizeof(BuildFrame));
+            if (ns == NULL) break;
+            stack = ns;
+        }
+        stack[top++] = (BuildFrame){child, 0, 0, 0};
+    }
+    free(stack);
+}
+
+/* ---------- Incremental maintenance ---------- */
+
+/* Add (add = 1) or remove the animal's id under every ancestor of node,
+ * using the branch taken at each ancestor. */
+static void update_ancestors(const Node *node, int id, int add) {
+    const Node *child = node;
+    for (const Node *a = node->parent; a != NULL; child = a, a = a->parent) {
+        int viaYes = a->yes == child;
+        if (add) put_id(a, viaYes, id);
+        else remove_id(a, viaYes, id);
+    }
+}
+
+/* Return 1 if some ancestor of node asks the same question (canonically)
+ * on the same branch as key. */
+static int path_has_key(const Node *node, const char *key) {
+    const Node *child = node;
+    for (const Node *a = node->parent; a != NULL; child = a, a = a->parent) {
+        char *k = index_key(a->text, a->yes == child);
+        int same = k && strcmp(k, key) == 0;
+        free(k);
+        if (same) return 1;
+    }
+    return 0;
+}
+
+/* A leaf was split into newQuestion(newLeaf, oldLeaf). newLeaf inherits
+ * every ancestor attribute plus its side of newQuestion; oldLeaf only gains
+ * its side of newQuestion. */
+void index_on_learn(const Edit *e) {
+    if (g_index.buckets == NULL) return;
+    Node *q = e->newQuestion;
+    int newOnYes = q->yes == e->newLeaf;
+
+    if (!registered(e->newLeaf) && register_animal(e->newLeaf) < 0) return;
+    if (!registered(e->oldLeaf)) {
+        if (register_animal(e->oldLeaf) < 0) return;
+        update_ancestors(q, e->oldLeaf->id, 1);
+    }
+
+    update_ancestors(q, e->newLeaf->id, 1);
+    put_id(q, newOnYes, e->newLeaf->id);
+    put_id(q, !newOnYes, e->oldLeaf->id);
+}
+
+/* newQuestion was unlinked and oldLeaf is back in its place. */
+void index_on_undo(const Edit *e) {
+    if (g_index.buckets == NULL) return;
+    Node *q = e->newQuestion;
+    int newOnYes = q->yes == e->newLeaf;
+    if (!registered(e->newLeaf) || !registered(e->oldLeaf)) return;
+
+    update_ancestors(e->oldLeaf, e->newLeaf->id, 0);
+    remove_id(q, newOnYes, e->newLeaf->id);
+
+    /* oldLeaf keeps the attribute if another ancestor asks the same thing */
+    char *key = index_key(q->text, !newOnYes);
+    if (key && !path_has_key(e->oldLeaf, key)) {
+        h_remove(&g_index, key, e->oldLeaf->id);
+    }
+    free(key);
+}
+
+void index_on_redo(const Edit *e) {
+    index_on_learn(e); // newLeaf keeps the id it was given originally
+}
+
+/* ---------- Queries ---------- */
+
+/* Copy the ids of animals answering answerYes to question into out (which
+ * must be initialized). Returns the number of matching animals. */
+int index_query(const char *question, int answerYes, IdList *out) {
+    idl_free(out);
+    if (g_index.buckets == NULL) return 0;
+    char *key = index_key(question, answerYes);
+    if (key == NULL) return 0;
+    IdList *list = h_get_list(&g_index, key);
+    free(key);
+    if (list) idl_copy(list, out);
+    return out->count;
+}
+
+/* A leaf that is gone for good (see engine.c) gives up its id; the slot
+ * stays empty. */
+void index_forget(const Node *leaf) {
+    if (registered(leaf)) animals[leaf->id] = NULL;
+}
+
+Node *index_animal(int id) {
+    if (id < 0 || id >= animalCount) return NULL;
+    return animals[id];
+}
+
+int index_animal_count(void) {
+    return animalCount;
+}
+
+/* ---------- Persistence ----------
+ * save_tree appends the index after the node records so load_tree can
+ * skip the rebuild (which canonicalizes and hashes every question). The
+ * section is bound to the exact node records it was written with:
+ *
+ *   magic "ATIX", version, payload length, checksum of payload
+ *   payload: tree checksum, hash probe, animal count,
+ *            animal id of every node in file order (-1 for questions),
+ *            bucket count, entry count,
+ *            entries: hash, key length, key, serialized posting list
+ *
+ * A missing section, a checksum mismatch, a different tree checksum or a
+ * different hash function (the probe) all make index_read fail, and the
+ * caller falls back to index_rebuild.
+ */
+
+#define INDEX_MAGIC 0x58495441  /* "ATIX" */
+#define INDEX_VERSION 1
+#define INDEX_PROBE "attribute-index-probe=yes"
+
+typedef struct {
+    unsigned char *p;
+    const unsigned char *end;
+} Cursor;
+
+static void put_bytes(Cursor *c, const void *src, size_t n) {
+    memcpy(c->p, src, n);
+    c->p += n;
+}
+
+static int get_bytes(Cursor *c, void *dst, size_t n) {
+    if ((size_t)(c->end - c->p) < n) return 0;
+    memcpy(dst, c->p, n);
+    c->p += n;
+    return 1;
+}
+
+/* Write the index section for nodes[0..count) (file order). Returns 1 on
+ * success (including when there is no index to write), 0 on I/O error. */
+int index_write(FILE *f, uint64_t treeSum, Node **nodes, int count) {
+    if (g_index.buckets == NULL) return 1;
+    for (int i = 0; i < count; i++) { // index built for some other tree
+        if (!nodes[i]->isQuestion && !registered(nodes[i])) return 1;
+    }
+
+    Entry **tables[2] = {g_index.buckets, g_index.oldBuckets};
+    int sizes[2] = {g_index.nbuckets, g_index.oldBuckets ? g_index.oldNbuckets : 0};
+
+    size_t len = 2 * sizeof(uint64_t) + sizeof(int32_t) * (size_t)(count + 3);
+    int32_t nentries = 0;
+    for (int t = 0; t < 2; t++) {
+        for (int b = 0; b < sizes[t]; b++) {
+            for (Entry *e = tables[t][b]; e; e = e->next) {
+                len += sizeof(uint64_t) + 2 * sizeof(uint32_t) + strlen(e->key) + idl_serialized_size(&e->vals);
+                nentries++;
+            }
+        }
+    }
+
+    unsigned char *buf = malloc(len);
+    if (buf == NULL) return 0;
+    Cursor c = {buf, buf + len};
+    uint64_t probe = g_index.hashFn(INDEX_PROBE, strlen(INDEX_PROBE));
+    int32_t animals32 = animalCount, nbuckets = g_index.nbuckets;
+    put_bytes(&c, &treeSum, sizeof treeSum);
+    put_bytes(&c, &probe, sizeof probe);
+    put_bytes(&c, &animals32, sizeof animals32);
+    for (int i = 0; i < count; i++) {
+        int32_t id = !nodes[i]->isQuestion && registered(nodes[i]) ? nodes[i]->id : -1;
+        put_bytes(&c, &id, sizeof id);
+    }
+    put_bytes(&c, &nbuckets, sizeof nbuckets);
+    put_bytes(&c, &nentries, sizeof nentries);
+    for (int t = 0; t < 2; t++) {
+        for (int b = 0; b < sizes[t]; b++) {
+            for (Entry *e = tables[t][b]; e; e = e->next) {
+                uint32_t keyLen = (uint32_t)strlen(e->key);
+                uint32_t listLen = (uint32_t)idl_serialized_size(&e->vals);
+                put_bytes(&c, &e->hash, sizeof e->hash);
+                put_bytes(&c, &keyLen, sizeof keyLen);
+                put_bytes(&c, e->key, keyLen);
+                put_bytes(&c, &listLen, sizeof listLen);
+                c.p += idl_serialize(&e->vals, c.p);
+            }
+        }
+    }
+
+    uint32_t magic = INDEX_MAGIC, version = INDEX_VERSION;
+    uint64_t len64 = len, sum = h_hash_wy((const char *)buf, len);
+    int ok = fwrite(&magic, sizeof magic, 1, f) == 1 &&
+             fwrite(&version, sizeof version, 1, f) == 1 &&
+             fwrite(&len64, sizeof len64, 1, f) == 1 &&
+             fwrite(&sum, sizeof sum, 1, f) == 1 &&
+             fwrite(buf, 1, len, f) == len;
+    free(buf);
+    return ok;
+}
+
+/* Read the section written by index_write and install it as g_index,
+ * assigning animal ids to nodes[0..count). Returns 1 if the index was
+ * loaded, 0 if it is missing or stale (g_index is left untouched). */
+int index_read(FILE *f, uint64_t treeSum, Node **nodes, int count) {
+    uint32_t magic, version;
+    uint64_t len, sum;
+    if (fread(&magic, sizeof magic, 1, f) != 1 || magic != INDEX_MAGIC) return 0;
+    if (fread(&version, sizeof version, 1, f) != 1 || version != INDEX_VERSION) return 0;
+    if (fread(&len, sizeof len, 1, f) != 1 || fread(&sum, sizeof sum, 1, f) != 1) return 0;
+    if (len > ((uint64_t)1 << 40)) return 0;
+
+    unsigned char *buf = malloc(len ? len : 1);
+    if (buf == NULL) return 0;
+    if (fread(buf, 1, len, f) != len || h_hash_wy((const char *)buf, len) != sum) {
+        free(buf);
+        return 0;
+    }
+
+    Cursor c = {buf, buf + len};
+    Hash fresh = {NULL, 0, 0, NULL, 0, 0, NULL};
+    Node **ids = NULL;
+    uint64_t fileTreeSum, probe;
+    int32_t animals32, nbuckets, nentries;
+    if (!get_bytes(&c, &fileTreeSum, sizeof fileTreeSum) || fileTreeSum != treeSum) goto stale;
+    if (!get_bytes(&c, &probe, sizeof probe) ||
+        probe != h_hash_wy(INDEX_PROBE, strlen(INDEX_PROBE))) goto stale;
+    if (!get_bytes(&c, &animals32, sizeof animals32) || animals32 < 0 || animals32 > count) goto stale;
+
+    /* id -> leaf; every id may be claimed once and only by a leaf */
+    ids = calloc((size_t)animals32 + 1, sizeof(Node *));
+    if (ids == NULL) goto stale;
+    for (int i = 0; i < count; i++) {
+        int32_t id;
+        if (!get_bytes(&c, &id, sizeof id)) goto stale;
+        if (id == -1) {
+            if (!nodes[i]->isQuestion) goto stale;
+            continue;
+        }
+        if (id < 0 || id >= animals32 || ids[id] || nodes[i]->isQuestion) goto stale;
+        ids[id] = nodes[i];
+    }
+
+    if (!get_bytes(&c, &nbuckets, sizeof nbuckets) || nbuckets < 1) goto stale;
+    if (!get_bytes(&c, &nentries, sizeof nentries) || nentries < 0) goto stale;
+    h_init(&fresh, nbuckets);
+    if (fresh.buckets == NULL) goto stale;
+    for (int32_t i = 0; i < nentries; i++) {
+        uint64_t hash;
+        uint32_t keyLen, listLen;
+        if (!get_bytes(&c, &hash, sizeof hash) || !get_bytes(&c, &keyLen, sizeof keyLen)) goto stale;
+        if ((size_t)(c.end - c.p) < keyLen) goto stale;
+        char *key = malloc((size_t)keyLen + 1);
+        if (key == NULL) goto stale;
+        get_bytes(&c, key, keyLen);
+        key[keyLen] = '\0';
+        Entry *e = h_adopt(&fresh, key, hash);
+        if (e == NULL) {
+            free(key);
+            goto stale;
+        }
+        size_t used;
+        if (!get_bytes(&c, &listLen, sizeof listLen) || (size_t)(c.end - c.p) < listLen) goto stale;
+        if (!idl_deserialize(&e->vals, c.p, listLen, &used) || used != listLen) goto stale;
+        c.p += listLen;
+    }
+    if (c.p != c.end) goto stale;
+
+    /* commit: swap in the loaded table and animal registry */
+    sim_reset();
+    names_reset();
+    path_invalidate();
+    prog_invalidate();
+    search_invalidate();
+    h_free(&g_index);
+    g_index = fresh;
+    free(animals);
+    animals = ids;
+    animalCount = animals32;
+    animalCapacity = animals32 + 1;
+    for (int32_t id = 0; id < animals32; id++) {
+        if (animals[id]) animals[id]->id = id;
+    }
+    free(buf);
+    return 1;
+
+stale:
+    h_free(&fresh);
+    free(ids);
+    free(buf);
+    return 0;
+}
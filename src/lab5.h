@@ -1,7 +1,10 @@
 #ifndef LAB5_H
 #define LAB5_H
 
+#include <stddef.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 
 /* ========== Tree Node ========== */
 typedef struct Node {
@@ -9,6 +12,10 @@ typedef struct Node {
     struct Node *yes;
     struct Node *no;
     int isQuestion;
+    int refs;             /* its owner (the tree or its edit) + edits made below it */
+    struct Node *parent;  /* NULL for the root; kept current by every edit */
+    int id;               /* animal id for leaves (see index.c), else -1 */
+    unsigned visitMark;   /* last integrity walk that reached it (utils.c) */
 } Node;
 
 /* Node constructors */
@@ -89,49 +96,523 @@ int q_dequeue(Queue *q, Node **node, int *id);
 int q_empty(Queue *q);
 void q_free(Queue *q);
 
-/* ========== Hash Table ========== */
+/* ========== Posting Lists ========== */
+/* Sorted, compressed set of non-negative ids (roaring layout). Ids are
+ * split by their high 16 bits into containers kept sorted by key; each
+ * container stores the low 16 bits as a sorted array (sparse), a 65536-bit
+ * bitmap (dense) or a list of runs (consecutive ids). */
+typedef enum {
+    IDC_ARRAY,
+    IDC_BITMAP,
+    IDC_RUN
+} IdContainerType;
+
+typedef struct {
+    uint16_t key;         /* high 16 bits shared by every id in here */
+    uint8_t type;         /* IdContainerType */
+    int card;             /* number of ids in the container */
+    int n;                /* array: values used, run: runs used */
+    int cap;              /* array: value slots, run: run slots */
+    uint16_t *vals;       /* array values, or run (start, length - 1) pairs */
+    uint64_t *bits;       /* bitmap words */
+} IdContainer;
+
 typedef struct IdList {
-    int *ids;
-    int count;
+    IdContainer *conts;
+    int nconts;
     int capacity;
+    int count;            /* total number of ids */
+    int *ids;             /* decoded copy from idl_to_array, NULL when stale */
 } IdList;
 
+void idl_init(IdList *l);
+void idl_free(IdList *l);
+int idl_add(IdList *l, int id);
+int idl_add_range(IdList *l, int lo, int hi);
+int idl_remove(IdList *l, int id);
+int idl_contains(const IdList *l, int id);
+int *idl_to_array(IdList *l);
+int idl_decode(const IdList *l, int *out);
+void idl_optimize(IdList *l);
+void idl_copy(const IdList *src, IdList *dst);
+void idl_and(const IdList *a, const IdList *b, IdList *out);
+void idl_or(const IdList *a, const IdList *b, IdList *out);
+void idl_andnot(const IdList *a, const IdList *b, IdList *out);
+size_t idl_serialized_size(const IdList *l);
+size_t idl_serialize(const IdList *l, unsigned char *out);
+int idl_deserialize(IdList *l, const unsigned char *buf, size_t len, size_t *used);
+
+/* ========== Hash Table ========== */
+
 typedef struct Entry {
     char *key;
+    uint64_t hash;        /* cached hashFn(key), reused when resizing */
     IdList vals;
     struct Entry *next;
 } Entry;
 
+/* Hash functions take the key and its length so word-at-a-time
+ * implementations never need to scan for the terminator themselves. */
+typedef uint64_t (*HashFn)(const char *key, size_t len);
+
+/* The table grows incrementally: when the load factor is exceeded a larger
+ * bucket array is allocated and the old one is drained a few buckets at a
+ * time by every h_put/h_contains/h_get_ids, so no single call pays for a
+ * full rehash. */
 typedef struct {
     Entry **buckets;
     int nbuckets;
     int size;
+    Entry **oldBuckets;   /* table being drained, NULL when not resizing */
+    int oldNbuckets;
+    int rehashPos;        /* next old bucket to migrate */
+    HashFn hashFn;        /* h_hash_wy unless chosen with h_init_with */
 } Hash;
 
 extern void h_init(Hash *h, int nbuckets);
+extern void h_init_with(Hash *h, int nbuckets, HashFn fn);
 extern unsigned h_hash(const char *s);
+extern uint64_t h_hash_djb2(const char *key, size_t len);
+extern uint64_t h_hash_wy(const char *key, size_t len);
 extern int h_put(Hash *h, const char *key, int animalId);
-extern int h_contains(const Hash *h, const char *key, int animalId);
-extern int *h_get_ids(const Hash *h, const char *key, int *outCount);
+extern int h_put_range(Hash *h, const char *key, int lo, int hi);
+extern int h_remove(Hash *h, const char *key, int animalId);
+extern int h_contains(Hash *h, const char *key, int animalId);
+extern int *h_get_ids(Hash *h, const char *key, int *outCount);
+extern IdList *h_get_list(Hash *h, const char *key);
+extern Entry *h_adopt(Hash *h, char *key, uint64_t hash);
+extern int h_rehashing(const Hash *h);
 extern void h_free(Hash *h);
 extern char *canonicalize(const char *s);
+
+/* canonicalize() picks the widest SIMD kernel the CPU supports at runtime;
+ * every implementation must produce identical output. */
+typedef enum {
+    CANON_SCALAR,
+    CANON_SSE2,
+    CANON_AVX2
+} CanonImpl;
+
+extern CanonImpl canonicalize_best_impl(void);
+extern char *canonicalize_with(const char *s, CanonImpl impl);
+extern size_t canonicalize_into(const char *s, size_t len, char *out);
 extern int get_yes_no(int y, int x, const char *prompt);
 extern char *get_input(int y, int x, const char *prompt);
 
 extern Hash g_index;
 
+/* ========== Epoch-Based Reclamation ========== */
+/* Readers bracket lock-free accesses with ebr_enter/ebr_exit; writers pass
+ * unlinked memory to ebr_retire, which frees it once no reader that could
+ * have seen it is still inside a section. */
+void ebr_enter(void);
+void ebr_exit(void);
+void ebr_thread_exit(void);
+void ebr_retire(void *ptr, void (*freeFn)(void *));
+void ebr_collect(void);
+void ebr_synchronize(void);
+int ebr_pending(void);
+
+/* ========== Concurrent Attribute Hash ========== */
+/* Thread-safe counterpart of Hash for sharing the attribute index between
+ * threads. Writers serialize per lock stripe; readers never block. Each
+ * key's ids live in copy-on-write 64K chunks, so ch_get_ids copies them out
+ * rather than handing back one array. */
+#define CH_STRIPES 64
+
+typedef struct CEntry CEntry;
+typedef struct CTable CTable;
+
+typedef struct {
+    CTable *table;                    /* current bucket array (atomic) */
+    int size;                         /* number of keys (atomic) */
+    pthread_mutex_t locks[CH_STRIPES];
+} CHash;
+
+void ch_init(CHash *h, int nbuckets);
+int ch_put(CHash *h, const char *key, int animalId);
+int ch_contains(CHash *h, const char *key, int animalId);
+void ch_read_begin(void);
+int ch_get_ids(CHash *h, const char *key, int *out, int max);
+void ch_read_end(void);
+void ch_free(CHash *h);
+
+/* ========== Attribute Index ========== */
+/* g_index maps "<canonical question>=yes" / "=no" to the ids of every
+ * animal below that branch. Leaves get dense animal ids when the index is
+ * rebuilt; animals learned later get the next free id. The hooks below
+ * must run after the tree (including parent links) has been updated. */
+void index_rebuild(void);
+void index_on_learn(const Edit *e);
+void index_on_undo(const Edit *e);
+void index_on_redo(const Edit *e);
+char *index_key(const char *question, int answerYes);
+int index_query(const char *question, int answerYes, IdList *out);
+Node *index_animal(int id);
+int index_animal_count(void);
+void index_forget(const Node *leaf);
+/* Optional index section of the tree file (see index.c). treeSum is the
+ * checksum of the node records the section belongs to. */
+int index_write(FILE *f, uint64_t treeSum, Node **nodes, int count);
+int index_read(FILE *f, uint64_t treeSum, Node **nodes, int count);
+
+/* ========== Question Similarity ========== */
+/* Trigram index over canonical question text for spotting near-duplicate
+ * questions while learning. Built lazily from g_root on first use. */
+typedef struct {
+    const char *text;     /* existing question, as first typed */
+    double score;         /* weighted trigram Dice similarity, 0..1 */
+} SimMatch;
+
+void sim_reset(void);
+void sim_rebuild(void);
+int sim_add(const char *question);
+void sim_remove(const char *question);
+void sim_on_learn(const Edit *e);
+void sim_on_undo(const Edit *e);
+void sim_on_redo(const Edit *e);
+int sim_find(const char *question, double minScore, SimMatch *out, int max);
+int sim_size(void);
+
+/* ========== Animal Names ========== */
+/* Canonical animal name -> ids of the leaves carrying it (see names.c).
+ * Built lazily from g_root; the hooks run after the index hooks. */
+void names_reset(void);
+void names_on_learn(const Edit *e);
+void names_on_undo(const Edit *e);
+void names_on_redo(const Edit *e);
+int names_lookup(const char *animal, int *ids, int max);
+Node *names_find(const char *animal);
+int names_duplicates(IdList *out);
+
+/* ========== Animal Paths ========== */
+/* O(1) lowest-common-ancestor queries between animals (ids as given by
+ * index_animal). The layout is built on the first query; the edit hooks
+ * keep it current (run them after index_on_*), and path_invalidate makes
+ * the next query rebuild it after any other change to the tree. */
+typedef struct {
+    Node *split;          /* question where the answers differ, else NULL */
+    int distance;         /* edges between the leaves; 0 same, -1 unknown */
+} PathInfo;
+
+void path_invalidate(void);
+void path_on_learn(const Edit *e);
+void path_on_undo(const Edit *e);
+void path_on_redo(const Edit *e);
+int path_query(int a, int b, PathInfo *out);
+long path_query_batch(const int *pairs, long count, PathInfo *out);
+
+/* ========== Compiled Classifier ========== */
+/* The tree flattened into an instruction array (see program.c). An answer
+ * vector has one bit per question id, set for "yes". prog_current compiles
+ * g_root on first use; call prog_invalidate after any edit. */
+#define PROG_LEAF(id) (-(id) - 1)  /* leaf target for animal id, and back */
+#define PROG_NONE INT32_MIN        /* entry of an empty program */
+
+typedef struct {
+    int32_t question;     /* question id: the answer bit to test */
+    int32_t yes, no;      /* next instruction, or PROG_LEAF(animal id) */
+} ProgInsn;
+
+typedef struct {
+    ProgInsn *code;
+    int count;            /* instructions, one per question node */
+    int32_t entry;        /* first instruction, a leaf, or PROG_NONE */
+    int questionCount;    /* distinct canonical questions */
+    uint32_t *textAt;     /* question id -> arena offset of its text */
+    char *arena;          /* each question's text, then its canonical form */
+    size_t arenaLen, arenaCap;
+    int32_t *slots;       /* open-addressed canonical text -> question id */
+    uint32_t slotMask;
+} DecisionProgram;
+
+int prog_compile(Node *root, DecisionProgram *out);
+void prog_free(DecisionProgram *p);
+int prog_classify(const DecisionProgram *p, const uint64_t *answers);
+int prog_question_id(const DecisionProgram *p, const char *question);
+const char *prog_question_text(const DecisionProgram *p, int q);
+int prog_answer_words(const DecisionProgram *p);
+int prog_answers(const DecisionProgram *p, const Node *leaf, uint64_t *answers);
+void prog_invalidate(void);
+const DecisionProgram *prog_current(void);
+/* Batches of answer vectors stored back to back, words apart */
+typedef struct {
+    long total;
+    long correct;         /* vectors that reached the animal they describe */
+    IdList missed;        /* animals at least one of their vectors missed */
+} ProgEval;
+
+void prog_classify_batch(const DecisionProgram *p, const uint64_t *answers, int words, long count,
+                         int32_t *out, int nthreads);
+void prog_evaluate(const DecisionProgram *p, const uint64_t *answers, int words,
+                   const int32_t *expected, long count, int nthreads, ProgEval *out);
+void prog_eval_free(ProgEval *e);
+/* Standalone C source with the program as static tables (see codegen.c) */
+int prog_emit_c(const DecisionProgram *p, FILE *f, const char *prefix, const char *source);
+
+/* ========== Tree Statistics ========== */
+/* Shape and size of a tree, gathered in one walk (see stats.c). Depths
+ * count the questions asked before reaching an animal, so avgDepth is the
+ * cost of a game for a uniformly chosen animal. */
+typedef struct {
+    long nodes, questions, animals;
+    long *depthHist;      /* animals at each depth 0..height */
+    int height;           /* longest root-to-animal path */
+    double avgDepth;      /* mean root-to-animal path */
+    int maxImbalance;     /* largest |height(yes) - height(no)| */
+    Node *worst;          /* a question with that imbalance, or NULL */
+    double avgImbalance;  /* mean over questions */
+    long unbalanced;      /* questions with imbalance above 1 */
+    size_t questionBytes; /* text bytes, without terminators */
+    size_t animalBytes;
+} TreeStats;
+
+int tree_stats(Node *root, int nthreads, TreeStats *out);
+void tree_stats_free(TreeStats *s);
+void tree_stats_json(const TreeStats *s, FILE *f);
+
+/* ========== Tree Layout Export ========== */
+/* A tidy 2D drawing of a tree written as SVG or Graphviz DOT (see
+ * layout.c), in one pass or on a background thread. */
+typedef enum { LAYOUT_SVG, LAYOUT_DOT } LayoutFormat;
+
+typedef struct {
+    LayoutFormat format;
+    int maxDepth;         /* deepest level drawn, -1 for the whole tree */
+} LayoutOptions;
+
+typedef struct {
+    pthread_t thread;
+    const Node *root;
+    LayoutOptions opt;
+    char *path;
+    long done, total;     /* progress over both passes (atomic) */
+    int cancel;           /* atomic */
+    int finished;         /* atomic: set when the thread is done */
+    int result;           /* 1 if the file was written */
+} LayoutJob;
+
+int layout_write(const Node *root, FILE *f, const LayoutOptions *opt);
+int layout_start(LayoutJob *job, const Node *root, const char *path, const LayoutOptions *opt);
+int layout_finished(const LayoutJob *job);
+void layout_progress(const LayoutJob *job, long *done, long *total);
+void layout_cancel(LayoutJob *job);
+int layout_wait(LayoutJob *job);
+
 /* ========== Persistence ========== */
 int save_tree(const char *filename);
+int save_tree_with(const char *filename, int withIndex);
 int load_tree(const char *filename);
+int tree_checksum(Node *root, uint64_t *sum);
 
 /* ========== Utilities ========== */
+/* Structural faults found by the integrity checker. A node reached twice
+ * is a cycle when it is an ancestor of the second path, else shared. */
+typedef enum {
+    INTEGRITY_OK,
+    INTEGRITY_MISSING_CHILD,  /* question without both children */
+    INTEGRITY_LEAF_CHILD,     /* animal with a child */
+    INTEGRITY_SHARED_NODE,    /* reachable through two parents (DAG) */
+    INTEGRITY_CYCLE,          /* reachable from itself */
+    INTEGRITY_BAD_PARENT,     /* parent link disagrees with the child links */
+    INTEGRITY_NO_MEMORY
+} IntegrityError;
+
+typedef struct {
+    IntegrityError error;
+    Node *node;           /* first offending node in preorder, or NULL */
+    char *path;           /* answers leading to it from the root ("yny") */
+    long visited;         /* nodes checked; the whole tree when valid */
+} IntegrityReport;
+
 int check_integrity();
-void find_shortest_path(const char *animal1, const char *animal2);
+int check_integrity_report(Node *root, int nthreads, IntegrityReport *rep);
+void integrity_report_free(IntegrityReport *rep);
+const char *integrity_error_str(IntegrityError e);
+/* Incremental validation: the hooks record the nodes an edit relinked (run
+ * them after the tree is updated) and check_changes checks only those. */
+void integrity_on_learn(const Edit *e);
+void integrity_on_undo(const Edit *e);
+void integrity_on_redo(const Edit *e);
+void integrity_forget_changes(void);
+int integrity_pending(void);
+int check_changes(IntegrityReport *rep);
+
+/* What tells two animals apart (see find_shortest_path). */
+typedef struct {
+    Node *leaf[2];
+    Node *split;           /* question where they part ways, NULL if the same animal */
+    int distance;          /* edges between the leaves */
+    FrameStack branch[2];  /* questions from split down to each leaf, with its answers */
+} AnimalPath;
+
+int find_shortest_path(const char *animal1, const char *animal2, AnimalPath *out);
+void animal_path_free(AnimalPath *p);
+
+/* ========== Game Engine ========== */
+/* One game, driven without any user interface (see engine.c): ask while
+ * the state is GAME_ASKING, then guess, then teach if the guess was
+ * wrong. */
+typedef enum {
+    GAME_ASKING,          /* engine_question has a question to ask */
+    GAME_GUESSING,        /* engine_guess has an animal to guess */
+    GAME_WON,             /* the guess was right */
+    GAME_LEARNING,        /* the guess was wrong; waiting for engine_teach */
+    GAME_OVER             /* taught, or there was no tree */
+} GameState;
+
+typedef struct Recorder Recorder;
+
+typedef struct {
+    GameState state;
+    Node *cur;            /* question being asked or animal being guessed */
+    Node *parent;         /* question answered last, NULL at the root */
+    int parentAnswer;     /* 1 yes, 0 no, -1 before the first answer */
+    int steps;            /* answers given so far */
+    EditStack *undo;      /* where teaching records its edit */
+    EditStack *redo;
+    Recorder *rec;        /* where the session is recorded, or NULL */
+    uint8_t *trail;       /* answers so far, one bit each, while recording */
+    int trailCap;         /* bits */
+    uint64_t epoch;       /* reclaim epoch it is counted in; 0 when not playing */
+} GameSession;
+
+int engine_begin(GameSession *s);
+const char *engine_question(const GameSession *s);
+GameState engine_answer(GameSession *s, int yes);
+const char *engine_guess(const GameSession *s);
+GameState engine_confirm(GameSession *s, int correct);
+int engine_teach(GameSession *s, const char *animal, const char *question, int answerYes);
+int engine_record(GameSession *s, Recorder *rec);
+void engine_history(GameSession *s, EditStack *undo, EditStack *redo);
+void engine_end(GameSession *s);
+int engine_undo(EditStack *undo, EditStack *redo);
+int engine_redo(EditStack *undo, EditStack *redo);
+void engine_drop_history(EditStack *undo, EditStack *redo);
+int engine_reclaim(void);
+
+/* ========== Session Recording ========== */
+/* Binary logs of finished sessions that replay through the engine (see
+ * record.c). A Recorder may be shared by concurrent sessions. */
+struct Recorder {
+    FILE *f;
+    pthread_mutex_t lock;
+    long sessions;        /* written so far */
+    int failed;           /* a write failed; the log is incomplete */
+};
+
+typedef struct {
+    char edit;            /* 'u' undo or 'r' redo instead of a game, else 0 */
+    GameState outcome;    /* state the session ended in */
+    int steps;
+    uint8_t *answers;     /* steps bits, LSB first */
+    char *animal;         /* taught animal when outcome is GAME_OVER */
+    char *question;
+    int answerYes;
+} RecordedSession;
+
+typedef struct {
+    FILE *f;
+    uint64_t startSum;    /* tree_checksum the recording starts from */
+    uint64_t endSum;      /* ...and ends with, once rec_next returned 0 */
+    int ended;
+} RecordReader;
+
+int rec_create(Recorder *rec, const char *filename);
+void rec_write(Recorder *rec, GameState outcome, const uint8_t *answers, int steps,
+               const char *animal, const char *question, int answerYes);
+void rec_write_edit(Recorder *rec, int redo);
+int rec_close(Recorder *rec);
+int rec_open(RecordReader *r, const char *filename);
+int rec_next(RecordReader *r, RecordedSession *out);
+void rec_session_free(RecordedSession *s);
+void rec_close_reader(RecordReader *r);
+int rec_replay(const RecordedSession *rs, uint64_t (*clock)(void), uint64_t *stepNs);
+
+/* ========== Game Server ========== */
+/* Many players at once on the shared tree over a UNIX socket, all driven
+ * by one event loop thread (see server.c for the protocol). */
+typedef struct GameServer {
+    int listenFd;
+    int epollFd;
+    int wakeFd;           /* written by server_stop */
+    int acceptPaused;     /* out of descriptors; listening resumes on a close */
+    char path[108];
+    pthread_t thread;     /* runs the event loop */
+    int live;             /* connections being served */
+    long sessions;        /* connections accepted */
+    long steps;           /* answers and confirmations served */
+} GameServer;
+
+int server_start(GameServer *srv, const char *path);
+void server_stop(GameServer *srv);
+int server_connect(const char *path);
+int server_run(const char *path);
 
 /* ========== Gameplay ========== */
+/* The ncurses frontend of the engine; games are recorded to rec while it
+ * is set. */
+void play_set_recorder(Recorder *rec);
 void play_game();
 
+/* ========== Tree View ========== */
+/* Rows of the tree view computed on demand (see treeview.c): a row is a
+ * cursor that steps to its visible neighbours through the tree links. */
+typedef struct {
+    Node *node;
+    int depth;
+} ViewRow;
+
+typedef struct {
+    const Node **toggled;  /* questions flipped from the default, open-addressed */
+    uint32_t mask;
+    int used;
+    int collapseAll;       /* the default: 1 collapsed, 0 expanded */
+} TreeView;
+
+void view_init(TreeView *v);
+void view_free(TreeView *v);
+int view_expanded(const TreeView *v, const Node *n);
+int view_toggle(TreeView *v, const Node *n);
+void view_collapse_all(TreeView *v, int collapsed);
+int view_first(ViewRow *row);
+int view_last(const TreeView *v, ViewRow *row);
+int view_next(const TreeView *v, ViewRow *row);
+int view_prev(const TreeView *v, ViewRow *row);
+int view_rows(const TreeView *v, ViewRow from, ViewRow *out, int max);
+
+/* ========== Tree Search ========== */
+/* Word index over question and animal text for the tree view's search
+ * (see search.c). Built from g_root on first use; call search_invalidate
+ * after any edit. */
+#define SEARCH_MAX_WORD 64    /* longer words are compared on this many bytes */
+#define SEARCH_MAX_WORDS 16   /* query words used */
+
+typedef struct {
+    char text[SEARCH_MAX_WORDS * (SEARCH_MAX_WORD + 1)];  /* normalized words */
+    int wordStart[SEARCH_MAX_WORDS];
+    int words;
+    int lastIsPrefix;     /* the query ends inside its last word */
+    uint32_t lo[SEARCH_MAX_WORDS], hi[SEARCH_MAX_WORDS];  /* word ranks matching each */
+    int pivot;            /* word with the fewest postings, -1 if nothing matches */
+    long hits;            /* matching nodes, -1 if too many postings to count */
+} SearchQuery;
+
+void search_invalidate(void);
+int search_ready(void);
+int search_compile(SearchQuery *q, const char *query);
+int search_matches(const SearchQuery *q, const Node *n);
+Node *search_next(const SearchQuery *q, const Node *from, int backward);
+
 /* ========== Visualization ========== */
 void draw_tree();
 
+/* ========== Test Trees ==========
+ * Random trees for the tests and benchmarks (test_trees.c, linked into
+ * run_tests and run_bench only). */
+#define TREE_TEXT_MAX 256
+typedef void (*TreeTextFn)(uint64_t *rng, int count, int depth, char *question, char *animal);
+int tree_rand(uint64_t *rng);
+Node *build_random_tree(int n, unsigned seed, TreeTextFn text, Node **leaves);
+
 #endif
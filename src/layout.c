@@ -0,0 +1,433 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lab5.h"
+
+/* ========== Tree Layout Export ==========
+ * Draws a tree (or the part of it down to a depth) as SVG, or as Graphviz
+ * DOT with fixed positions for `neato -n`, laid out by the Reingold-Tilford
+ * tidy tree algorithm: parents centred over their two children, subtrees
+ * pushed apart just far enough that no level overlaps, mirror images drawn
+ * as mirror images.
+ *
+ * Two iterative passes, no recursion:
+ *  1. Postorder. Each question places its yes and no subtrees by walking
+ *     the right contour of the one against the left contour of the other,
+ *     level by level. A contour steps to the outer child or, past the
+ *     bottom of a shallower subtree, along a thread left on its lowest
+ *     leaf, so the walk costs the height of the shallower subtree and the
+ *     whole pass is O(n). Only each node's offset from its parent is kept.
+ *  2. Preorder. Absolute positions are summed down the tree and every node
+ *     and edge is written as soon as it is reached.
+ *
+ * Memory is 12 bytes per node drawn plus stacks as deep as the tree; the
+ * text is never gathered, it streams to the file. Nodes are numbered in
+ * preorder (yes before no), so a question's yes child is the next number
+ * and only the no child needs storing.
+ *
+ * The tree must not change until an export finishes; the menu waits for a
+ * background job before any edit.
+ */
+
+#define LAYOUT_SEP 2           /* layout units between neighbours on a level */
+#define LAYOUT_UNIT 60         /* pixels (points in DOT) per layout unit */
+#define LAYOUT_LEVEL 70        /* pixels between levels */
+#define LAYOUT_BOX_W 112       /* node box, narrower than LAYOUT_SEP units */
+#define LAYOUT_BOX_H 24
+#define LAYOUT_MARGIN 10
+#define LAYOUT_LABEL 16        /* label bytes shown; the full text is the tooltip */
+#define LAYOUT_CHECK 4096      /* nodes between progress updates and cancel checks */
+#define LAYOUT_MAX_NODES (INT32_MAX / LAYOUT_SEP / 2)
+
+typedef struct {
+    int32_t *link;   /* question: its no child; leaf: -1, or -2 - thread target */
+    int32_t *off;    /* x relative to the parent */
+    int32_t *toff;   /* leaf with a thread: x of the target relative to it */
+    int32_t count, cap;
+    int64_t minX, maxX;
+    int height;
+} Layout;
+
+/* What a parent needs to know about a placed subtree: its lowest leftmost
+ * and rightmost nodes (where threads start) and its extent, with x
+ * relative to the subtree root. */
+typedef struct {
+    int32_t lo, hi;
+    int64_t loX, hiX;
+    int depth;       /* absolute depth of its lowest level */
+    int64_t minX, maxX;
+} Extent;
+
+typedef struct {
+    const Node *node;
+    int32_t idx;
+    int depth;
+    int state;       /* 0 new, 1 yes placed, 2 both placed */
+} PlaceFrame;
+
+typedef struct {
+    const Node *node;
+    int32_t parent;  /* -1 for the root */
+    int depth;
+    int64_t px;      /* the parent's absolute x */
+    int isYes;
+} DrawFrame;
+
+/* Shared by the synchronous and background entry points. */
+typedef struct {
+    long *done, *total;
+    const int *cancel;
+} LayoutProgress;
+
+static int cancelled(const LayoutProgress *pr, long nodes) {
+    if (pr == NULL || nodes % LAYOUT_CHECK != 0) return 0;
+    __atomic_store_n(pr->done, nodes, __ATOMIC_RELAXED);
+    return __atomic_load_n(pr->cancel, __ATOMIC_RELAXED);
+}
+
+static int is_cut(const Node *n, int depth, int maxDepth) {
+    return n->isQuestion && maxDepth >= 0 && depth >= maxDepth;
+}
+
+static int grow(void **p, size_t elem, int32_t *cap, int32_t need) {
+    if (need <= *cap) return 1;
+    int32_t nc = *cap ? *cap : 1024;
+    while (nc < need) nc = nc > LAYOUT_MAX_NODES / 2 ? LAYOUT_MAX_NODES : nc * 2;
+    void *q = realloc(*p, (size_t)nc * elem);
+    if (q == NULL) return 0;
+    *p = q;
+    *cap = nc;
+    return 1;
+}
+
+static int add_node(Layout *lay) {
+    if (lay->count == lay->cap) {
+        if (lay->cap == LAYOUT_MAX_NODES) return 0;
+        int32_t cap = lay->cap == 0 ? 1024 : lay->cap > LAYOUT_MAX_NODES / 2 ? LAYOUT_MAX_NODES : lay->cap * 2;
+        int32_t *link = realloc(lay->link, (size_t)cap * sizeof(int32_t));
+        if (link == NULL) return 0;
+        lay->link = link;
+        int32_t *off = realloc(lay->off, (size_t)cap * sizeof(int32_t));
+        if (off == NULL) return 0;
+        lay->off = off;
+        int32_t *toff = realloc(lay->toff, (size_t)cap * sizeof(int32_t));
+        if (toff == NULL) return 0;
+        lay->toff = toff;
+        lay->cap = cap;
+    }
+    lay->link[lay->count] = -1;
+    lay->off[lay->count] = 0;
+    lay->count++;
+    return 1;
+}
+
+/* Step v down its left or right contour. Returns 0 at the bottom. */
+static int contour_step(const Layout *lay, int32_t v, int right, int32_t *next, int64_t *dx) {
+    int32_t k = lay->link[v];
+    if (k >= 0) {
+        int32_t c = right ? k : v + 1;
+        *next = c;
+        *dx = lay->off[c];
+        return 1;
+    }
+    if (k == -1) return 0;
+    *next = -2 - k;
+    *dx = lay->toff[v];
+    return 1;
+}
+
+static void set_thread(Layout *lay, int32_t from, int32_t to, int64_t dx) {
+    lay->link[from] = -2 - to;
+    lay->toff[from] = (int32_t)dx;
+}
+
+/* Place the two subtrees of question v side by side; a and b are their
+ * extents, out receives v's. */
+static void place_children(Layout *lay, int32_t v, const Extent *a, const Extent *b, Extent *out) {
+    int32_t yes = v + 1, no = lay->link[v];
+    int32_t l = yes, r = no, nl = -1, nr = -1;
+    int64_t lx = 0, rx = 0, dl = 0, dr = 0;  // contour x relative to each subtree root
+    int64_t dist = LAYOUT_SEP;
+    int moreL, moreR;
+    for (;;) {
+        if (lx - rx + LAYOUT_SEP > dist) dist = lx - rx + LAYOUT_SEP;
+        moreL = contour_step(lay, l, 1, &nl, &dl);
+        moreR = contour_step(lay, r, 0, &nr, &dr);
+        if (!moreL || !moreR) break;
+        l = nl;
+        lx += dl;
+        r = nr;
+        rx += dr;
+    }
+    dist += dist & 1; // keep the parent on a whole unit
+    int64_t half = dist / 2;
+    lay->off[yes] = (int32_t)-half;
+    lay->off[no] = (int32_t)half;
+
+    /* the shallower side's outer contour continues into the deeper one */
+    if (moreL && !moreR) {
+        set_thread(lay, b->hi, nl, (-half + lx + dl) - (half + b->hiX));
+    } else if (moreR && !moreL) {
+        set_thread(lay, a->lo, nr, (half + rx + dr) - (-half + a->loX));
+    }
+
+    const Extent *left = b->depth > a->depth ? b : a;
+    const Extent *right = a->depth > b->depth ? a : b;
+    out->lo = left->lo;
+    out->loX = left->loX + (left == a ? -half : half);
+    out->hi = right->hi;
+    out->hiX = right->hiX + (right == a ? -half : half);
+    out->depth = a->depth > b->depth ? a->depth : b->depth;
+    out->minX = a->minX - half < 0 ? a->minX - half : 0;
+    if (b->minX + half < out->minX) out->minX = b->minX + half;
+    out->maxX = b->maxX + half > 0 ? b->maxX + half : 0;
+    if (a->maxX - half > out->maxX) out->maxX = a->maxX - half;
+}
+
+/* Pass 1: number the nodes and place every subtree. */
+static int place(const Node *root, int maxDepth, Layout *lay, const LayoutProgress *pr) {
+    PlaceFrame *stack = NULL;
+    Extent *ext = NULL;
+    int32_t stackCap = 0, extCap = 0;
+    int32_t sp = 0, ep = 0;
+    int ok = grow((void **)&stack, sizeof *stack, &stackCap, 1);
+    if (ok) stack[sp++] = (PlaceFrame){root, -1, 0, 0};
+
+    while (ok && sp > 0) {
+        PlaceFrame *f = &stack[sp - 1];
+        const Node *n = f->node;
+        if (f->state == 0) {
+            if (!add_node(lay) || cancelled(pr, lay->count)) {
+                ok = 0;
+                break;
+            }
+            f->idx = lay->count - 1;
+            if (f->depth > lay->height) lay->height = f->depth;
+            if (!n->isQuestion || is_cut(n, f->depth, maxDepth)) {
+                if (!grow((void **)&ext, sizeof *ext, &extCap, ep + 1)) {
+                    ok = 0;
+                    break;
+                }
+                ext[ep++] = (Extent){f->idx, f->idx, 0, 0, f->depth, 0, 0};
+                sp--;
+                continue;
+            }
+            f->state = 1;
+            PlaceFrame child = {n->yes, -1, f->depth + 1, 0};
+            if (!grow((void **)&stack, sizeof *stack, &stackCap, sp + 1)) {
+                ok = 0;
+                break;
+            }
+            stack[sp++] = child;
+        } else if (f->state == 1) {
+            lay->link[f->idx] = lay->count; // the no subtree starts here
+            f->state = 2;
+            PlaceFrame child = {n->no, -1, f->depth + 1, 0};
+            if (!grow((void **)&stack, sizeof *stack, &stackCap, sp + 1)) {
+                ok = 0;
+                break;
+            }
+            stack[sp++] = child;
+        } else {
+            Extent e;
+            place_children(lay, f->idx, &ext[ep - 2], &ext[ep - 1], &e);
+            ext[ep - 2] = e;
+            ep--;
+            sp--;
+        }
+    }
+    if (ok) {
+        lay->minX = ext[0].minX;
+        lay->maxX = ext[0].maxX;
+    }
+    free(stack);
+    free(ext);
+    return ok;
+}
+
+/* ---------- Output ---------- */
+
+/* Write at most max bytes of s (whole UTF-8 characters), escaped for XML
+ * or a DOT string. Control characters become spaces. */
+static void put_escaped(FILE *f, const char *s, size_t max, LayoutFormat format) {
+    size_t len = strlen(s);
+    if (len > max) {
+        while (max > 0 && ((unsigned char)s[max] & 0xc0) == 0x80) max--;
+        len = max;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20) c = ' ';
+        if (format == LAYOUT_SVG) {
+            if (c == '&') fputs("&amp;", f);
+            else if (c == '<') fputs("&lt;", f);
+            else if (c == '>') fputs("&gt;", f);
+            else if (c == '"') fputs("&quot;", f);
+            else fputc(c, f);
+        } else {
+            if (c == '"' || c == '\\') fputc('\\', f);
+            fputc(c, f);
+        }
+    }
+    if (strlen(s) > len) fputs("...", f);
+}
+
+static void write_header(FILE *f, const Layout *lay, LayoutFormat format) {
+    if (format == LAYOUT_DOT) {
+        fputs("digraph animals {\n"
+              "  node [shape=box, fontsize=10, fixedsize=true, width=1.55, height=0.33];\n"
+              "  edge [arrowhead=none];\n", f);
+        return;
+    }
+    int64_t width = (lay->maxX - lay->minX) * LAYOUT_UNIT + LAYOUT_BOX_W + 2 * LAYOUT_MARGIN;
+    int64_t height = (int64_t)lay->height * LAYOUT_LEVEL + LAYOUT_BOX_H + 2 * LAYOUT_MARGIN;
+    fprintf(f,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%lld\" height=\"%lld\" "
+            "viewBox=\"0 0 %lld %lld\" font-family=\"sans-serif\" font-size=\"11\" text-anchor=\"middle\">\n"
+            "<style>rect{stroke:#333;rx:4px}.q rect{fill:#fff3b0}.a rect{fill:#c8f0c0}"
+            ".c rect{fill:#fff3b0;stroke-dasharray:4 3}line{stroke-width:1.5}.y{stroke:#2a8a2a}.n{stroke:#b03030}</style>\n",
+            (long long)width, (long long)height, (long long)width, (long long)height);
+}
+
+/* One node and the edge from its parent. */
+static void write_node(FILE *f, const Layout *lay, const DrawFrame *d, int32_t idx, int64_t x, int cut,
+                       LayoutFormat format) {
+    const Node *n = d->node;
+    if (format == LAYOUT_DOT) {
+        fprintf(f, "  n%d [label=\"", idx);
+        put_escaped(f, n->text, LAYOUT_LABEL, format);
+        fputs("\", tooltip=\"", f);
+        put_escaped(f, n->text, SIZE_MAX, format);
+        fprintf(f, "\", pos=\"%lld,%lld!\"%s];\n", (long long)((x - lay->minX) * LAYOUT_UNIT),
+                -(long long)d->depth * LAYOUT_LEVEL,
+                cut ? ", style=dashed" : n->isQuestion ? "" : ", style=filled, fillcolor=\"#c8f0c0\"");
+        if (d->parent >= 0) {
+            fprintf(f, "  n%d -> n%d [label=\"%s\"];\n", d->parent, idx, d->isYes ? "yes" : "no");
+        }
+        return;
+    }
+    long long cx = (x - lay->minX) * LAYOUT_UNIT + LAYOUT_MARGIN + LAYOUT_BOX_W / 2;
+    long long cy = (long long)d->depth * LAYOUT_LEVEL + LAYOUT_MARGIN + LAYOUT_BOX_H / 2;
+    if (d->parent >= 0) {
+        long long px = (d->px - lay->minX) * LAYOUT_UNIT + LAYOUT_MARGIN + LAYOUT_BOX_W / 2;
+        fprintf(f, "<line class=\"%c\" x1=\"%lld\" y1=\"%lld\" x2=\"%lld\" y2=\"%lld\"/>\n", d->isYes ? 'y' : 'n',
+                px, cy - LAYOUT_LEVEL + LAYOUT_BOX_H / 2, cx, cy - LAYOUT_BOX_H / 2);
+    }
+    fprintf(f, "<g class=\"%c\"><title>", cut ? 'c' : n->isQuestion ? 'q' : 'a');
+    put_escaped(f, n->text, SIZE_MAX, format);
+    fprintf(f, "</title><rect x=\"%lld\" y=\"%lld\" width=\"%d\" height=\"%d\"/><text x=\"%lld\" y=\"%lld\">",
+            cx - LAYOUT_BOX_W / 2, cy - LAYOUT_BOX_H / 2, LAYOUT_BOX_W, LAYOUT_BOX_H, cx, cy + 4);
+    put_escaped(f, n->text, LAYOUT_LABEL, format);
+    fputs("</text></g>\n", f);
+}
+
+/* Pass 2: sum the offsets down the tree and write as we go. */
+static int draw(const Node *root, const Layout *lay, const LayoutOptions *opt, FILE *f, const LayoutProgress *pr) {
+    DrawFrame *stack = NULL;
+    int32_t cap = 0, sp = 0, next = 0;
+    int ok = grow((void **)&stack, sizeof *stack, &cap, 1);
+    if (ok) stack[sp++] = (DrawFrame){root, -1, 0, 0, 0};
+    write_header(f, lay, opt->format);
+
+    while (ok && sp > 0) {
+        DrawFrame d = stack[--sp];
+        int32_t idx = next++;
+        int64_t x = d.px + lay->off[idx];
+        int cut = is_cut(d.node, d.depth, opt->maxDepth);
+        write_node(f, lay, &d, idx, x, cut, opt->format);
+        if (cancelled(pr, (long)lay->count + next) || ferror(f)) {
+            ok = 0;
+            break;
+        }
+        if (!d.node->isQuestion || cut) continue;
+        if (!grow((void **)&stack, sizeof *stack, &cap, sp + 2)) {
+            ok = 0;
+            break;
+        }
+        stack[sp++] = (DrawFrame){d.node->no, idx, d.depth + 1, x, 0};
+        stack[sp++] = (DrawFrame){d.node->yes, idx, d.depth + 1, x, 1}; // popped first: preorder
+    }
+    free(stack);
+    if (ok) fputs(opt->format == LAYOUT_DOT ? "}\n" : "</svg>\n", f);
+    return ok && !ferror(f);
+}
+
+static int layout_run(const Node *root, FILE *f, const LayoutOptions *opt, const LayoutProgress *pr) {
+    if (root == NULL) return 0;
+    Layout lay;
+    memset(&lay, 0, sizeof lay);
+    int ok = place(root, opt->maxDepth, &lay, pr);
+    if (ok && pr) __atomic_store_n(pr->total, 2L * lay.count, __ATOMIC_RELAXED);
+    ok = ok && draw(root, &lay, opt, f, pr);
+    if (ok && pr) __atomic_store_n(pr->done, 2L * lay.count, __ATOMIC_RELAXED);
+    free(lay.link);
+    free(lay.off);
+    free(lay.toff);
+    return ok;
+}
+
+/* Write the layout of root (down to opt->maxDepth, or all of it when
+ * negative) to f. Returns 0 for an empty tree, out of memory or a write
+ * error. */
+int layout_write(const Node *root, FILE *f, const LayoutOptions *opt) {
+    return layout_run(root, f, opt, NULL);
+}
+
+/* ---------- Background export ---------- */
+
+static void *layout_thread(void *arg) {
+    LayoutJob *job = arg;
+    LayoutProgress pr = {&job->done, &job->total, &job->cancel};
+    FILE *f = fopen(job->path, "w");
+    int ok = f != NULL && layout_run(job->root, f, &job->opt, &pr);
+    if (f != NULL && fclose(f) != 0) ok = 0;
+    if (!ok && f != NULL) remove(job->path); // no half-written drawings
+    job->result = ok;
+    __atomic_store_n(&job->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Start writing the layout of root to path on a thread of its own.
+ * Returns 0 if it could not be started. */
+int layout_start(LayoutJob *job, const Node *root, const char *path, const LayoutOptions *opt) {
+    memset(job, 0, sizeof *job);
+    job->root = root;
+    job->opt = *opt;
+    job->path = strdup(path);
+    if (job->path == NULL) return 0;
+    if (pthread_create(&job->thread, NULL, layout_thread, job) != 0) {
+        free(job->path);
+        job->path = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* 1 once the job has stopped; layout_wait will not block. */
+int layout_finished(const LayoutJob *job) {
+    return __atomic_load_n(&job->finished, __ATOMIC_ACQUIRE);
+}
+
+/* Nodes processed so far over both passes, and the total (0 until the
+ * first pass has counted them). */
+void layout_progress(const LayoutJob *job, long *done, long *total) {
+    *done = __atomic_load_n(&job->done, __ATOMIC_RELAXED);
+    *total = __atomic_load_n(&job->total, __ATOMIC_RELAXED);
+}
+
+/* Ask the job to stop early; its file is removed. */
+void layout_cancel(LayoutJob *job) {
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+/* Wait for the job and release it. Returns 1 if the file was written. */
+int layout_wait(LayoutJob *job) {
+    pthread_join(job->thread, NULL);
+    free(job->path);
+    job->path = NULL;
+    return job->result;
+}
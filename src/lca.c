@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Lowest Common Ancestors ==========
+ * Answers "where do these two animals part ways" in O(1) per pair.
+ *
+ * The build lays the tree out in preorder and records every position's
+ * depth and parent. For two leaves at positions u < v, every node in
+ * (u, v] lies below their lowest common ancestor, and the shallowest of
+ * them is the child of that ancestor on v's side. So the ancestor is the
+ * parent of the range minimum of depth over (u, v].
+ *
+ * Range minima come from a linear-space RMQ: positions are grouped in
+ * blocks of 64, a sparse table covers whole blocks, and inside a block a
+ * 64-bit mask per position encodes the stack of increasing minima ending
+ * there, so a partial block is one mask and one count-leading-zeros.
+ *
+ * Edits are not laid out: inserting two positions would shift all the
+ * later ones. Every edit splits or restores a leaf, so the animals an
+ * edit touches stay anchored at the position of the snapshot leaf they
+ * grew from, and the hooks only move ids between "at their own position"
+ * and "somewhere under this anchor". Pairs under different anchors part
+ * where the anchors do; pairs under one anchor meet by walking parent
+ * links inside the small subtree grown there. After LCA_OVERLAY_MAX edits
+ * (or an undo of an edit older than the layout) the next query rebuilds
+ * in O(n), so a rebuild is paid for by that many edits.
+ */
+
+#define LCA_BLOCK 64
+#define LCA_OVERLAY_MAX 1024
+
+typedef struct {
+    Node *node;
+    Node *parent;
+    int depth;
+} LcaFrame;
+
+static int posCount = 0, posCap = 0;
+static int *depthAt = NULL;         /* depth of the node at each position */
+static Node **parentAt = NULL;      /* its parent (NULL for the root) */
+static uint64_t *stackMask = NULL;  /* in-block minima stack ending here */
+static int *leafPos = NULL;         /* animal id -> position; -1 not in the
+                                     * tree, -2 - anchor if moved by an edit */
+static int leafCount = 0;
+static int *blockMin = NULL;        /* [level * nblocks + b]: position of the
+                                     * minimum of blocks [b, b + 2^level) */
+static int nblocks = 0;
+static Node **grown = NULL;         /* questions edits added since the build */
+static int grownCount = 0;
+static int valid = 0;
+
+/* The tree changed wholesale; the next query rebuilds. */
+void path_invalidate(void) {
+    valid = 0;
+}
+
+static void lca_free(void) {
+    free(depthAt);
+    free(parentAt);
+    free(stackMask);
+    free(leafPos);
+    free(blockMin);
+    free(grown);
+    depthAt = NULL;
+    parentAt = NULL;
+    stackMask = NULL;
+    leafPos = NULL;
+    blockMin = NULL;
+    grown = NULL;
+    posCount = posCap = leafCount = nblocks = grownCount = 0;
+}
+
+static int min_pos(int a, int b) {
+    return depthAt[b] < depthAt[a] ? b : a;
+}
+
+static int lca_reserve(void) {
+    if (posCount < posCap) return 1;
+    int newCap = posCap ? posCap * 2 : 1024;
+    int *nd = realloc(depthAt, (size_t)newCap * sizeof(int));
+    if (nd == NULL) return 0;
+    depthAt = nd;
+    Node **np = realloc(parentAt, (size_t)newCap * sizeof(Node *));
+    if (np == NULL) return 0;
+    parentAt = np;
+    posCap = newCap;
+    return 1;
+}
+
+/* Preorder layout of g_root plus the RMQ tables. */
+static int lca_build(void) {
+    lca_free();
+    if (g_root == NULL) {
+        valid = 1;
+        return 1;
+    }
+    leafCount = index_animal_count();
+    leafPos = malloc((size_t)(leafCount ? leafCount : 1) * sizeof(int));
+    int cap = 64, top = 0;
+    LcaFrame *stack = malloc((size_t)cap * sizeof(LcaFrame));
+    if (leafPos == NULL || stack == NULL) {
+        free(stack);
+        lca_free();
+        return 0;
+    }
+    for (int i = 0; i < leafCount; i++) leafPos[i] = -1;
+
+    stack[top++] = (LcaFrame){g_root, NULL, 0};
+    while (top > 0) {
+        LcaFrame f = stack[--top];
+        if (!lca_reserve()) {
+            free(stack);
+            lca_free();
+            return 0;
+        }
+        int pos = posCount++;
+        depthAt[pos] = f.depth;
+        parentAt[pos] = f.parent;
+        Node *n = f.node;
+        if (!n->isQuestion) {
+            if (n->id >= 0 && n->id < leafCount && index_animal(n->id) == n) leafPos[n->id] = pos;
+            continue;
+        }
+        if (top + 2 > cap) {
+            LcaFrame *ns = realloc(stack, (size_t)cap * 2 * sizeof(LcaFrame));
+            if (ns == NULL) {
+                free(stack);
+                lca_free();
+                return 0;
+            }
+            stack = ns;
+            cap *= 2;
+        }
+        if (n->no) stack[top++] = (LcaFrame){n->no, n, f.depth + 1};
+        if (n->yes) stack[top++] = (LcaFrame){n->yes, n, f.depth + 1};
+    }
+    free(stack);
+
+    /* in-block stacks: bit k of stackMask[i] is set when position i - k is
+     * on the stack of strictly increasing depths ending at i */
+    stackMask = malloc((size_t)posCount * sizeof(uint64_t));
+    nblocks = (posCount + LCA_BLOCK - 1) / LCA_BLOCK;
+    int levels = 1;
+    while ((1 << levels) <= nblocks) levels++;
+    blockMin = malloc((size_t)levels * (size_t)nblocks * sizeof(int));
+    if (stackMask == NULL || blockMin == NULL) {
+        lca_free();
+        return 0;
+    }
+    for (int b = 0; b < nblocks; b++) {
+        int start = b * LCA_BLOCK;
+        int end = start + LCA_BLOCK < posCount ? start + LCA_BLOCK : posCount;
+        uint64_t cur = 0;
+        int best = start;
+        for (int i = start; i < end; i++) {
+            cur <<= 1;
+            while (cur && depthAt[i - __builtin_ctzll(cur)] >= depthAt[i]) cur &= cur - 1;
+            stackMask[i] = cur |= 1;
+            best = min_pos(best, i);
+        }
+        blockMin[b] = best;
+    }
+    for (int l = 1; l < levels; l++) {
+        int *prev = blockMin + (size_t)(l - 1) * nblocks, *row = blockMin + (size_t)l * nblocks;
+        for (int b = 0; b + (1 << l) <= nblocks; b++) {
+            row[b] = min_pos(prev[b], prev[b + (1 << (l - 1))]);
+        }
+    }
+    valid = 1;
+    return 1;
+}
+
+/* Position of the minimum depth in [l, r] when both lie in one block. */
+static int in_block_min(int l, int r) {
+    uint64_t m = stackMask[r];
+    if (r - l < 63) m &= (2ull << (r - l)) - 1; // drop entries before l
+    return r - (63 - __builtin_clzll(m));
+}
+
+static int range_min(int l, int r) {
+    int bl = l / LCA_BLOCK, br = r / LCA_BLOCK;
+    if (bl == br) return in_block_min(l, r);
+    int best = min_pos(in_block_min(l, bl * LCA_BLOCK + LCA_BLOCK - 1), in_block_min(br * LCA_BLOCK, r));
+    if (br - bl > 1) {
+        int from = bl + 1, count = br - bl - 1;
+        int level = 31 - __builtin_clz((unsigned)count);
+        int *row = blockMin + (size_t)level * nblocks;
+        best = min_pos(best, min_pos(row[from], row[br - (1 << level)]));
+    }
+    return best;
+}
+
+/* ---------- Edits ---------- */
+
+/* Position of animal id, or for a moved one (*moved = 1) the position of
+ * the leaf it is anchored under; -1 if it is not in the tree. */
+static int anchor_of(int id, int *moved) {
+    int v = id >= 0 && id < leafCount ? leafPos[id] : -1;
+    *moved = v < -1;
+    return v < -1 ? -2 - v : v;
+}
+
+static int set_anchor(int id, int anchor) {
+    if (id >= leafCount) {
+        int newCount = leafCount * 2 > id + 1 ? leafCount * 2 : id + 1;
+        int *np = realloc(leafPos, (size_t)newCount * sizeof(int));
+        if (np == NULL) return 0;
+        for (int i = leafCount; i < newCount; i++) np[i] = -1;
+        leafPos = np;
+        leafCount = newCount;
+    }
+    leafPos[id] = -2 - anchor;
+    return 1;
+}
+
+/* A leaf was split: both leaves now hang under the old leaf's anchor. */
+void path_on_learn(const Edit *e) {
+    if (!valid) return;
+    int moved, anchor = anchor_of(e->oldLeaf->id, &moved);
+    if (grown == NULL) grown = malloc(LCA_OVERLAY_MAX * sizeof(Node *));
+    if (anchor < 0 || grown == NULL || grownCount == LCA_OVERLAY_MAX || e->newLeaf->id < 0 ||
+        !set_anchor(e->oldLeaf->id, anchor) || !set_anchor(e->newLeaf->id, anchor)) {
+        valid = 0;
+        return;
+    }
+    grown[grownCount++] = e->newQuestion;
+}
+
+/* newQuestion was unlinked: its new leaf leaves the tree and the old leaf
+ * keeps its anchor. An edit older than the layout moves laid-out
+ * positions, so that one rebuilds. */
+void path_on_undo(const Edit *e) {
+    if (!valid) return;
+    int i = grownCount - 1;
+    while (i >= 0 && grown[i] != e->newQuestion) i--;
+    if (i < 0) {
+        valid = 0;
+        return;
+    }
+    grown[i] = grown[--grownCount];
+    if (e->newLeaf->id >= 0 && e->newLeaf->id < leafCount) leafPos[e->newLeaf->id] = -1;
+}
+
+void path_on_redo(const Edit *e) {
+    path_on_learn(e);
+}
+
+/* ---------- Queries ---------- */
+
+/* Edges from n up to the node that stands at its anchor. */
+static int climb(const Node *n, int anchor) {
+    int steps = 0;
+    for (; n->parent != parentAt[anchor]; n = n->parent) steps++;
+    return steps;
+}
+
+static void answer(int a, int b, PathInfo *out) {
+    int movedA, movedB;
+    int pa = anchor_of(a, &movedA), pb = anchor_of(b, &movedB);
+    if (pa < 0 || pb < 0) {
+        out->split = NULL;
+        out->distance = -1;
+    } else if (a == b) {
+        out->split = NULL;
+        out->distance = 0;
+    } else if (pa == pb) { // both grew from one leaf: meet inside that subtree
+        const Node *x = index_animal(a), *y = index_animal(b);
+        int hx = climb(x, pa), hy = climb(y, pb), distance = 0;
+        for (; hx > hy; hx--, distance++) x = x->parent;
+        for (; hy > hx; hy--, distance++) y = y->parent;
+        for (; x != y; distance += 2) {
+            x = x->parent;
+            y = y->parent;
+        }
+        out->split = (Node *)x;
+        out->distance = distance;
+    } else {
+        int m = pa < pb ? range_min(pa + 1, pb) : range_min(pb + 1, pa);
+        int da = depthAt[pa] + (movedA ? climb(index_animal(a), pa) : 0);
+        int db = depthAt[pb] + (movedB ? climb(index_animal(b), pb) : 0);
+        out->split = parentAt[m];
+        out->distance = da + db - 2 * (depthAt[m] - 1);
+    }
+}
+
+/* Where animals a and b (ids, see index_animal) part ways. Returns 1 if
+ * both are in the tree. */
+int path_query(int a, int b, PathInfo *out) {
+    if (!valid && !lca_build()) return 0;
+    answer(a, b, out);
+    return out->distance >= 0;
+}
+
+/* path_query for count pairs (pairs[2i], pairs[2i + 1]) -> out[i].
+ * Returns how many pairs had both animals in the tree. */
+long path_query_batch(const int *pairs, long count, PathInfo *out) {
+    if (!valid && !lca_build()) return 0;
+    long found = 0;
+    for (long i = 0; i < count; i++) {
+        /* random pairs miss the cache at every step: fetch the leaf
+         * positions well ahead and the tables they point at closer in */
+        if (i + 16 < count) {
+            for (int k = 0; k < 2; k++) {
+                int id = pairs[2 * (i + 16) + k];
+                if (id >= 0 && id < leafCount) __builtin_prefetch(&leafPos[id]);
+            }
+        }
+        if (i + 8 < count) {
+            for (int k = 0; k < 2; k++) {
+                int id = pairs[2 * (i + 8) + k];
+                int pos = id >= 0 && id < leafCount ? leafPos[id] : -1;
+                if (pos >= 0) {
+                    __builtin_prefetch(&stackMask[pos]);
+                    __builtin_prefetch(&stackMask[pos | (LCA_BLOCK - 1)]);
+                    __builtin_prefetch(&depthAt[pos]);
+                }
+            }
+        }
+        answer(pairs[2 * i], pairs[2 * i + 1], &out[i]);
+        found += out[i].distance >= 0;
+    }
+    return found;
+}
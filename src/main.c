@@ -22,6 +22,8 @@
 #include <ncurses.h>
 #include "lab5.h"
 
+char *strdup(const char *s);
+
 /* Global root node */
 Node *g_root = NULL;
 
@@ -30,7 +32,7 @@ EditStack g_undo = {NULL, 0, 0};
 EditStack g_redo = {NULL, 0, 0};
 
 /* Global attribute index */
-Hash g_index = {NULL, 0, 0};
+Hash g_index = {NULL, 0, 0, NULL, 0, 0, NULL};
 
 /* GUI Colors */
 #define COLOR_HEADER 1
@@ -80,7 +82,8 @@ void display_header() {
 void display_menu() {
     int row = LINES - 3;
     attron(COLOR_PAIR(COLOR_HEADER));
-    mvprintw(row, 2, "[P]lay | [V]iew Tree | [U]ndo | [R]edo | [S]ave | [L]oad | [I]ntegrity | [Q]uit");
+    mvprintw(row, 2, "[P]lay | [V]iew | [A]ttributes | [D]iff | [U]ndo | [R]edo | [S]ave | [L]oad");
+    mvprintw(row + 1, 2, "[I]ntegrity | [C]hanges | [T]ree stats | [E]xport | [Q]uit"); // fits 80 columns
     attroff(COLOR_PAIR(COLOR_HEADER));
 }
 
@@ -130,11 +133,286 @@ void initialize_tree() {
     water->no = create_animal_node("Dog");
     g_root = water;
     
+    /* Link parents, number the animals and index every question */
+    index_rebuild();
+}
+
+/* List every animal that answers a question a given way, straight from the
+ * attribute index (no tree walk). */
+void show_attribute_query() {
+    erase();
+    display_header();
+    draw_box(2, 1, LINES - 6, COLS - 2, "Attribute Query");
+
+    char *input = get_input(4, 3, "Question: ");
+    if (input[0] == '\0') return;
+    char *question = strdup(input); // get_input reuses its buffer
+    if (question == NULL) return;
+    int yes = get_yes_no(5, 3, "Animals that answer yes? (y/n): ");
+
+    IdList ids;
+    idl_init(&ids);
+    int n = index_query(question, yes, &ids);
+    int *arr = idl_to_array(&ids);
+
+    mvprintw(7, 3, "%d animal(s) answer '%s' to \"%s\"", n, yes ? "yes" : "no", question);
+    int row = 9;
+    for (int i = 0; i < n && row < LINES - 8; i++, row++) {
+        Node *animal = index_animal(arr[i]);
+        mvprintw(row, 5, "%s", animal ? animal->text : "?");
+    }
+    if (n > row - 9) {
+        mvprintw(row, 5, "... and %d more", n - (row - 9));
+    }
+
+    mvprintw(LINES - 6, 3, "Press any key to return...");
+    refresh();
+    getch();
+    idl_free(&ids);
+    free(question);
+}
+
+/* The questions that tell two animals apart, from where their games part
+ * ways down to each of them. */
+void show_animal_path() {
+    erase();
+    display_header();
+    draw_box(2, 1, LINES - 6, COLS - 2, "Tell Two Animals Apart");
+
+    char *input = get_input(4, 3, "First animal: ");
+    if (input[0] == '\0') return;
+    char *first = strdup(input); // get_input reuses its buffer
+    if (first == NULL) return;
+    input = get_input(5, 3, "Second animal: ");
+
+    AnimalPath path;
+    if (!find_shortest_path(first, input, &path)) {
+        free(first);
+        show_message("Unknown animal!", 1);
+        return;
+    }
+    free(first);
+    int row = 7;
+    if (path.split == NULL) {
+        mvprintw(row++, 3, "\"%s\" is the same animal", path.leaf[0]->text);
+    } else {
+        mvprintw(row++, 3, "%d step(s) apart, parting at \"%.60s\"", path.distance, path.split->text);
+    }
+    for (int k = 0; k < 2 && path.split; k++) {
+        row++;
+        mvprintw(row++, 3, "%s:", path.leaf[k]->text);
+        const FrameStack *b = &path.branch[k];
+        for (int i = 0; i < b->size && row < LINES - 8; i++, row++) {
+            mvprintw(row, 5, "%.64s %s", b->frames[i].node->text, b->frames[i].answeredYes ? "yes" : "no");
+        }
+    }
+    animal_path_free(&path);
+
+    mvprintw(LINES - 6, 3, "Press any key to return...");
+    refresh();
+    getch();
+}
+
+/* Run the full integrity check, or check only the nodes edited since the
+ * last check, and say where the first fault is. */
+void show_integrity_report(int changesOnly) {
+    IntegrityReport rep;
+    char msg[256];
+    int ok = changesOnly ? check_changes(&rep) : check_integrity_report(g_root, 0, &rep);
+    if (ok) {
+        snprintf(msg, sizeof msg, "%s check passed! (%ld nodes)",
+                 changesOnly ? "Changed nodes" : "Tree integrity", rep.visited);
+    } else if (rep.node) {
+        snprintf(msg, sizeof msg, "Integrity check failed: %s at \"%.30s\" (path: %.20s%s)",
+                 integrity_error_str(rep.error), rep.node->text,
+                 rep.path && rep.path[0] ? rep.path : "root",
+                 rep.path && strlen(rep.path) > 20 ? "..." : "");
+    } else {
+        snprintf(msg, sizeof msg, "Integrity check failed: %s", integrity_error_str(rep.error));
+    }
+    integrity_report_free(&rep);
+    show_message(msg, !ok);
+}
+
+/* Counts, depth histogram, path lengths and imbalance of the tree. */
+void show_tree_stats() {
+    TreeStats st;
+    int ok = tree_stats(g_root, 0, &st);
+    erase();
+    display_header();
+    draw_box(2, 1, LINES - 6, COLS - 2, "Tree Statistics");
+    if (!ok) {
+        tree_stats_free(&st);
+        show_message("Error: out of memory gathering statistics!", 1);
+        return;
+    }
+
+    mvprintw(4, 3, "Nodes: %ld (%ld questions, %ld animals)", st.nodes, st.questions, st.animals);
+    mvprintw(5, 3, "Questions per game: %.2f on average, %d at most", st.avgDepth, st.height);
+    mvprintw(6, 3, "Imbalance: max %d, average %.2f, %ld question(s) off by more than 1",
+             st.maxImbalance, st.avgImbalance, st.unbalanced);
+    if (st.worst && st.maxImbalance > 1) {
+        mvprintw(7, 5, "worst at \"%.60s\"", st.worst->text);
+    }
+    mvprintw(8, 3, "Text: %zu bytes of questions, %zu bytes of animal names",
+             st.questionBytes, st.animalBytes);
+
+    /* depth histogram, one bar per depth, scaled to the widest */
+    long most = 1;
+    for (int d = 0; d <= st.height; d++) {
+        if (st.depthHist[d] > most) most = st.depthHist[d];
+    }
+    int width = COLS - 24 > 10 ? COLS - 24 : 10;
+    int row = 10, last = LINES - 8;
+    mvprintw(row++, 3, "Animals by depth:");
+    for (int d = 0; d <= st.height && row < last; d++, row++) {
+        int bar = (int)((double)st.depthHist[d] * width / most);
+        if (bar == 0 && st.depthHist[d] > 0) bar = 1;
+        mvprintw(row, 5, "%4d %8ld ", d, st.depthHist[d]);
+        attron(COLOR_PAIR(COLOR_SUCCESS));
+        for (int i = 0; i < bar; i++) addch(' ' | A_REVERSE);
+        attroff(COLOR_PAIR(COLOR_SUCCESS));
+    }
+    if (row == last && st.height >= last - 11) {
+        mvprintw(row, 5, "... %d deeper level(s)", st.height - (last - 11) + 1);
+    }
+
+    mvprintw(LINES - 6, 3, "Press any key to return...");
+    refresh();
+    getch();
+    tree_stats_free(&st);
+}
+
+/* Headless: print the statistics of the tree in file (animals.dat by
+ * default) as JSON on stdout. */
+static int print_stats_json(const char *file) {
+    if (!load_tree(file)) {
+        fprintf(stderr, "cannot load %s\n", file);
+        return 1;
+    }
+    TreeStats st;
+    int ok = tree_stats(g_root, 0, &st);
+    if (ok) tree_stats_json(&st, stdout);
+    else fprintf(stderr, "out of memory\n");
+    tree_stats_free(&st);
+    free_tree(g_root);
+    h_free(&g_index);
+    return ok ? 0 : 1;
+}
+
+/* Headless: compile the tree in file into a standalone C classifier whose
+ * symbols start with prefix, written to out. */
+static int emit_classifier(const char *out, const char *file, const char *prefix) {
+    if (!load_tree(file)) {
+        fprintf(stderr, "cannot load %s\n", file);
+        return 1;
+    }
+    const DecisionProgram *p = prog_current();
+    FILE *f = fopen(out, "w");
+    int ok = p != NULL && f != NULL && prog_emit_c(p, f, prefix, file);
+    if (f != NULL && fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "cannot write %s\n", out);
+    free_tree(g_root);
+    h_free(&g_index);
+    return ok ? 0 : 1;
+}
+
+/* LAYOUT_DOT for a .dot or .gv file name, else LAYOUT_SVG. */
+static LayoutFormat layout_format_for(const char *out) {
+    const char *dot = strrchr(out, '.');
+    return dot && (strcmp(dot, ".dot") == 0 || strcmp(dot, ".gv") == 0) ? LAYOUT_DOT : LAYOUT_SVG;
+}
+
+/* Headless: draw the tree in file down to maxDepth (-1 for all of it) as
+ * SVG or DOT, chosen by the extension of out. */
+static int export_layout(const char *out, const char *file, int maxDepth) {
+    if (!load_tree(file)) {
+        fprintf(stderr, "cannot load %s\n", file);
+        return 1;
+    }
+    LayoutOptions opt = {layout_format_for(out), maxDepth};
+    FILE *f = fopen(out, "w");
+    int ok = f != NULL && layout_write(g_root, f, &opt);
+    if (f != NULL && fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "cannot write %s\n", out);
+    free_tree(g_root);
+    h_free(&g_index);
+    return ok ? 0 : 1;
+}
+
+/* Headless: serve the tree in file (the built-in one if not given) to
+ * players over the UNIX socket at path until interrupted. */
+static int serve_tree(const char *path, const char *file) {
+    es_init(&g_undo);
+    es_init(&g_redo);
+    if (file == NULL) {
+        initialize_tree();
+    } else if (!load_tree(file)) {
+        fprintf(stderr, "cannot load %s\n", file);
+        return 1;
+    }
+    int status = server_run(path);
+    free_tree(g_root);
     h_free(&g_index);
-    h_init(&g_index, 31);
+    es_free(&g_undo);
+    es_free(&g_redo);
+    return status;
+}
+
+/* Games, undos and redos are recorded here after --record FILE. */
+static Recorder recorder;
+static int recording = 0;
+
+static void stop_recording() {
+    if (!recording) return;
+    play_set_recorder(NULL);
+    recording = 0;
+    if (!rec_close(&recorder)) show_message("Error: the recording is incomplete!", 1);
+}
+
+/* The menu's background layout export (see layout.c). */
+static LayoutJob layoutJob;
+static int layoutState = 0;  /* 0 none, 1 running, 2 written, 3 failed */
+
+static void start_layout() {
+    LayoutOptions opt = {LAYOUT_SVG, -1};
+    if (layoutState == 1) {
+        show_message("A layout export is already running.", 1);
+    } else if (layout_start(&layoutJob, g_root, "animals.svg", &opt)) {
+        layoutState = 1;
+    } else {
+        show_message("Error: cannot start the layout export!", 1);
+    }
+}
+
+/* The export reads the tree, so it must end before the tree changes. */
+static void finish_layout() {
+    if (layoutState != 1) return;
+    if (!layout_finished(&layoutJob)) {
+        mvprintw(LINES - 5, 2, "%-76s", "Finishing the layout export...");
+        refresh();
+    }
+    layoutState = layout_wait(&layoutJob) ? 2 : 3;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+        return print_stats_json(argc > 2 ? argv[2] : "animals.dat");
+    }
+    if (argc > 2 && strcmp(argv[1], "--emit-c") == 0) {
+        return emit_classifier(argv[2], argc > 3 ? argv[3] : "animals.dat", argc > 4 ? argv[4] : "animals");
+    }
+    if (argc > 2 && strcmp(argv[1], "--layout") == 0) {
+        return export_layout(argv[2], argc > 3 ? argv[3] : "animals.dat", argc > 4 ? atoi(argv[4]) : -1);
+    }
+    if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+        return serve_tree(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    const char *recordFile = NULL;
+    if (argc > 2 && strcmp(argv[1], "--record") == 0) {
+        recordFile = argv[2];
+    }
+
     init_gui();
     
     /* Initialize undo/redo stacks FIRST */
@@ -149,16 +427,29 @@ int main() {
     es_init(&g_redo);
     
     initialize_tree();
+    if (recordFile) {
+        recording = rec_create(&recorder, recordFile);
+        if (recording) play_set_recorder(&recorder);
+        else show_message("Error: cannot record to that file!", 1);
+    }
     
     int running = 1;
     while (running) {
-        clear();
+        /* erase, not clear: refresh then sends only what changed since the
+         * last frame instead of wiping and repainting the whole terminal */
+        erase();
         display_header();
         draw_box(2, 1, LINES - 6, COLS - 2, "Game Status");
         display_menu();
         
         mvprintw(4, 3, "Tree nodes: %d", g_root ? count_nodes(g_root) : 0);
         mvprintw(5, 3, "Undo stack: %d | Redo stack: %d", g_undo.size, g_redo.size);
+        int pending = integrity_pending();
+        if (pending > 0) {
+            mvprintw(6, 3, "Unchecked changes: %d node(s)", pending);
+        } else if (pending < 0) {
+            mvprintw(6, 3, "Unchecked changes: many (next check is a full one)");
+        }
         
         if (g_root == NULL) {
             attron(COLOR_PAIR(COLOR_ERROR));
@@ -167,29 +458,56 @@ int main() {
         } else {
             mvprintw(7, 3, "Choose an option:");
         }
+        if (layoutState == 1 && layout_finished(&layoutJob)) {
+            layoutState = layout_wait(&layoutJob) ? 2 : 3;
+        }
+        if (layoutState == 1) {
+            long done, total;
+            layout_progress(&layoutJob, &done, &total);
+            if (total > 0) mvprintw(9, 3, "Exporting layout to animals.svg: %ld%%", done * 100 / total);
+            else mvprintw(9, 3, "Exporting layout to animals.svg: placing %ld nodes", done);
+        } else if (layoutState == 2) {
+            mvprintw(9, 3, "Layout written to animals.svg");
+        } else if (layoutState == 3) {
+            mvprintw(9, 3, "Layout export failed");
+        }
         refresh();
         
+        timeout(layoutState == 1 ? 250 : -1); // keep the progress moving
         int ch = getch();
+        timeout(-1);
         
         switch (tolower(ch)) {
             case 'p':
+                finish_layout(); // the export reads the tree this changes
                 if (g_root == NULL) {
                     show_message("Error: Tree not initialized! Implement TODOs 1-2 first.", 1);
                 } else {
                     play_game();
                 }
+                break;
             case 'v':
                 draw_tree();
                 break;
+            case 'a':
+                show_attribute_query();
+                break;
+            case 'd':
+                show_animal_path();
+                break;
             case 'u':
+                finish_layout();
                 if (undo_last_edit()) {
+                    if (recording) rec_write_edit(&recorder, 0);
                     show_message("Undo successful!", 0);
                 } else {
                     show_message("Nothing to undo!", 1);
                 }
                 break;
             case 'r':
+                finish_layout();
                 if (redo_last_edit()) {
+                    if (recording) rec_write_edit(&recorder, 1);
                     show_message("Redo successful!", 0);
                 } else {
                     show_message("Nothing to redo!", 1);
@@ -205,6 +523,8 @@ int main() {
                 }
                 break;
             case 'l':
+                finish_layout();
+                stop_recording(); // the log can only replay from one tree
                 if (load_tree("animals.dat")) {
                     show_message("Tree loaded successfully!", 0);
                 } else {
@@ -214,18 +534,39 @@ int main() {
             case 'i':
                 if (g_root == NULL) {
                     show_message("Error: No tree to check! Initialize tree first.", 1);
-                } else if (check_integrity()) {
-                    show_message("Tree integrity check passed!", 0);
                 } else {
-                    show_message("Tree integrity check failed!", 1);
+                    show_integrity_report(0);
+                }
+                break;
+            case 'c':
+                if (g_root == NULL) {
+                    show_message("Error: No tree to check! Initialize tree first.", 1);
+                } else {
+                    show_integrity_report(1);
+                }
+                break;
+            case 'e':
+                if (g_root == NULL) {
+                    show_message("Error: No tree to draw! Initialize tree first.", 1);
+                } else {
+                    start_layout();
+                }
+                break;
+            case 't':
+                if (g_root == NULL) {
+                    show_message("Error: No tree to measure! Initialize tree first.", 1);
+                } else {
+                    show_tree_stats();
                 }
                 break;
             case 'q':
+                finish_layout();
                 running = 0;
                 break;
         }
     }
     
+    stop_recording();
     endwin();
     free_tree(g_root);
     free_edit_stack(&g_undo);
@@ -5,22 +5,151 @@
 #include "lab5.h"
 
 extern Node *g_root; // global roots
+extern EditStack g_undo;
+extern EditStack g_redo;
 
 #define MAGIC 0x41544C35  /* "ATL5" */
 #define VERSION 1
 
+/* Sanity limits for a node record; the index section has its own checks. */
+#define MAX_NODES (1 << 26)
+#define MAX_TEXT_LEN 10000
+
 typedef struct {
     Node *node;
-    int id;
+    int32_t yesId;  /* file ids of the children, -1 if NULL */
+    int32_t noId;
 } NodeMapping;
 
-// helper function to find ID in nodemapping arr
-static int find_id(NodeMapping *map, int count, Node *ptr) {
-    for (int i = 0; i < count; ++i) {
-        if (map[i].node == ptr) return map[i].id;
+/* Fold one node record into the tree checksum that binds the optional
+ * index section to the records it was built from. */
+static uint64_t record_sum(uint64_t sum, uint8_t isQuestion, const char *text,
+                           uint32_t textLen, int32_t yesId, int32_t noId) {
+    uint64_t h = h_hash_wy(text, textLen);
+    h ^= (((uint64_t)(uint32_t)yesId << 32) | (uint32_t)noId) * 0x9E3779B97F4A7C15ull;
+    h ^= isQuestion;
+    sum = (sum << 7 | sum >> 57) ^ h;
+    return sum * 0xff51afd7ed558ccdull;
+}
+
+/* Ids of the nodes numbered so far, open-addressed by node address (-1
+ * marks a free slot); the key of slot b is map[seen[b]].node. */
+static uint32_t seen_slot(const int32_t *seen, uint32_t mask, const NodeMapping *map, const Node *n) {
+    uint64_t x = (uint64_t)(uintptr_t)n;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    uint32_t b = (uint32_t)(x >> 32) & mask;
+    while (seen[b] >= 0 && map[seen[b]].node != n) b = (b + 1) & mask;
+    return b;
+}
+
+/* Double the id table once it is half full. Returns 0 if out of memory. */
+static int seen_grow(int32_t **seen, uint32_t *mask, const NodeMapping *map, int count) {
+    uint32_t newMask = *mask * 2 + 1;
+    int32_t *grown = malloc(((size_t)newMask + 1) * sizeof(int32_t));
+    if (grown == NULL) return 0;
+    memset(grown, 0xff, ((size_t)newMask + 1) * sizeof(int32_t));
+    for (int i = 0; i < count; i++) grown[seen_slot(grown, newMask, map, map[i].node)] = i;
+    free(*seen);
+    *seen = grown;
+    *mask = newMask;
+    return 1;
+}
+
+/* Number the nodes under root in BFS order: map[i] is node i with the ids
+ * of its children. A node reached twice (shared, or on a cycle) keeps its
+ * first id, so a malformed tree is written as it is instead of looping.
+ * Returns NULL if out of memory. */
+static NodeMapping *bfs_map(Node *root, int *countOut) {
+    Queue q;
+    q_init(&q);
+
+    int treeCap = 16; // inital tree cap
+    int treeCount = 0; // cur num of nodes mapped
+
+    // allocate mem for mapping array
+    NodeMapping *map = malloc(sizeof(NodeMapping)*treeCap);
+    uint32_t seenMask = 63;
+    int32_t *seen = malloc((seenMask + 1) * sizeof(int32_t));
+    if(map == NULL || seen == NULL){
+        free(map);
+        free(seen);
+        return NULL;
+    }
+    memset(seen, 0xff, (seenMask + 1) * sizeof(int32_t));
+    map[treeCount].node = root; // begin mapping with root node
+    seen[seen_slot(seen, seenMask, map, root)] = treeCount;
+    treeCount++;
+
+    q_enqueue(&q, root, 0); // enque root with ID #0
+
+    // assign IDs in BFS order; a child's id is known when it is enqueued,
+    // so the parent's record can store it directly
+    while(!q_empty(&q)){
+        Node *cur = NULL;
+        int id = -1;
+        q_dequeue(&q, &cur, &id); // remove cur node
+
+        Node *kids[2] = {cur->yes, cur->no};
+        int32_t kidIds[2] = {-1, -1};
+        for(int k = 0; k < 2; k++){
+            if(kids[k] == NULL) continue;
+            uint32_t slot = seen_slot(seen, seenMask, map, kids[k]);
+            if(seen[slot] >= 0){ // already numbered
+                kidIds[k] = seen[slot];
+                continue;
+            }
+            if(treeCount >= treeCap){ // realloc mapping array if there's no more room
+                treeCap *= 2;
+                NodeMapping *nbuf = realloc(map, sizeof(NodeMapping)*treeCap);
+                if(!nbuf){
+                    free(map);
+                    free(seen);
+                    q_free(&q);
+                    return NULL;
+                }
+                map = nbuf;
+            }
+            kidIds[k] = treeCount;
+            map[treeCount].node = kids[k];
+            seen[slot] = treeCount;
+            q_enqueue(&q, kids[k], treeCount);
+            treeCount++;
+            if((uint32_t)treeCount * 2 > seenMask && !seen_grow(&seen, &seenMask, map, treeCount)){
+                free(map);
+                free(seen);
+                q_free(&q);
+                return NULL;
+            }
+        }
+        map[id].yesId = kidIds[0];
+        map[id].noId = kidIds[1];
+    }
+    q_free(&q); // free queue
+    free(seen);
+    *countOut = treeCount;
+    return map;
+}
+
+/* Checksum of the node records save_tree would write for the tree under
+ * root (0 for an empty tree): trees with equal checksums have matching
+ * node sections. Returns 0 if out of memory. */
+int tree_checksum(Node *root, uint64_t *sum) {
+    *sum = 0;
+    if(root == NULL) return 1;
+    int count = 0;
+    NodeMapping *map = bfs_map(root, &count);
+    if(map == NULL) return 0;
+    for(int i = 0; i < count; i++){
+        Node *node = map[i].node;
+        *sum = record_sum(*sum, (uint8_t)(node->isQuestion ? 1 : 0), node->text,
+                          (uint32_t)strlen(node->text), map[i].yesId, map[i].noId);
     }
-    return -1;
+    *sum ^= (uint64_t)count;
+    free(map);
+    return 1;
 }
+
 /* TODO 27: Implement save_tree
  * Save the tree to a binary file using BFS traversal
  * 
@@ -32,6 +161,7 @@ static int find_id(NodeMapping *map, int count, Node *ptr) {
  *   - text (textLen bytes, no null terminator)
  *   - yesId (4 bytes, -1 if NULL)
  *   - noId (4 bytes, -1 if NULL)
+ * - Optionally, the attribute index section (see index_write in index.c)
  * 
  * Steps:
  * 1. Return 0 if g_root is NULL
@@ -53,113 +183,34 @@ static int find_id(NodeMapping *map, int count, Node *ptr) {
  * 7. Clean up and return 1 on success
  */
 int save_tree(const char *filename) {
-    // TODO: Implement this function
-    // This is complex - break it into smaller steps
-    // You'll need to use the Queue functions you implemented
-   
+    return save_tree_with(filename, 1);
+}
+
+/* save_tree, optionally without the index section (the file then loads
+ * exactly as before, with a full index rebuild). */
+int save_tree_with(const char *filename, int withIndex) {
     //  * 1. Return 0 if g_root is NULL
     if(g_root == NULL) return 0;
 
     //  * 2. Open file for writing binary ("wb")
     FILE *fptr = fopen(filename, "wb");
     if(fptr == NULL) return 0;
+    setvbuf(fptr, NULL, _IOFBF, 1 << 16); // many small writes per node
 
-    //  * 3. Initialize queue for BFS traversal
-    Queue q;
-    q_init(&q);
-
-
-    // number of nodes in tree
-    int treeCap =16; // inital tree cap
-    int treeCount =0; // cur num of nodes mapped
-
-    // allocate mem for mapping array
-    NodeMapping *map = malloc(sizeof(NodeMapping)*treeCap);
+    //  * 3-4. Assign IDs to all nodes in BFS order
+    int treeCount = 0;
+    NodeMapping *map = bfs_map(g_root, &treeCount);
     if(map == NULL){
         fclose(fptr);
         return 0;
     }
 
-    if(treeCount>= treeCap){
-        treeCap *= 2;
-        NodeMapping *nbuffer = realloc(map,sizeof(NodeMapping)*treeCap);
-        if(nbuffer==NULL){
-            free(map);
-            fclose(fptr);
-            return 0;
-        }
-        map = nbuffer;
-    }
-    map[treeCount].node = g_root; // begin mapping with root node
-    map[treeCount].id = 0;
-    treeCount++;
-
-    q_enqueue(&q, g_root, 0); // enque root with ID #0
-
-    // assign ID to node
-    while(!q_empty(&q)){
-        Node *cur = NULL;
-        int id = -1;
-        q_dequeue(&q, &cur, &id); // remove cur node
-
-    // If node has yes child: add to mappings, enqueue with new id
-        if(cur->yes){
-            int yesID = find_id(map, treeCount, cur->yes);
-            if(yesID <0){ // not mapped yet
-                yesID = treeCount;
-                if(treeCount>=treeCap){ // realloc mapping array if there's no more room
-                    treeCap *=2;
-                    NodeMapping *nbuf = realloc(map, sizeof(NodeMapping)*treeCap);
-                        if(!nbuf){
-                            free(map);
-                            q_free(&q);
-                            fclose(fptr);
-                            return 0;
-                        }
-                        map = nbuf;
-                    }
-                    
-                map[treeCount].node = cur->yes;
-                map[treeCount].id =yesID;
-                treeCount++;
-                q_enqueue(&q, cur->yes, yesID);
-            }
-        }
-
-    // If node has no child: add to mappings, enqueue with new id
-
-        if(cur->no){
-            int noID = find_id(map, treeCount, cur->no);
-            if(noID < 0){
-                // assign new ID
-                noID = treeCount;
-                if(treeCount>= treeCap){
-                    treeCap *=2;
-                    NodeMapping *nbuf = realloc(map, sizeof(NodeMapping)*treeCap);
-                    if(!nbuf){
-                            free(map);
-                            q_free(&q);
-                            fclose(fptr);
-                            return 0;
-                    }
-                    map = nbuf;
-                }
-            map[treeCount].node = cur->no;
-            map[treeCount].id = noID;
-            treeCount++;
-            q_enqueue(&q, cur->no, noID);
-
-        }
-    }
-}
-    q_free(&q); // free queue
-
     // * 5. Write header (magic, version, treeCount)
 
     uint32_t magic = MAGIC;
     uint32_t version = VERSION;
     uint32_t count = (uint32_t)treeCount;
-    
+
     if (fwrite(&magic, sizeof(uint32_t), 1, fptr) != 1 ||
         fwrite(&version, sizeof(uint32_t), 1, fptr) != 1 ||
         fwrite(&count, sizeof(uint32_t), 1, fptr) != 1) {
@@ -168,67 +219,48 @@ int save_tree(const char *filename) {
             return 0;
         }
 
+    //  Write nodes in BFS order
 
-    //  Write node in BSF node
-
+    uint64_t treeSum = 0;
     for(int i=0; i<treeCount; i++){
-        Node *node = map[i].node; 
+        Node *node = map[i].node;
 
-        uint8_t isQuestion= (uint8_t)(node->isQuestion ? 1 : 0);
+        uint8_t isQuestion = (uint8_t)(node->isQuestion ? 1 : 0);
         int32_t textLength = (int32_t)strlen(node->text);
-
-
-    //Find yes child's id in mappings (or -1)
-
-        int32_t yesChildID;
-        int32_t noChildID;
-
-    
-        if(node->yes != NULL){
-            yesChildID = (int32_t)find_id(map, treeCount, node->yes);
-        }else{
-            yesChildID = -1;
+        treeSum = record_sum(treeSum, isQuestion, node->text, (uint32_t)textLength,
+                             map[i].yesId, map[i].noId);
+
+        if(fwrite(&isQuestion, sizeof(int8_t), 1, fptr) != 1 ||
+           fwrite(&textLength, sizeof(int32_t), 1, fptr) != 1 ||
+           (textLength > 0 && fwrite(node->text, 1, (size_t)textLength, fptr) != (size_t)textLength) ||
+           fwrite(&map[i].yesId, sizeof(int32_t), 1, fptr) != 1 ||
+           fwrite(&map[i].noId, sizeof(int32_t), 1, fptr) != 1){
+            free(map);
+            fclose(fptr);
+            return 0;
         }
+    }
 
-        if(node->no != NULL){
-            noChildID = (int32_t)find_id(map, treeCount, node->no);
-        }else{
-            noChildID = -1;
+    // optional attribute index section, so loading can skip the rebuild
+    if(withIndex){
+        Node **order = malloc(sizeof(Node *) * (size_t)treeCount);
+        int ok = order != NULL;
+        if(ok){
+            for(int i = 0; i < treeCount; i++) order[i] = map[i].node;
+            ok = index_write(fptr, treeSum, order, treeCount);
+        }
+        free(order);
+        if(!ok){
+            free(map);
+            fclose(fptr);
+            return 0;
         }
-        
-
-    if(fwrite(&isQuestion, sizeof(int8_t), 1, fptr) != 1){
-        free(map);
-        fclose(fptr);
-        return 0;
-    }
-    if(fwrite(&textLength, sizeof(int32_t), 1, fptr) != 1){
-        free(map);
-        fclose(fptr);
-        return 0;
-    }
-    if(textLength > 0 && fwrite(node->text, 1, (size_t)textLength, fptr) != (size_t)textLength){
-        free(map);
-        fclose(fptr);
-        return 0;
-    }
-    if(fwrite(&yesChildID, sizeof(int32_t), 1, fptr) != 1){
-        free(map);
-        fclose(fptr);
-        return 0;
-    }
-    if(fwrite(&noChildID, sizeof(int32_t), 1, fptr) != 1){
-        free(map);
-        fclose(fptr);
-        return 0;
     }
-}
 
     // success
 
     free(map);
-    fclose(fptr);
-    return 1;
+    return fclose(fptr) == 0;
 }
 
 /* TODO 28: Implement load_tree
@@ -269,6 +301,7 @@ int load_tree(const char *filename) {
     // * 1. Open file for reading binary ("rb")    
     FILE *fptr = fopen(filename, "rb");
     if(fptr == NULL) return 0;
+    setvbuf(fptr, NULL, _IOFBF, 1 << 16); // many small reads per node
     
     //  * 2. Read and validate header (magic, version, count)
 
@@ -292,18 +325,16 @@ int load_tree(const char *filename) {
 
     }
 
-    printf("DEBUG: magic=0x%X version=%u count=%u\n", magic, version, count);
-
     // validating
-    if(magic != MAGIC || version != VERSION || count == 0 || count > 10000){
+    if(magic != MAGIC || version != VERSION || count == 0 || count > MAX_NODES){
         fclose(fptr);
         return 0; // invalid file
     }
 
     // * 3. Allocate arrays for nodes and child IDs
     Node **nodes = calloc(count, sizeof(Node*));
-    int32_t *yesIds = calloc(count, sizeof(int32_t)*count);
-    int32_t *noIds = calloc(count, sizeof(int32_t)*count);
+    int32_t *yesIds = calloc(count, sizeof(int32_t));
+    int32_t *noIds = calloc(count, sizeof(int32_t));
     if (!nodes || !yesIds || !noIds) {
         free (nodes);
         free(yesIds);
@@ -314,6 +345,7 @@ int load_tree(const char *filename) {
 
     
     //* 4. Read each node:
+    uint64_t treeSum = 0;
 
     for (uint32_t i=0; i<count; i++){
         uint8_t isQuestion;
@@ -328,12 +360,12 @@ int load_tree(const char *filename) {
         
     //* Validate textLen (e.g., < 10000)
 
-    if (textLen > 10000){
+    if (textLen > MAX_TEXT_LEN){
         goto load_err;
     }
 
     //* Allocate and read text string
-    char *text = malloc((size_t)+1);
+    char *text = malloc((size_t)textLen + 1);
     if(text == NULL){
         goto load_err;
     }
@@ -379,10 +411,15 @@ int load_tree(const char *filename) {
     }
 
     node->isQuestion = (isQuestion ? 1 : 0);
+    node->refs = 1;
     node->text = text;
     node->yes = NULL;
     node->no = NULL;
+    node->parent = NULL;
+    node->id = -1;
+    node->visitMark = 0;
     
+    treeSum = record_sum(treeSum, isQuestion, text, textLen, yID, noID);
     nodes[i] = node;
     yesIds[i] = yID;
     noIds[i] = noID;
@@ -396,13 +433,32 @@ int load_tree(const char *filename) {
 for(uint32_t i=0; i<count; i++){
     if(yesIds[i] >= 0){
         nodes[i]->yes = nodes[yesIds[i]];
+        nodes[yesIds[i]]->parent = nodes[i];
     }
     if(noIds[i] >= 0){
         nodes[i]->no = nodes[noIds[i]];
+        nodes[noIds[i]]->parent = nodes[i];
     }
 
 }
 
+// ids are only range-checked, so a corrupt file can still link records
+// into a DAG or a cycle, or leave some unreachable; reject it before it
+// replaces the tree
+{
+    IntegrityReport rep;
+    int sound = check_integrity_report(nodes[0], 0, &rep) && rep.visited == (long)count;
+    integrity_report_free(&rep);
+    if(!sound){
+        goto load_err;
+    }
+}
+
+// edits refer to nodes of the old tree; dropping them through the engine
+// hands the undone edits' detached nodes to the reclaimer (the emptied
+// stacks grow again on their next push)
+engine_drop_history(&g_undo, &g_redo);
+
 // * 6. Free old g_root if not NULL
 
 if (g_root){
@@ -413,6 +469,14 @@ if (g_root){
 
 g_root = nodes[0]; // set new root
 
+integrity_forget_changes(); // checked as a whole above
+
+// use the saved attribute index if it matches these records, otherwise
+// number the animals, link parents and rebuild it from scratch
+if(!index_read(fptr, treeSum, nodes, (int)count)){
+    index_rebuild();
+}
+
 // * 8. Clean up temporary arrays
 
 free(yesIds);
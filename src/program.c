@@ -0,0 +1,554 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Compiled Classifier ==========
+ * Walking the Node graph costs a dependent load per question, each to
+ * wherever malloc put that node. Compiling flattens the tree into one
+ * array of 12-byte instructions (question id, yes target, no target) with
+ * leaves encoded as negative animal ids (PROG_LEAF), so classifying an
+ * answer vector is a tight loop over a dense array.
+ *
+ * Questions are numbered by canonical text: the same question asked in
+ * two subtrees gets one id, and an answer vector holds one bit per id,
+ * like the attributes in the index.
+ *
+ * Layout: instructions follow a preorder that visits the child with more
+ * animals first, so the likelier branch is the next instruction. Along the
+ * heavy path a classification reads memory sequentially and the branch
+ * into the light child is the rare one.
+ *
+ * The program for g_root is compiled on first use; edits call
+ * prog_invalidate and the next prog_current recompiles, like the LCA
+ * layout.
+ *
+ * Batches: one classification is a chain of dependent loads, so a core
+ * mostly waits. prog_classify_batch keeps BATCH_LANES vectors in flight
+ * and advances each one level per round, so their loads overlap; a lane
+ * whose vector reaches a leaf is refilled with the next vector at once
+ * rather than idling until the deepest one finishes. With AVX2 the lanes
+ * are 8 to a register and a round is gathers (instruction fields, then
+ * answer words) and masked blends. Batches are split across threads.
+ */
+
+#define PROG_INITIAL_ARENA (1 << 16)
+#define BATCH_LANES 32
+#define BATCH_BLOCK 4096  /* vectors per gather block (32-bit offsets) */
+
+typedef struct {
+    Node *node;
+    int parent;     /* instruction that leads here, -1 for the root */
+    int isYes;      /* ... through its yes target */
+} CompileFrame;
+
+static DecisionProgram current;
+static int valid = 0;
+
+/* The tree changed; the next prog_current recompiles. */
+void prog_invalidate(void) {
+    valid = 0;
+}
+
+void prog_free(DecisionProgram *p) {
+    free(p->code);
+    free(p->textAt);
+    free(p->arena);
+    free(p->slots);
+    memset(p, 0, sizeof *p);
+    p->entry = PROG_NONE;
+}
+
+/* Text of question id q as first seen in the tree. */
+const char *prog_question_text(const DecisionProgram *p, int q) {
+    return q >= 0 && q < p->questionCount ? p->arena + p->textAt[q] : NULL;
+}
+
+/* Canonical form stored right after the text. */
+static const char *canon_at(const DecisionProgram *p, int q) {
+    const char *text = p->arena + p->textAt[q];
+    return text + strlen(text) + 1;
+}
+
+static int slots_alloc(DecisionProgram *p, uint32_t count) {
+    int32_t *ns = malloc((size_t)count * sizeof(int32_t));
+    if (ns == NULL) return 0;
+    for (uint32_t i = 0; i < count; i++) ns[i] = -1;
+    uint32_t mask = count - 1;
+    for (int q = 0; q < p->questionCount; q++) {
+        const char *c = canon_at(p, q);
+        uint32_t b = (uint32_t)h_hash_wy(c, strlen(c)) & mask;
+        while (ns[b] >= 0) b = (b + 1) & mask;
+        ns[b] = q;
+    }
+    free(p->slots);
+    p->slots = ns;
+    p->slotMask = mask;
+    return 1;
+}
+
+/* Slot holding canonical text c (hash h), or the empty slot where it goes. */
+static uint32_t find_slot(const DecisionProgram *p, const char *c, uint64_t h) {
+    uint32_t b = (uint32_t)h & p->slotMask;
+    while (p->slots[b] >= 0 && strcmp(canon_at(p, p->slots[b]), c) != 0) b = (b + 1) & p->slotMask;
+    return b;
+}
+
+static int arena_reserve(DecisionProgram *p, size_t more) {
+    if (p->arenaLen + more <= p->arenaCap) return 1;
+    if (p->arenaLen + more > UINT32_MAX) return 0; // textAt holds 32-bit offsets
+    size_t newCap = p->arenaCap ? p->arenaCap : PROG_INITIAL_ARENA;
+    while (newCap < p->arenaLen + more) newCap *= 2;
+    char *na = realloc(p->arena, newCap);
+    if (na == NULL) return 0;
+    p->arena = na;
+    p->arenaCap = newCap;
+    return 1;
+}
+
+/* Id of a question's text, numbering it if new. -1 if out of memory. */
+static int intern(DecisionProgram *p, const char *text, int *textCap) {
+    size_t len = strlen(text);
+    if (!arena_reserve(p, 2 * len + 2)) return -1;
+    char *t = p->arena + p->arenaLen, *c = t + len + 1;
+    memcpy(t, text, len + 1);
+    canonicalize_into(t, len, c);
+    uint64_t h = h_hash_wy(c, strlen(c));
+    uint32_t b = find_slot(p, c, h);
+    if (p->slots[b] >= 0) return p->slots[b];
+
+    if (p->questionCount >= *textCap) {
+        int newCap = *textCap ? *textCap * 2 : 1024;
+        uint32_t *nt = realloc(p->textAt, (size_t)newCap * sizeof(uint32_t));
+        if (nt == NULL) return -1;
+        p->textAt = nt;
+        *textCap = newCap;
+    }
+    int q = p->questionCount++;
+    p->textAt[q] = (uint32_t)p->arenaLen;
+    p->arenaLen += len + 1 + strlen(c) + 1;
+    p->slots[b] = q;
+    if ((uint32_t)p->questionCount * 2 > p->slotMask + 1 && !slots_alloc(p, (p->slotMask + 1) * 2)) return -1;
+    return q;
+}
+
+/* Id of a question (any spelling with the same canonical form), or -1 if
+ * the program does not ask it. */
+int prog_question_id(const DecisionProgram *p, const char *question) {
+    if (p->questionCount == 0) return -1;
+    char *c = canonicalize(question);
+    if (c == NULL) return -1;
+    int q = p->slots[find_slot(p, c, h_hash_wy(c, strlen(c)))];
+    free(c);
+    return q;
+}
+
+/* Words of an answer vector for p. */
+int prog_answer_words(const DecisionProgram *p) {
+    return (p->questionCount + 63) / 64;
+}
+
+/* Fill answers (prog_answer_words(p) words) with the path from the root to
+ * leaf: bit q is set where question q was answered yes. Returns 0 if the
+ * program does not know one of the questions (it is stale). A question
+ * asked twice on the path keeps the answer given nearest the root. */
+int prog_answers(const DecisionProgram *p, const Node *leaf, uint64_t *answers) {
+    memset(answers, 0, (size_t)prog_answer_words(p) * sizeof(uint64_t));
+    for (const Node *c = leaf; c->parent; c = c->parent) {
+        int q = prog_question_id(p, c->parent->text);
+        if (q < 0) return 0;
+        uint64_t bit = 1ull << (q & 63);
+        answers[q >> 6] = c->parent->yes == c ? answers[q >> 6] | bit : answers[q >> 6] & ~bit;
+    }
+    return 1;
+}
+
+/* ---------- Compilation ---------- */
+
+/* Pass 1: preorder (yes first) into tmp, numbering questions and linking
+ * every child into its parent's instruction. */
+static int compile_preorder(Node *root, DecisionProgram *p, ProgInsn **tmpOut, int *countOut) {
+    int cap = 1024, count = 0, textCap = 0, stackCap = 64, top = 0;
+    ProgInsn *tmp = malloc((size_t)cap * sizeof(ProgInsn));
+    CompileFrame *stack = malloc((size_t)stackCap * sizeof(CompileFrame));
+    int ok = tmp != NULL && stack != NULL && slots_alloc(p, 1024);
+
+    int32_t entry = PROG_NONE;
+    if (ok) stack[top++] = (CompileFrame){root, -1, 0};
+    while (ok && top > 0) {
+        CompileFrame f = stack[--top];
+        Node *n = f.node;
+        if (count >= cap) {
+            ProgInsn *nt = realloc(tmp, (size_t)cap * 2 * sizeof(ProgInsn));
+            if (nt == NULL) {
+                ok = 0;
+                break;
+            }
+            tmp = nt;
+            cap *= 2;
+        }
+        int32_t *link = f.parent < 0 ? &entry : f.isYes ? &tmp[f.parent].yes : &tmp[f.parent].no;
+        if (!n->isQuestion) {
+            if (n->id < 0 || index_animal(n->id) != n) { // not numbered: run index_rebuild
+                ok = 0;
+                break;
+            }
+            *link = PROG_LEAF(n->id);
+            continue;
+        }
+        if (n->yes == NULL || n->no == NULL) {
+            ok = 0;
+            break;
+        }
+        int k = count++;
+        *link = k;
+        tmp[k].question = intern(p, n->text, &textCap);
+        if (tmp[k].question < 0) {
+            ok = 0;
+            break;
+        }
+        if (top + 2 > stackCap) {
+            CompileFrame *ns = realloc(stack, (size_t)stackCap * 2 * sizeof(CompileFrame));
+            if (ns == NULL) {
+                ok = 0;
+                break;
+            }
+            stack = ns;
+            stackCap *= 2;
+        }
+        stack[top++] = (CompileFrame){n->no, k, 0};
+        stack[top++] = (CompileFrame){n->yes, k, 1};
+    }
+    free(stack);
+    if (!ok) {
+        free(tmp);
+        return 0;
+    }
+    p->entry = entry;
+    *tmpOut = tmp;
+    *countOut = count;
+    return 1;
+}
+
+/* Compile the tree at root (leaves numbered by index_rebuild) into out.
+ * Returns 0 if out of memory or the tree is malformed. */
+int prog_compile(Node *root, DecisionProgram *out) {
+    memset(out, 0, sizeof *out);
+    out->entry = PROG_NONE;
+    if (root == NULL) return 1;
+
+    ProgInsn *tmp;
+    int count;
+    if (!compile_preorder(root, out, &tmp, &count)) {
+        prog_free(out);
+        return 0;
+    }
+    if (count == 0) { // a single animal
+        free(tmp);
+        return 1;
+    }
+
+    /* Pass 2: animals below each instruction. Preorder puts children after
+     * their parent, so one backward sweep sees them first. */
+    int32_t *weight = malloc((size_t)count * sizeof(int32_t));
+    int32_t *place = malloc((size_t)count * sizeof(int32_t));
+    int32_t *stack = malloc((size_t)count * sizeof(int32_t));
+    out->code = malloc((size_t)count * sizeof(ProgInsn));
+    if (weight == NULL || place == NULL || stack == NULL || out->code == NULL) {
+        free(weight);
+        free(place);
+        free(stack);
+        free(tmp);
+        prog_free(out);
+        return 0;
+    }
+    for (int k = count - 1; k >= 0; k--) {
+        weight[k] = (tmp[k].yes < 0 ? 1 : weight[tmp[k].yes]) + (tmp[k].no < 0 ? 1 : weight[tmp[k].no]);
+    }
+
+    /* Pass 3: preorder again, heavier child first, then retarget. */
+    int top = 0, next = 0;
+    stack[top++] = out->entry;
+    while (top > 0) {
+        int k = stack[--top];
+        place[k] = next++;
+        int32_t y = tmp[k].yes, n = tmp[k].no;
+        int yesHeavy = (y < 0 ? 1 : weight[y]) >= (n < 0 ? 1 : weight[n]);
+        int32_t first = yesHeavy ? y : n, second = yesHeavy ? n : y;
+        if (second >= 0) stack[top++] = second;
+        if (first >= 0) stack[top++] = first;
+    }
+    for (int k = 0; k < count; k++) {
+        ProgInsn in = tmp[k];
+        if (in.yes >= 0) in.yes = place[in.yes];
+        if (in.no >= 0) in.no = place[in.no];
+        out->code[place[k]] = in;
+    }
+    out->entry = place[out->entry];
+    out->count = count;
+    free(weight);
+    free(place);
+    free(stack);
+    free(tmp);
+    return 1;
+}
+
+/* ---------- Classification ---------- */
+
+/* Animal id (see index_animal) the answers lead to, or -1 for no tree. */
+int prog_classify(const DecisionProgram *p, const uint64_t *answers) {
+    int32_t pc = p->entry;
+    if (pc == PROG_NONE) return -1;
+    const ProgInsn *code = p->code;
+    while (pc >= 0) {
+        ProgInsn in = code[pc];
+        // start both children while the answer bit loads (leaf targets
+        // make harmless hints)
+        __builtin_prefetch(&code[in.yes]);
+        __builtin_prefetch(&code[in.no]);
+        pc = (answers[in.question >> 6] >> (in.question & 63)) & 1 ? in.yes : in.no;
+    }
+    return PROG_LEAF(pc);
+}
+
+/* The program for g_root, compiled if an edit made it stale. NULL if out
+ * of memory. Like path_query, not safe against concurrent edits. */
+const DecisionProgram *prog_current(void) {
+    if (!valid) {
+        prog_free(&current);
+        if (!prog_compile(g_root, &current)) return NULL;
+        valid = 1;
+    }
+    return &current;
+}
+
+/* ---------- Batch classification ---------- */
+
+typedef struct {
+    const DecisionProgram *p;
+    const uint64_t *answers;
+    int words;
+    const int32_t *expected;  /* NULL: classify only */
+    int32_t *out;             /* NULL: evaluate only */
+    long lo, hi;
+    long correct;
+    IdList missed;
+} BatchWorker;
+
+/* Classify answers[0, count) into out: BATCH_LANES independent walks. */
+static void batch_scalar(const DecisionProgram *p, const uint64_t *answers, int words, int count,
+                         int32_t *out) {
+    const ProgInsn *code = p->code;
+    int32_t pc[BATCH_LANES];
+    int at[BATCH_LANES];
+    int next = 0, live = 0;
+    for (int k = 0; k < BATCH_LANES; k++) {
+        at[k] = next < count ? next++ : -1;
+        pc[k] = p->entry;
+        live += at[k] >= 0;
+    }
+    while (live > 0) {
+        for (int k = 0; k < BATCH_LANES; k++) {
+            if (at[k] < 0) continue;
+            if (pc[k] < 0) {
+                out[at[k]] = PROG_LEAF(pc[k]);
+                if (next < count) {
+                    at[k] = next++;
+                    pc[k] = p->entry;
+                } else {
+                    at[k] = -1;
+                    live--;
+                }
+                continue;
+            }
+            ProgInsn in = code[pc[k]];
+            const uint64_t *a = answers + (size_t)at[k] * words;
+            pc[k] = (a[in.question >> 6] >> (in.question & 63)) & 1 ? in.yes : in.no;
+        }
+    }
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define PROG_HAVE_X86 1
+
+/* batch_scalar on AVX2: BATCH_LANES lanes as BATCH_LANES / 8 registers,
+ * stepped in turn so their gathers overlap. Answers are gathered as
+ * 32-bit words at offsets from answers, so count * words < 2^30. */
+#define BATCH_REGS (BATCH_LANES / 8)
+
+__attribute__((target("avx2")))
+static void batch_avx2(const DecisionProgram *p, const uint64_t *answers, int words, int count,
+                       int32_t *out) {
+    const int *code = (const int *)p->code;
+    const int *base = (const int *)answers;
+    int32_t pcs[BATCH_LANES], offs[BATCH_LANES], ats[BATCH_LANES];
+    int next = 0, live = 0;
+    for (int k = 0; k < BATCH_LANES; k++) {
+        ats[k] = next < count ? next++ : -1;
+        offs[k] = ats[k] < 0 ? 0 : ats[k] * words * 2;
+        pcs[k] = ats[k] < 0 ? PROG_LEAF(0) : p->entry; // idle lanes sit on a leaf
+        live += ats[k] >= 0;
+    }
+    __m256i pc[BATCH_REGS], off[BATCH_REGS];
+    for (int r = 0; r < BATCH_REGS; r++) {
+        pc[r] = _mm256_loadu_si256((const __m256i *)(pcs + 8 * r));
+        off[r] = _mm256_loadu_si256((const __m256i *)(offs + 8 * r));
+    }
+    const __m256i one = _mm256_set1_epi32(1), low5 = _mm256_set1_epi32(31), zero = _mm256_setzero_si256();
+    while (live > 0) {
+        for (int r = 0; r < BATCH_REGS; r++) {
+            __m256i active = _mm256_cmpgt_epi32(pc[r], _mm256_set1_epi32(-1));
+            int m = ~_mm256_movemask_ps(_mm256_castsi256_ps(active)) & 0xff;
+            for (; m; m &= m - 1) { // lanes at a leaf: record and refill
+                int k = 8 * r + __builtin_ctz((unsigned)m);
+                if (ats[k] < 0) continue;
+                _mm256_storeu_si256((__m256i *)(pcs + 8 * r), pc[r]);
+                out[ats[k]] = PROG_LEAF(pcs[k]);
+                if (next < count) {
+                    ats[k] = next++;
+                    offs[k] = ats[k] * words * 2;
+                    pcs[k] = p->entry;
+                } else {
+                    ats[k] = -1;
+                    live--;
+                }
+                pc[r] = _mm256_loadu_si256((const __m256i *)(pcs + 8 * r));
+                off[r] = _mm256_loadu_si256((const __m256i *)(offs + 8 * r));
+                active = _mm256_cmpgt_epi32(pc[r], _mm256_set1_epi32(-1));
+            }
+
+            __m256i ip = _mm256_add_epi32(pc[r], _mm256_slli_epi32(pc[r], 1)); // 3 ints each
+            __m256i q = _mm256_mask_i32gather_epi32(zero, code, ip, active, 4);
+            __m256i yes = _mm256_mask_i32gather_epi32(zero, code + 1, ip, active, 4);
+            __m256i no = _mm256_mask_i32gather_epi32(zero, code + 2, ip, active, 4);
+            __m256i wordAt = _mm256_add_epi32(off[r], _mm256_srli_epi32(q, 5));
+            __m256i word = _mm256_mask_i32gather_epi32(zero, base, wordAt, active, 4);
+            __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(q, low5)), one);
+            __m256i target = _mm256_blendv_epi8(no, yes, _mm256_cmpeq_epi32(bit, one));
+            pc[r] = _mm256_blendv_epi8(pc[r], target, active);
+        }
+    }
+}
+#endif
+
+static void batch_block(const DecisionProgram *p, const uint64_t *answers, int words, int count,
+                        int32_t *out) {
+    if (p->entry < 0) { // empty tree or a single animal
+        for (int i = 0; i < count; i++) out[i] = p->entry == PROG_NONE ? -1 : PROG_LEAF(p->entry);
+        return;
+    }
+#ifdef PROG_HAVE_X86
+    static int useAvx2 = -1;
+    if (useAvx2 < 0) {
+        __builtin_cpu_init();
+        useAvx2 = __builtin_cpu_supports("avx2");
+    }
+    if (useAvx2 && (long)count * words < (1L << 30)) {
+        batch_avx2(p, answers, words, count, out);
+        return;
+    }
+#endif
+    batch_scalar(p, answers, words, count, out);
+}
+
+static void *batch_worker(void *arg) {
+    BatchWorker *w = arg;
+    int32_t local[BATCH_BLOCK];
+    for (long i = w->lo; i < w->hi; i += BATCH_BLOCK) {
+        int n = w->hi - i < BATCH_BLOCK ? (int)(w->hi - i) : BATCH_BLOCK;
+        int32_t *got = w->out ? w->out + i : local;
+        batch_block(w->p, w->answers + (size_t)i * w->words, w->words, n, got);
+        if (w->expected == NULL) continue;
+        for (int k = 0; k < n; k++) {
+            if (got[k] == w->expected[i + k]) w->correct++;
+            else idl_add(&w->missed, w->expected[i + k]);
+        }
+    }
+    return NULL;
+}
+
+/* eval->missed |= part (idl_or cannot write over an input). */
+static void merge_missed(ProgEval *eval, const IdList *part) {
+    IdList merged;
+    idl_init(&merged);
+    idl_or(&eval->missed, part, &merged);
+    idl_free(&eval->missed);
+    eval->missed = merged;
+}
+
+/* Split [0, count) across nthreads workers (0: one per online CPU). */
+static void batch_run(const DecisionProgram *p, const uint64_t *answers, int words,
+                      const int32_t *expected, int32_t *out, long count, int nthreads, ProgEval *eval) {
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long perThread = (count + BATCH_BLOCK - 1) / BATCH_BLOCK;
+    if (nthreads > perThread) nthreads = perThread > 0 ? (int)perThread : 1;
+    BatchWorker *w = calloc((size_t)nthreads, sizeof(BatchWorker));
+    pthread_t *tid = calloc((size_t)nthreads, sizeof(pthread_t));
+    int *started = calloc((size_t)nthreads, sizeof(int));
+    if (w == NULL || tid == NULL || started == NULL) {
+        free(w);
+        free(tid);
+        free(started);
+        BatchWorker one = {p, answers, words, expected, out, 0, count, 0, {0}};
+        idl_init(&one.missed);
+        batch_worker(&one);
+        if (eval) {
+            eval->correct = one.correct;
+            merge_missed(eval, &one.missed);
+        }
+        idl_free(&one.missed);
+        return;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        w[i] = (BatchWorker){p, answers, words, expected, out, count * i / nthreads,
+                             count * (i + 1) / nthreads, 0, {0}};
+        idl_init(&w[i].missed);
+    }
+    for (int i = 1; i < nthreads; i++) {
+        started[i] = pthread_create(&tid[i], NULL, batch_worker, &w[i]) == 0;
+    }
+    batch_worker(&w[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+        else batch_worker(&w[i]); // no thread: do its share here
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (eval) {
+            eval->correct += w[i].correct;
+            merge_missed(eval, &w[i].missed);
+        }
+        idl_free(&w[i].missed);
+    }
+    free(w);
+    free(tid);
+    free(started);
+}
+
+/* Classify count answer vectors stored back to back, words (at least
+ * prog_answer_words(p)) apart, into out[i] on nthreads threads (0: one
+ * per online CPU). */
+void prog_classify_batch(const DecisionProgram *p, const uint64_t *answers, int words, long count,
+                         int32_t *out, int nthreads) {
+    batch_run(p, answers, words, NULL, out, count, nthreads, NULL);
+}
+
+/* Classify like prog_classify_batch and score against the animal each
+ * vector describes. Release out with prog_eval_free. */
+void prog_evaluate(const DecisionProgram *p, const uint64_t *answers, int words,
+                   const int32_t *expected, long count, int nthreads, ProgEval *out) {
+    out->total = count;
+    out->correct = 0;
+    idl_init(&out->missed);
+    batch_run(p, answers, words, expected, NULL, count, nthreads, out);
+}
+
+void prog_eval_free(ProgEval *e) {
+    idl_free(&e->missed);
+}
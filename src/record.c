@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Session Recording ==========
+ * A recording is a compact log of finished game sessions that can be
+ * played back through the engine to reproduce the tree it ended with.
+ *
+ * Format (little-endian, varints are LEB128):
+ * - Header: magic (4 bytes), version (4 bytes), checksum of the tree the
+ *   recording started from (8 bytes, see tree_checksum)
+ * - One record per session, in the order the sessions ended:
+ *   - REC_SESSION (1 byte)
+ *   - final GameState (1 byte)
+ *   - answer count (varint), then the answers one bit each, LSB first
+ *   - for a taught animal (GAME_OVER): animal and question (varint
+ *     length + bytes each) and the animal's answer (1 byte)
+ * - REC_UNDO or REC_REDO (1 byte) where the last edit was undone or redone
+ * - REC_END (1 byte), then the checksum of the tree at close (8 bytes)
+ *
+ * Sessions are written whole when they end, so concurrent sessions never
+ * interleave; replaying them in log order reproduces the edits exactly as
+ * long as no session answered across another one's teach.
+ */
+
+#define REC_MAGIC 0x43455241  /* "AREC" */
+#define REC_VERSION 1
+#define REC_SESSION 1
+#define REC_END 2
+#define REC_UNDO 3
+#define REC_REDO 4
+#define REC_MAX_STEPS (1 << 26)
+#define REC_MAX_TEXT 10000
+
+static int put_varint(FILE *f, uint32_t v) {
+    unsigned char buf[5];
+    int n = 0;
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v) buf[n] |= 0x80;
+        n++;
+    } while (v);
+    return fwrite(buf, 1, (size_t)n, f) == (size_t)n;
+}
+
+static int get_varint(FILE *f, uint32_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = fgetc(f);
+        if (c == EOF) return 0;
+        *v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return 1;
+    }
+    return 0;
+}
+
+static int put_text(FILE *f, const char *s) {
+    size_t len = strlen(s);
+    return put_varint(f, (uint32_t)len) && fwrite(s, 1, len, f) == len;
+}
+
+static char *get_text(FILE *f) {
+    uint32_t len;
+    if (!get_varint(f, &len) || len > REC_MAX_TEXT) return NULL;
+    char *s = malloc(len + 1);
+    if (s == NULL) return NULL;
+    if (fread(s, 1, len, f) != len) {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/* Start recording to filename; the header binds it to the current tree. */
+int rec_create(Recorder *rec, const char *filename) {
+    rec->sessions = 0;
+    rec->failed = 0;
+    rec->f = fopen(filename, "wb");
+    if (rec->f == NULL) return 0;
+    uint32_t header[2] = {REC_MAGIC, REC_VERSION};
+    uint64_t sum;
+    if (!tree_checksum(g_root, &sum) || fwrite(header, sizeof header, 1, rec->f) != 1 ||
+        fwrite(&sum, sizeof sum, 1, rec->f) != 1) {
+        fclose(rec->f);
+        rec->f = NULL;
+        return 0;
+    }
+    pthread_mutex_init(&rec->lock, NULL);
+    return 1;
+}
+
+/* Append one finished session. */
+void rec_write(Recorder *rec, GameState outcome, const uint8_t *answers, int steps,
+               const char *animal, const char *question, int answerYes) {
+    pthread_mutex_lock(&rec->lock);
+    FILE *f = rec->f;
+    size_t bytes = ((size_t)steps + 7) / 8;
+    int ok = fputc(REC_SESSION, f) != EOF && fputc((int)outcome, f) != EOF &&
+             put_varint(f, (uint32_t)steps) && (bytes == 0 || fwrite(answers, 1, bytes, f) == bytes);
+    if (ok && outcome == GAME_OVER) {
+        ok = put_text(f, animal) && put_text(f, question) && fputc(answerYes ? 1 : 0, f) != EOF;
+    }
+    if (ok) rec->sessions++;
+    else rec->failed = 1;
+    pthread_mutex_unlock(&rec->lock);
+}
+
+/* Append an undo (redo == 0) or redo of the last edit. */
+void rec_write_edit(Recorder *rec, int redo) {
+    pthread_mutex_lock(&rec->lock);
+    if (fputc(redo ? REC_REDO : REC_UNDO, rec->f) == EOF) rec->failed = 1;
+    pthread_mutex_unlock(&rec->lock);
+}
+
+/* Finish the recording with the checksum of the tree as it is now.
+ * Returns 1 if every session was written. */
+int rec_close(Recorder *rec) {
+    if (rec->f == NULL) return 0;
+    uint64_t sum;
+    int ok = !rec->failed && tree_checksum(g_root, &sum) && fputc(REC_END, rec->f) != EOF &&
+             fwrite(&sum, sizeof sum, 1, rec->f) == 1;
+    ok = (fclose(rec->f) == 0) && ok;
+    rec->f = NULL;
+    pthread_mutex_destroy(&rec->lock);
+    return ok;
+}
+
+/* Open a recording for playback; startSum and endSum say which tree it
+ * starts from and should end with (endSum is read when the end is
+ * reached). */
+int rec_open(RecordReader *r, const char *filename) {
+    memset(r, 0, sizeof *r);
+    r->f = fopen(filename, "rb");
+    if (r->f == NULL) return 0;
+    setvbuf(r->f, NULL, _IOFBF, 1 << 16);
+    uint32_t header[2];
+    if (fread(header, sizeof header, 1, r->f) != 1 || header[0] != REC_MAGIC ||
+        header[1] != REC_VERSION || fread(&r->startSum, sizeof r->startSum, 1, r->f) != 1) {
+        fclose(r->f);
+        r->f = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Read the next session or undo/redo into out (release it with
+ * rec_session_free). Returns 1 for one, 0 at the end record, -1 if the
+ * file is truncated or corrupt. */
+int rec_next(RecordReader *r, RecordedSession *out) {
+    memset(out, 0, sizeof *out);
+    int kind = fgetc(r->f);
+    if (kind == REC_END) {
+        if (fread(&r->endSum, sizeof r->endSum, 1, r->f) != 1) return -1;
+        r->ended = 1;
+        return 0;
+    }
+    if (kind == REC_UNDO || kind == REC_REDO) {
+        out->edit = kind == REC_UNDO ? 'u' : 'r';
+        return 1;
+    }
+    int outcome = fgetc(r->f);
+    uint32_t steps;
+    if (kind != REC_SESSION || outcome < GAME_ASKING || outcome > GAME_OVER ||
+        !get_varint(r->f, &steps) || steps > REC_MAX_STEPS) {
+        return -1;
+    }
+    size_t bytes = ((size_t)steps + 7) / 8;
+    out->outcome = (GameState)outcome;
+    out->steps = (int)steps;
+    out->answers = malloc(bytes ? bytes : 1);
+    if (out->answers == NULL || fread(out->answers, 1, bytes, r->f) != bytes) {
+        rec_session_free(out);
+        return -1;
+    }
+    if (outcome == GAME_OVER) {
+        out->animal = get_text(r->f);
+        out->question = get_text(r->f);
+        int yes = fgetc(r->f);
+        if (out->animal == NULL || out->question == NULL || (yes != 0 && yes != 1)) {
+            rec_session_free(out);
+            return -1;
+        }
+        out->answerYes = yes;
+    }
+    return 1;
+}
+
+void rec_session_free(RecordedSession *s) {
+    free(s->answers);
+    free(s->animal);
+    free(s->question);
+    s->answers = NULL;
+    s->animal = NULL;
+    s->question = NULL;
+}
+
+void rec_close_reader(RecordReader *r) {
+    if (r->f) fclose(r->f);
+    r->f = NULL;
+}
+
+/* Play a recorded session (or undo/redo) through the engine against
+ * g_root. If clock is given, stepNs[i] receives the duration of engine
+ * call i (room for steps + 1 entries). Returns the number of engine calls
+ * made, or -1 if the tree no longer leads where the recording went. */
+int rec_replay(const RecordedSession *rs, uint64_t (*clock)(void), uint64_t *stepNs) {
+    GameSession s;
+    int calls = 0;
+    uint64_t t = clock ? clock() : 0;
+    if (rs->edit) {
+        if (!(rs->edit == 'u' ? undo_last_edit() : redo_last_edit())) return -1;
+        if (clock) stepNs[0] = clock() - t;
+        return 1;
+    }
+    if (!engine_begin(&s)) return -1;
+    for (int i = 0; i < rs->steps; i++) {
+        if (s.state != GAME_ASKING) {
+            engine_end(&s);
+            return -1;
+        }
+        engine_answer(&s, (rs->answers[i >> 3] >> (i & 7)) & 1);
+        if (clock) {
+            uint64_t now = clock();
+            stepNs[calls] = now - t;
+            t = now;
+        }
+        calls++;
+    }
+
+    GameState want = rs->outcome;
+    int ok;
+    if (want == GAME_ASKING || want == GAME_GUESSING) {
+        ok = s.state == want;
+    } else if (s.state != GAME_GUESSING) {
+        ok = 0;
+    } else {
+        engine_confirm(&s, want == GAME_WON);
+        ok = want != GAME_OVER || engine_teach(&s, rs->animal, rs->question, rs->answerYes) > 0;
+        if (clock) stepNs[calls] = clock() - t;
+        calls++;
+    }
+    engine_end(&s);
+    return ok ? calls : -1;
+}
@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Tree Search ==========
+ * Incremental search over question and animal text for the tree view. A
+ * query is a run of words that must appear consecutively in a node's
+ * text, the last one possibly cut short: "sw" finds "Can it swim?", "it
+ * sw" finds it too, "t sw" does not. Words are maximal runs of letters,
+ * digits and non-ASCII bytes, compared without ASCII case.
+ *
+ * The index is a word-level inverted file:
+ *  - every distinct word, sorted, so the words starting with a prefix
+ *    are one rank range found by binary search;
+ *  - one posting list per word holding the preorder numbers of the nodes
+ *    that use it, laid out back to back in rank order, so a prefix's
+ *    postings are one contiguous range too (a list per word keeps each
+ *    list in preorder, and the next match after the selection is a
+ *    binary search);
+ *  - the same postings with every SEARCH_BLOCK-sized block sorted, so
+ *    the next match in a range spanning many lists (a short prefix) costs
+ *    one binary search per block instead of a scan;
+ *  - the nodes by preorder number and their subtree sizes, to turn a
+ *    number into a node and back by walking the path from the root.
+ *
+ * A one-word query is then O(log words + range / SEARCH_BLOCK * log
+ * SEARCH_BLOCK) and exact. A longer one intersects its words' postings
+ * by leapfrogging (each word's next posting at or after the candidate
+ * moves the candidate on until all agree) and checks the agreed node's
+ * text for the words in order, so its cost grows with the nodes that have
+ * all the words but not as a phrase.
+ *
+ * Like the compiled classifier the index is built from g_root on first
+ * use; every edit calls search_invalidate and the next search rebuilds it.
+ */
+
+#define SEARCH_BLOCK 4096
+#define SEARCH_COUNT_LIMIT 4096  /* most postings deduplicated to count hits */
+
+static int built = 0;
+static Node **nodeAt = NULL;      /* preorder number -> node */
+static uint32_t *subtree = NULL;  /* preorder number -> nodes in its subtree */
+static uint32_t nodeCount = 0;
+static char *words = NULL;        /* distinct words, NUL-terminated */
+static uint32_t *wordAt = NULL;   /* rank -> offset in words */
+static uint32_t wordCount = 0;
+static uint32_t *listStart = NULL; /* rank -> first posting, wordCount + 1 entries */
+static uint32_t *postings = NULL; /* preorder numbers, by word rank then preorder */
+static uint32_t *blocks = NULL;   /* postings with each block sorted */
+
+static void release(void) {
+    free(nodeAt);
+    free(subtree);
+    free(words);
+    free(wordAt);
+    free(listStart);
+    free(postings);
+    free(blocks);
+    nodeAt = NULL;
+    subtree = wordAt = listStart = postings = blocks = NULL;
+    words = NULL;
+    nodeCount = wordCount = 0;
+    built = 0;
+}
+
+/* The tree changed; the next search rebuilds the index. */
+void search_invalidate(void) {
+    built = 0;
+}
+
+static int word_char(unsigned char c) {
+    return c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+/* Copy the next word of *s, lowercased and cut to SEARCH_MAX_WORD bytes,
+ * into out and advance *s past it. Returns its length, 0 at the end. */
+static size_t next_word(const char **s, char *out) {
+    const unsigned char *p = (const unsigned char *)*s;
+    size_t len = 0;
+    while (*p && !word_char(*p)) p++;
+    while (word_char(*p)) {
+        if (len < SEARCH_MAX_WORD) out[len++] = (char)(*p < 0x80 ? (*p | 0x20) : *p);
+        p++;
+    }
+    out[len] = '\0';
+    *s = (const char *)p;
+    return len;
+}
+
+/* ---------- Building ---------- */
+
+typedef struct {
+    uint32_t *slots;      /* word id + 1, 0 if free */
+    uint32_t mask;
+    uint32_t *offset;     /* word id -> offset in words */
+    uint32_t *count;      /* word id -> nodes using it */
+    uint32_t *lastNode;   /* word id -> last node counted + 1 */
+    uint32_t cap;
+    size_t wordsLen, wordsCap;
+} Vocab;
+
+static int vocab_grow(Vocab *v) {
+    uint32_t cap = v->cap ? v->cap * 2 : 1024;
+    uint32_t *offset = realloc(v->offset, cap * sizeof(uint32_t));
+    if (offset == NULL) return 0;
+    v->offset = offset;
+    uint32_t *count = realloc(v->count, cap * sizeof(uint32_t));
+    if (count == NULL) return 0;
+    v->count = count;
+    uint32_t *lastNode = realloc(v->lastNode, cap * sizeof(uint32_t));
+    if (lastNode == NULL) return 0;
+    v->lastNode = lastNode;
+    v->cap = cap;
+
+    /* slots stay under half full */
+    uint32_t *slots = calloc((size_t)cap * 2, sizeof(uint32_t));
+    if (slots == NULL) return 0;
+    for (uint32_t id = 0; id < wordCount; id++) {
+        const char *w = words + v->offset[id];
+        uint32_t b = (uint32_t)h_hash_wy(w, strlen(w)) & (cap * 2 - 1);
+        while (slots[b]) b = (b + 1) & (cap * 2 - 1);
+        slots[b] = id + 1;
+    }
+    free(v->slots);
+    v->slots = slots;
+    v->mask = cap * 2 - 1;
+    return 1;
+}
+
+/* Id of word w (len bytes), added if new. Returns -1 if out of memory. */
+static int64_t vocab_id(Vocab *v, const char *w, size_t len) {
+    uint32_t h = (uint32_t)h_hash_wy(w, len);
+    if (v->slots != NULL) {
+        for (uint32_t b = h & v->mask; v->slots[b]; b = (b + 1) & v->mask) {
+            uint32_t id = v->slots[b] - 1;
+            if (strcmp(words + v->offset[id], w) == 0) return id;
+        }
+    }
+    if (wordCount == v->cap && !vocab_grow(v)) return -1;
+    if (v->wordsLen + len + 1 > v->wordsCap) {
+        size_t cap = v->wordsCap ? v->wordsCap * 2 : 4096;
+        while (cap < v->wordsLen + len + 1) cap *= 2;
+        char *nw = realloc(words, cap);
+        if (nw == NULL) return -1;
+        words = nw;
+        v->wordsCap = cap;
+    }
+    uint32_t id = wordCount++;
+    v->offset[id] = (uint32_t)v->wordsLen;
+    v->count[id] = 0;
+    v->lastNode[id] = 0;
+    memcpy(words + v->wordsLen, w, len + 1);
+    v->wordsLen += len + 1;
+    uint32_t b = h & v->mask;
+    while (v->slots[b]) b = (b + 1) & v->mask;
+    v->slots[b] = id + 1;
+    return id;
+}
+
+static const char *sortWords; // qsort has no context argument
+static const uint32_t *sortOffset;
+
+static int by_word(const void *a, const void *b) {
+    return strcmp(sortWords + sortOffset[*(const uint32_t *)a], sortWords + sortOffset[*(const uint32_t *)b]);
+}
+
+static int by_value(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Number the nodes in preorder and size their subtrees. */
+static int number_nodes(void) {
+    uint32_t cap = 0, stackCap = 0, sp = 0;
+    Node **stack = NULL;
+    int ok = 1;
+    for (Node *n = g_root; ok && n != NULL;) {
+        if (nodeCount == cap) {
+            uint32_t nc = cap ? cap * 2 : 1024;
+            Node **na = realloc(nodeAt, (size_t)nc * sizeof(Node *));
+            if (na == NULL) ok = 0;
+            else nodeAt = na, cap = nc;
+        }
+        if (ok && n->isQuestion && sp == stackCap) {
+            uint32_t nc = stackCap ? stackCap * 2 : 64;
+            Node **ns = realloc(stack, (size_t)nc * sizeof(Node *));
+            if (ns == NULL) ok = 0;
+            else stack = ns, stackCap = nc;
+        }
+        if (!ok) break;
+        nodeAt[nodeCount++] = n;
+        if (n->isQuestion) {
+            stack[sp++] = n->no;
+            n = n->yes;
+        } else {
+            n = sp > 0 ? stack[--sp] : NULL;
+        }
+    }
+    free(stack);
+    subtree = ok ? malloc(((size_t)nodeCount + 1) * sizeof(uint32_t)) : NULL;
+    if (subtree == NULL) return 0;
+    for (uint32_t i = nodeCount; i-- > 0;) { // children come after their parent
+        subtree[i] = 1;
+        if (nodeAt[i]->isQuestion) subtree[i] += subtree[i + 1] + subtree[i + 1 + subtree[i + 1]];
+    }
+    return 1;
+}
+
+static int build(void) {
+    release();
+    if (!number_nodes()) return 0;
+
+    /* every node's distinct words, in preorder */
+    Vocab v;
+    memset(&v, 0, sizeof v);
+    uint32_t *nodeWords = malloc(((size_t)nodeCount + 1) * sizeof(uint32_t));
+    uint32_t *occ = NULL;
+    size_t occCount = 0, occCap = 0;
+    int ok = nodeWords != NULL && vocab_grow(&v);
+    char w[SEARCH_MAX_WORD + 1];
+    for (uint32_t i = 0; ok && i < nodeCount; i++) {
+        nodeWords[i] = (uint32_t)occCount;
+        const char *s = nodeAt[i]->text;
+        size_t len;
+        while (ok && (len = next_word(&s, w)) > 0) {
+            int64_t id = vocab_id(&v, w, len);
+            if (id < 0 || occCount == UINT32_MAX) {
+                ok = 0;
+            } else if (v.lastNode[id] != i + 1) { // a word counts once per node
+                v.lastNode[id] = i + 1;
+                v.count[id]++;
+                if (occCount == occCap) {
+                    size_t nc = occCap ? occCap * 2 : 4096;
+                    uint32_t *no = realloc(occ, nc * sizeof(uint32_t));
+                    if (no == NULL) ok = 0;
+                    else occ = no, occCap = nc;
+                }
+                if (ok) occ[occCount++] = (uint32_t)id;
+            }
+        }
+    }
+    if (ok) nodeWords[nodeCount] = (uint32_t)occCount;
+    free(v.slots);
+    free(v.lastNode);
+
+    /* rank the words, then lay the posting lists out in rank order */
+    uint32_t *rankOf = NULL;
+    if (ok) {
+        wordAt = malloc(((size_t)wordCount + 1) * sizeof(uint32_t));
+        rankOf = malloc(((size_t)wordCount + 1) * sizeof(uint32_t));
+        listStart = malloc(((size_t)wordCount + 1) * sizeof(uint32_t));
+        postings = malloc((occCount + 1) * sizeof(uint32_t));
+        blocks = malloc((occCount + 1) * sizeof(uint32_t));
+        ok = wordAt && rankOf && listStart && postings && blocks;
+    }
+    if (ok) {
+        uint32_t *order = rankOf; // ids by rank, before it becomes rank by id
+        for (uint32_t id = 0; id < wordCount; id++) order[id] = id;
+        sortWords = words;
+        sortOffset = v.offset;
+        qsort(order, wordCount, sizeof(uint32_t), by_word);
+        uint32_t at = 0;
+        for (uint32_t r = 0; r < wordCount; r++) {
+            wordAt[r] = v.offset[order[r]];
+            listStart[r] = at;
+            at += v.count[order[r]];
+        }
+        listStart[wordCount] = at;
+        for (uint32_t r = 0; r < wordCount; r++) v.count[order[r]] = r; // count now holds rank by id
+        for (uint32_t i = 0; i < nodeCount; i++) {
+            for (uint32_t k = nodeWords[i]; k < nodeWords[i + 1]; k++) {
+                uint32_t r = v.count[occ[k]];
+                postings[listStart[r]++] = i;
+            }
+        }
+        for (uint32_t r = wordCount; r > 0; r--) listStart[r] = listStart[r - 1]; // fill moved each start to the next
+        listStart[0] = 0;
+
+        memcpy(blocks, postings, occCount * sizeof(uint32_t));
+        for (size_t b = 0; b < occCount; b += SEARCH_BLOCK) {
+            size_t len = occCount - b < SEARCH_BLOCK ? occCount - b : SEARCH_BLOCK;
+            size_t k = 1;
+            while (k < len && blocks[b + k - 1] <= blocks[b + k]) k++;
+            if (k < len) qsort(blocks + b, len, sizeof(uint32_t), by_value); // spans two lists
+        }
+    }
+    free(rankOf);
+    free(v.offset);
+    free(v.count);
+    free(nodeWords);
+    free(occ);
+    if (!ok) {
+        release();
+        return 0;
+    }
+    built = 1;
+    return 1;
+}
+
+/* Build the index if the tree changed since the last search. Returns 0 if
+ * out of memory. */
+int search_ready(void) {
+    return built || build();
+}
+
+/* ---------- Queries ---------- */
+
+/* First rank whose word is >= w, or (prefix) does not start with w. */
+static uint32_t rank_bound(const char *w, size_t len, int past) {
+    uint32_t lo = 0, hi = wordCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = past ? strncmp(words + wordAt[mid], w, len) : strcmp(words + wordAt[mid], w);
+        if (c < 0 || (past && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Parse and resolve query. Returns 0 if the index could not be built. */
+int search_compile(SearchQuery *q, const char *query) {
+    memset(q, 0, sizeof *q);
+    if (!search_ready()) return 0;
+    const char *s = query;
+    size_t len, used = 0;
+    char w[SEARCH_MAX_WORD + 1];
+    while (q->words < SEARCH_MAX_WORDS && (len = next_word(&s, w)) > 0) {
+        int i = q->words++;
+        memcpy(q->text + used, w, len + 1);
+        q->wordStart[i] = (int)used;
+        used += len + 1;
+        q->lo[i] = rank_bound(w, len, 0);
+        q->hi[i] = q->lo[i] < wordCount && strcmp(words + wordAt[q->lo[i]], w) == 0 ? q->lo[i] + 1 : q->lo[i];
+    }
+    if (q->words == 0) return 1;
+    /* the last word is a prefix unless the query goes on past it */
+    int last = q->words - 1;
+    size_t qlen = strlen(query);
+    q->lastIsPrefix = word_char((unsigned char)query[qlen - 1]) && next_word(&s, w) == 0;
+    if (q->lastIsPrefix) q->hi[last] = rank_bound(q->text + q->wordStart[last], strlen(q->text + q->wordStart[last]), 1);
+
+    q->pivot = 0;
+    for (int i = 0; i < q->words; i++) {
+        if (q->lo[i] == q->hi[i]) { // a word nothing uses
+            q->pivot = -1;
+            return 1;
+        }
+        if (listStart[q->hi[i]] - listStart[q->lo[i]] < listStart[q->hi[q->pivot]] - listStart[q->lo[q->pivot]]) {
+            q->pivot = i;
+        }
+    }
+    /* hits counts nodes, each once. One word's list holds every node using
+     * it once; a prefix spanning several words, or a phrase, is counted
+     * from the (rarest) word's postings with the repeats removed */
+    if (q->words == 1 && q->hi[0] - q->lo[0] == 1) {
+        q->hits = listStart[q->hi[0]] - listStart[q->lo[0]];
+        return 1;
+    }
+    uint32_t a = listStart[q->lo[q->pivot]], b = listStart[q->hi[q->pivot]];
+    uint32_t *seen = b - a <= SEARCH_COUNT_LIMIT ? malloc((b - a) * sizeof(uint32_t)) : NULL;
+    if (seen == NULL) {
+        q->hits = -1;
+        return 1;
+    }
+    memcpy(seen, postings + a, (b - a) * sizeof(uint32_t));
+    qsort(seen, b - a, sizeof(uint32_t), by_value);
+    for (uint32_t k = 0; k < b - a; k++) {
+        if (k > 0 && seen[k] == seen[k - 1]) continue;
+        q->hits += q->words == 1 || search_matches(q, nodeAt[seen[k]]);
+    }
+    free(seen);
+    return 1;
+}
+
+/* 1 if n's text contains the phrase q. */
+int search_matches(const SearchQuery *q, const Node *n) {
+    if (q->words == 0 || q->pivot < 0) return 0;
+    char ring[SEARCH_MAX_WORDS][SEARCH_MAX_WORD + 1];
+    const char *s = n->text;
+    int seen = 0;
+    while (next_word(&s, ring[seen % q->words]) > 0) {
+        seen++;
+        if (seen < q->words) continue;
+        int i = 0;
+        for (; i < q->words; i++) {
+            const char *have = ring[(seen - q->words + i) % q->words];
+            const char *want = q->text + q->wordStart[i];
+            if (i == q->words - 1 && q->lastIsPrefix ? strncmp(have, want, strlen(want)) != 0
+                                                     : strcmp(have, want) != 0) {
+                break;
+            }
+        }
+        if (i == q->words) return 1;
+    }
+    return 0;
+}
+
+/* Preorder number of n, or -1 if it is not in the indexed tree. */
+static int64_t number_of(const Node *n) {
+    int depth = 0;
+    for (const Node *c = n; c->parent; c = c->parent) depth++;
+    const Node **path = malloc(((size_t)depth + 1) * sizeof(Node *));
+    if (path == NULL) return -1;
+    int d = depth;
+    for (const Node *c = n; c; c = c->parent) path[d--] = c;
+    int64_t at = -1;
+    if (path[0] == g_root && nodeCount > 0) {
+        uint32_t i = 0;
+        for (d = 1; d <= depth && i < nodeCount; d++) {
+            uint32_t yes = i + 1;
+            i = path[d - 1]->yes == path[d] ? yes : yes + subtree[yes];
+        }
+        if (i < nodeCount && nodeAt[i] == n) at = i;
+    }
+    free(path);
+    return at;
+}
+
+/* The smallest posting in [a, b) above cur (or, backward, the largest
+ * below it); -1 if none. */
+static int64_t range_next(uint32_t a, uint32_t b, int64_t cur, int backward) {
+    int64_t best = -1;
+    uint32_t k = a;
+    /* a partial first block: the postings in place */
+    uint32_t edge = (a + SEARCH_BLOCK - 1) / SEARCH_BLOCK * SEARCH_BLOCK;
+    for (; k < b && k < edge; k++) {
+        int64_t p = postings[k];
+        if (backward ? p < cur && p > best : p > cur && (best < 0 || p < best)) best = p;
+    }
+    /* whole blocks: one binary search each in the sorted copy */
+    for (; k + SEARCH_BLOCK <= b; k += SEARCH_BLOCK) {
+        const uint32_t *blk = blocks + k;
+        uint32_t lo = 0, hi = SEARCH_BLOCK;
+        while (lo < hi) { // first >= cur (backward) or > cur (forward)
+            uint32_t mid = (lo + hi) / 2;
+            if (backward ? (int64_t)blk[mid] < cur : (int64_t)blk[mid] <= cur) lo = mid + 1;
+            else hi = mid;
+        }
+        if (backward) {
+            if (lo > 0 && (int64_t)blk[lo - 1] > best) best = blk[lo - 1];
+        } else if (lo < SEARCH_BLOCK && (best < 0 || blk[lo] < best)) {
+            best = blk[lo];
+        }
+    }
+    for (; k < b; k++) {
+        int64_t p = postings[k];
+        if (backward ? p < cur && p > best : p > cur && (best < 0 || p < best)) best = p;
+    }
+    return best;
+}
+
+/* ---------- Phrase cursors ---------- */
+
+/* A sorted run of postings read in search order: ascending, or from the
+ * top down when backward. */
+typedef struct {
+    const uint32_t *data;
+    uint32_t len, k;
+} Run;
+
+/* One word's postings as a merge of sorted runs (a single list, or the
+ * whole blocks of a prefix's range plus its partial ends sorted into
+ * scratch), kept in a heap by current posting. Seeking only moves runs
+ * that are behind the target, so a leapfrog that inches through two
+ * interleaved lists pays O(log) per step instead of a pass over the
+ * range. */
+typedef struct {
+    Run *runs;
+    int count;
+    int backward;
+    uint32_t *scratch;
+} Cursor;
+
+static uint32_t run_at(const Cursor *c, const Run *r, uint32_t k) {
+    return r->data[c->backward ? r->len - 1 - k : k];
+}
+
+/* x comes before y in search order */
+static int before(const Cursor *c, int64_t x, int64_t y) {
+    return c->backward ? x > y : x < y;
+}
+
+static int run_before(const Cursor *c, int i, int j) {
+    return before(c, run_at(c, &c->runs[i], c->runs[i].k), run_at(c, &c->runs[j], c->runs[j].k));
+}
+
+static void sift_down(Cursor *c, int i) {
+    for (;;) {
+        int l = 2 * i + 1, m = i;
+        if (l < c->count && run_before(c, l, m)) m = l;
+        if (l + 1 < c->count && run_before(c, l + 1, m)) m = l + 1;
+        if (m == i) return;
+        Run t = c->runs[i];
+        c->runs[i] = c->runs[m];
+        c->runs[m] = t;
+        i = m;
+    }
+}
+
+static int cursor_open(Cursor *c, uint32_t a, uint32_t b, int single, int backward) {
+    uint32_t edge = single ? b : (a + SEARCH_BLOCK - 1) / SEARCH_BLOCK * SEARCH_BLOCK;
+    if (edge > b) edge = b;
+    uint32_t tail = single ? b : edge + (b - edge) / SEARCH_BLOCK * SEARCH_BLOCK;
+    uint32_t loose = (edge - a) + (b - tail);
+    c->runs = malloc(((b - a) / SEARCH_BLOCK + 2) * sizeof(Run));
+    c->scratch = single ? NULL : malloc(((size_t)loose + 1) * sizeof(uint32_t));
+    c->count = 0;
+    c->backward = backward;
+    if (c->runs == NULL || (!single && c->scratch == NULL)) {
+        free(c->runs);
+        free(c->scratch);
+        return 0;
+    }
+    if (single) { // one word's list is already in preorder
+        c->runs[c->count++] = (Run){postings + a, b - a, 0};
+    } else {
+        memcpy(c->scratch, postings + a, (edge - a) * sizeof(uint32_t));
+        memcpy(c->scratch + (edge - a), postings + tail, (b - tail) * sizeof(uint32_t));
+        qsort(c->scratch, loose, sizeof(uint32_t), by_value);
+        if (loose > 0) c->runs[c->count++] = (Run){c->scratch, loose, 0};
+        for (uint32_t k = edge; k < tail; k += SEARCH_BLOCK) c->runs[c->count++] = (Run){blocks + k, SEARCH_BLOCK, 0};
+    }
+    for (int i = c->count / 2 - 1; i >= 0; i--) sift_down(c, i);
+    return 1;
+}
+
+static void cursor_close(Cursor *c) {
+    free(c->runs);
+    free(c->scratch);
+}
+
+/* The first posting at or after target in search order; -1 if none. */
+static int64_t cursor_seek(Cursor *c, int64_t target) {
+    while (c->count > 0) {
+        Run *r = &c->runs[0];
+        if (!before(c, run_at(c, r, r->k), target)) return run_at(c, r, r->k);
+        /* gallop, then binary search, to the first entry not before target */
+        uint32_t lo = r->k + 1, step = 1;
+        while (lo < r->len && before(c, run_at(c, r, lo), target)) {
+            lo += step;
+            step *= 2;
+        }
+        uint32_t hi = lo < r->len ? lo : r->len;
+        lo = lo - step / 2 > r->k ? lo - step / 2 : r->k + 1;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (before(c, run_at(c, r, mid), target)) lo = mid + 1;
+            else hi = mid;
+        }
+        r->k = lo;
+        if (r->k == r->len) c->runs[0] = c->runs[--c->count]; // run used up
+        sift_down(c, 0);
+    }
+    return -1;
+}
+
+/* Phrase queries: the first node after cur (before it, backward) that
+ * has every word, by leapfrogging the words' cursors from the rarest
+ * one, and then the phrase; -1 if none before the end of the tree. */
+static int64_t phrase_next(const SearchQuery *q, int64_t cur, int backward) {
+    Cursor cursors[SEARCH_MAX_WORDS];
+    int open = 0;
+    for (; open < q->words; open++) {
+        if (!cursor_open(&cursors[open], listStart[q->lo[open]], listStart[q->hi[open]],
+                         q->hi[open] - q->lo[open] == 1, backward)) {
+            break;
+        }
+    }
+    int64_t step = backward ? -1 : 1, at = -1;
+    if (open == q->words) at = cursor_seek(&cursors[q->pivot], cur + step);
+    while (at >= 0) {
+        int agreed = 0;
+        for (int i = q->pivot; at >= 0 && agreed < q->words; i = (i + 1) % q->words) {
+            int64_t p = cursor_seek(&cursors[i], at);
+            if (p == at) {
+                agreed++;
+            } else {
+                at = p;
+                agreed = 1;
+            }
+        }
+        if (at < 0 || search_matches(q, nodeAt[at])) break;
+        at = cursor_seek(&cursors[q->pivot], at + step);
+    }
+    while (open > 0) cursor_close(&cursors[--open]);
+    return at;
+}
+
+/* The next node after from in preorder (the previous one when backward)
+ * whose text matches q, wrapping around the tree; from may be NULL to
+ * start at the first (or last) node. NULL if nothing matches. */
+Node *search_next(const SearchQuery *q, const Node *from, int backward) {
+    if (q->words == 0 || q->pivot < 0 || !search_ready()) return NULL;
+    int64_t cur = from ? number_of(from) : -1;
+    if (cur < 0) cur = backward ? (int64_t)nodeCount : -1;
+    int64_t wrap = backward ? (int64_t)nodeCount : -1, at;
+    if (q->words == 1) {
+        uint32_t a = listStart[q->lo[0]], b = listStart[q->hi[0]];
+        at = range_next(a, b, cur, backward);
+        if (at < 0) at = range_next(a, b, wrap, backward);
+    } else {
+        at = phrase_next(q, cur, backward);
+        if (at < 0) at = phrase_next(q, wrap, backward);
+    }
+    return at < 0 ? NULL : nodeAt[at];
+}
@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "lab5.h"
+
+/* ========== Game Server ==========
+ * Serves games over a UNIX stream socket to many players at once, all on
+ * the shared tree. One thread runs an epoll loop over every connection;
+ * a connection is just its GameSession (a resumable state machine, see
+ * engine.c), its undo history and its socket, a couple of hundred bytes
+ * while idle. Requests are read and replies built in buffers shared by
+ * the loop; a connection only holds memory of its own for a request line
+ * that arrived in pieces or a reply its player is slow to take.
+ * Answering takes no lock, so other threads may play the same tree;
+ * teach, undo and redo go through the engine's writer lock.
+ *
+ * The protocol is text lines, and the server speaks first:
+ *   "Q <question>"  answer with "y" or "n"
+ *   "G <animal>"    confirm with "y" (right) or "n" (wrong)
+ *   "WON"           followed by the first line of the next game
+ *   "LEARN"         teach with "teach <y|n> <animal>\t<question>", where
+ *                   y/n is the animal's answer; "OK" and the next game
+ *                   follow, or "ERR <reason>"
+ * At any time the client may send "undo" or "redo" (its own edits; the
+ * reply is "OK" or "ERR <reason>"), "new" to restart the game, or "quit".
+ */
+
+#define SERVER_LINE 2048           /* longest request line */
+#define SERVER_READ (64 * 1024)    /* shared request buffer */
+#define SERVER_OUT (64 * 1024)     /* shared reply buffer */
+#define SERVER_EVENTS 256          /* events taken per epoll_wait */
+
+typedef struct Conn {
+    int fd;
+    unsigned char skipping;        /* discarding the rest of an overlong line */
+    unsigned char closing;         /* hang up once pend is sent */
+    struct Conn *prev, *next;      /* every connection, for server_stop */
+    GameSession game;
+    EditStack undo, redo;          /* allocated by the first teach */
+    char *part;                    /* start of a request line still arriving */
+    int partLen;
+    char *pend;                    /* reply the socket would not take yet */
+    int pendLen, pendOff;
+} Conn;
+
+/* State of the loop thread. */
+typedef struct {
+    GameServer *srv;
+    Conn *conns;
+    int outLen;
+    char in[SERVER_LINE + SERVER_READ]; // a carried-over part, then new bytes
+    char out[SERVER_OUT];
+} Loop;
+
+static void watch(GameServer *srv, int op, int fd, uint32_t events, void *ptr) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = ptr;
+    epoll_ctl(srv->epollFd, op, fd, &ev);
+}
+
+/* Send the reply built so far. What the socket does not take waits in
+ * c->pend, and the connection is not read again until it is sent. */
+static void out_flush(Loop *l, Conn *c) {
+    const char *p = l->out;
+    size_t n = (size_t)l->outLen;
+    l->outLen = 0;
+    while (n > 0 && c->pend == NULL) {
+        ssize_t k = send(c->fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            c->closing = 1; // the player is gone
+            return;
+        }
+        if (k < 0) break;
+        p += k;
+        n -= (size_t)k;
+    }
+    if (n == 0) return;
+    char *np = realloc(c->pend, (size_t)c->pendLen + n);
+    if (np == NULL) {
+        c->closing = 1;
+        return;
+    }
+    if (c->pend == NULL) watch(l->srv, EPOLL_CTL_MOD, c->fd, EPOLLOUT, c);
+    memcpy(np + c->pendLen, p, n);
+    c->pend = np;
+    c->pendLen += (int)n;
+}
+
+static void out_put(Loop *l, Conn *c, const char *s, size_t n) {
+    while (n > 0) {
+        size_t room = sizeof l->out - (size_t)l->outLen;
+        if (room == 0) {
+            out_flush(l, c);
+            continue;
+        }
+        size_t k = n < room ? n : room;
+        memcpy(l->out + l->outLen, s, k);
+        l->outLen += (int)k;
+        s += k;
+        n -= k;
+    }
+}
+
+/* One reply line: tag, then text if given. */
+static void out_line(Loop *l, Conn *c, const char *tag, const char *text) {
+    out_put(l, c, tag, strlen(tag));
+    if (text) {
+        out_put(l, c, " ", 1);
+        out_put(l, c, text, strlen(text));
+    }
+    out_put(l, c, "\n", 1);
+}
+
+/* The line that tells the client what the session wants next. */
+static void out_prompt(Loop *l, Conn *c) {
+    switch (c->game.state) {
+        case GAME_ASKING:   out_line(l, c, "Q", engine_question(&c->game)); break;
+        case GAME_GUESSING: out_line(l, c, "G", engine_guess(&c->game)); break;
+        case GAME_LEARNING: out_line(l, c, "LEARN", NULL); break;
+        default:            out_line(l, c, "ERR", "no tree"); break;
+    }
+}
+
+static void new_game(Conn *c) {
+    engine_end(&c->game);
+    engine_begin(&c->game);
+    engine_history(&c->game, &c->undo, &c->redo);
+}
+
+/* "teach <y|n> <animal>\t<question>" */
+static void do_teach(Loop *l, Conn *c, char *args) {
+    char *tab = strchr(args, '\t');
+    if (c->game.state != GAME_LEARNING) {
+        out_line(l, c, "ERR", "not learning");
+        return;
+    }
+    if ((args[0] != 'y' && args[0] != 'n') || args[1] != ' ' || tab == NULL ||
+        tab == args + 2 || tab[1] == '\0') {
+        out_line(l, c, "ERR", "usage: teach <y|n> <animal>\\t<question>");
+        return;
+    }
+    *tab = '\0';
+    int r = engine_teach(&c->game, args + 2, tab + 1, args[0] == 'y');
+    if (r < 0) {
+        out_line(l, c, "ERR", "the tree changed; start a new game");
+    } else if (r == 0) {
+        out_line(l, c, "ERR", "out of memory");
+    } else {
+        new_game(c);
+        out_line(l, c, "OK", NULL);
+        out_prompt(l, c);
+    }
+}
+
+static void do_edit(Loop *l, Conn *c, int redo) {
+    int r = redo ? engine_redo(&c->undo, &c->redo) : engine_undo(&c->undo, &c->redo);
+    if (r > 0) out_line(l, c, "OK", NULL);
+    else if (r == 0) out_line(l, c, "ERR", redo ? "nothing to redo" : "nothing to undo");
+    else out_line(l, c, "ERR", "another player has taught below it");
+}
+
+/* Handle one request line. */
+static void handle_line(Loop *l, Conn *c, char *line) {
+    GameSession *g = &c->game;
+    if (strcmp(line, "y") == 0 || strcmp(line, "n") == 0) {
+        int yes = line[0] == 'y';
+        if (g->state == GAME_ASKING) {
+            engine_answer(g, yes);
+            __atomic_add_fetch(&l->srv->steps, 1, __ATOMIC_RELAXED);
+            out_prompt(l, c);
+        } else if (g->state == GAME_GUESSING) {
+            __atomic_add_fetch(&l->srv->steps, 1, __ATOMIC_RELAXED);
+            if (engine_confirm(g, yes) != GAME_LEARNING) {
+                new_game(c);
+                out_line(l, c, "WON", NULL);
+            }
+            out_prompt(l, c);
+        } else {
+            out_line(l, c, "ERR", "not a yes/no question");
+        }
+    } else if (strncmp(line, "teach ", 6) == 0) {
+        do_teach(l, c, line + 6);
+    } else if (strcmp(line, "undo") == 0) {
+        do_edit(l, c, 0);
+    } else if (strcmp(line, "redo") == 0) {
+        do_edit(l, c, 1);
+    } else if (strcmp(line, "new") == 0) {
+        new_game(c);
+        out_prompt(l, c);
+    } else if (strcmp(line, "quit") == 0) {
+        out_line(l, c, "BYE", NULL);
+        c->closing = 1;
+    } else {
+        out_line(l, c, "ERR", "unknown command");
+    }
+}
+
+static void conn_close(Loop *l, Conn *c) {
+    GameServer *srv = l->srv;
+    if (c->prev) c->prev->next = c->next;
+    else l->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    engine_end(&c->game);
+    engine_drop_history(&c->undo, &c->redo);
+    close(c->fd); // also leaves the epoll set
+    free(c->part);
+    free(c->pend);
+    free(c);
+    __atomic_sub_fetch(&srv->live, 1, __ATOMIC_RELAXED);
+    if (srv->acceptPaused) { // a descriptor is free again
+        srv->acceptPaused = 0;
+        watch(srv, EPOLL_CTL_ADD, srv->listenFd, EPOLLIN, srv);
+    }
+}
+
+static void conn_open(Loop *l, int fd) {
+    Conn *c = calloc(1, sizeof(Conn));
+    if (c == NULL || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        free(c);
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->next = l->conns;
+    if (l->conns) l->conns->prev = c;
+    l->conns = c;
+    __atomic_add_fetch(&l->srv->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&l->srv->sessions, 1, __ATOMIC_RELAXED);
+    watch(l->srv, EPOLL_CTL_ADD, fd, EPOLLIN, c);
+    new_game(c);
+    out_prompt(l, c);
+    out_flush(l, c);
+    if (c->closing) conn_close(l, c);
+}
+
+static void accept_all(Loop *l) {
+    GameServer *srv = l->srv;
+    for (;;) {
+        int fd = accept(srv->listenFd, NULL, NULL);
+        if (fd >= 0) {
+            conn_open(l, fd);
+            continue;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno == EMFILE || errno == ENFILE || errno == ENOMEM || errno == ENOBUFS) {
+            // out of descriptors: stop listening until a player leaves
+            epoll_ctl(srv->epollFd, EPOLL_CTL_DEL, srv->listenFd, NULL);
+            srv->acceptPaused = 1;
+        }
+        return;
+    }
+}
+
+/* Read what the player sent and answer every complete line. */
+static void conn_read(Loop *l, Conn *c) {
+    int len = c->partLen;
+    if (c->part) memcpy(l->in, c->part, (size_t)len);
+    free(c->part);
+    c->part = NULL;
+    c->partLen = 0;
+    ssize_t k;
+    do {
+        k = recv(c->fd, l->in + len, SERVER_READ, 0);
+    } while (k < 0 && errno == EINTR);
+    if (k == 0 || (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        conn_close(l, c);
+        return;
+    }
+    if (k > 0) len += (int)k;
+
+    int start = 0;
+    for (int i = 0; i < len && !c->closing; i++) {
+        if (l->in[i] != '\n') continue;
+        l->in[i] = '\0';
+        if (i > start && l->in[i - 1] == '\r') l->in[i - 1] = '\0';
+        if (c->skipping) c->skipping = 0;
+        else handle_line(l, c, l->in + start);
+        start = i + 1;
+    }
+    int rest = c->closing ? 0 : len - start;
+    if (rest >= SERVER_LINE) {
+        if (!c->skipping) out_line(l, c, "ERR", "line too long");
+        c->skipping = 1;
+    } else if (rest > 0 && !c->skipping) {
+        c->part = malloc((size_t)rest);
+        if (c->part == NULL) {
+            c->closing = 1;
+        } else {
+            memcpy(c->part, l->in + start, (size_t)rest);
+            c->partLen = rest;
+        }
+    }
+    out_flush(l, c);
+    if (c->closing && c->pend == NULL) conn_close(l, c);
+}
+
+/* The socket has room again: send the rest of the reply, then read on. */
+static void conn_write(Loop *l, Conn *c) {
+    while (c->pendOff < c->pendLen) {
+        ssize_t k = send(c->fd, c->pend + c->pendOff, (size_t)(c->pendLen - c->pendOff), MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (k < 0) {
+            conn_close(l, c);
+            return;
+        }
+        c->pendOff += (int)k;
+    }
+    free(c->pend);
+    c->pend = NULL;
+    c->pendLen = c->pendOff = 0;
+    if (c->closing) conn_close(l, c);
+    else watch(l->srv, EPOLL_CTL_MOD, c->fd, EPOLLIN, c);
+}
+
+static void *event_loop(void *arg) {
+    GameServer *srv = arg;
+    struct epoll_event events[SERVER_EVENTS];
+    Loop *l = malloc(sizeof(Loop));
+    if (l == NULL) return NULL;
+    l->srv = srv;
+    l->conns = NULL;
+    l->outLen = 0;
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(srv->epollFd, events, SERVER_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == srv) {
+                accept_all(l);
+            } else if (ptr == &srv->wakeFd) {
+                running = 0; // server_stop
+            } else if (events[i].events & EPOLLOUT) {
+                conn_write(l, ptr);
+            } else {
+                conn_read(l, ptr); // EPOLLIN, or a hangup that recv reports
+            }
+        }
+    }
+    while (l->conns) conn_close(l, l->conns);
+    free(l);
+    return NULL;
+}
+
+/* Listen on the UNIX socket at path (replacing a stale one) and serve the
+ * tree in g_root from a background thread. Returns 0 on failure. */
+int server_start(GameServer *srv, const char *path) {
+    memset(srv, 0, sizeof *srv);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) return 0;
+    strcpy(addr.sun_path, path);
+    strcpy(srv->path, path);
+
+    srv->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    srv->epollFd = epoll_create1(0);
+    srv->wakeFd = eventfd(0, 0);
+    if (srv->listenFd < 0 || srv->epollFd < 0 || srv->wakeFd < 0) goto fail;
+    unlink(path);
+    if (bind(srv->listenFd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+        listen(srv->listenFd, SOMAXCONN) != 0 ||
+        fcntl(srv->listenFd, F_SETFL, fcntl(srv->listenFd, F_GETFL) | O_NONBLOCK) != 0) {
+        goto fail;
+    }
+    watch(srv, EPOLL_CTL_ADD, srv->listenFd, EPOLLIN, srv);
+    watch(srv, EPOLL_CTL_ADD, srv->wakeFd, EPOLLIN, &srv->wakeFd);
+    if (pthread_create(&srv->thread, NULL, event_loop, srv) != 0) goto fail;
+    return 1;
+
+fail:
+    if (srv->listenFd >= 0) close(srv->listenFd);
+    if (srv->epollFd >= 0) close(srv->epollFd);
+    if (srv->wakeFd >= 0) close(srv->wakeFd);
+    unlink(path);
+    return 0;
+}
+
+/* Stop serving: hang up on every player and wait for the loop to end. */
+void server_stop(GameServer *srv) {
+    uint64_t one = 1;
+    while (write(srv->wakeFd, &one, sizeof one) < 0 && errno == EINTR) {
+    }
+    pthread_join(srv->thread, NULL);
+    close(srv->listenFd);
+    close(srv->epollFd);
+    close(srv->wakeFd);
+    unlink(srv->path);
+}
+
+/* Connect to the server at path as a player. Returns the socket, or -1. */
+int server_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) return -1;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve g_root on path until SIGINT or SIGTERM. Returns 0 on a clean
+ * shutdown. */
+int server_run(const char *path) {
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL); // inherited by the loop thread
+    GameServer srv;
+    if (!server_start(&srv, path)) {
+        fprintf(stderr, "cannot listen on %s\n", path);
+        return 1;
+    }
+    fprintf(stderr, "serving on %s\n", path);
+    int sig;
+    sigwait(&stop, &sig);
+    server_stop(&srv);
+    fprintf(stderr, "served %ld sessions, %ld answers\n", srv.sessions, srv.steps);
+    return 0;
+}
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+char *strdup(const char *s);
+
+/* ========== Question Similarity ==========
+ * Finds existing questions that are near-duplicates of a new one ("Does it
+ * swim?" / "Can it swim?") so the learning phase can offer to reuse them.
+ *
+ * Every distinct canonical question gets a question id. Its trigrams (of
+ * the canonical text padded with '_') are stored twice: as a posting list
+ * per trigram (trigram -> question ids) and as a sorted forward list per
+ * question. Canonical text only contains [a-z0-9_], so a trigram maps to a
+ * dense index below 37^3 and no hashing is needed.
+ *
+ * Similarity is a Dice coefficient weighted by inverse document frequency,
+ * so the boilerplate shared by every question ("_do", "it_") counts for
+ * little and the distinguishing words dominate. A query only unions the
+ * posting lists of its rarest trigrams: any question that shares none of
+ * them cannot reach the threshold (prefix filtering). Hits are counted
+ * per question while scanning, so only candidates whose count plus the
+ * unscanned weight can still reach the threshold are scored exactly by
+ * merging forward lists.
+ *
+ * The set is built lazily from g_root on the first query and then kept
+ * current by the learn/undo/redo hooks. Undone questions stay in the set
+ * with a zero reference count and are simply not reported.
+ */
+
+#define TRI_ALPHABET 37
+#define TRI_SPACE (TRI_ALPHABET * TRI_ALPHABET * TRI_ALPHABET)
+#define SIM_MAX_TRIGRAMS 512
+#define SIM_SCAN_BUDGET 32768   /* postings scanned per query, at most */
+#define SIM_MAX_VERIFY 256      /* candidates scored when over budget */
+
+typedef struct {
+    char *text;       /* display text (first spelling seen) */
+    int triStart;     /* offset of the forward list in triPool */
+    int triCount;
+    int refs;         /* question nodes in the tree using this question */
+} SimQuestion;
+
+static IdList *postings = NULL;        /* TRI_SPACE lists, trigram -> qids */
+static uint16_t *triPool = NULL;       /* forward lists, sorted per question */
+static int triPoolCount = 0, triPoolCap = 0;
+static SimQuestion *questions = NULL;
+static int questionCount = 0, questionCap = 0;
+static Hash byCanon = {NULL, 0, 0, NULL, 0, 0, NULL}; /* canonical -> qid */
+static int built = 0;
+
+/* Trigram weights are cached in a compact table and recomputed, together
+ * with every question's total, whenever the corpus has grown by 1/16 since
+ * the last refresh: scoring then touches one small array instead of a
+ * posting list header per trigram. Totals live apart from SimQuestion so
+ * that bounding a candidate's score costs a single dense load. */
+static uint8_t *triWeight = NULL;
+static int *qWeight = NULL;  /* per question id, sized like questions */
+static int weightsAt = -1;  /* questionCount at the last refresh */
+
+/* Query scratch, sized to questionCount: per-question weighted overlap
+ * with the scanned trigrams (kept all-zero between queries), the questions
+ * touched, and a decode buffer for one posting list. */
+static int *acc = NULL, *touchedIds = NULL, *scanIds = NULL;
+static int scanCap = 0;
+
+static int tri_char(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= '0' && c <= '9') return 26 + (c - '0');
+    return 36; // '_' and anything else
+}
+
+static int cmp_u16(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+/* Distinct trigrams of canonical text, sorted. Returns how many. */
+static int trigrams(const char *canon, uint16_t *out) {
+    size_t len = strlen(canon);
+    int n = 0;
+    int a = 36, b = tri_char((unsigned char)canon[0]); // leading pad
+    for (size_t i = 1; i <= len && n < SIM_MAX_TRIGRAMS; i++) {
+        int c = i < len ? tri_char((unsigned char)canon[i]) : 36; // trailing pad
+        out[n++] = (uint16_t)((a * TRI_ALPHABET + b) * TRI_ALPHABET + c);
+        a = b;
+        b = c;
+    }
+    if (len == 0) return 0;
+    qsort(out, n, sizeof(uint16_t), cmp_u16);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (k == 0 || out[k - 1] != out[i]) out[k++] = out[i];
+    }
+    return k;
+}
+
+/* Inverse document frequency as an integer log2, so that a trigram found
+ * in every question weighs 1 and a unique one about log2(N) + 1. */
+static int tri_weight(int df) {
+    unsigned ratio = (unsigned)(questionCount + 1) / (unsigned)(df + 1);
+    return ratio ? 32 - __builtin_clz(ratio) : 1;
+}
+
+static void refresh_weights(void) {
+    if (weightsAt >= 0 && questionCount <= weightsAt + weightsAt / 16) return;
+    if (triWeight == NULL) {
+        triWeight = malloc(TRI_SPACE);
+        if (triWeight == NULL) return;
+    }
+    for (int t = 0; t < TRI_SPACE; t++) triWeight[t] = (uint8_t)tri_weight(postings[t].count);
+    for (int i = 0; i < questionCount; i++) {
+        const uint16_t *qt = triPool + questions[i].triStart;
+        int w = 0;
+        for (int j = 0; j < questions[i].triCount; j++) w += triWeight[qt[j]];
+        qWeight[i] = w;
+    }
+    weightsAt = questionCount;
+}
+
+/* Forget every question; the next query rebuilds from g_root. */
+void sim_reset(void) {
+    if (postings) {
+        for (int t = 0; t < TRI_SPACE; t++) idl_free(&postings[t]);
+    }
+    free(postings);
+    postings = NULL;
+    for (int i = 0; i < questionCount; i++) free(questions[i].text);
+    free(questions);
+    questions = NULL;
+    free(qWeight);
+    qWeight = NULL;
+    questionCount = questionCap = 0;
+    free(triPool);
+    triPool = NULL;
+    triPoolCount = triPoolCap = 0;
+    h_free(&byCanon);
+    free(triWeight);
+    triWeight = NULL;
+    weightsAt = -1;
+    free(acc);
+    free(touchedIds);
+    free(scanIds);
+    acc = touchedIds = scanIds = NULL;
+    scanCap = 0;
+    built = 0;
+}
+
+/* Register one more use of question. Callers that manage the set
+ * themselves (tests, benchmarks) may call this directly; it marks the set
+ * as built so the first query does not also pull in g_root. Returns the
+ * question id, or -1 on allocation failure. */
+int sim_add(const char *question) {
+    if (postings == NULL) {
+        postings = malloc(TRI_SPACE * sizeof(IdList));
+        if (postings == NULL) return -1;
+        for (int t = 0; t < TRI_SPACE; t++) idl_init(&postings[t]);
+        h_init(&byCanon, 1021);
+    }
+    built = 1;
+
+    char *canon = canonicalize(question);
+    if (canon == NULL) return -1;
+    int count;
+    int *ids = h_get_ids(&byCanon, canon, &count);
+    if (count > 0) { // same canonical question: just another use
+        questions[ids[0]].refs++;
+        free(canon);
+        return ids[0];
+    }
+
+    uint16_t tri[SIM_MAX_TRIGRAMS];
+    int n = trigrams(canon, tri);
+    if (questionCount >= questionCap) {
+        int newCap = questionCap ? questionCap * 2 : 256;
+        SimQuestion *nq = realloc(questions, (size_t)newCap * sizeof(SimQuestion));
+        if (nq == NULL) {
+            free(canon);
+            return -1;
+        }
+        questions = nq;
+        int *nw = realloc(qWeight, (size_t)newCap * sizeof(int));
+        if (nw == NULL) {
+            free(canon);
+            return -1;
+        }
+        qWeight = nw;
+        questionCap = newCap;
+    }
+    if (triPoolCount + n > triPoolCap) {
+        int newCap = triPoolCap ? triPoolCap : 4096;
+        while (newCap < triPoolCount + n) newCap *= 2;
+        uint16_t *np = realloc(triPool, (size_t)newCap * sizeof(uint16_t));
+        if (np == NULL) {
+            free(canon);
+            return -1;
+        }
+        triPool = np;
+        triPoolCap = newCap;
+    }
+
+    int qid = questionCount++;
+    SimQuestion *q = &questions[qid];
+    q->text = strdup(question);
+    q->triStart = triPoolCount;
+    q->triCount = n;
+    q->refs = 1;
+    qWeight[qid] = 0;
+    memcpy(triPool + triPoolCount, tri, (size_t)n * sizeof(uint16_t));
+    triPoolCount += n;
+    for (int i = 0; i < n; i++) {
+        idl_add(&postings[tri[i]], qid);
+        if (triWeight) qWeight[qid] += triWeight[tri[i]];
+    }
+    h_put(&byCanon, canon, qid);
+    free(canon);
+    return qid;
+}
+
+/* Drop one use of question (the question stays known for redo). */
+void sim_remove(const char *question) {
+    if (!built || postings == NULL) return;
+    char *canon = canonicalize(question);
+    if (canon == NULL) return;
+    int count;
+    int *ids = h_get_ids(&byCanon, canon, &count);
+    if (count > 0 && questions[ids[0]].refs > 0) questions[ids[0]].refs--;
+    free(canon);
+}
+
+/* Rebuild the set from every question node in g_root. */
+void sim_rebuild(void) {
+    sim_reset();
+    built = 1;
+    if (g_root == NULL) return;
+    int cap = 64, top = 0;
+    Node **stack = malloc((size_t)cap * sizeof(Node *));
+    if (stack == NULL) return;
+    stack[top++] = g_root;
+    while (top > 0) {
+        Node *n = stack[--top];
+        if (n == NULL || !n->isQuestion) continue;
+        sim_add(n->text);
+        if (top + 2 > cap) {
+            cap *= 2;
+            Node **ns = realloc(stack, (size_t)cap * sizeof(Node *));
+            if (ns == NULL) break;
+            stack = ns;
+        }
+        stack[top++] = n->no;
+        stack[top++] = n->yes;
+    }
+    free(stack);
+}
+
+/* Edit hooks; they do nothing until the set has been built. */
+void sim_on_learn(const Edit *e) {
+    if (built) sim_add(e->newQuestion->text);
+}
+
+void sim_on_undo(const Edit *e) {
+    if (built) sim_remove(e->newQuestion->text);
+}
+
+void sim_on_redo(const Edit *e) {
+    sim_on_learn(e);
+}
+
+/* ---------- Queries ---------- */
+
+static int scan_reserve(void) {
+    if (scanCap >= questionCount) return 1;
+    int newCap = questionCount * 2;
+    int *na = realloc(acc, (size_t)newCap * sizeof(int));
+    if (na == NULL) return 0;
+    acc = na;
+    memset(acc + scanCap, 0, (size_t)(newCap - scanCap) * sizeof(int));
+    int *nt = realloc(touchedIds, (size_t)newCap * sizeof(int));
+    if (nt == NULL) return 0;
+    touchedIds = nt;
+    int *ns = realloc(scanIds, (size_t)newCap * sizeof(int));
+    if (ns == NULL) return 0;
+    scanIds = ns;
+    scanCap = newCap;
+    return 1;
+}
+
+typedef struct {
+    uint16_t tri;
+    int df;
+} QueryTri;
+
+static int cmp_df(const void *a, const void *b) {
+    const QueryTri *x = a, *y = b;
+    return (x->df > y->df) - (x->df < y->df);
+}
+
+/* Find up to max questions whose similarity to question is at least
+ * minScore (0..1], best first. Returns how many were written to out; the
+ * text pointers stay valid until the set is next reset. */
+int sim_find(const char *question, double minScore, SimMatch *out, int max) {
+    if (!built) sim_rebuild();
+    if (postings == NULL || max <= 0 || minScore <= 0.0) return 0;
+
+    char *canon = canonicalize(question);
+    if (canon == NULL) return 0;
+    uint16_t tri[SIM_MAX_TRIGRAMS];
+    int n = trigrams(canon, tri);
+    free(canon);
+    if (n == 0) return 0;
+
+    refresh_weights();
+    if (triWeight == NULL || !scan_reserve()) return 0;
+    QueryTri order[SIM_MAX_TRIGRAMS];
+    long wa = 0; // total query weight
+    for (int i = 0; i < n; i++) {
+        order[i].tri = tri[i];
+        order[i].df = postings[tri[i]].count;
+        wa += triWeight[tri[i]];
+    }
+
+    /* A match needs weighted overlap >= minScore * wa / (2 - minScore).
+     * Scanning the rarest lists until the unscanned (suffix) weight drops
+     * below that finds every match: a question sharing none of the scanned
+     * trigrams cannot reach it. When that prefix does not fit in the scan
+     * budget the search becomes best-effort, and only the questions sharing
+     * the most rare-trigram weight are verified. */
+    double need = minScore * (double)wa / (2.0 - minScore);
+    qsort(order, n, sizeof(QueryTri), cmp_df);
+    long suffix = wa, budget = SIM_SCAN_BUDGET;
+    int touched = 0, scanned = 0;
+    for (; scanned < n && (double)suffix >= need; scanned++) {
+        if (order[scanned].df > budget && scanned > 0) break;
+        int w = triWeight[order[scanned].tri];
+        suffix -= w;
+        budget -= order[scanned].df;
+        int m = idl_decode(&postings[order[scanned].tri], scanIds);
+        for (int k = 0; k < m; k++) {
+            int qid = scanIds[k];
+            if (acc[qid] == 0) touchedIds[touched++] = qid;
+            acc[qid] += w;
+        }
+    }
+    int exact = (double)suffix < need;
+
+    /* Every possible match is touched by now (in exact mode). Scanning a
+     * few more lists only tightens their bounds; that is worth it while a
+     * list is no longer than the candidate set it prunes. */
+    for (; exact && scanned < n && order[scanned].df <= budget && order[scanned].df <= touched; scanned++) {
+        int w = triWeight[order[scanned].tri];
+        suffix -= w;
+        budget -= order[scanned].df;
+        int m = idl_decode(&postings[order[scanned].tri], scanIds);
+        for (int k = 0; k < m; k++) {
+            if (acc[scanIds[k]]) acc[scanIds[k]] += w;
+        }
+    }
+
+    /* Pick the acc cutoff: in exact mode the bound acc + suffix must reach
+     * need; otherwise keep (about) the SIM_MAX_VERIFY best candidates. */
+    long cutoff = exact ? (long)(need - (double)suffix) : 1;
+    int verifyLeft = exact ? touched : SIM_MAX_VERIFY;
+    if (!exact && touched > SIM_MAX_VERIFY) {
+        long top = wa - suffix;
+        int *hist = calloc((size_t)top + 1, sizeof(int));
+        if (hist) {
+            for (int c = 0; c < touched; c++) hist[acc[touchedIds[c]]]++;
+            int kept = hist[top];
+            for (cutoff = top; cutoff > 1 && kept + hist[cutoff - 1] <= SIM_MAX_VERIFY; cutoff--) {
+                kept += hist[cutoff - 1];
+            }
+            free(hist);
+        }
+    }
+
+    uint64_t queryBits[(TRI_SPACE + 63) / 64] = {0};
+    for (int i = 0; i < n; i++) queryBits[tri[i] >> 6] |= 1ull << (tri[i] & 63);
+
+    int found = 0;
+    for (int c = 0; c < touched; c++) {
+        int qid = touchedIds[c];
+        long shared = acc[qid];
+        acc[qid] = 0; // leave acc all-zero for the next query
+        if (shared < cutoff || verifyLeft == 0) continue;
+        /* the unscanned overlap is at most suffix: bound the score before
+         * touching the question itself */
+        long wb = qWeight[qid];
+        if (2.0 * (double)(shared + suffix) < minScore * (double)(wa + wb)) continue;
+        const SimQuestion *q = &questions[qid];
+        if (q->refs == 0) continue;
+        verifyLeft--;
+
+        /* exact score from the forward list, branch-free */
+        const uint16_t *qt = triPool + q->triStart;
+        long overlap = 0;
+        for (int j = 0; j < q->triCount; j++) {
+            uint64_t in = (queryBits[qt[j] >> 6] >> (qt[j] & 63)) & 1;
+            overlap += triWeight[qt[j]] & -(long)in;
+        }
+        double score = 2.0 * (double)overlap / (double)(wa + wb);
+        if (score < minScore) continue;
+
+        /* insertion into the small best-first result array */
+        int pos = found < max ? found++ : max;
+        while (pos > 0 && out[pos - 1].score < score) {
+            if (pos < max) out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max) {
+            out[pos].text = q->text;
+            out[pos].score = score;
+        }
+    }
+    return found;
+}
+
+/* Number of distinct questions known (including undone ones). */
+int sim_size(void) {
+    if (!built) sim_rebuild();
+    return questionCount;
+}
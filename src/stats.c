@@ -0,0 +1,318 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Tree Statistics ==========
+ * Everything is gathered in one iterative postorder walk: counts and text
+ * bytes on the way down, the depth histogram at the leaves, and subtree
+ * heights (hence imbalance) on the way back up.
+ *
+ * For large trees the top of the tree is expanded breadth-first on the
+ * calling thread until enough subtrees hang below it, worker threads walk
+ * those subtrees into private totals, and the calling thread then merges
+ * the totals and finishes the expanded top nodes bottom-up from the
+ * subtree heights the workers left behind.
+ *
+ * The walk trusts the tree's shape; a loaded tree has already passed the
+ * integrity check.
+ */
+
+#define STATS_MAX_THREADS 64
+#define STATS_TOP_NODES 65536   /* expanded alone before starting workers */
+
+typedef struct {
+    long nodes, questions, animals;
+    long *hist;             /* animals per depth */
+    int histLen;
+    long long depthSum;     /* sum of animal depths */
+    int maxImbalance;
+    Node *worst;
+    long long imbalanceSum;
+    long unbalanced;
+    size_t questionBytes, animalBytes;
+    int failed;             /* out of memory */
+} StatsPart;
+
+typedef struct {
+    Node *node;
+    int depth;
+    int height;             /* filled once the subtree is done */
+    int yes, no;            /* item indices of expanded children, else -1 */
+} StatsItem;
+
+typedef struct {
+    Node *node;
+    int depth;
+    int stage;              /* 0 new, 1 yes pushed, 2 no pushed */
+    int hYes, hNo;
+} StatsFrame;
+
+typedef struct {
+    StatsItem *items;
+    int from, to;           /* the subtree items [from, to) */
+    int next;               /* next item to claim (atomic) */
+} StatsWork;
+
+typedef struct {
+    StatsWork *work;
+    StatsPart part;
+} StatsWorker;
+
+static void part_leaf(StatsPart *p, const Node *n, int depth) {
+    p->nodes++;
+    p->animals++;
+    p->animalBytes += strlen(n->text);
+    p->depthSum += depth;
+    if (depth >= p->histLen) {
+        int newLen = p->histLen ? p->histLen : 32;
+        while (newLen <= depth) newLen *= 2;
+        long *nh = realloc(p->hist, (size_t)newLen * sizeof(long));
+        if (nh == NULL) {
+            p->failed = 1;
+            return;
+        }
+        memset(nh + p->histLen, 0, (size_t)(newLen - p->histLen) * sizeof(long));
+        p->hist = nh;
+        p->histLen = newLen;
+    }
+    p->hist[depth]++;
+}
+
+/* Fold in a question whose subtrees are hYes and hNo high; returns its
+ * own height. */
+static int part_question(StatsPart *p, Node *n, int hYes, int hNo) {
+    int imbalance = hYes > hNo ? hYes - hNo : hNo - hYes;
+    p->nodes++;
+    p->questions++;
+    p->questionBytes += strlen(n->text);
+    p->imbalanceSum += imbalance;
+    if (imbalance > 1) p->unbalanced++;
+    if (imbalance > p->maxImbalance || p->worst == NULL) {
+        p->maxImbalance = imbalance;
+        p->worst = n;
+    }
+    return 1 + (hYes > hNo ? hYes : hNo);
+}
+
+/* Postorder walk of the subtree at root (which sits at depth) into p.
+ * Returns the subtree height, or -1 if out of memory. */
+static int part_walk(StatsPart *p, Node *root, int depth) {
+    int cap = 64, top = 0, height = -1;
+    StatsFrame *stack = malloc((size_t)cap * sizeof(StatsFrame));
+    if (stack == NULL) {
+        p->failed = 1;
+        return -1;
+    }
+    stack[top++] = (StatsFrame){root, depth, 0, 0, 0};
+    while (top > 0) {
+        StatsFrame *f = &stack[top - 1];
+        Node *child = NULL;
+        if (!f->node->isQuestion) {
+            part_leaf(p, f->node, f->depth);
+            height = 0;
+        } else if (f->stage < 2) {
+            child = f->stage++ == 0 ? f->node->yes : f->node->no;
+        } else {
+            height = part_question(p, f->node, f->hYes, f->hNo);
+        }
+        if (child != NULL) {
+            if (top == cap) {
+                StatsFrame *ns = realloc(stack, (size_t)cap * 2 * sizeof(StatsFrame));
+                if (ns == NULL) {
+                    p->failed = 1;
+                    break;
+                }
+                stack = ns;
+                cap *= 2;
+                f = &stack[top - 1];
+            }
+            stack[top++] = (StatsFrame){child, f->depth + 1, 0, 0, 0};
+            continue;
+        }
+        top--; // finished: hand the height to the parent frame
+        if (top > 0) {
+            if (stack[top - 1].stage == 1) stack[top - 1].hYes = height;
+            else stack[top - 1].hNo = height;
+        }
+    }
+    free(stack);
+    return p->failed ? -1 : height;
+}
+
+static void *stats_worker(void *arg) {
+    StatsWorker *w = arg;
+    StatsWork *work = w->work;
+    for (;;) {
+        int i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+        if (i >= work->to || w->part.failed) break;
+        work->items[i].height = part_walk(&w->part, work->items[i].node, work->items[i].depth);
+    }
+    return NULL;
+}
+
+static void part_merge(StatsPart *into, StatsPart *from) {
+    into->nodes += from->nodes;
+    into->questions += from->questions;
+    into->animals += from->animals;
+    into->depthSum += from->depthSum;
+    into->imbalanceSum += from->imbalanceSum;
+    into->unbalanced += from->unbalanced;
+    into->questionBytes += from->questionBytes;
+    into->animalBytes += from->animalBytes;
+    into->failed |= from->failed;
+    if (from->worst && (into->worst == NULL || from->maxImbalance > into->maxImbalance)) {
+        into->maxImbalance = from->maxImbalance;
+        into->worst = from->worst;
+    }
+    if (from->histLen > into->histLen) { // keep the longer histogram
+        long *t = into->hist;
+        int tl = into->histLen;
+        into->hist = from->hist;
+        into->histLen = from->histLen;
+        from->hist = t;
+        from->histLen = tl;
+    }
+    for (int d = 0; d < from->histLen; d++) into->hist[d] += from->hist[d];
+    free(from->hist);
+    from->hist = NULL;
+    from->histLen = 0;
+}
+
+/* Expand the top of the tree breadth-first, walk the subtrees below it on
+ * nthreads threads, then finish the top into total. */
+static void stats_parallel(Node *root, int nthreads, StatsPart *total) {
+    int cap = 1024, count = 1, head = 0;
+    StatsItem *items = malloc((size_t)cap * sizeof(StatsItem));
+    if (items == NULL) {
+        total->failed = 1;
+        return;
+    }
+    items[0] = (StatsItem){root, 0, 0, -1, -1};
+    while (head < count && head < STATS_TOP_NODES) {
+        StatsItem *it = &items[head++];
+        if (!it->node->isQuestion) continue;
+        if (count + 2 > cap) {
+            StatsItem *ni = realloc(items, (size_t)cap * 2 * sizeof(StatsItem));
+            if (ni == NULL) {
+                free(items);
+                total->failed = 1;
+                return;
+            }
+            items = ni;
+            cap *= 2;
+            it = &items[head - 1];
+        }
+        it->yes = count;
+        items[count++] = (StatsItem){it->node->yes, it->depth + 1, 0, -1, -1};
+        it->no = count;
+        items[count++] = (StatsItem){it->node->no, it->depth + 1, 0, -1, -1};
+    }
+
+    /* items [head, count) are unexpanded subtrees */
+    StatsWork work = {items, head, count, head};
+    int nworkers = head < count ? nthreads : 0;
+    StatsWorker *w = calloc((size_t)(nworkers ? nworkers : 1), sizeof(StatsWorker));
+    pthread_t *tid = calloc((size_t)(nworkers ? nworkers : 1), sizeof(pthread_t));
+    int *started = calloc((size_t)(nworkers ? nworkers : 1), sizeof(int));
+    if (w == NULL || tid == NULL || started == NULL) {
+        nworkers = 0;
+        for (int i = head; i < count && !total->failed; i++) {
+            items[i].height = part_walk(total, items[i].node, items[i].depth);
+        }
+    }
+    for (int i = 0; i < nworkers; i++) w[i].work = &work;
+    for (int i = 1; i < nworkers; i++) {
+        started[i] = pthread_create(&tid[i], NULL, stats_worker, &w[i]) == 0;
+    }
+    if (nworkers > 0) stats_worker(&w[0]); // unclaimed items fall to this one
+    for (int i = 1; i < nworkers; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+    }
+    for (int i = 0; i < nworkers; i++) part_merge(total, &w[i].part);
+
+    for (int i = head - 1; i >= 0 && !total->failed; i--) {
+        StatsItem *it = &items[i];
+        if (!it->node->isQuestion) {
+            part_leaf(total, it->node, it->depth);
+            it->height = 0;
+        } else {
+            it->height = part_question(total, it->node, items[it->yes].height, items[it->no].height);
+        }
+    }
+    free(w);
+    free(tid);
+    free(started);
+    free(items);
+}
+
+/* Gather statistics for the tree under root on nthreads threads (0: one
+ * per online CPU). Returns 1 on success; out must be released with
+ * tree_stats_free either way. */
+int tree_stats(Node *root, int nthreads, TreeStats *out) {
+    memset(out, 0, sizeof *out);
+    if (root == NULL) return 1;
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > STATS_MAX_THREADS) nthreads = STATS_MAX_THREADS;
+
+    StatsPart total;
+    memset(&total, 0, sizeof total);
+    if (nthreads == 1) {
+        part_walk(&total, root, 0);
+    } else {
+        stats_parallel(root, nthreads, &total);
+    }
+
+    out->nodes = total.nodes;
+    out->questions = total.questions;
+    out->animals = total.animals;
+    out->questionBytes = total.questionBytes;
+    out->animalBytes = total.animalBytes;
+    out->depthHist = total.hist;
+    out->height = total.histLen - 1;
+    while (out->height > 0 && total.hist[out->height] == 0) out->height--;
+    if (out->height < 0) out->height = 0;
+    out->avgDepth = total.animals ? (double)total.depthSum / total.animals : 0.0;
+    out->maxImbalance = total.maxImbalance;
+    out->worst = total.worst;
+    out->avgImbalance = total.questions ? (double)total.imbalanceSum / total.questions : 0.0;
+    out->unbalanced = total.unbalanced;
+    return !total.failed;
+}
+
+void tree_stats_free(TreeStats *s) {
+    free(s->depthHist);
+    s->depthHist = NULL;
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* Write s as one JSON object (and a newline) to f. */
+void tree_stats_json(const TreeStats *s, FILE *f) {
+    fprintf(f, "{\"nodes\":%ld,\"questions\":%ld,\"animals\":%ld,", s->nodes, s->questions, s->animals);
+    fprintf(f, "\"height\":%d,\"avgDepth\":%.4f,\"depthHistogram\":[", s->height, s->avgDepth);
+    for (int d = 0; s->depthHist && d <= s->height; d++) {
+        fprintf(f, "%s%ld", d ? "," : "", s->depthHist[d]);
+    }
+    fprintf(f, "],\"imbalance\":{\"max\":%d,\"avg\":%.4f,\"unbalanced\":%ld,\"worst\":",
+            s->maxImbalance, s->avgImbalance, s->unbalanced);
+    if (s->worst) json_string(f, s->worst->text);
+    else fputs("null", f);
+    fprintf(f, "},\"textBytes\":{\"questions\":%zu,\"animals\":%zu}}\n", s->questionBytes, s->animalBytes);
+}
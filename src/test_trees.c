@@ -0,0 +1,71 @@
+/*
+ * test_trees.c - Random trees for the tests and benchmarks
+ *
+ * Linked into run_tests and run_bench only. Draws from its own generator,
+ * so building a tree leaves rand() alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lab5.h"
+
+/* Next value of the generator at *rng, in [0, 2^31). */
+int tree_rand(uint64_t *rng) {
+    *rng = *rng * 6364136223846793005ull + 1442695040888963407ull;
+    return (int)(*rng >> 33);
+}
+
+/* Default texts: "q" and "a<count>". */
+static void default_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    (void)rng;
+    (void)depth;
+    snprintf(question, TREE_TEXT_MAX, "q");
+    snprintf(animal, TREE_TEXT_MAX, "a%d", count);
+}
+
+/* Grow a tree of n animals the way learning does: each step puts a new
+ * question over a random leaf, the old leaf on its yes side and a new
+ * animal on its no side. The same seed grows the same tree. text (or
+ * default_text if NULL) fills in both for the count-th animal, whose old
+ * leaf is at the given depth, and may draw from rng; count 0 is the first
+ * leaf and only its animal is used. The count-th animal goes in
+ * leaves[count] if leaves is not NULL. Parent links are set, ids are not
+ * (see index_rebuild). Returns the root, or NULL if out of memory. */
+Node *build_random_tree(int n, unsigned seed, TreeTextFn text, Node **leaves) {
+    char question[TREE_TEXT_MAX], animal[TREE_TEXT_MAX];
+    Node **own = leaves ? NULL : malloc((size_t)n * sizeof(Node *));
+    if (leaves == NULL && own == NULL) return NULL;
+    if (leaves == NULL) leaves = own;
+    if (text == NULL) text = default_text;
+
+    uint64_t rng = seed;
+    text(&rng, 0, 0, question, animal);
+    Node *root = create_animal_node(animal);
+    leaves[0] = root;
+    for (int count = 1; root != NULL && count < n; count++) {
+        Node *old = leaves[tree_rand(&rng) % count];
+        int depth = 0;
+        for (const Node *c = old; c->parent; c = c->parent) depth++;
+        text(&rng, count, depth, question, animal);
+        Node *q = create_question_node(question);
+        Node *leaf = create_animal_node(animal);
+        if (q == NULL || leaf == NULL) {
+            free_tree(q);
+            free_tree(leaf);
+            free_tree(root);
+            root = NULL;
+            break;
+        }
+        q->yes = old;
+        q->no = leaf;
+        if (old == root) root = q;
+        else if (old->parent->yes == old) old->parent->yes = q;
+        else old->parent->no = q;
+        q->parent = old->parent;
+        old->parent = q;
+        leaf->parent = q;
+        leaves[count] = leaf;
+    }
+    free(own);
+    return root;
+}
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "lab5.h"
 
 /* Test Frame Stack */
@@ -115,10 +118,406 @@ void test_hash() {
     
     assert(h.size > 2);
     
+    h_free(&h);
+
+    /* djb2 stays available through the pluggable interface */
+    assert(h_hash_djb2("does_it_meow", 12) == h_hash("does_it_meow"));
+    assert(h_hash_wy("does_it_meow", 12) != h_hash_wy("does_it_moo", 11));
+
+    h_init_with(&h, 5, h_hash_djb2);
+    assert(h.hashFn == h_hash_djb2);
+    h_put(&h, "meow", 1);
+    h_put(&h, "bark", 2);
+    assert(h_contains(&h, "meow", 1));
+    assert(!h_contains(&h, "meow", 2));
     h_free(&h);
     printf("  ✓ Hash table tests passed\n");
 }
 
+/* Test incremental resizing of the hash table */
+void test_hash_resize() {
+    printf("Testing Hash Resize...\n");
+
+    Hash h;
+    h_init(&h, 3);
+
+    char key[32];
+    int sawRehash = 0;
+    for (int i = 0; i < 2000; i++) {
+        sprintf(key, "attr%d", i);
+        assert(h_put(&h, key, i));
+        if (h_rehashing(&h)) sawRehash = 1;
+
+        /* Every key inserted so far must stay visible mid-resize */
+        if (i % 97 == 0) {
+            for (int j = 0; j <= i; j++) {
+                sprintf(key, "attr%d", j);
+                assert(h_contains(&h, key, j));
+            }
+        }
+    }
+    assert(sawRehash);
+    assert(h.size == 2000);
+    assert(h.nbuckets > 3);
+
+    /* Duplicate puts are still rejected whichever table holds the key */
+    assert(!h_put(&h, "attr5", 5));
+    assert(h_put(&h, "attr5", 6));
+    int count;
+    h_get_ids(&h, "attr5", &count);
+    assert(count == 2);
+
+    /* Lookups alone finish draining the old table */
+    for (int i = 0; i < 2000 && h_rehashing(&h); i++) {
+        h_contains(&h, "attr0", 0);
+    }
+    assert(!h_rehashing(&h));
+    h_free(&h);
+
+    /* Bulk loading through h_adopt grows the table the same way */
+    h_init(&h, 3);
+    for (int i = 0; i < 2000; i++) {
+        sprintf(key, "attr%d", i);
+        char *owned = malloc(strlen(key) + 1);
+        assert(owned && strcpy(owned, key) && h_adopt(&h, owned, h.hashFn(owned, strlen(owned))));
+    }
+    assert(h.size == 2000 && h.nbuckets > 3);
+    for (int i = 0; i < 2000 && h_rehashing(&h); i++) h_contains(&h, "attr0", 0);
+    assert(h.size <= h.nbuckets * 2 + 1);
+    for (int i = 0; i < 2000; i += 37) {
+        sprintf(key, "attr%d", i);
+        assert(h_put(&h, key, i) && h_contains(&h, key, i));
+    }
+
+    h_free(&h);
+    printf("  ✓ Hash resize tests passed\n");
+}
+
+/* Test compressed posting lists against a plain membership array */
+void test_idlist() {
+    printf("Testing Posting Lists...\n");
+
+    enum { N = 200000 };
+    static char refA[N], refB[N], refC[N];
+    IdList a, b, c, t, out;
+    idl_init(&a);
+    idl_init(&b);
+    idl_init(&c);
+    idl_init(&t);
+    idl_init(&out);
+
+    /* a: dense (bitmap containers), b: sparse (arrays), c: ranges (runs) */
+    srand(5);
+    for (int i = 0; i < N; i++) {
+        if (rand() % 2 == 0) { refA[i] = 1; assert(idl_add(&a, i)); }
+        if (rand() % 50 == 0) { refB[i] = 1; assert(idl_add(&b, i)); }
+    }
+    assert(idl_add(&a, 0) == !refA[0]); // duplicates are rejected
+    refA[0] = 1;
+    idl_add_range(&c, 1000, 90000);
+    idl_add_range(&c, 150000, 150010);
+    for (int i = 0; i < N; i++) refC[i] = (i >= 1000 && i < 90000) || (i >= 150000 && i < 150010);
+    assert(c.count == 89010);
+
+    /* Removal, including from run containers */
+    for (int i = 0; i < N; i += 7) {
+        assert(idl_remove(&a, i) == refA[i]);
+        refA[i] = 0;
+    }
+    assert(idl_remove(&c, 5000));
+    refC[5000] = 0;
+    assert(!idl_remove(&c, 5000));
+
+    for (int i = 0; i < N; i++) {
+        assert(idl_contains(&a, i) == refA[i]);
+        assert(idl_contains(&b, i) == refB[i]);
+        assert(idl_contains(&c, i) == refC[i]);
+    }
+
+    /* a AND c AND NOT b, then a OR b */
+    idl_and(&a, &c, &t);
+    idl_andnot(&t, &b, &out);
+    int expect = 0;
+    for (int i = 0; i < N; i++) {
+        int in = refA[i] && refC[i] && !refB[i];
+        expect += in;
+        assert(idl_contains(&out, i) == in);
+    }
+    assert(out.count == expect);
+
+    idl_or(&a, &b, &out);
+    int *ids = idl_to_array(&out);
+    int n = 0;
+    for (int i = 0; i < N; i++) {
+        if (refA[i] || refB[i]) assert(ids[n++] == i); // sorted output
+    }
+    assert(n == out.count);
+
+    /* Ranges merge into existing containers of every kind, counting only
+     * the ids they add; many short ranges outgrow the run encoding */
+    IdList *lists[3] = {&a, &b, &c};
+    char *refs[3] = {refA, refB, refC};
+    for (int r = 0; r < 600; r++) {
+        int k = r % 3, lo = rand() % N, hi = lo + 1 + rand() % (r % 2 ? 40 : 3000);
+        if (hi > N) hi = N;
+        int fresh = 0;
+        for (int i = lo; i < hi; i++) {
+            fresh += !refs[k][i];
+            refs[k][i] = 1;
+        }
+        assert(idl_add_range(lists[k], lo, hi) == fresh);
+    }
+    for (int i = 100000; i + 2 < N; i += 4) {
+        int fresh = !refC[i] + !refC[i + 1];
+        refC[i] = refC[i + 1] = 1;
+        assert(idl_add_range(&c, i, i + 2) == fresh);
+    }
+    for (int k = 0; k < 3; k++) {
+        int count = 0;
+        for (int i = 0; i < N; i++) {
+            assert(idl_contains(lists[k], i) == refs[k][i]);
+            count += refs[k][i];
+        }
+        assert(lists[k]->count == count);
+    }
+
+    /* Re-encoding keeps the set intact */
+    idl_optimize(&a);
+    idl_optimize(&c);
+    for (int i = 0; i < N; i++) {
+        assert(idl_contains(&a, i) == refA[i]);
+        assert(idl_contains(&c, i) == refC[i]);
+    }
+    idl_copy(&c, &t);
+    assert(t.count == c.count && idl_contains(&t, 1000));
+
+    /* Serialization round-trips every container type */
+    size_t len = idl_serialized_size(&a);
+    unsigned char *buf = malloc(len);
+    size_t used = 0;
+    assert(idl_serialize(&a, buf) == len);
+    assert(idl_deserialize(&t, buf, len, &used) && used == len);
+    assert(t.count == a.count);
+    for (int i = 0; i < N; i++) assert(idl_contains(&t, i) == refA[i]);
+    assert(!idl_deserialize(&t, buf, len - 1, &used)); // truncated
+    free(buf);
+
+    idl_free(&a);
+    idl_free(&b);
+    idl_free(&c);
+    idl_free(&t);
+    idl_free(&out);
+    printf("  ✓ Posting list tests passed\n");
+}
+
+/* Test Concurrent Hash: writers and readers racing on one table */
+typedef struct {
+    CHash *h;
+    int base;
+} CHashWriter;
+
+static void *chash_writer(void *arg) {
+    CHashWriter *w = arg;
+    char key[32];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(key, sizeof key, "k%d=yes", i % 300);
+        ch_put(w->h, key, w->base + i);
+    }
+    ebr_thread_exit();
+    return NULL;
+}
+
+static void *chash_reader(void *arg) {
+    CHash *h = arg;
+    char key[32];
+    for (int i = 0; i < 4000; i++) {
+        snprintf(key, sizeof key, "k%d=yes", i % 300);
+        int ids[64];
+        int count = ch_get_ids(h, key, ids, 64);
+        assert(count <= 64);
+        for (int j = 1; j < count; j++) assert(ids[j - 1] < ids[j]); // chunks stay sorted
+    }
+    ebr_thread_exit();
+    return NULL;
+}
+
+void test_chash() {
+    printf("Testing Concurrent Hash...\n");
+
+    CHash h;
+    ch_init(&h, 1);
+    assert(ch_put(&h, "a=yes", 3) == 1);
+    assert(ch_put(&h, "a=yes", 3) == 0);
+    assert(ch_put(&h, "a=yes", 1) == 1);
+    assert(ch_contains(&h, "a=yes", 1));
+    assert(ch_contains(&h, "a=yes", 3));
+    assert(!ch_contains(&h, "a=yes", 2));
+    assert(!ch_contains(&h, "b=yes", 1));
+
+    pthread_t tid[6];
+    CHashWriter w[4];
+    for (int t = 0; t < 4; t++) {
+        w[t] = (CHashWriter){&h, t * 100000};
+        pthread_create(&tid[t], NULL, chash_writer, &w[t]);
+    }
+    pthread_create(&tid[4], NULL, chash_reader, &h);
+    pthread_create(&tid[5], NULL, chash_reader, &h);
+    for (int t = 0; t < 6; t++) pthread_join(tid[t], NULL);
+
+    /* every insert from every writer landed, despite resizes under load */
+    char key[32];
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 2000; i += 97) {
+            snprintf(key, sizeof key, "k%d=yes", i % 300);
+            assert(ch_contains(&h, key, t * 100000 + i));
+        }
+    }
+    assert(h.size == 301);
+    int ids[64];
+    assert(ch_get_ids(&h, "k0=yes", ids, 64) == 4 * 7); // i = 0, 300, ..., 1800 per writer
+    for (int j = 1; j < 4 * 7; j++) assert(ids[j - 1] < ids[j]);
+    assert(ch_get_ids(&h, "k0=yes", ids, 3) == 4 * 7 && ids[2] == 600);
+    assert(ch_get_ids(&h, "nope=yes", ids, 64) == 0);
+
+    /* one hot key: array chunks turn into bitmaps, ids span many chunks */
+    for (int i = 0; i < 20000; i++) assert(ch_put(&h, "hot=yes", (i * 7919) % 20000 * 13));
+    assert(ch_put(&h, "hot=yes", 13 * 4) == 0);
+    assert(ch_contains(&h, "hot=yes", 13 * 19999) && !ch_contains(&h, "hot=yes", 14));
+    int *hot = malloc(20000 * sizeof(int));
+    assert(ch_get_ids(&h, "hot=yes", hot, 20000) == 20000);
+    for (int j = 0; j < 20000; j++) assert(hot[j] == j * 13);
+    free(hot);
+
+    ch_free(&h);
+    assert(ebr_pending() == 0);
+
+    printf("  ✓ Concurrent hash tests passed\n");
+}
+
+/* Test the attribute index: rebuild, learn, undo, redo */
+void test_index() {
+    printf("Testing Attribute Index...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it live in water?");
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_question_node("Does it bark?");
+    g_root->no->yes = create_animal_node("Dog");
+    g_root->no->no = create_animal_node("Cat");
+
+    index_rebuild();
+    assert(index_animal_count() == 3);
+    assert(g_root->no->yes->parent == g_root->no);
+
+    IdList ids;
+    idl_init(&ids);
+    assert(index_query("does it live in water", 0, &ids) == 2);
+    assert(idl_contains(&ids, g_root->no->yes->id));
+    assert(idl_contains(&ids, g_root->no->no->id));
+    assert(index_query("Does it bark?", 1, &ids) == 1);
+    assert(index_animal(idl_to_array(&ids)[0]) == g_root->no->yes);
+
+    /* Learn: split Cat into "Does it moo?" -> Cow / Cat */
+    Node *cat = g_root->no->no;
+    Node *q = create_question_node("Does it moo?");
+    Node *cow = create_animal_node("Cow");
+    q->yes = cow;
+    q->no = cat;
+    g_root->no->no = q;
+    q->parent = g_root->no;
+    cat->parent = q;
+    cow->parent = q;
+    Edit e = {EDIT_INSERT_SPLIT, g_root->no, 0, cat, q, cow};
+    index_on_learn(&e);
+
+    assert(index_query("Does it live in water?", 0, &ids) == 3);
+    assert(idl_contains(&ids, cow->id));
+    assert(index_query("Does it bark?", 0, &ids) == 2);
+    assert(index_query("Does it moo?", 1, &ids) == 1 && idl_contains(&ids, cow->id));
+    assert(index_query("Does it moo?", 0, &ids) == 1 && idl_contains(&ids, cat->id));
+
+    /* Undo puts Cat back and drops Cow and the moo attribute */
+    g_root->no->no = cat;
+    cat->parent = g_root->no;
+    index_on_undo(&e);
+    assert(index_query("Does it live in water?", 0, &ids) == 2);
+    assert(!idl_contains(&ids, cow->id));
+    assert(index_query("Does it moo?", 1, &ids) == 0);
+    assert(index_query("Does it moo?", 0, &ids) == 0);
+
+    /* Redo restores Cow under its original id */
+    int cowId = cow->id;
+    g_root->no->no = q;
+    cat->parent = q;
+    index_on_redo(&e);
+    assert(cow->id == cowId);
+    assert(index_query("Does it bark?", 0, &ids) == 2);
+
+    idl_free(&ids);
+    free_tree(g_root);
+    g_root = saved;
+    h_free(&g_index);
+    printf("  ✓ Attribute index tests passed\n");
+}
+
+/* Test Question Similarity */
+void test_similar() {
+    printf("Testing Question Similarity...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it swim?");
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_question_node("Does it fly?");
+    g_root->no->yes = create_animal_node("Bird");
+    g_root->no->no = create_question_node("Does it have stripes?");
+    g_root->no->no->yes = create_animal_node("Zebra");
+    g_root->no->no->no = create_animal_node("Dog");
+    for (int i = 0; i < 50; i++) { // filler so boilerplate trigrams are common
+        char buf[64];
+        snprintf(buf, sizeof buf, "Does it eat food number %d?", i);
+        sim_add(buf);
+    }
+    sim_reset(); // filler above is dropped; the tree is loaded lazily below
+
+    assert(sim_size() == 3);
+    SimMatch m[3];
+    int n = sim_find("can it swim", 0.5, m, 3);
+    assert(n >= 1 && strcmp(m[0].text, "Does it swim?") == 0);
+    assert(sim_find("does it swim!!", 0.5, m, 3) >= 1 && m[0].score > 0.99);
+    assert(sim_find("Is it striped?", 0.4, m, 3) >= 1);
+    assert(strcmp(m[0].text, "Does it have stripes?") == 0);
+    assert(sim_find("Is it a reptile?", 0.5, m, 3) == 0);
+
+    /* "does it fly" shares only boilerplate with "does it swim" */
+    for (int i = 0; i < 200; i++) {
+        char buf[64];
+        snprintf(buf, sizeof buf, "Does it like color %d?", i);
+        sim_add(buf);
+    }
+    n = sim_find("Does it fly?", 0.5, m, 3);
+    assert(n == 1 && strcmp(m[0].text, "Does it fly?") == 0);
+
+    /* learn/undo/redo keep the set current */
+    Node *dog = g_root->no->no->no;
+    Node *q = create_question_node("Does it purr?");
+    Node *cat = create_animal_node("Cat");
+    q->yes = cat;
+    q->no = dog;
+    g_root->no->no->no = q;
+    Edit e = {EDIT_INSERT_SPLIT, g_root->no->no, 0, dog, q, cat};
+    sim_on_learn(&e);
+    assert(sim_find("does it purr", 0.9, m, 3) == 1);
+    sim_on_undo(&e);
+    assert(sim_find("does it purr", 0.9, m, 3) == 0);
+    sim_on_redo(&e);
+    assert(sim_find("does it purr", 0.9, m, 3) == 1);
+
+    sim_reset();
+    free_tree(g_root);
+    g_root = saved;
+    printf("  ✓ Question similarity tests passed\n");
+}
+
 /* Test Persistence */
 void test_persistence() {
     printf("Testing Persistence...\n");
@@ -133,6 +532,7 @@ void test_persistence() {
     /* Save original root */
     Node *saved_root = g_root;
     g_root = root;
+    index_rebuild(); // the game keeps g_index in step with g_root
     
     /* Save */
     assert(save_tree("test.dat"));
@@ -163,10 +563,52 @@ void test_persistence() {
     fclose(f1);
     fclose(f2);
     
-    /* Restore original root */
+    /* The saved index is used as-is: same ids, same answers */
+    int catId = g_root->yes->id;
+    IdList ids;
+    idl_init(&ids);
+    assert(load_tree("test2.dat"));
+    assert(g_root->yes->id == catId);
+    assert(g_root->no->no->parent == g_root->no);
+    assert(index_query("another question", 0, &ids) == 1);
+    assert(index_animal(idl_to_array(&ids)[0]) == g_root->no->no);
+    
+    /* Without the section (or with a corrupt one) load falls back to a rebuild */
+    assert(save_tree_with("test.dat", 0));
+    f1 = fopen("test.dat", "rb");
+    fseek(f1, 0, SEEK_END);
+    assert(ftell(f1) < size2);
+    fclose(f1);
+    assert(load_tree("test.dat"));
+    assert(index_query("test question", 1, &ids) == 1);
+    
+    f2 = fopen("test2.dat", "r+b");
+    fseek(f2, -3, SEEK_END);
+    fputc(0x5a, f2);
+    fclose(f2);
+    assert(load_tree("test2.dat"));
+    assert(index_animal_count() == 3);
+    assert(index_query("another question", 1, &ids) == 1);
+    assert(index_animal(idl_to_array(&ids)[0]) == g_root->no->yes);
+    idl_free(&ids);
+    
+    /* Restore original root (load_tree also rebuilt the index) */
     free_tree(g_root);
     g_root = saved_root;
-    
+    h_free(&g_index);
+    
+    /* A node reached twice keeps one id, so a cycle cannot hang the save */
+    Node *loop = create_question_node("Does it loop?");
+    loop->yes = create_animal_node("Ouroboros");
+    loop->no = loop;
+    g_root = loop;
+    uint64_t sum;
+    assert(save_tree_with("test.dat", 0));
+    assert(tree_checksum(loop, &sum));
+    loop->no = NULL;
+    free_tree(loop);
+    g_root = saved_root;
+
     remove("test.dat");
     remove("test2.dat");
     
@@ -195,12 +637,1707 @@ void test_integrity() {
     root->no = create_animal_node("A2");
     assert(check_integrity());
     
+    /* Reports point at the first fault in preorder */
+    IntegrityReport rep;
+    Node *leaf = root->no;
+    leaf->yes = create_animal_node("A3");
+    assert(!check_integrity_report(root, 1, &rep));
+    assert(rep.error == INTEGRITY_LEAF_CHILD && rep.node == leaf);
+    assert(strcmp(rep.path, "n") == 0);
+    integrity_report_free(&rep);
+    free_tree(leaf->yes);
+    leaf->yes = NULL;
+
+    /* Shared node (DAG) and cycle: detected instead of looping */
+    Node *q2 = create_question_node("Q2");
+    q2->yes = create_animal_node("A4");
+    q2->no = root->no;                // A2 now has two parents
+    free_tree(root->yes);
+    root->yes = q2;
+    assert(!check_integrity_report(root, 1, &rep));
+    assert(rep.error == INTEGRITY_SHARED_NODE && rep.node == root->no);
+    assert(strcmp(rep.path, "n") == 0);
+    integrity_report_free(&rep);
+    q2->no = create_animal_node("A5");
+    assert(check_integrity());
+
+    Node *saveNo = q2->no;
+    q2->no = root;                    // back to the root
+    assert(!check_integrity_report(root, 1, &rep));
+    assert(rep.error == INTEGRITY_CYCLE && rep.node == root);
+    assert(strcmp(rep.path, "yn") == 0);
+    integrity_report_free(&rep);
+    q2->no = saveNo;
+
     free_tree(g_root);
     g_root = saved;
-    
+
+    /* A big tree through the thread pool, valid and then with one fault
+     * deep inside; both must agree with the single-threaded walk. */
+    int n = 300000;
+    Node **nodes = malloc((size_t)(n + 1) * sizeof(Node *));
+    nodes[0] = create_question_node("big");
+    int count = 1;
+    srand(34);
+    while (count < n) {  // split random leaves into questions
+        Node *cur = nodes[rand() % count];
+        if (cur->isQuestion && cur->yes) continue;
+        if (!cur->isQuestion) {
+            cur->isQuestion = 1;
+        }
+        cur->yes = create_animal_node("y");
+        cur->no = create_animal_node("n");
+        nodes[count++] = cur->yes;
+        nodes[count++] = cur->no;
+    }
+    Node *big = nodes[0];
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        assert(check_integrity_report(big, threads, &rep));
+        assert(rep.visited == count);
+        integrity_report_free(&rep);
+    }
+    Node *victim = NULL;
+    for (int i = count - 1; victim == NULL; i--) {
+        if (nodes[i]->isQuestion) victim = nodes[i];
+    }
+    Node *lost = victim->no;
+    victim->no = victim->yes;         // shared deep in the tree
+    IntegrityReport seq;
+    assert(!check_integrity_report(big, 1, &seq));
+    assert(!check_integrity_report(big, 4, &rep));
+    assert(rep.error == INTEGRITY_SHARED_NODE && seq.error == INTEGRITY_SHARED_NODE);
+    assert(rep.node == victim->yes && strcmp(rep.path, seq.path) == 0);
+    Node *walk = big;                 // the path leads to the node
+    for (const char *c = rep.path; *c; c++) walk = *c == 'y' ? walk->yes : walk->no;
+    assert(walk == victim->yes);
+    integrity_report_free(&rep);
+    integrity_report_free(&seq);
+    victim->no = lost;
+    assert(check_integrity_report(big, 4, NULL));
+    free_tree(big);
+    free(nodes);
+
+    /* load_tree refuses files whose records do not form a tree */
+    int32_t records[3][3][3] = {      // {isQuestion, yesId, noId} per record
+        {{1, 1, 2}, {1, 2, 2}, {0, -1, -1}},   // record 2 has two parents
+        {{1, 1, 2}, {1, 0, 2}, {0, -1, -1}},   // record 1 points back at the root
+        {{0, -1, -1}, {0, -1, -1}, {0, -1, -1}}, // records 1 and 2 unreachable
+    };
+    for (int c = 0; c < 3; c++) {
+        FILE *f = fopen("test_bad.dat", "wb");
+        uint32_t header[3] = {0x41544C35, 1, 3};
+        fwrite(header, sizeof header, 1, f);
+        for (int i = 0; i < 3; i++) {
+            uint8_t isQ = (uint8_t)records[c][i][0];
+            uint32_t len = 1;
+            fwrite(&isQ, 1, 1, f);
+            fwrite(&len, sizeof len, 1, f);
+            fwrite("x", 1, 1, f);
+            fwrite(&records[c][i][1], sizeof(int32_t), 2, f);
+        }
+        fclose(f);
+        Node *before = g_root;
+        assert(!load_tree("test_bad.dat"));
+        assert(g_root == before);
+    }
+    remove("test_bad.dat");
+
     printf("  ✓ Integrity tests passed\n");
 }
 
+/* Incremental validation of edited nodes */
+void test_integrity_changes() {
+    printf("Testing Incremental Integrity...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it fly?");
+    g_root->yes = create_animal_node("Bird");
+    g_root->no = create_animal_node("Dog");
+    index_rebuild(); // links parents
+    integrity_forget_changes();
+
+    /* learn the way play_game does */
+    Node *dog = g_root->no;
+    Node *q = create_question_node("Does it purr?");
+    Node *cat = create_animal_node("Cat");
+    q->yes = cat;
+    q->no = dog;
+    g_root->no = q;
+    q->parent = g_root;
+    dog->parent = q;
+    cat->parent = q;
+    Edit e = {EDIT_INSERT_SPLIT, g_root, 0, dog, q, cat};
+    index_on_learn(&e);
+    integrity_on_learn(&e);
+    assert(integrity_pending() == 4);
+
+    IntegrityReport rep;
+    assert(check_changes(&rep));
+    assert(rep.visited == 4);
+    integrity_report_free(&rep);
+    assert(integrity_pending() == 0);
+    assert(check_changes(NULL));      // nothing left to check
+
+    /* undo/redo (as in game.c) mark only what they relink */
+    g_root->no = dog;
+    dog->parent = g_root;
+    index_on_undo(&e);
+    integrity_on_learn(&e);           // pending again, then undone
+    integrity_on_undo(&e);
+    assert(integrity_pending() == 2);
+    assert(check_changes(NULL));
+    g_root->no = q;
+    dog->parent = q;
+    index_on_redo(&e);
+    integrity_on_redo(&e);
+    assert(integrity_pending() == 4);
+    assert(check_changes(NULL));
+
+    /* a forgotten parent link and a second parent are caught */
+    dog->parent = g_root;
+    integrity_on_redo(&e);
+    assert(!check_changes(&rep));
+    assert(rep.node == q && rep.error == INTEGRITY_BAD_PARENT);
+    assert(strcmp(rep.path, "n") == 0);
+    integrity_report_free(&rep);
+    dog->parent = q;
+    assert(check_changes(NULL));
+
+    g_root->yes = q;
+    Node *bird = index_animal(0);
+    integrity_on_learn(&e);
+    assert(!check_changes(&rep));
+    assert(rep.error == INTEGRITY_SHARED_NODE && rep.node == q);
+    integrity_report_free(&rep);
+    g_root->yes = bird;
+    assert(check_changes(NULL));
+
+    /* too many changes fall back to (and are cleared by) a full check */
+    Node *many = calloc(5000, sizeof(Node));
+    for (int i = 0; i < 5000; i++) {
+        Edit big = {EDIT_INSERT_SPLIT, &many[i], 0, NULL, NULL, NULL};
+        integrity_on_learn(&big);
+    }
+    assert(integrity_pending() == -1);
+    free(many);                       // a full check never looks at the set
+    assert(check_changes(&rep));
+    assert(rep.visited == count_nodes(g_root));
+    integrity_report_free(&rep);
+    assert(integrity_pending() == 0);
+
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Incremental integrity tests passed\n");
+}
+
+/* LCA queries agree with walking parent links */
+static Node *naive_split(Node *a, Node *b, int *distance) {
+    int da = 0, db = 0;
+    for (Node *x = a; x->parent; x = x->parent) da++;
+    for (Node *x = b; x->parent; x = x->parent) db++;
+    *distance = 0;
+    Node *ca = a, *cb = b;
+    while (da > db) { ca = ca->parent; da--; (*distance)++; }
+    while (db > da) { cb = cb->parent; db--; (*distance)++; }
+    while (ca != cb) {
+        ca = ca->parent;
+        cb = cb->parent;
+        *distance += 2;
+    }
+    return ca;
+}
+
+/* n hangs from g_root by child links (an undone leaf keeps its parent). */
+static int linked_in_tree(const Node *n) {
+    for (; n->parent; n = n->parent) {
+        if (n->parent->yes != n && n->parent->no != n) return 0;
+    }
+    return n == g_root;
+}
+
+void test_paths() {
+    printf("Testing Animal Paths...\n");
+
+    Node *saved = g_root;
+    int n = 20000;
+    g_root = build_random_tree(n, 36, NULL, NULL);
+    srand(36);
+    index_rebuild();
+
+    int pairs[2 * 1000];
+    PathInfo batch[1000];
+    for (int i = 0; i < 1000; i++) {
+        pairs[2 * i] = rand() % n;
+        pairs[2 * i + 1] = rand() % n;
+    }
+    assert(path_query_batch(pairs, 1000, batch) == 1000);
+    for (int i = 0; i < 1000; i++) {
+        Node *a = index_animal(pairs[2 * i]), *b = index_animal(pairs[2 * i + 1]);
+        int distance;
+        Node *split = naive_split(a, b, &distance);
+        PathInfo one;
+        assert(path_query(pairs[2 * i], pairs[2 * i + 1], &one));
+        assert(one.distance == distance && batch[i].distance == distance);
+        if (a == b) assert(one.split == NULL);
+        else assert(one.split == split && batch[i].split == split);
+    }
+
+    /* an edit invalidates the layout; the next query sees the new animal */
+    Node *old = index_animal(7);
+    Node *q = create_question_node("new");
+    q->yes = create_animal_node("fresh");
+    q->no = old;
+    if (old->parent->yes == old) old->parent->yes = q;
+    else old->parent->no = q;
+    q->parent = old->parent;
+    old->parent = q;
+    q->yes->parent = q;
+    Edit e = {EDIT_INSERT_SPLIT, q->parent, 0, old, q, q->yes};
+    index_on_learn(&e);
+    path_invalidate();
+    PathInfo info;
+    assert(path_query(q->yes->id, 7, &info));
+    assert(info.split == q && info.distance == 2);
+    assert(!path_query(-1, 7, &info) && info.distance == -1);
+
+    /* teach, undo and redo keep the layout current, past the point where
+     * it is rebuilt */
+    es_init(&g_undo);
+    es_init(&g_redo);
+    for (int step = 0; step < 3000; step++) {
+        int r = rand() % 10;
+        if (r < 2) {
+            engine_undo(&g_undo, &g_redo);
+        } else if (r < 3) {
+            engine_redo(&g_undo, &g_redo);
+        } else {
+            GameSession s;
+            assert(engine_begin(&s));
+            while (s.state == GAME_ASKING) engine_answer(&s, rand() % 2);
+            engine_confirm(&s, 0);
+            char name[16];
+            snprintf(name, sizeof name, "t%d", step);
+            assert(engine_teach(&s, name, "Was it taught?", rand() % 2) > 0);
+        }
+        for (int k = 0; k < 20; k++) {
+            int ids = index_animal_count();
+            int ia = rand() % ids, ib = k < 5 ? ids - 1 - k : rand() % ids; // favour new animals
+            Node *a = index_animal(ia), *b = index_animal(ib);
+            int in = a && b && linked_in_tree(a) && linked_in_tree(b);
+            PathInfo one;
+            assert(path_query(ia, ib, &one) == in);
+            if (!in) continue;
+            int distance;
+            Node *split = naive_split(a, b, &distance);
+            assert(one.distance == distance && one.split == (a == b ? NULL : split));
+        }
+    }
+
+    /* the questions between two animals, split first */
+    AnimalPath ap;
+    assert(!find_shortest_path("a5", "no such animal", &ap));
+    assert(find_shortest_path("a5", "A5", &ap) && ap.split == NULL && ap.distance == 0);
+    animal_path_free(&ap);
+    int taught = index_animal_count() - 1;
+    while (!index_animal(taught) || !linked_in_tree(index_animal(taught))) taught--;
+    assert(find_shortest_path("a5", index_animal(taught)->text, &ap));
+    int distance;
+    assert(ap.split == naive_split(ap.leaf[0], ap.leaf[1], &distance) && ap.distance == distance);
+    assert(ap.branch[0].size + ap.branch[1].size == distance);
+    for (int k = 0; k < 2; k++) {
+        const FrameStack *b = &ap.branch[k];
+        assert(b->size > 0 && b->frames[0].node == ap.split);
+        for (int i = 0; i < b->size; i++) {
+            Node *next = i + 1 < b->size ? b->frames[i + 1].node : ap.leaf[k];
+            assert((b->frames[i].answeredYes ? b->frames[i].node->yes : b->frames[i].node->no) == next);
+        }
+    }
+    assert(ap.branch[0].frames[0].answeredYes != ap.branch[1].frames[0].answeredYes);
+    animal_path_free(&ap);
+    engine_drop_history(&g_undo, &g_redo);
+
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Animal path tests passed\n");
+}
+
+/* Question texts for test_program's random tree. */
+static void trait_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    snprintf(question, TREE_TEXT_MAX, "Trait %d at %d?", tree_rand(rng) % 7, depth);
+    snprintf(animal, TREE_TEXT_MAX, "a%d", count);
+}
+
+/* Compiled classifier */
+void test_program() {
+    printf("Testing Compiled Classifier...\n");
+
+    Node *saved = g_root;
+    DecisionProgram p;
+    g_root = NULL;
+    assert(prog_compile(NULL, &p) && p.entry == PROG_NONE && prog_classify(&p, NULL) == -1);
+    prog_free(&p);
+
+    /* random splits; the same question text recurs across subtrees but
+     * never twice on one path (the depth is part of it) */
+    int n = 5000;
+    Node **leaves = malloc((size_t)n * sizeof(Node *));
+    g_root = build_random_tree(n, 44, trait_text, leaves);
+    srand(44);
+    index_rebuild();
+
+    const DecisionProgram *cur = prog_current();
+    assert(cur != NULL && cur->count == n - 1 && cur->questionCount < n - 1);
+    char shout[48];
+    for (int i = 0; (shout[i] = (char)toupper((unsigned char)g_root->text[i])) != '\0'; i++) {}
+    assert(prog_question_id(cur, shout) == cur->code[cur->entry].question);
+    assert(prog_question_id(cur, "Trait 9 at 1?") == -1);
+    uint64_t *answers = malloc((size_t)prog_answer_words(cur) * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        assert(prog_answers(cur, leaves[i], answers));
+        assert(prog_classify(cur, answers) == leaves[i]->id);
+    }
+    /* heavy child first: the fall-through never leads to fewer animals */
+    for (int k = 0; k < cur->count; k++) {
+        const ProgInsn *in = &cur->code[k];
+        assert(in->yes == k + 1 || in->no == k + 1 || (in->yes < 0 && in->no < 0));
+        assert(in->yes < 0 || in->yes > k);
+        assert(in->no < 0 || in->no > k);
+    }
+    assert(cur->entry == 0);
+    free(answers);
+
+    /* batches: every leaf three times, one in ten vectors with a flipped
+     * answer, classified on three threads */
+    int words = prog_answer_words(cur);
+    long total = 3L * n;
+    uint64_t *batch = malloc((size_t)total * words * sizeof(uint64_t));
+    int32_t *expected = malloc((size_t)total * sizeof(int32_t));
+    int32_t *got = malloc((size_t)total * sizeof(int32_t));
+    for (long i = 0; i < total; i++) {
+        uint64_t *a = batch + (size_t)i * words;
+        Node *leaf = leaves[i % n];
+        prog_answers(cur, leaf, a);
+        expected[i] = leaf->id;
+        if (i % 10 == 0 && leaf->parent) {
+            int q = prog_question_id(cur, leaf->parent->text);
+            a[q >> 6] ^= 1ull << (q & 63);
+        }
+    }
+    prog_classify_batch(cur, batch, words, total, got, 3);
+    long right = 0;
+    IdList missed;
+    idl_init(&missed);
+    for (long i = 0; i < total; i++) {
+        assert(got[i] == prog_classify(cur, batch + (size_t)i * words));
+        if (got[i] == expected[i]) right++;
+        else idl_add(&missed, expected[i]);
+    }
+    assert(right == total - (total + 9) / 10);
+    ProgEval eval;
+    prog_evaluate(cur, batch, words, expected, total, 3, &eval);
+    assert(eval.total == total && eval.correct == right && eval.missed.count == missed.count);
+    for (long i = 0; i < total; i++) {
+        assert(idl_contains(&eval.missed, expected[i]) == idl_contains(&missed, expected[i]));
+    }
+    prog_eval_free(&eval);
+    idl_free(&missed);
+    free(batch);
+    free(expected);
+    free(got);
+
+    /* a taught animal shows up on the next prog_current */
+    es_init(&g_undo);
+    es_init(&g_redo);
+    Node *old = leaves[17];
+    GameSession s;
+    assert(engine_begin(&s));
+    for (const Node *c = g_root; c->isQuestion;) {
+        const Node *next = c->yes;
+        for (const Node *u = old; u != c; u = u->parent) {
+            if (u->parent == c) next = u;
+        }
+        engine_answer(&s, next == c->yes);
+        c = next;
+    }
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Okapi", "Does it have a long tongue?", 1) > 0);
+    Node *okapi = names_find("okapi");
+    cur = prog_current();
+    answers = malloc((size_t)prog_answer_words(cur) * sizeof(uint64_t));
+    assert(cur->count == n && prog_answers(cur, okapi, answers));
+    assert(prog_classify(cur, answers) == okapi->id);
+    assert(prog_answers(cur, old, answers) && prog_classify(cur, answers) == old->id);
+    assert(undo_last_edit());
+    cur = prog_current();
+    assert(cur->count == n - 1 && prog_question_id(cur, "Does it have a long tongue?") == -1);
+    free(answers);
+
+    engine_drop_history(&g_undo, &g_redo); // frees the undone okapi
+    free_tree(g_root);
+    free(leaves);
+    g_root = saved;
+    index_rebuild();
+    prog_current();
+    printf("  ✓ Compiled classifier tests passed\n");
+}
+
+/* Emit the loaded tree as C, build it with a driver that classifies every
+ * leaf's answers, and check the compiled classifier against the tree. */
+static void check_generated(const char *treeFile) {
+    assert(load_tree(treeFile));
+    const DecisionProgram *p = prog_current();
+    assert(p != NULL);
+    FILE *f = fopen("test_gen.c", "w");
+    assert(prog_emit_c(p, f, "tree", treeFile));
+    fclose(f);
+
+    int words = prog_answer_words(p), animals = index_animal_count();
+    uint64_t *a = malloc((size_t)(words ? words : 1) * sizeof(uint64_t));
+    f = fopen("test_gen_main.c", "w");
+    fprintf(f, "#include <stdio.h>\n#include <string.h>\n#include \"test_gen.c\"\n\n"
+               "static const uint64_t leaves[][%d] = {\n", words ? words : 1);
+    for (int id = 0; id < animals; id++) {
+        assert(prog_answers(p, index_animal(id), a));
+        fputs("    {", f);
+        for (int w = 0; w < words; w++) fprintf(f, "%lluull, ", (unsigned long long)a[w]);
+        fputs(words ? "},\n" : "0},\n", f);
+    }
+    fprintf(f, "};\n\n"
+               "int main(void) {\n"
+               "    FILE *out = fopen(\"test_gen.out\", \"wb\");\n"
+               "    for (int i = 0; i < %d; i++) {\n"
+               "        const char *name = tree_animal(tree_classify(leaves[i]));\n"
+               "        fprintf(out, \"%%d\", tree_classify(leaves[i]));\n"
+               "        fwrite(name, 1, strlen(name) + 1, out);\n"
+               "    }\n"
+               "    for (int q = 0; q < TREE_QUESTIONS; q++) fwrite(tree_question(q), 1, strlen(tree_question(q)) + 1, out);\n"
+               "    return fclose(out) != 0;\n"
+               "}\n", animals);
+    fclose(f);
+    free(a);
+    const char *cc = getenv("CC"); // the generated file must build with any C99 compiler
+    char cmd[256];
+    snprintf(cmd, sizeof cmd, "%s -O2 -std=c99 -Wall -Wextra -Werror -o test_gen test_gen_main.c",
+             cc && *cc ? cc : "cc");
+    assert(system(cmd) == 0);
+    assert(system("./test_gen") == 0);
+
+    /* every leaf path ends at its own animal, under its own name */
+    f = fopen("test_gen.out", "rb");
+    char buf[1024];
+    for (int id = 0; id < animals; id++) {
+        int got = -1, c, n = 0;
+        assert(fscanf(f, "%d", &got) == 1 && got == id);
+        while ((c = fgetc(f)) > 0 && n < (int)sizeof buf - 1) buf[n++] = (char)c;
+        buf[n] = '\0';
+        assert(strcmp(buf, index_animal(id)->text) == 0);
+    }
+    for (int q = 0; q < p->questionCount; q++) {
+        int c, n = 0;
+        while ((c = fgetc(f)) > 0 && n < (int)sizeof buf - 1) buf[n++] = (char)c;
+        buf[n] = '\0';
+        assert(strcmp(buf, prog_question_text(p, q)) == 0);
+    }
+    assert(fgetc(f) == EOF);
+    fclose(f);
+    free_tree(g_root);
+    g_root = NULL;
+    remove("test_gen.c");
+    remove("test_gen_main.c");
+    remove("test_gen");
+    remove("test_gen.out");
+}
+
+/* Question and animal texts that need escaping in generated C. */
+static void odd_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    static const char *odd[] = {"Is it \"quoted\"?", "Back\\slash?\?=", "Two\nlines\t?", "Caf\xc3\xa9 au lait?",
+                                "Is it 50% *",  "Ends in ?"};
+    snprintf(question, TREE_TEXT_MAX, "%s %d", odd[tree_rand(rng) % 6], depth);
+    if (count == 0) snprintf(animal, TREE_TEXT_MAX, "First \"animal\"");
+    else snprintf(animal, TREE_TEXT_MAX, "Animal\\%d?", count);
+}
+
+/* Classifier code generation */
+void test_codegen() {
+    printf("Testing Classifier Code Generation...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it live in water?");
+    g_root->yes = create_question_node("Does it have fins?");
+    g_root->yes->yes = create_animal_node("Fish");
+    g_root->yes->no = create_animal_node("Octopus");
+    g_root->no = create_question_node("Can it fly?");
+    g_root->no->yes = create_animal_node("Bird");
+    g_root->no->no = create_animal_node("Dog");
+    index_rebuild();
+    assert(save_tree("test.dat"));
+    free_tree(g_root);
+    g_root = NULL;
+    check_generated("test.dat");
+    remove("test.dat");
+
+    /* text that needs escaping, and a bigger tree grown by random splits */
+    g_root = build_random_tree(3000, 46, odd_text, NULL);
+    index_rebuild();
+    assert(save_tree("test.dat"));
+    free_tree(g_root);
+    g_root = NULL;
+    check_generated("test.dat");
+    remove("test.dat");
+
+    /* a bad prefix is refused before anything is written */
+    DecisionProgram empty;
+    assert(prog_compile(NULL, &empty));
+    assert(!prog_emit_c(&empty, stdout, "2fast", NULL) && !prog_emit_c(&empty, stdout, "a-b", NULL));
+    prog_free(&empty);
+
+    g_root = saved;
+    index_rebuild();
+    prog_invalidate();
+    printf("  ✓ Classifier code generation tests passed\n");
+}
+
+/* Visible rows the slow way: preorder, skipping collapsed subtrees. */
+static void naive_rows(const TreeView *v, Node *n, int depth, ViewRow *out, int *count) {
+    out[*count].node = n;
+    out[*count].depth = depth;
+    (*count)++;
+    if (!view_expanded(v, n)) return;
+    naive_rows(v, n->yes, depth + 1, out, count);
+    naive_rows(v, n->no, depth + 1, out, count);
+}
+
+static void check_view(const TreeView *v, ViewRow *want, ViewRow *got, int n) {
+    int count = 0;
+    naive_rows(v, g_root, 0, want, &count);
+    ViewRow r;
+    assert(view_first(&r));
+    assert(view_rows(v, r, got, n + 1) == count);
+    for (int i = 0; i < count; i++) assert(got[i].node == want[i].node && got[i].depth == want[i].depth);
+    assert(view_last(v, &r) && r.node == want[count - 1].node && r.depth == want[count - 1].depth);
+    for (int i = count - 1; i > 0; i--) { // and back up again
+        assert(view_prev(v, &r) && r.node == want[i - 1].node && r.depth == want[i - 1].depth);
+    }
+    assert(!view_prev(v, &r) && r.node == g_root);
+}
+
+/* Lazily computed tree view rows */
+void test_treeview() {
+    printf("Testing Tree View...\n");
+
+    Node *saved = g_root;
+    int n = 4000;
+    Node **leaves = malloc((size_t)n * sizeof(Node *));
+    Node **questions = malloc((size_t)n * sizeof(Node *));
+    g_root = build_random_tree(n, 47, NULL, leaves);
+    srand(47);
+    for (int count = 1; count < n; count++) { // each animal's first question
+        Node *q = leaves[count];
+        while (q->parent->no != q) q = q->parent;
+        questions[count - 1] = q->parent;
+    }
+    ViewRow *want = malloc((size_t)(2 * n) * sizeof(ViewRow));
+    ViewRow *got = malloc((size_t)(2 * n) * sizeof(ViewRow));
+
+    TreeView v;
+    view_init(&v);
+    check_view(&v, want, got, 2 * n);
+    ViewRow r;
+    view_first(&r);
+    assert(view_rows(&v, r, got, 10) == 10 && view_rows(&v, r, got, 2 * n) == 2 * n - 1);
+
+    /* fold random questions, unfold half of them again (set deletions) */
+    for (int i = 0; i < 600; i++) assert(view_toggle(&v, questions[rand() % (n - 1)]));
+    check_view(&v, want, got, 2 * n);
+    for (int i = 0; i < n - 1; i += 2) {
+        if (!view_expanded(&v, questions[i])) view_toggle(&v, questions[i]);
+    }
+    check_view(&v, want, got, 2 * n);
+    view_toggle(&v, leaves[1]); // animals have nothing to fold
+    assert(!view_expanded(&v, leaves[1]));
+
+    /* everything folded shows only the root; unfolding it shows two more */
+    view_collapse_all(&v, 1);
+    assert(view_last(&v, &r) && r.node == g_root);
+    view_toggle(&v, g_root);
+    check_view(&v, want, got, 2 * n);
+    view_collapse_all(&v, 0);
+    check_view(&v, want, got, 2 * n);
+    view_free(&v);
+    free_tree(g_root);
+
+    /* a 200000-deep chain opens and scrolls without recursion */
+    int deep = 200000;
+    g_root = create_question_node("q");
+    Node *cur = g_root;
+    for (int d = 1; d < deep; d++) {
+        cur->yes = create_animal_node("a");
+        cur->no = create_question_node("q");
+        cur->yes->parent = cur->no->parent = cur;
+        cur = cur->no;
+    }
+    cur->yes = create_animal_node("a");
+    cur->no = create_animal_node("z");
+    cur->yes->parent = cur->no->parent = cur;
+    view_init(&v);
+    assert(view_last(&v, &r) && r.node == cur->no && r.depth == deep);
+    assert(view_prev(&v, &r) && r.node == cur->yes && view_prev(&v, &r) && r.node == cur);
+    assert(view_rows(&v, r, got, 10) == 3);
+    view_free(&v);
+    for (Node *q = g_root; q != NULL;) { // free_tree would recurse 200000 deep
+        Node *next = q->isQuestion ? q->no : NULL;
+        if (q->isQuestion) free_tree(q->yes);
+        free(q->text);
+        free(q);
+        q = next;
+    }
+
+    free(leaves);
+    free(questions);
+    free(want);
+    free(got);
+    g_root = saved;
+    printf("  ✓ Tree view tests passed\n");
+}
+
+/* Node positions read back from a DOT layout, in preorder. */
+static int read_dot_positions(FILE *f, long long *x, long long *y, int max, int *dashed) {
+    char line[4096];
+    int count = 0;
+    *dashed = 0;
+    rewind(f);
+    while (fgets(line, sizeof line, f)) {
+        const char *pos = strstr(line, "pos=\"");
+        int id;
+        if (pos == NULL || sscanf(line, " n%d [", &id) != 1) continue;
+        assert(id == count && count < max);
+        assert(sscanf(pos, "pos=\"%lld,%lld!\"", &x[count], &y[count]) == 2);
+        if (strstr(line, "style=dashed")) (*dashed)++;
+        count++;
+    }
+    return count;
+}
+
+/* Lay root out as DOT and record each node's x by preorder position. */
+static int layout_positions(Node *root, int maxDepth, long long *x, long long *y, int max, int *dashed) {
+    LayoutOptions opt = {LAYOUT_DOT, maxDepth};
+    FILE *f = tmpfile();
+    assert(f != NULL && layout_write(root, f, &opt));
+    int count = read_dot_positions(f, x, y, max, dashed);
+    fclose(f);
+    return count;
+}
+
+static void mirror_tree(Node **order, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!order[i]->isQuestion) continue;
+        Node *t = order[i]->yes;
+        order[i]->yes = order[i]->no;
+        order[i]->no = t;
+    }
+}
+
+/* Plain texts, and one animal name that needs escaping in the export. */
+static void markup_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    (void)rng;
+    (void)depth;
+    snprintf(question, TREE_TEXT_MAX, "q");
+    snprintf(animal, TREE_TEXT_MAX, "%s", count == 7 ? "a<&>\"\\" : "a");
+}
+
+void test_layout() {
+    printf("Testing Tree Layout Export...\n");
+
+    Node *saved = g_root;
+    int n = 3000, total = 2 * n - 1;
+    Node **leaves = malloc((size_t)n * sizeof(Node *));
+    g_root = build_random_tree(n, 49, markup_text, leaves);
+    srand(49);
+
+    /* preorder nodes and depths, to match the exported ids */
+    Node **order = malloc((size_t)total * sizeof(Node *));
+    int *depth = malloc((size_t)total * sizeof(int));
+    int *parent = malloc((size_t)total * sizeof(int));
+    Node **stack = malloc((size_t)total * sizeof(Node *));
+    int *stackDepth = malloc((size_t)total * sizeof(int));
+    int *stackParent = malloc((size_t)total * sizeof(int));
+    int sp = 0, count = 0;
+    stack[sp] = g_root;
+    stackDepth[sp] = 0;
+    stackParent[sp++] = -1;
+    while (sp > 0) {
+        sp--;
+        order[count] = stack[sp];
+        depth[count] = stackDepth[sp];
+        parent[count] = stackParent[sp];
+        if (order[count]->isQuestion) {
+            Node *kids[2] = {order[count]->no, order[count]->yes};
+            for (int k = 0; k < 2; k++) {
+                stack[sp] = kids[k];
+                stackDepth[sp] = depth[count] + 1;
+                stackParent[sp++] = count;
+            }
+        }
+        count++;
+    }
+    assert(count == total);
+
+    long long *x = malloc((size_t)total * sizeof(long long));
+    long long *y = malloc((size_t)total * sizeof(long long));
+    long long *mx = malloc((size_t)total * sizeof(long long));
+    long long *lastX = malloc((size_t)total * sizeof(long long));
+    int dashed;
+    assert(layout_positions(g_root, -1, x, y, total, &dashed) == total && dashed == 0);
+
+    /* parents centred over their children, yes on the left, levels flat */
+    long long gap = -1;
+    for (int i = 0; i < total; i++) {
+        if (parent[i] < 0) continue;
+        assert(y[i] < y[parent[i]] && y[i] == y[0] - (y[0] - y[1]) * depth[i]);
+        if (order[parent[i]]->yes == order[i]) {
+            int no = i + 1; // the yes subtree ends where the no child starts
+            while (parent[no] != parent[i]) no++;
+            assert(x[i] < x[no] && x[i] + x[no] == 2 * x[parent[i]]);
+            if (gap < 0 || x[no] - x[i] < gap) gap = x[no] - x[i];
+        }
+    }
+    assert(gap > 0);
+    /* left to right in preorder on every level, never closer than siblings */
+    for (int d = 0; d < total; d++) lastX[d] = -1;
+    for (int i = 0; i < total; i++) {
+        if (lastX[depth[i]] >= 0) assert(x[i] - lastX[depth[i]] >= gap);
+        lastX[depth[i]] = x[i];
+    }
+
+    /* a mirrored tree is drawn as the mirror image */
+    mirror_tree(order, total);
+    long long width = 0;
+    for (int i = 0; i < total; i++) width = x[i] > width ? x[i] : width;
+    assert(layout_positions(g_root, -1, mx, y, total, &dashed) == total);
+    int at = 0; // the mirror's preorder takes the no branch first
+    sp = 0;
+    stack[sp++] = g_root;
+    while (sp > 0) {
+        Node *m = stack[--sp];
+        int i = 0;
+        while (order[i] != m) i++;
+        assert(x[i] + mx[at] == width);
+        at++;
+        if (m->isQuestion) {
+            stack[sp++] = m->no;
+            stack[sp++] = m->yes;
+        }
+    }
+    mirror_tree(order, total);
+
+    /* a depth limit draws only the top levels, with cut questions dashed */
+    int limit = 4, within = 0, cut = 0;
+    for (int i = 0; i < total; i++) {
+        if (depth[i] <= limit) within++;
+        if (depth[i] == limit && order[i]->isQuestion) cut++;
+    }
+    assert(layout_positions(g_root, limit, x, y, total, &dashed) == within && dashed == cut);
+    assert(layout_positions(g_root->yes, 0, x, y, total, &dashed) == 1);
+
+    /* text is escaped for each format */
+    LayoutOptions svg = {LAYOUT_SVG, -1};
+    LayoutOptions dot = {LAYOUT_DOT, -1};
+    char line[4096];
+    int foundSvg = 0, foundDot = 0, closed = 0;
+    FILE *f = tmpfile();
+    assert(layout_write(g_root, f, &svg));
+    rewind(f);
+    while (fgets(line, sizeof line, f)) {
+        if (strstr(line, "a&lt;&amp;&gt;&quot;\\")) foundSvg = 1;
+        closed = strcmp(line, "</svg>\n") == 0;
+    }
+    fclose(f);
+    assert(foundSvg && closed);
+    f = tmpfile();
+    assert(layout_write(g_root, f, &dot));
+    rewind(f);
+    while (fgets(line, sizeof line, f)) {
+        if (strstr(line, "label=\"a<&>\\\"\\\\\"")) foundDot = 1;
+    }
+    fclose(f);
+    assert(foundDot);
+    assert(!layout_write(NULL, stdout, &svg));
+
+    /* in the background: progress ends at the total, cancelling removes
+     * the file unless the job had already finished */
+    LayoutJob job;
+    long done, all;
+    assert(layout_start(&job, g_root, "test_layout.svg", &svg));
+    assert(layout_wait(&job));
+    layout_progress(&job, &done, &all);
+    assert(all == 2L * total && done == all);
+    f = fopen("test_layout.svg", "r");
+    assert(f != NULL);
+    fclose(f);
+    assert(layout_start(&job, g_root, "test_layout.svg", &svg));
+    layout_cancel(&job);
+    int written = layout_wait(&job);
+    assert(layout_finished(&job));
+    if (!written) assert(fopen("test_layout.svg", "r") == NULL);
+    remove("test_layout.svg");
+
+    free(x);
+    free(y);
+    free(mx);
+    free(lastX);
+    free(order);
+    free(depth);
+    free(parent);
+    free(stack);
+    free(stackDepth);
+    free(stackParent);
+    free(leaves);
+    free_tree(g_root);
+
+    /* a 200000-deep chain lays out without recursion */
+    int deep = 200000;
+    g_root = create_question_node("q");
+    Node *cur = g_root;
+    for (int d = 1; d < deep; d++) {
+        cur->yes = create_animal_node("a");
+        cur->no = create_question_node("q");
+        cur = cur->no;
+    }
+    cur->yes = create_animal_node("a");
+    cur->no = create_animal_node("z");
+    f = tmpfile();
+    assert(layout_write(g_root, f, &svg));
+    fclose(f);
+    for (Node *q = g_root; q != NULL;) {
+        Node *next = q->isQuestion ? q->no : NULL;
+        if (q->isQuestion) free_tree(q->yes);
+        free(q->text);
+        free(q);
+        q = next;
+    }
+
+    g_root = saved;
+    printf("  ✓ Tree layout tests passed\n");
+}
+
+/* Words of s for the naive matcher: lowercased runs of letters, digits
+ * and non-ASCII bytes. Returns how many (at most max). */
+static int naive_words(const char *s, char out[][32], int max) {
+    int count = 0;
+    while (*s && count < max) {
+        unsigned char c = (unsigned char)*s;
+        if (!(isalnum(c) || c >= 0x80)) {
+            s++;
+            continue;
+        }
+        int len = 0;
+        while (*s && (isalnum((unsigned char)*s) || (unsigned char)*s >= 0x80)) {
+            if (len < 31) out[count][len++] = (char)tolower((unsigned char)*s);
+            s++;
+        }
+        out[count++][len] = '\0';
+    }
+    return count;
+}
+
+/* Node text contains the query words in a row, the last as a prefix if
+ * the query ends inside it. */
+static int naive_search_match(const char *text, const char *query) {
+    char tw[64][32], qw[16][32];
+    int tn = naive_words(text, tw, 64), qn = naive_words(query, qw, 16);
+    size_t ql = strlen(query);
+    int prefix = ql > 0 && (isalnum((unsigned char)query[ql - 1]) || (unsigned char)query[ql - 1] >= 0x80);
+    for (int k = 0; qn > 0 && k + qn <= tn; k++) {
+        int i = 0;
+        while (i < qn && (i == qn - 1 && prefix ? strncmp(tw[k + i], qw[i], strlen(qw[i])) == 0
+                                                 : strcmp(tw[k + i], qw[i]) == 0)) {
+            i++;
+        }
+        if (i == qn) return 1;
+    }
+    return 0;
+}
+
+/* Questions of one to five words from a small vocabulary, some of them
+ * prefixes of others, with stray commas and mixed case. */
+static void vocab_text(uint64_t *rng, int count, int depth, char *question, char *animal) {
+    static const char *vocab[] = {"does", "it", "swim", "fly", "have", "fur", "can", "live", "in",
+                                  "water", "big", "cat", "catfish", "Dog", "DOGS", "\xc3\xa9lan", "x1"};
+    int nv = (int)(sizeof vocab / sizeof vocab[0]);
+    int len = 0, words = 1 + tree_rand(rng) % 5;
+    (void)depth;
+    for (int w = 0; w < words; w++) {
+        const char *sep = w == 0 ? "" : tree_rand(rng) % 4 ? " " : ", ";
+        len += snprintf(question + len, TREE_TEXT_MAX - (size_t)len, "%s%s", sep, vocab[tree_rand(rng) % nv]);
+    }
+    snprintf(question + len, TREE_TEXT_MAX - (size_t)len, "?");
+    if (count == 0) snprintf(animal, TREE_TEXT_MAX, "Animal 0");
+    else snprintf(animal, TREE_TEXT_MAX, "%s %d", vocab[tree_rand(rng) % nv], count);
+}
+
+void test_search() {
+    printf("Testing Tree Search...\n");
+
+    Node *saved = g_root;
+    int n = 3000, total = 2 * n - 1;
+    g_root = build_random_tree(n, 50, vocab_text, NULL);
+    srand(50);
+    index_rebuild();
+
+    Node **order = malloc((size_t)total * sizeof(Node *));
+    Node **stack = malloc((size_t)total * sizeof(Node *));
+    int sp = 0, count = 0;
+    stack[sp++] = g_root;
+    while (sp > 0) {
+        Node *c = stack[--sp];
+        order[count++] = c;
+        if (c->isQuestion) {
+            stack[sp++] = c->no;
+            stack[sp++] = c->yes;
+        }
+    }
+    assert(count == total);
+
+    /* fixed queries, then random prefixes and phrases cut from node text */
+    const char *fixed[] = {"c", "cat", "cat ", "CATF", "dog", "dogs", "it sw", "does it", "d i", "\xc3\xa9",
+                           "fur?", "x1 ", "zzz", "", "  ", "12", "animal 1", "it, can"};
+    int nfixed = (int)(sizeof fixed / sizeof fixed[0]);
+    SearchQuery q;
+    char query[64];
+    int counted = 0;
+    for (int t = 0; t < nfixed + 300; t++) {
+        if (t < nfixed) {
+            snprintf(query, sizeof query, "%s", fixed[t]);
+        } else {
+            const char *src = order[rand() % total]->text;
+            size_t from = (size_t)rand() % strlen(src), len = 1 + (size_t)rand() % 12;
+            while (from > 0 && src[from - 1] != ' ') from--; // start at a word
+            snprintf(query, sizeof query, "%.*s", (int)len, src + from);
+        }
+        assert(search_compile(&q, query));
+
+        int matches = 0;
+        for (int i = 0; i < total; i++) {
+            int m = naive_search_match(order[i]->text, query);
+            assert(search_matches(&q, order[i]) == m);
+            matches += m;
+        }
+        if (q.hits >= 0) assert(q.hits == matches);
+        counted += q.hits >= 0;
+
+        /* next and previous from random places, wrapping around */
+        for (int k = 0; k < 20; k++) {
+            int at = k == 0 ? -1 : rand() % total;
+            for (int backward = 0; backward < 2; backward++) {
+                Node *want = NULL;
+                for (int step = 1; step <= total && want == NULL; step++) {
+                    int i = at < 0 ? (backward ? total - step : step - 1)
+                                   : (backward ? (at - step + total) % total : (at + step) % total);
+                    if (naive_search_match(order[i]->text, query)) want = order[i];
+                }
+                assert(search_next(&q, at < 0 ? NULL : order[at], backward) == want);
+            }
+        }
+    }
+
+    assert(counted > 250); // only short prefixes have too many postings to count
+
+    /* edits invalidate the index */
+    es_init(&g_undo);
+    es_init(&g_redo);
+    GameSession s;
+    assert(engine_begin(&s));
+    while (s.state == GAME_ASKING) engine_answer(&s, 1);
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Zebrafish", "Is it striped?", 1) > 0);
+    assert(search_compile(&q, "zebra") && q.hits == 1);
+    Node *zebra = search_next(&q, NULL, 0);
+    assert(zebra != NULL && strcmp(zebra->text, "Zebrafish") == 0 && search_next(&q, zebra, 1) == zebra);
+    assert(undo_last_edit());
+    assert(search_compile(&q, "zebra") && q.hits == 0 && search_next(&q, NULL, 0) == NULL);
+    engine_drop_history(&g_undo, &g_redo);
+
+    free(order);
+    free(stack);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Tree search tests passed\n");
+}
+
+/* Animal name -> leaf map */
+void test_names() {
+    printf("Testing Animal Names...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it meow?");
+    g_root->yes = create_animal_node("Cat");
+    g_root->no = create_question_node("Does it bark?");
+    g_root->no->yes = create_animal_node("Dog");
+    g_root->no->no = create_animal_node("cat!");   // taught twice
+    index_rebuild();
+
+    int ids[4];
+    assert(names_lookup("CAT", ids, 4) == 2);
+    assert(index_animal(ids[0]) == g_root->yes && index_animal(ids[1]) == g_root->no->no);
+    assert(names_find("dog") == g_root->no->yes);
+    assert(names_find("Horse") == NULL);
+    IdList dups;
+    idl_init(&dups);
+    assert(names_duplicates(&dups) == 2);
+
+    /* learn/undo/redo keep the map current */
+    Node *dog = g_root->no->yes;
+    Node *q = create_question_node("Does it neigh?");
+    Node *horse = create_animal_node("Horse");
+    q->yes = horse;
+    q->no = dog;
+    g_root->no->yes = q;
+    q->parent = g_root->no;
+    dog->parent = q;
+    horse->parent = q;
+    Edit e = {EDIT_INSERT_SPLIT, g_root->no, 1, dog, q, horse};
+    index_on_learn(&e);
+    names_on_learn(&e);
+    assert(names_find("horse") == horse);
+    assert(names_find("Dog") == dog);
+    names_on_undo(&e);
+    assert(names_find("horse") == NULL);
+    names_on_redo(&e);
+    assert(names_find("horse") == horse);
+
+    /* a second horse makes a new duplicate pair */
+    Node *cat = g_root->yes;
+    Node *q2 = create_question_node("Is it big?");
+    Node *horse2 = create_animal_node("Horse");
+    q2->yes = horse2;
+    q2->no = cat;
+    g_root->yes = q2;
+    q2->parent = g_root;
+    cat->parent = q2;
+    horse2->parent = q2;
+    Edit e2 = {EDIT_INSERT_SPLIT, g_root, 1, cat, q2, horse2};
+    index_on_learn(&e2);
+    names_on_learn(&e2);
+    assert(names_lookup("horse", ids, 4) == 2);
+    assert(names_duplicates(&dups) == 4);
+    names_on_undo(&e2);
+    assert(names_duplicates(&dups) == 2);
+    assert(names_lookup("horse", ids, 4) == 1 && index_animal(ids[0]) == horse);
+
+    idl_free(&dups);
+    free_tree(horse2);
+    free(q2->text);
+    free(q2);
+    g_root->yes = cat;
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Animal name tests passed\n");
+}
+
+/* Reference height of a subtree, recursively. */
+static int naive_height(const Node *n) {
+    if (!n->isQuestion) return 0;
+    int y = naive_height(n->yes), no = naive_height(n->no);
+    return 1 + (y > no ? y : no);
+}
+
+/* Tree statistics */
+void test_stats() {
+    printf("Testing Tree Statistics...\n");
+
+    /* hand-checked: depths 1, 2, 3, 3; the root is off by 2 */
+    Node *root = create_question_node("Q1?");
+    root->yes = create_animal_node("A");
+    root->no = create_question_node("Q2");
+    root->no->yes = create_animal_node("Bb");
+    root->no->no = create_question_node("Q3");
+    root->no->no->yes = create_animal_node("C");
+    root->no->no->no = create_animal_node("D");
+    TreeStats st;
+    assert(tree_stats(root, 1, &st));
+    assert(st.nodes == 7 && st.questions == 3 && st.animals == 4);
+    assert(st.height == 3 && st.avgDepth == 9.0 / 4);
+    assert(st.depthHist[0] == 0 && st.depthHist[1] == 1 && st.depthHist[2] == 1 && st.depthHist[3] == 2);
+    assert(st.maxImbalance == 2 && st.worst == root && st.unbalanced == 1);
+    assert(st.avgImbalance == 3.0 / 3);
+    assert(st.questionBytes == 7 && st.animalBytes == 5);
+    char buf[512];
+    FILE *f = tmpfile();
+    tree_stats_json(&st, f);
+    rewind(f);
+    buf[fread(buf, 1, sizeof buf - 1, f)] = '\0';
+    fclose(f);
+    assert(strstr(buf, "\"depthHistogram\":[0,1,1,2]") != NULL);
+    assert(strstr(buf, "\"worst\":\"Q1?\"") != NULL);
+    tree_stats_free(&st);
+    free_tree(root);
+
+    /* a single animal */
+    Node *leaf = create_animal_node("Solo");
+    assert(tree_stats(leaf, 4, &st));
+    assert(st.nodes == 1 && st.animals == 1 && st.height == 0 && st.worst == NULL);
+    tree_stats_free(&st);
+    free_tree(leaf);
+
+    /* big random tree: the threaded walk agrees with the sequential one */
+    int n = 300000;
+    root = build_random_tree(n, 38, NULL, NULL);
+    TreeStats seq, par;
+    assert(tree_stats(root, 1, &seq));
+    assert(tree_stats(root, 4, &par));
+    assert(seq.nodes == count_nodes(root) && seq.animals == n && seq.questions == n - 1);
+    assert(seq.height == naive_height(root));
+    assert(par.nodes == seq.nodes && par.height == seq.height && par.avgDepth == seq.avgDepth);
+    assert(par.maxImbalance == seq.maxImbalance && par.unbalanced == seq.unbalanced);
+    assert(par.avgImbalance == seq.avgImbalance);
+    assert(par.questionBytes == seq.questionBytes && par.animalBytes == seq.animalBytes);
+    long total = 0;
+    for (int d = 0; d <= seq.height; d++) {
+        assert(par.depthHist[d] == seq.depthHist[d]);
+        total += seq.depthHist[d];
+    }
+    assert(total == n);
+    tree_stats_free(&seq);
+    tree_stats_free(&par);
+    free_tree(root);
+    printf("  ✓ Tree statistics tests passed\n");
+}
+
+/* Headless game engine */
+void test_engine() {
+    printf("Testing Game Engine...\n");
+
+    Node *saved = g_root;
+    g_root = create_question_node("Does it live in water?");
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_animal_node("Dog");
+    index_rebuild();
+    es_init(&g_undo);
+    es_init(&g_redo);
+
+    /* a game that guesses right */
+    GameSession s;
+    assert(engine_begin(&s) && s.state == GAME_ASKING);
+    assert(strcmp(engine_question(&s), "Does it live in water?") == 0);
+    assert(engine_guess(&s) == NULL);
+    assert(engine_answer(&s, 1) == GAME_GUESSING && s.steps == 1);
+    assert(engine_question(&s) == NULL && strcmp(engine_guess(&s), "Fish") == 0);
+    assert(engine_confirm(&s, 1) == GAME_WON);
+    assert(!engine_teach(&s, "Whale", "Is it a mammal?", 1));
+
+    /* a wrong guess teaches a new animal through every index */
+    engine_begin(&s);
+    engine_answer(&s, 0);
+    assert(engine_confirm(&s, 0) == GAME_LEARNING);
+    assert(engine_teach(&s, "Cat", "Does it meow?", 1) && s.state == GAME_OVER);
+    assert(g_undo.size == 1 && g_redo.size == 0);
+    Node *cat = names_find("cat");
+    assert(cat != NULL && cat->parent == g_root->no && g_root->no->yes == cat);
+    assert(g_root->no->no->parent == g_root->no);
+    assert(check_integrity());
+    IdList ids;
+    idl_init(&ids);
+    assert(index_query("Does it meow?", 1, &ids) == 1 && idl_contains(&ids, cat->id));
+    idl_free(&ids);
+
+    engine_begin(&s);
+    assert(engine_answer(&s, 0) == GAME_ASKING);
+    assert(engine_answer(&s, 1) == GAME_GUESSING && engine_guess(&s) == cat->text);
+
+    /* undo/redo live in the engine too */
+    assert(undo_last_edit());
+    assert(names_find("cat") == NULL && g_root->no->parent == g_root);
+    assert(redo_last_edit());
+    assert(names_find("cat") == cat);
+    engine_end(&s);
+
+    /* teaching at a root leaf replaces the root */
+    Node *tree = g_root;
+    g_root = create_animal_node("Ant");
+    index_rebuild();
+    assert(engine_begin(&s) && s.state == GAME_GUESSING);
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Bee", "Can it fly?", 1));
+    assert(g_root->isQuestion && g_root->parent == NULL && strcmp(g_root->yes->text, "Bee") == 0);
+    free_tree(g_root);
+    g_root = NULL;
+    assert(!engine_begin(&s) && s.state == GAME_OVER);
+
+    es_free(&g_undo);
+    es_free(&g_redo);
+    free_tree(tree);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Game engine tests passed\n");
+}
+
+/* Session recording and replay */
+static Node *record_start_tree() {
+    Node *root = create_question_node("Does it live in water?");
+    root->yes = create_animal_node("Fish");
+    root->no = create_animal_node("Dog");
+    return root;
+}
+
+/* A chain of depth questions: question i continues on its yes side when
+ * i % 3 == 0 and on its no side otherwise, with an animal on the other. */
+static Node *record_chain_tree(int depth) {
+    char text[32];
+    Node *root = NULL, **slot = &root;
+    for (int i = 0; i < depth; i++) {
+        snprintf(text, sizeof text, "Question %d?", i);
+        Node *q = create_question_node(text);
+        snprintf(text, sizeof text, "Animal %d", i);
+        Node *leaf = create_animal_node(text);
+        *slot = q;
+        if (i % 3 == 0) {
+            q->no = leaf;
+            slot = &q->yes;
+        } else {
+            q->yes = leaf;
+            slot = &q->no;
+        }
+    }
+    *slot = create_animal_node("Animal end");
+    return root;
+}
+
+static uint64_t fake_clock(void) {
+    static uint64_t t = 0;
+    return t += 5;
+}
+
+void test_record() {
+    printf("Testing Session Recording...\n");
+
+    Node *saved = g_root;
+    g_root = record_start_tree();
+    index_rebuild();
+    es_init(&g_undo);
+    es_init(&g_redo);
+    uint64_t startSum, endSum, sum;
+    assert(tree_checksum(g_root, &startSum));
+
+    Recorder rec;
+    assert(rec_create(&rec, "test.rec"));
+    GameSession s;
+    engine_begin(&s);                           // won
+    engine_record(&s, &rec);
+    engine_answer(&s, 1);
+    engine_confirm(&s, 1);
+    engine_begin(&s);                           // taught Cat
+    engine_record(&s, &rec);
+    engine_answer(&s, 0);
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Cat", "Does it meow?", 1));
+    for (int i = 0; i < 70; i++) {              // many short sessions: Cat every time
+        engine_begin(&s);
+        engine_record(&s, &rec);
+        engine_answer(&s, 0);
+        engine_answer(&s, 1);
+        engine_confirm(&s, 1);
+    }
+    engine_begin(&s);                           // taught Shark, then undone and redone
+    engine_record(&s, &rec);
+    engine_answer(&s, 1);
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Shark", "Is it dangerous?", 1));
+    assert(undo_last_edit());
+    rec_write_edit(&rec, 0);
+    assert(redo_last_edit());
+    rec_write_edit(&rec, 1);
+    engine_begin(&s);                           // abandoned mid-game
+    engine_record(&s, &rec);
+    engine_answer(&s, 0);
+    engine_end(&s);
+    assert(rec.sessions == 74);
+    assert(rec_close(&rec));
+    assert(tree_checksum(g_root, &endSum) && endSum != startSum);
+    Node *recorded = g_root;
+
+    /* replay from the same start tree ends with the same tree */
+    g_root = record_start_tree();
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    RecordReader r;
+    assert(rec_open(&r, "test.rec") && r.startSum == startSum);
+    RecordedSession rs;
+    uint64_t stepNs[8];
+    int n = 0, got;
+    while ((got = rec_next(&r, &rs)) == 1) {
+        int calls = rec_replay(&rs, n == 0 ? fake_clock : NULL, stepNs);
+        assert(calls > 0);
+        if (n == 0) assert(calls == 2 && rs.outcome == GAME_WON && stepNs[0] == 5 && stepNs[1] == 5);
+        if (n == 2) assert(rs.steps == 2 && (rs.answers[0] & 3) == 2);
+        rec_session_free(&rs);
+        n++;
+    }
+    assert(got == 0 && r.ended && n == 76);
+    rec_close_reader(&r);
+    assert(tree_checksum(g_root, &sum) && sum == endSum && r.endSum == endSum);
+    assert(names_find("shark") != NULL && names_find("cat") != NULL);
+    free_tree(g_root);
+
+    /* a different start tree does not replay */
+    g_root = create_question_node("Can it fly?");
+    g_root->yes = create_animal_node("Bird");
+    g_root->no = create_animal_node("Dog");
+    index_rebuild();
+    assert(tree_checksum(g_root, &sum) && sum != startSum);
+    assert(rec_open(&r, "test.rec") && r.startSum == startSum);
+    assert(rec_next(&r, &rs) == 1);
+    rec_session_free(&rs);
+    assert(rec_next(&r, &rs) == 1 && rs.outcome == GAME_OVER && strcmp(rs.animal, "Cat") == 0);
+    rec_session_free(&rs);
+    assert(rec_next(&r, &rs) == 1 && rs.steps == 2);
+    assert(rec_replay(&rs, NULL, NULL) == -1); // runs out of questions
+    rec_session_free(&rs);
+    rec_close_reader(&r);
+    free_tree(g_root);
+
+    /* one session answers more than the 64 the trail starts with */
+    g_root = record_chain_tree(100);
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    assert(tree_checksum(g_root, &startSum));
+    assert(rec_create(&rec, "test.rec"));
+    engine_begin(&s);
+    engine_record(&s, &rec);
+    for (int i = 0; i < 100; i++) {
+        assert(engine_answer(&s, i % 3 == 0) == (i < 99 ? GAME_ASKING : GAME_GUESSING));
+    }
+    assert(s.trailCap >= 128 && strcmp(engine_guess(&s), "Animal end") == 0);
+    engine_confirm(&s, 0);
+    assert(engine_teach(&s, "Owl", "Does it hoot?", 1) == 1);
+    assert(rec.sessions == 1 && !rec.failed && rec_close(&rec));
+    assert(tree_checksum(g_root, &endSum));
+    Node *deep = g_root;
+
+    g_root = record_chain_tree(100);
+    index_rebuild();
+    es_clear(&g_undo);
+    es_clear(&g_redo);
+    assert(rec_open(&r, "test.rec") && r.startSum == startSum);
+    assert(rec_next(&r, &rs) == 1 && rs.steps == 100 && rs.outcome == GAME_OVER);
+    for (int i = 0; i < 100; i++) assert(((rs.answers[i >> 3] >> (i & 7)) & 1) == (i % 3 == 0));
+    assert(rec_replay(&rs, NULL, NULL) > 0);
+    rec_session_free(&rs);
+    assert(rec_next(&r, &rs) == 0 && r.ended);
+    rec_close_reader(&r);
+    assert(tree_checksum(g_root, &sum) && sum == endSum && r.endSum == endSum);
+    assert(names_find("owl") != NULL);
+    free_tree(g_root);
+    free_tree(deep);
+
+    es_free(&g_undo);
+    es_free(&g_redo);
+    free_tree(recorded);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Session recording tests passed\n");
+}
+
+/* Game server: several players on one tree */
+static const char *srv_request(int fd, const char *req, int lines) {
+    static char buf[512];
+    size_t len = 0;
+    if (req) {
+        assert(write(fd, req, strlen(req)) == (ssize_t)strlen(req) && write(fd, "\n", 1) == 1);
+    }
+    while (lines > 0) {
+        ssize_t k = read(fd, buf + len, 1);
+        assert(k == 1 && len + 1 < sizeof buf);
+        if (buf[len++] == '\n') lines--;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+void test_server() {
+    printf("Testing Game Server...\n");
+
+    Node *saved = g_root;
+    g_root = record_start_tree();
+    index_rebuild();
+    es_init(&g_undo);
+    es_init(&g_redo);
+    GameServer srv;
+    assert(server_start(&srv, "test.sock"));
+
+    int a = server_connect("test.sock");
+    assert(a >= 0);
+    assert(strcmp(srv_request(a, NULL, 1), "Q Does it live in water?\n") == 0);
+    assert(strcmp(srv_request(a, "y", 1), "G Fish\n") == 0);
+    assert(strcmp(srv_request(a, "y", 2), "WON\nQ Does it live in water?\n") == 0);
+    assert(strcmp(srv_request(a, "n", 1), "G Dog\n") == 0);
+    assert(strcmp(srv_request(a, "teach y Cat\tDoes it meow?", 1), "ERR not learning\n") == 0);
+    assert(strcmp(srv_request(a, "n", 1), "LEARN\n") == 0);
+    assert(strncmp(srv_request(a, "teach y Cat", 1), "ERR usage", 9) == 0);
+    assert(strcmp(srv_request(a, "teach y Cat\tDoes it meow?", 2), "OK\nQ Does it live in water?\n") == 0);
+
+    /* a second player sees the first one's animal and teaches below it */
+    int b = server_connect("test.sock");
+    assert(b >= 0);
+    srv_request(b, NULL, 1);
+    assert(strcmp(srv_request(b, "n", 1), "Q Does it meow?\n") == 0);
+    assert(strcmp(srv_request(b, "y", 1), "G Cat\n") == 0);
+    assert(strcmp(srv_request(b, "n", 1), "LEARN\n") == 0);
+    assert(strcmp(srv_request(b, "teach y Lion\tDoes it roar?", 2), "OK\nQ Does it live in water?\n") == 0);
+    assert(names_find("lion") != NULL && g_undo.size == 0);
+
+    /* undo is per player, and only while nothing is taught below */
+    assert(strcmp(srv_request(b, "undo", 1), "OK\n") == 0);
+    assert(strcmp(srv_request(b, "undo", 1), "ERR nothing to undo\n") == 0);
+    assert(strcmp(srv_request(b, "redo", 1), "OK\n") == 0);
+    assert(strcmp(srv_request(a, "undo", 1), "ERR another player has taught below it\n") == 0);
+    assert(strcmp(srv_request(b, "undo", 1), "OK\n") == 0);
+    assert(strcmp(srv_request(a, "undo", 1), "OK\n") == 0);
+    assert(names_find("cat") == NULL && check_integrity());
+    assert(strncmp(srv_request(b, "redo", 1), "ERR", 3) == 0); // its question is cut off
+    assert(strcmp(srv_request(a, "redo", 1), "OK\n") == 0);
+    assert(strcmp(srv_request(b, "redo", 1), "OK\n") == 0);
+    assert(names_find("lion") != NULL && check_integrity());
+
+    /* teaching at a leaf another player has undone away fails */
+    int c = server_connect("test.sock");
+    assert(c >= 0);
+    srv_request(c, NULL, 1);
+    srv_request(c, "n", 1);
+    srv_request(c, "y", 1);
+    assert(strcmp(srv_request(c, "y", 1), "G Lion\n") == 0);
+    assert(strcmp(srv_request(c, "n", 1), "LEARN\n") == 0);
+    assert(strcmp(srv_request(b, "undo", 1), "OK\n") == 0);
+    assert(strcmp(srv_request(c, "teach y Tiger\tIs it striped?", 1),
+                  "ERR the tree changed; start a new game\n") == 0);
+    assert(names_find("tiger") == NULL);
+    assert(strcmp(srv_request(c, "new", 1), "Q Does it live in water?\n") == 0);
+    assert(strcmp(srv_request(c, "maybe", 1), "ERR unknown command\n") == 0);
+    assert(strcmp(srv_request(b, "redo", 1), "OK\n") == 0);
+
+    assert(strcmp(srv_request(a, "quit", 1), "BYE\n") == 0);
+    assert(read(a, (char[1]){0}, 1) == 0);
+    close(a);
+    assert(__atomic_load_n(&srv.steps, __ATOMIC_RELAXED) == 11);
+
+    /* stopping hangs up on the players still connected */
+    server_stop(&srv);
+    assert(srv.sessions == 3 && srv.live == 0);
+    assert(read(b, (char[1]){0}, 1) == 0 && read(c, (char[1]){0}, 1) == 0);
+    close(b);
+    close(c);
+    assert(server_connect("test.sock") < 0);
+    free_tree(g_root);
+
+    /* requests split, pipelined and answered faster than they are read */
+    static char question[1501];
+    memset(question, 'x', 1499);
+    question[1499] = '?';
+    g_root = create_question_node(question);
+    g_root->yes = create_animal_node("Fish");
+    g_root->no = create_animal_node("Dog");
+    index_rebuild();
+    assert(server_start(&srv, "test.sock"));
+    int d = server_connect("test.sock");
+    assert(d >= 0);
+    char *reply = malloc(1600);
+    assert(read(d, reply, 1600) == 1503 && reply[0] == 'Q' && reply[1502] == '\n');
+    assert(write(d, "ye", 2) == 2 && write(d, "s", 1) == 1); // "yes" is not an answer
+    assert(strcmp(srv_request(d, "", 1), "ERR unknown command\n") == 0);
+    assert(write(d, "y", 1) == 1);
+    assert(strcmp(srv_request(d, "", 1), "G Fish\n") == 0);
+    char *requests = malloc(2000 * 4);
+    for (int i = 0; i < 2000; i++) memcpy(requests + i * 4, "new\n", 4);
+    assert(write(d, requests, 2000 * 4) == 2000 * 4); // ~3 MB of replies
+    free(requests);
+    for (int i = 0; i < 2000; i++) {
+        size_t got = 0;
+        while (got < 1503) {
+            ssize_t k = read(d, reply + got, 1503 - got);
+            assert(k > 0);
+            got += (size_t)k;
+        }
+        assert(reply[0] == 'Q' && reply[2] == 'x' && reply[1502] == '\n');
+    }
+    assert(strcmp(srv_request(d, "n", 1), "G Dog\n") == 0);
+    free(reply);
+    close(d);
+    server_stop(&srv);
+    assert(srv.sessions == 1 && srv.live == 0);
+
+    es_free(&g_undo);
+    es_free(&g_redo);
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Game server tests passed\n");
+}
+
+/* Reclaiming nodes detached by undone edits */
+static int reclaimStop = 0;
+
+static void *reclaim_player(void *arg) {
+    unsigned x = (unsigned)(size_t)arg;
+    long games = 0;
+    while (!__atomic_load_n(&reclaimStop, __ATOMIC_ACQUIRE)) {
+        GameSession s;
+        engine_begin(&s);
+        while (s.state == GAME_ASKING) {
+            x = x * 1103515245u + 12345u;
+            assert(strlen(engine_question(&s)) > 0);
+            engine_answer(&s, (x >> 16) & 1);
+        }
+        assert(strlen(engine_guess(&s)) > 0);
+        if ((x >> 20) & 1) engine_confirm(&s, 1);
+        else engine_end(&s);
+        games++;
+    }
+    return (void *)games;
+}
+
+void test_reclaim() {
+    printf("Testing Node Reclamation...\n");
+
+    Node *saved = g_root;
+    g_root = record_start_tree();
+    index_rebuild();
+    assert(engine_reclaim() == 0);
+    EditStack undoA = {NULL, 0, 0}, redoA = {NULL, 0, 0};
+    EditStack undoB = {NULL, 0, 0}, redoB = {NULL, 0, 0};
+    GameSession a, b, w;
+
+    /* A teaches Cat below Dog, then B teaches Lion below Cat */
+    engine_begin(&a);
+    engine_history(&a, &undoA, &redoA);
+    engine_answer(&a, 0);
+    engine_confirm(&a, 0);
+    assert(engine_teach(&a, "Cat", "Does it meow?", 1) == 1);
+    Node *meow = g_root->no;
+    int catId = names_find("cat")->id;
+    assert(meow->refs == 1 && g_root->refs == 2);
+    engine_begin(&b);
+    engine_history(&b, &undoB, &redoB);
+    engine_answer(&b, 0);
+    engine_answer(&b, 1);
+    engine_confirm(&b, 0);
+    assert(engine_teach(&b, "Lion", "Does it roar?", 1) == 1);
+    int lionId = names_find("lion")->id;
+    assert(meow->refs == 2);
+
+    /* W stands on Lion while both edits are undone */
+    engine_begin(&w);
+    engine_answer(&w, 0);
+    engine_answer(&w, 1);
+    assert(engine_answer(&w, 1) == GAME_GUESSING);
+    assert(engine_undo(&undoB, &redoB) == 1 && engine_undo(&undoA, &redoA) == 1);
+    assert(strcmp(g_root->no->text, "Dog") == 0 && engine_reclaim() == 0);
+
+    /* A teaches again, dropping its undone edit: Cat is retired but W may
+     * still reach it, and the question stays while B's edit needs it */
+    engine_begin(&a);
+    engine_history(&a, &undoA, &redoA);
+    engine_answer(&a, 1);
+    engine_confirm(&a, 0);
+    assert(engine_teach(&a, "Whale", "Is it a mammal?", 1) == 1);
+    assert(redoA.size == 0 && meow->refs == 1 && meow->parent == NULL);
+    assert(engine_reclaim() == 1 && index_animal(catId) == NULL);
+    assert(engine_redo(&undoB, &redoB) == -1); // its question is gone for good
+
+    /* B leaves: Lion, its question and the meow question follow */
+    engine_drop_history(&undoB, &redoB);
+    assert(engine_reclaim() == 4 && index_animal(lionId) == NULL);
+    assert(strcmp(engine_guess(&w), "Lion") == 0);
+    engine_confirm(&w, 0);
+    assert(engine_teach(&w, "Tiger", "Is it striped?", 1) == -1);
+    engine_end(&w);
+    assert(engine_reclaim() == 0);
+    assert(names_find("lion") == NULL && names_find("whale") != NULL && check_integrity());
+
+    /* W stops on a question that is retired under it; reclaiming between
+     * its answers must not free the leaf it steps onto */
+    engine_begin(&a);
+    engine_history(&a, &undoA, &redoA);
+    engine_answer(&a, 0);
+    engine_confirm(&a, 0);
+    assert(engine_teach(&a, "Cat", "Does it meow?", 1) == 1);
+    engine_begin(&w);
+    assert(engine_answer(&w, 0) == GAME_ASKING && strcmp(engine_question(&w), "Does it meow?") == 0);
+    assert(engine_undo(&undoA, &redoA) == 1);
+    engine_begin(&a);
+    engine_history(&a, &undoA, &redoA);
+    engine_answer(&a, 0);
+    engine_confirm(&a, 0);
+    assert(engine_teach(&a, "Horse", "Does it neigh?", 1) == 1);
+    assert(engine_reclaim() == 2);
+    assert(engine_answer(&w, 1) == GAME_GUESSING);
+    assert(engine_reclaim() == 2);
+    assert(strcmp(engine_guess(&w), "Cat") == 0);
+    engine_confirm(&w, 0);
+    assert(engine_teach(&w, "Tiger", "Is it striped?", 1) == -1);
+    engine_end(&w);
+    assert(engine_reclaim() == 0 && check_integrity());
+
+    /* loading drops the global history through the engine, so an undone
+     * edit's nodes wait for W like any other dropped edit's (a session's
+     * own history must go before its tree does) */
+    engine_drop_history(&undoA, &redoA);
+    assert(g_undo.size == 0 && g_redo.size == 0);
+    engine_begin(&a);
+    while (a.state == GAME_ASKING) engine_answer(&a, 0);
+    engine_confirm(&a, 0);
+    assert(engine_teach(&a, "Mole", "Does it dig?", 1) == 1);
+    engine_begin(&w);
+    while (w.state == GAME_ASKING) engine_answer(&w, strcmp(engine_question(&w), "Does it dig?") == 0);
+    assert(strcmp(engine_guess(&w), "Mole") == 0 && undo_last_edit());
+    assert(save_tree("test.dat") && load_tree("test.dat"));
+    remove("test.dat");
+    assert(g_undo.size == 0 && g_redo.size == 0 && engine_reclaim() == 2);
+    assert(strcmp(engine_guess(&w), "Mole") == 0);
+    engine_end(&w);
+    assert(engine_reclaim() == 0 && names_find("mole") == NULL && check_integrity());
+
+    /* players on other threads while edits are undone and dropped */
+    pthread_t players[3];
+    for (int i = 0; i < 3; i++) {
+        pthread_create(&players[i], NULL, reclaim_player, (void *)(size_t)(i + 1));
+    }
+    unsigned x = 7;
+    char animal[32], question[48];
+    for (int i = 0; i < 2000; i++) {
+        engine_begin(&a);
+        engine_history(&a, &undoA, &redoA);
+        while (a.state == GAME_ASKING) {
+            x = x * 1103515245u + 12345u;
+            engine_answer(&a, (x >> 16) & 1);
+        }
+        engine_confirm(&a, 0);
+        snprintf(animal, sizeof animal, "Animal %d", i);
+        snprintf(question, sizeof question, "Is it animal %d?", i);
+        assert(engine_teach(&a, animal, question, (x >> 20) & 1) == 1);
+        if (i % 3 != 2) assert(engine_undo(&undoA, &redoA) == 1);
+        if (i % 7 == 0 && redoA.size > 0) assert(engine_redo(&undoA, &redoA) == 1);
+    }
+    __atomic_store_n(&reclaimStop, 1, __ATOMIC_RELEASE);
+    long games = 0;
+    for (int i = 0; i < 3; i++) {
+        void *n;
+        pthread_join(players[i], &n);
+        games += (long)(size_t)n;
+    }
+    engine_drop_history(&undoA, &redoA);
+    assert(games > 0 && engine_reclaim() == 0 && check_integrity());
+
+    free_tree(g_root);
+    g_root = saved;
+    index_rebuild();
+    printf("  ✓ Node reclamation tests passed\n");
+}
+
 /* Test Canonicalization */
 void test_canonicalize() {
     printf("Testing Canonicalization...\n");
@@ -217,9 +2354,45 @@ void test_canonicalize() {
     assert(strcmp(c3, "abc123") == 0);
     free(c3);
     
+    /* Punctuation in the middle is dropped, other whitespace becomes '_' */
+    char *c4 = canonicalize("Can't\tit, swim?!");
+    assert(strcmp(c4, "cant_it_swim") == 0);
+    free(c4);
+
     printf("  ✓ Canonicalization tests passed\n");
 }
 
+/* Fuzz the SIMD canonicalizers against the scalar reference */
+void test_canonicalize_fuzz() {
+    printf("Testing Canonicalization (SIMD vs scalar)...\n");
+
+    CanonImpl best = canonicalize_best_impl();
+    char buf[300];
+    srand(312);
+
+    for (int iter = 0; iter < 5000; iter++) {
+        int len = rand() % (int)(sizeof(buf) - 1);
+        for (int i = 0; i < len; i++) {
+            /* Mostly letters and spaces, with every other byte value mixed in */
+            int r = rand() % 8;
+            if (r < 4) buf[i] = (char)('a' + rand() % 26 - (r == 0 ? 32 : 0));
+            else if (r == 4) buf[i] = ' ';
+            else buf[i] = (char)(1 + rand() % 255);
+        }
+        buf[len] = '\0';
+
+        char *ref = canonicalize_with(buf, CANON_SCALAR);
+        for (int impl = CANON_SCALAR + 1; impl <= (int)best; impl++) {
+            char *got = canonicalize_with(buf, (CanonImpl)impl);
+            assert(strcmp(ref, got) == 0);
+            free(got);
+        }
+        free(ref);
+    }
+
+    printf("  ✓ SIMD canonicalization matches scalar (best impl %d)\n", (int)best);
+}
+
 /* Test Node Creation and Count */
 void test_nodes() {
     printf("Testing Node Functions...\n");
@@ -303,9 +2476,28 @@ int main() {
     test_edit_stack();
     test_queue();
     test_canonicalize();
+    test_canonicalize_fuzz();
     test_hash();
+    test_hash_resize();
+    test_idlist();
+    test_chash();
+    test_index();
+    test_similar();
     test_persistence();
     test_integrity();
+    test_integrity_changes();
+    test_names();
+    test_paths();
+    test_program();
+    test_codegen();
+    test_treeview();
+    test_layout();
+    test_search();
+    test_stats();
+    test_engine();
+    test_record();
+    test_server();
+    test_reclaim();
     
     printf("\n=== All Tests Passed! ===\n\n");
     printf("Great job! Your implementations are working correctly.\n");
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab5.h"
+
+extern Node *g_root;
+
+/* ========== Tree View ==========
+ * The rows of the tree view are the nodes of g_root in preorder (yes
+ * before no), minus everything below a collapsed question. Nothing is
+ * flattened up front: a ViewRow is a cursor (node and depth), and
+ * view_next/view_prev step it to the neighbouring visible row through the
+ * child and parent links. Filling a screen is O(rows shown + the depth
+ * climbed), whatever the size of the tree.
+ *
+ * Collapsing: every question is expanded unless collapseAll is set; the
+ * set holds the questions toggled away from that default, so "collapse
+ * everything" is O(1) and a toggle is one hash insert or delete. The set
+ * is open-addressed over node pointers with linear probing and
+ * backward-shift deletion (no tombstones), like the name map.
+ */
+
+#define VIEW_INITIAL_SLOTS 64
+
+static uint32_t ptr_hash(const Node *n) {
+    uint64_t x = (uint64_t)(uintptr_t)n;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+void view_init(TreeView *v) {
+    memset(v, 0, sizeof *v);
+}
+
+void view_free(TreeView *v) {
+    free(v->toggled);
+    memset(v, 0, sizeof *v);
+}
+
+static int set_find(const TreeView *v, const Node *n) {
+    if (v->toggled == NULL) return -1;
+    for (uint32_t b = ptr_hash(n) & v->mask; v->toggled[b]; b = (b + 1) & v->mask) {
+        if (v->toggled[b] == n) return (int)b;
+    }
+    return -1;
+}
+
+static int set_grow(TreeView *v) {
+    uint32_t count = v->toggled ? (v->mask + 1) * 2 : VIEW_INITIAL_SLOTS;
+    const Node **ns = calloc(count, sizeof(Node *));
+    if (ns == NULL) return 0;
+    for (uint32_t i = 0; v->toggled && i <= v->mask; i++) {
+        if (v->toggled[i] == NULL) continue;
+        uint32_t b = ptr_hash(v->toggled[i]) & (count - 1);
+        while (ns[b]) b = (b + 1) & (count - 1);
+        ns[b] = v->toggled[i];
+    }
+    free(v->toggled);
+    v->toggled = ns;
+    v->mask = count - 1;
+    return 1;
+}
+
+static void set_remove(TreeView *v, uint32_t hole) {
+    v->toggled[hole] = NULL;
+    v->used--;
+    /* shift back later members of the run that may no longer be reachable */
+    for (uint32_t b = (hole + 1) & v->mask; v->toggled[b]; b = (b + 1) & v->mask) {
+        uint32_t home = ptr_hash(v->toggled[b]) & v->mask;
+        if (((b - home) & v->mask) >= ((b - hole) & v->mask)) {
+            v->toggled[hole] = v->toggled[b];
+            v->toggled[b] = NULL;
+            hole = b;
+        }
+    }
+}
+
+/* 1 if n is a question whose children are shown. */
+int view_expanded(const TreeView *v, const Node *n) {
+    if (!n->isQuestion) return 0;
+    return !v->collapseAll ^ (v->used > 0 && set_find(v, n) >= 0);
+}
+
+/* Collapse an expanded question or expand a collapsed one. Returns 0 if
+ * out of memory (nothing changes). */
+int view_toggle(TreeView *v, const Node *n) {
+    if (!n->isQuestion) return 1;
+    int at = set_find(v, n);
+    if (at >= 0) {
+        set_remove(v, (uint32_t)at);
+        return 1;
+    }
+    if ((uint32_t)(v->used + 1) * 4 > (v->toggled ? v->mask + 1 : 0) * 3 && !set_grow(v)) return 0;
+    uint32_t b = ptr_hash(n) & v->mask;
+    while (v->toggled[b]) b = (b + 1) & v->mask;
+    v->toggled[b] = n;
+    v->used++;
+    return 1;
+}
+
+/* Collapse (or expand) every question. */
+void view_collapse_all(TreeView *v, int collapsed) {
+    if (v->toggled) memset(v->toggled, 0, (size_t)(v->mask + 1) * sizeof(Node *));
+    v->used = 0;
+    v->collapseAll = collapsed ? 1 : 0;
+}
+
+/* The first row: the root. Returns 0 if there is no tree. */
+int view_first(ViewRow *row) {
+    row->node = g_root;
+    row->depth = 0;
+    return g_root != NULL;
+}
+
+/* The last visible row: keep taking the no branch of expanded questions. */
+int view_last(const TreeView *v, ViewRow *row) {
+    if (!view_first(row)) return 0;
+    while (view_expanded(v, row->node)) {
+        row->node = row->node->no;
+        row->depth++;
+    }
+    return 1;
+}
+
+/* Step row to the next visible row. Returns 0 (row unchanged) at the end. */
+int view_next(const TreeView *v, ViewRow *row) {
+    Node *n = row->node;
+    if (view_expanded(v, n)) {
+        row->node = n->yes;
+        row->depth++;
+        return 1;
+    }
+    /* climb out of no branches; the first yes branch left leads to its
+     * sibling */
+    int depth = row->depth;
+    while (n->parent && n->parent->no == n) {
+        n = n->parent;
+        depth--;
+    }
+    if (n->parent == NULL) return 0;
+    row->node = n->parent->no;
+    row->depth = depth;
+    return 1;
+}
+
+/* Step row to the previous visible row. Returns 0 at the root. */
+int view_prev(const TreeView *v, ViewRow *row) {
+    Node *n = row->node, *p = n->parent;
+    if (p == NULL) return 0;
+    if (p->yes == n) { // the parent comes right before its yes branch
+        row->node = p;
+        row->depth--;
+        return 1;
+    }
+    /* otherwise the last visible row of the yes branch */
+    n = p->yes;
+    while (view_expanded(v, n)) {
+        n = n->no;
+        row->depth++;
+    }
+    row->node = n;
+    return 1;
+}
+
+/* Up to max rows starting at from into out. Returns how many. */
+int view_rows(const TreeView *v, ViewRow from, ViewRow *out, int max) {
+    int count = 0;
+    if (from.node == NULL || max <= 0) return 0;
+    out[count++] = from;
+    while (count < max && view_next(v, &from)) out[count++] = from;
+    return count;
+}
@@ -1,131 +1,585 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include "lab5.h"
 
 extern Node *g_root;
 
-/* TODO 29: Implement check_integrity
- * Use BFS to verify tree structure:
- * - Question nodes must have both yes and no children (not NULL)
- * - Leaf nodes (isQuestion == 0) must have NULL children
- * 
- * Return 1 if valid, 0 if invalid
- * 
- * Steps:
- * 1. Return 1 if g_root is NULL (empty tree is valid)
- * 2. Initialize queue and enqueue root with id=0
- * 3. Set valid = 1
- * 4. While queue not empty:
- *    - Dequeue node
- *    - If node->isQuestion:
- *      - Check if yes == NULL or no == NULL
- *      - If so, set valid = 0 and break
- *      - Otherwise, enqueue both children
- *    - Else (leaf node):
- *      - Check if yes != NULL or no != NULL
- *      - If so, set valid = 0 and break
- * 5. Free queue and return valid
+/* ========== Integrity Checking ==========
+ * A valid tree is a binary tree: every question has both children, every
+ * animal has none, and every node is reached exactly once from the root.
+ * A corrupt file can link records into a DAG or a cycle, which would make
+ * a plain walk loop forever and free_tree free a node twice.
+ *
+ * Revisits are detected with Node.visitMark: each walk takes a fresh
+ * generation number and claims a node by atomically exchanging it in, so
+ * a node whose mark already equals the generation has been reached before.
+ * The mark lives in a line the walk loads anyway, which is cheaper than a
+ * side table keyed by address and needs no size estimate up front.
+ *
+ * The fast pass only answers valid/invalid. It walks the first nodes on
+ * the calling thread and, for larger trees, splits the remaining subtrees
+ * across a work-stealing pool: each worker runs a private DFS stack and
+ * hands the oldest half of it (the biggest subtrees) to its shared deque
+ * while another worker is idle; idle workers steal from the other end.
+ * When the fast pass fails, a sequential preorder walk finds the first
+ * offending node and the answers that lead to it.
  */
-int check_integrity() {
-    // TODO: Implement this function
 
-    // Use the Queue functions you implemented
+#define CHECK_MAX_THREADS 64
+#define CHECK_PREFIX_NODES 65536   /* walked alone before starting helpers */
+#define CHECK_DONATE_MIN 32        /* smallest private stack worth splitting */
 
-    // * 1. Return 1 if g_root is NULL (empty tree is valid)
+static pthread_mutex_t checkLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned checkGen = 0;  /* guarded by checkLock */
 
-    if(g_root == NULL){
-        return 1;
-    }
+typedef struct {
+    Node **items;
+    int count;
+    int cap;
+} CheckStack;
 
-    // * 2. Initialize queue and enqueue root with id=0
+typedef struct CheckPool CheckPool;
 
-    Queue q;
+typedef struct {
+    pthread_mutex_t lock;  /* guards the deque */
+    Node **deque;          /* owner pops at tail, thieves take at head */
+    int head, tail, cap;
+    long visited;
+    CheckPool *pool;
+    int index;
+} CheckWorker;
 
-    q_init(&q);
-    
-    q_enqueue(&q, g_root, 0);
+struct CheckPool {
+    CheckWorker *workers;
+    int nworkers;
+    unsigned gen;
+    int outstanding;  /* subtree tasks queued or being walked (atomic) */
+    int idle;         /* workers looking for a task (atomic) */
+    int failed;       /* set on the first fault or allocation failure */
+};
 
-    // * 4. While queue not empty:
-    //*    - Dequeue node
-    //*    - If node->isQuestion:
-    //*      - Check if yes == NULL or no == NULL
-    //*      - If so, set valid = 0 and break
-    //*      - Otherwise, enqueue both children
-    //*    - Else (leaf node):
-    //*      - Check if yes != NULL or no != NULL
-    //*      - If so, set valid = 0 and break
- 
-    while(!q_empty(&q)){
-      /**/  Node *node = NULL;
-        int id =0;
-        q_dequeue(&q, &node, &id);
+static unsigned check_next_gen(void) {
+    if (++checkGen == 0) checkGen = 1; // 0 is the mark of a fresh node
+    return checkGen;
+}
 
-        if(!node){
-            q_free(&q);
+/* Claim n for this walk; 0 if it was already reached. */
+static int check_claim(Node *n, unsigned gen) {
+    if (__atomic_load_n(&n->visitMark, __ATOMIC_RELAXED) == gen) return 0;
+    return __atomic_exchange_n(&n->visitMark, gen, __ATOMIC_RELAXED) != gen;
+}
+
+static IntegrityError check_shape(const Node *n) {
+    if (n->isQuestion) return (n->yes && n->no) ? INTEGRITY_OK : INTEGRITY_MISSING_CHILD;
+    return (n->yes || n->no) ? INTEGRITY_LEAF_CHILD : INTEGRITY_OK;
+}
+
+static int cs_push(CheckStack *s, Node *n) {
+    if (s->count >= s->cap) {
+        int newCap = s->cap ? s->cap * 2 : 256;
+        Node **ni = realloc(s->items, (size_t)newCap * sizeof(Node *));
+        if (ni == NULL) return 0;
+        s->items = ni;
+        s->cap = newCap;
+    }
+    s->items[s->count++] = n;
+    return 1;
+}
+
+/* Queue k subtrees on w's deque, where idle workers can steal them. */
+static int cw_give(CheckWorker *w, Node **items, int k) {
+    pthread_mutex_lock(&w->lock);
+    if (w->head > 0 && w->head == w->tail) w->head = w->tail = 0;
+    if (w->tail + k > w->cap) {
+        int newCap = w->cap ? w->cap : 64;
+        while (newCap < w->tail + k) newCap *= 2;
+        Node **nd = realloc(w->deque, (size_t)newCap * sizeof(Node *));
+        if (nd == NULL) {
+            pthread_mutex_unlock(&w->lock);
             return 0;
         }
+        w->deque = nd;
+        w->cap = newCap;
+    }
+    memcpy(w->deque + w->tail, items, (size_t)k * sizeof(Node *));
+    w->tail += k;
+    __atomic_add_fetch(&w->pool->outstanding, k, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&w->lock);
+    return 1;
+}
+
+/* Next task: newest from w's own deque, else the oldest of another's. */
+static Node *cw_take(CheckWorker *w) {
+    CheckPool *p = w->pool;
+    Node *task = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->tail > w->head) task = w->deque[--w->tail];
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 1; task == NULL && i < p->nworkers; i++) {
+        CheckWorker *v = &p->workers[(w->index + i) % p->nworkers];
+        pthread_mutex_lock(&v->lock);
+        if (v->tail > v->head) task = v->deque[v->head++];
+        pthread_mutex_unlock(&v->lock);
+    }
+    return task;
+}
 
-        // Question Node - must have both children
-        if(node->isQuestion){
-            if(node->yes == NULL || node->no == NULL){
-                // Missing child - not valid
-                q_free(&q);
-                return 0;
-                
+/* Walk s until it is empty, limit nodes were checked or the pool failed. */
+static void cw_walk(CheckWorker *w, CheckStack *s, long limit) {
+    CheckPool *p = w->pool;
+    for (long done = 0; s->count > 0 && done < limit; done++) {
+        Node *n = s->items[--s->count];
+        if (!check_claim(n, p->gen) || check_shape(n) != INTEGRITY_OK) {
+            __atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        w->visited++;
+        if (n->isQuestion && (!cs_push(s, n->no) || !cs_push(s, n->yes))) {
+            __atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (s->count >= CHECK_DONATE_MIN && __atomic_load_n(&p->idle, __ATOMIC_RELAXED) > 0) {
+            int k = s->count / 2; // the bottom of the stack holds the biggest subtrees
+            if (cw_give(w, s->items, k)) {
+                memmove(s->items, s->items + k, (size_t)(s->count - k) * sizeof(Node *));
+                s->count -= k;
             }
-            // enque both children to continue checking
-        q_enqueue(&q, node->yes, 0);
-        q_enqueue(&q, node->no, 0);
         }
-        else{
-            if(node->yes != NULL || node->no != NULL){
-                q_free(&q);
-                return 0;
+        if ((done & 1023) == 0 && __atomic_load_n(&p->failed, __ATOMIC_RELAXED)) return;
+    }
+}
+
+static void *check_worker(void *arg) {
+    CheckWorker *w = arg;
+    CheckPool *p = w->pool;
+    CheckStack s = {NULL, 0, 0};
+    int waiting = 0;
+    while (!__atomic_load_n(&p->failed, __ATOMIC_RELAXED)) {
+        Node *task = cw_take(w);
+        if (task == NULL) {
+            if (!waiting) __atomic_add_fetch(&p->idle, 1, __ATOMIC_RELAXED);
+            waiting = 1;
+            if (__atomic_load_n(&p->outstanding, __ATOMIC_ACQUIRE) == 0) break;
+            sched_yield();
+            continue;
+        }
+        if (waiting) __atomic_sub_fetch(&p->idle, 1, __ATOMIC_RELAXED);
+        waiting = 0;
+        s.count = 0;
+        if (cs_push(&s, task)) {
+            cw_walk(w, &s, LONG_MAX);
+        } else {
+            __atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_sub_fetch(&p->outstanding, 1, __ATOMIC_RELEASE);
+    }
+    if (waiting) __atomic_sub_fetch(&p->idle, 1, __ATOMIC_RELAXED);
+    free(s.items);
+    return NULL;
+}
+
+/* Fast pass: 1 if the tree under root is valid. Caller holds checkLock. */
+static int check_parallel(Node *root, int nthreads, long *visited) {
+    CheckPool p = {NULL, 1, check_next_gen(), 0, 0, 0};
+    CheckWorker first = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, &p, 0};
+    p.workers = &first;
+    CheckStack s = {NULL, 0, 0};
+    if (!cs_push(&s, root)) return 0;
+
+    cw_walk(&first, &s, CHECK_PREFIX_NODES);
+    if (s.count > 0 && !p.failed && nthreads <= 1) cw_walk(&first, &s, LONG_MAX);
+    *visited = first.visited;
+    if (s.count == 0 || p.failed) {
+        free(s.items);
+        return !p.failed;
+    }
+
+    /* Big tree: deal the pending subtrees out and let the pool finish. */
+    CheckWorker *w = calloc((size_t)nthreads, sizeof(CheckWorker));
+    pthread_t *tid = calloc((size_t)nthreads, sizeof(pthread_t));
+    int *started = calloc((size_t)nthreads, sizeof(int));
+    if (w == NULL || tid == NULL || started == NULL) {
+        cw_walk(&first, &s, LONG_MAX); // no pool: finish alone
+        *visited = first.visited;
+        free(w);
+        free(tid);
+        free(started);
+        free(s.items);
+        return !p.failed;
+    }
+    p.workers = w;
+    p.nworkers = nthreads;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&w[i].lock, NULL);
+        w[i].pool = &p;
+        w[i].index = i;
+    }
+    for (int i = 0; i < nthreads && !p.failed; i++) {
+        int lo = (int)((long)s.count * i / nthreads);
+        int hi = (int)((long)s.count * (i + 1) / nthreads);
+        if (hi > lo && !cw_give(&w[i], s.items + lo, hi - lo)) p.failed = 1;
+    }
+    free(s.items);
+    for (int i = 1; i < nthreads; i++) {
+        started[i] = pthread_create(&tid[i], NULL, check_worker, &w[i]) == 0;
+    }
+    check_worker(&w[0]); // a helper that failed to start is simply robbed
+    for (int i = 0; i < nthreads; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        *visited += w[i].visited;
+        pthread_mutex_destroy(&w[i].lock);
+        free(w[i].deque);
+    }
+    free(w);
+    free(tid);
+    free(started);
+    return !p.failed;
+}
+
+typedef struct {
+    Node *node;
+    int depth;
+    char answer;  /* 'y' or 'n' from the parent, 0 for the root */
+} CheckFrame;
+
+/* Sequential preorder walk (yes before no) that stops at the first fault
+ * and records where it is. Caller holds checkLock. */
+static int check_report(Node *root, IntegrityReport *rep) {
+    unsigned gen = check_next_gen();
+    int cap = 256, top = 0, pathCap = 256;
+    CheckFrame *stack = malloc((size_t)cap * sizeof(CheckFrame));
+    Node **pathNodes = malloc((size_t)pathCap * sizeof(Node *)); // ancestors of the current node
+    char *path = malloc((size_t)pathCap);
+    IntegrityError err = INTEGRITY_OK;
+    Node *bad = NULL;
+    int badDepth = 0;
+    rep->visited = 0;
+
+    if (stack && pathNodes && path) stack[top++] = (CheckFrame){root, 0, 0};
+    else err = INTEGRITY_NO_MEMORY;
+    while (top > 0 && err == INTEGRITY_OK) {
+        CheckFrame f = stack[--top];
+        if (f.depth >= pathCap) {
+            int newCap = pathCap * 2;
+            Node **np = realloc(pathNodes, (size_t)newCap * sizeof(Node *));
+            if (np) pathNodes = np;
+            char *pp = np ? realloc(path, (size_t)newCap) : NULL;
+            if (pp == NULL) {
+                err = INTEGRITY_NO_MEMORY;
+                break;
+            }
+            path = pp;
+            pathCap = newCap;
+        }
+        if (f.depth > 0) path[f.depth - 1] = f.answer;
+        pathNodes[f.depth] = f.node;
+
+        if (!check_claim(f.node, gen)) {
+            err = INTEGRITY_SHARED_NODE;
+            for (int d = 0; d < f.depth; d++) {
+                if (pathNodes[d] == f.node) err = INTEGRITY_CYCLE;
+            }
+        } else {
+            err = check_shape(f.node);
+        }
+        if (err != INTEGRITY_OK) {
+            bad = f.node;
+            badDepth = f.depth;
+            break;
+        }
+        rep->visited++;
+        if (!f.node->isQuestion) continue;
+        if (top + 2 > cap) {
+            CheckFrame *ns = realloc(stack, (size_t)cap * 2 * sizeof(CheckFrame));
+            if (ns == NULL) {
+                err = INTEGRITY_NO_MEMORY;
+                break;
             }
+            stack = ns;
+            cap *= 2;
         }
+        stack[top++] = (CheckFrame){f.node->no, f.depth + 1, 'n'};
+        stack[top++] = (CheckFrame){f.node->yes, f.depth + 1, 'y'};
     }
 
-    // finish traversal free queue and return valid
+    rep->error = err;
+    rep->node = bad;
+    if (bad) {
+        rep->path = malloc((size_t)badDepth + 1);
+        if (rep->path) {
+            memcpy(rep->path, path, (size_t)badDepth);
+            rep->path[badDepth] = '\0';
+        }
+    }
+    free(stack);
+    free(pathNodes);
+    free(path);
+    return err == INTEGRITY_OK;
+}
 
-    //* 5. Free queue and return valid
-    
-    q_free(&q);
-    return 1;
+/* Check the tree under root with up to nthreads threads (0 = one per
+ * online CPU). Returns 1 if it is valid. rep (optional) receives the
+ * first fault in preorder and must be released with
+ * integrity_report_free. Only one check runs at a time; the tree must not
+ * change while it runs. */
+int check_integrity_report(Node *root, int nthreads, IntegrityReport *rep) {
+    IntegrityReport local;
+    if (rep == NULL) rep = &local;
+    rep->error = INTEGRITY_OK;
+    rep->node = NULL;
+    rep->path = NULL;
+    rep->visited = 0;
+    if (root == NULL) return 1;
+
+    if (nthreads <= 0) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > CHECK_MAX_THREADS) nthreads = CHECK_MAX_THREADS;
+
+    pthread_mutex_lock(&checkLock);
+    long visited = 0;
+    int ok = check_parallel(root, nthreads, &visited);
+    if (ok) {
+        rep->visited = visited;
+    } else {
+        ok = check_report(root, rep); // authoritative, and says where
+    }
+    pthread_mutex_unlock(&checkLock);
+    if (ok && root == g_root) integrity_forget_changes(); // all checked
+    if (rep == &local) integrity_report_free(rep);
+    return ok;
+}
+
+void integrity_report_free(IntegrityReport *rep) {
+    if (rep == NULL) return;
+    free(rep->path);
+    rep->path = NULL;
+}
+
+const char *integrity_error_str(IntegrityError e) {
+    switch (e) {
+        case INTEGRITY_OK: return "ok";
+        case INTEGRITY_MISSING_CHILD: return "question is missing a child";
+        case INTEGRITY_LEAF_CHILD: return "animal has a child";
+        case INTEGRITY_SHARED_NODE: return "node has two parents";
+        case INTEGRITY_CYCLE: return "node is its own ancestor";
+        case INTEGRITY_BAD_PARENT: return "parent link does not match";
+        case INTEGRITY_NO_MEMORY: return "out of memory";
+    }
+    return "unknown";
+}
+
+/* ---------- Incremental validation ----------
+ * Edits only relink a handful of nodes, so re-walking the whole tree after
+ * each one is wasted work. The edit hooks record every node whose links
+ * changed, and check_changes validates just those: its shape, that each
+ * child's parent link points back at it, and that its parent (or g_root)
+ * points at it exactly once.
+ *
+ * Given a tree that was valid with consistent parent links, those local
+ * checks on every changed node show the result is still a tree: a node
+ * can only have gained a second parent or joined a cycle through a link
+ * that changed. Nodes an undo detaches are dropped from the set. When
+ * more than INTEGRITY_MAX_DIRTY nodes are pending, or the set could not
+ * grow, check_changes falls back to the full check.
+ */
+
+#define INTEGRITY_MAX_DIRTY 4096
+
+static Node **dirty = NULL;
+static int dirtyCount = 0, dirtyCap = 0;
+static int dirtyOverflow = 0;  /* too many changes: check everything */
+
+static void mark_dirty(Node *n) {
+    if (n == NULL || dirtyOverflow) return;
+    for (int i = 0; i < dirtyCount; i++) {
+        if (dirty[i] == n) return;
+    }
+    if (dirtyCount >= dirtyCap) {
+        int newCap = dirtyCap ? dirtyCap * 2 : 16;
+        Node **nd = newCap <= INTEGRITY_MAX_DIRTY ? realloc(dirty, (size_t)newCap * sizeof(Node *)) : NULL;
+        if (nd == NULL) {
+            dirtyOverflow = 1;
+            return;
+        }
+        dirty = nd;
+        dirtyCap = newCap;
+    }
+    dirty[dirtyCount++] = n;
 }
 
-typedef struct PathNode {
-    Node *treeNode;
-    struct PathNode *parent;
-    int viaYes;  /* 1 if reached via yes, 0 if via no, -1 for root */
-} PathNode;
+static void unmark_dirty(const Node *n) {
+    int kept = 0;
+    for (int i = 0; i < dirtyCount; i++) {
+        if (dirty[i] != n) dirty[kept++] = dirty[i];
+    }
+    dirtyCount = kept;
+}
+
+void integrity_on_learn(const Edit *e) {
+    mark_dirty(e->parent);
+    mark_dirty(e->newQuestion);
+    mark_dirty(e->oldLeaf);
+    mark_dirty(e->newLeaf);
+}
+
+void integrity_on_undo(const Edit *e) {
+    unmark_dirty(e->newQuestion); // out of the tree until redone
+    unmark_dirty(e->newLeaf);
+    mark_dirty(e->parent);
+    mark_dirty(e->oldLeaf);
+}
+
+void integrity_on_redo(const Edit *e) {
+    integrity_on_learn(e);
+}
+
+/* Forget pending changes, e.g. after the whole tree was replaced. */
+void integrity_forget_changes(void) {
+    free(dirty);
+    dirty = NULL;
+    dirtyCount = dirtyCap = 0;
+    dirtyOverflow = 0;
+}
+
+/* Number of changed nodes waiting for check_changes; -1 when so many
+ * changed that the next check_changes is a full check. */
+int integrity_pending(void) {
+    return dirtyOverflow ? -1 : dirtyCount;
+}
+
+/* Local consistency of one node in a tree with parent links. */
+static IntegrityError check_links(const Node *n) {
+    IntegrityError err = check_shape(n);
+    if (err != INTEGRITY_OK) return err;
+    if (n->isQuestion && (n->yes->parent != n || n->no->parent != n)) return INTEGRITY_BAD_PARENT;
+    if (n->parent == NULL) return n == g_root ? INTEGRITY_OK : INTEGRITY_BAD_PARENT;
+    if (n == g_root || !n->parent->isQuestion) return INTEGRITY_BAD_PARENT;
+    int asYes = n->parent->yes == n, asNo = n->parent->no == n;
+    if (asYes && asNo) return INTEGRITY_SHARED_NODE;
+    return asYes || asNo ? INTEGRITY_OK : INTEGRITY_BAD_PARENT;
+}
+
+/* Answers from the root to n along parent links (stops at a loop). */
+static char *parent_path(Node *n, unsigned gen) {
+    int len = 0, cap = 64;
+    char *rev = malloc((size_t)cap);
+    while (rev && n->parent && check_claim(n, gen)) {
+        if (len + 1 >= cap) {
+            char *nr = realloc(rev, (size_t)cap * 2);
+            if (nr == NULL) break;
+            rev = nr;
+            cap *= 2;
+        }
+        rev[len++] = n->parent->yes == n ? 'y' : 'n';
+        n = n->parent;
+    }
+    if (rev == NULL) return NULL;
+    for (int i = 0; i < len / 2; i++) {
+        char c = rev[i];
+        rev[i] = rev[len - 1 - i];
+        rev[len - 1 - i] = c;
+    }
+    rev[len] = '\0';
+    return rev;
+}
+
+/* Validate only the nodes changed since the last successful check, in
+ * O(changed nodes). Reports like check_integrity_report; on success the
+ * changes count as checked. */
+int check_changes(IntegrityReport *rep) {
+    if (dirtyOverflow) return check_integrity_report(g_root, 0, rep);
+
+    IntegrityReport local;
+    if (rep == NULL) rep = &local;
+    rep->error = INTEGRITY_OK;
+    rep->node = NULL;
+    rep->path = NULL;
+    rep->visited = 0;
+
+    pthread_mutex_lock(&checkLock); // parent_path takes a walk generation
+    for (int i = 0; i < dirtyCount && rep->error == INTEGRITY_OK; i++) {
+        Node *n = dirty[i];
+        rep->visited++;
+        rep->error = check_links(n);
+        if (rep->error != INTEGRITY_OK) {
+            rep->node = n;
+            rep->path = parent_path(n, check_next_gen());
+        }
+    }
+    pthread_mutex_unlock(&checkLock);
+
+    int ok = rep->error == INTEGRITY_OK;
+    if (ok) dirtyCount = 0;
+    if (rep == &local) integrity_report_free(rep);
+    return ok;
+}
+
+/* TODO 29: Implement check_integrity
+ * Verify the tree structure:
+ * - Question nodes must have both yes and no children (not NULL)
+ * - Leaf nodes (isQuestion == 0) must have NULL children
+ * - No node may be reached twice (shared subtrees, cycles)
+ *
+ * Return 1 if valid, 0 if invalid
+ */
+int check_integrity() {
+    return check_integrity_report(g_root, 0, NULL);
+}
+
+/* Id of an animal in the tree whose name matches (canonically), or -1. */
+static int find_animal(const char *name) {
+    int id;
+    return names_lookup(name, &id, 1) > 0 ? id : -1;
+}
+
+/* The questions from split down to leaf, each with the answer taken. */
+static void collect_branch(Node *split, Node *leaf, FrameStack *branch) {
+    fs_init(branch);
+    for (Node *child = leaf; split && child != split; child = child->parent) {
+        fs_push(branch, child->parent, child->parent->yes == child);
+    }
+    for (int i = 0, j = branch->size - 1; i < j; i++, j--) { // collected leaf upwards
+        Frame t = branch->frames[i];
+        branch->frames[i] = branch->frames[j];
+        branch->frames[j] = t;
+    }
+}
 
 /* TODO 30: Implement find_shortest_path (OPTIONAL CHALLENGE)
- * Find the shortest distinguishing path between two animals
- * 
- * This is an optional challenge problem. If you want to attempt it:
- * 
- * Steps:
- * 1. Use BFS to find paths to both animals
- * 2. Build PathNode structures that track parent and direction
- * 3. Build arrays of PathNodes from each animal to root
- * 4. Find the Lowest Common Ancestor (LCA)
- * 5. Print the questions that distinguish them
- * 
- * Algorithm:
- * - Use BFS with a PathNode array to track the path taken
- * - For each node visited, record its parent and which branch (yes/no)
- * - Once both animals are found, trace back to root for each
- * - Find where the paths diverge (LCA)
- * - Print the distinguishing questions from LCA to each animal
+ * Find the shortest distinguishing path between two animals: the
+ * questions that tell them apart, from their lowest common ancestor down
+ * to each animal.
+ *
+ * The ancestor comes from the LCA index (lca.c) in O(1); the branches
+ * walk parent links, so the cost is the length of the result. Returns 1
+ * if both animals are in the tree (free out with animal_path_free), 0 if
+ * either is unknown.
  */
+int find_shortest_path(const char *animal1, const char *animal2, AnimalPath *out) {
+    memset(out, 0, sizeof *out);
+    int a = find_animal(animal1);
+    int b = find_animal(animal2);
+    PathInfo info;
+    if (g_root == NULL || a < 0 || b < 0 || !path_query(a, b, &info)) return 0;
+    out->leaf[0] = index_animal(a);
+    out->leaf[1] = index_animal(b);
+    out->split = info.split;
+    out->distance = info.distance;
+    collect_branch(info.split, out->leaf[0], &out->branch[0]);
+    collect_branch(info.split, out->leaf[1], &out->branch[1]);
+    return 1;
+}
 
-/* void find_shortest_path(const char *animal1, const char *animal2) {
-    if (g_root == NULL) return;
-    
-    // TODO: Implement this function (OPTIONAL CHALLENGE)
-    // This is complex and requires careful path tracking
-    
-    printf("find_shortest_path not yet implemented\n");
+void animal_path_free(AnimalPath *p) {
+    fs_free(&p->branch[0]);
+    fs_free(&p->branch[1]);
 }
-*/
\ No newline at end of file
@@ -6,67 +6,153 @@
 
 extern Node *g_root;
 
-#define MAX_DISPLAY_LINES 1000
 #define COLOR_TREE_Q 6
 #define COLOR_TREE_A 7
+#define MAX_ROW_BYTES 512
 
-typedef struct DisplayLine {
-    char *text;
-    int indent;
-    int isQuestion;
-} DisplayLine;
+/* Rows come from a TreeView cursor (treeview.c): only the rows on screen
+ * are ever computed, so opening and scrolling cost O(rows shown) however
+ * big the tree is, and nothing recurses. */
 
-static DisplayLine *lines = NULL;
-static int line_count = 0;
-static int line_capacity = 0;
+/* Format one row into buf (at most width characters): indentation, the
+ * branch it hangs from, a fold marker for questions, then the text. Deep
+ * rows stop indenting at half the width and show their depth instead. */
+static void format_row(const TreeView *v, const ViewRow *r, char *buf, int width) {
+    if (width > MAX_ROW_BYTES - 1) width = MAX_ROW_BYTES - 1; // very wide terminals
+    int maxIndent = width / 2;
+    int indent = r->depth * 2;
+    int len = 0;
+    if (indent > maxIndent) {
+        char depth[16];
+        int dl = snprintf(depth, sizeof depth, "<%d> ", r->depth);
+        indent = maxIndent > dl ? maxIndent - dl : 0;
+        len = snprintf(buf, MAX_ROW_BYTES, "%*s%s", indent, "", depth);
+    } else {
+        len = snprintf(buf, MAX_ROW_BYTES, "%*s", indent, "");
+    }
+    const Node *n = r->node;
+    const char *branch = n->parent == NULL ? "ROOT:" : n->parent->yes == n ? "[YES]" : "[NO]";
+    const char *fold = !n->isQuestion ? "" : view_expanded(v, n) ? "[-] " : "[+] ";
+    snprintf(buf + len, (size_t)(MAX_ROW_BYTES - len), "%s %s%s", branch, fold, n->text);
 
-void add_display_line(const char *text, int indent, int isQuestion) {
-    if (line_count >= line_capacity) {
-        line_capacity = line_capacity ? line_capacity * 2 : 100;
-        lines = realloc(lines, line_capacity * sizeof(DisplayLine));
+    if ((int)strlen(buf) > width && width >= 3) {
+        strcpy(buf + width - 3, "...");
     }
-    
-    lines[line_count].text = strdup(text);
-    lines[line_count].indent = indent;
-    lines[line_count].isQuestion = isQuestion;
-    line_count++;
 }
 
-void build_tree_display(Node *node, int depth, const char *prefix, int isYesBranch) {
-    if (node == NULL) return;
-    
-    char line[256];
-    char branch[64];
-    
-    if (depth == 0) {
-        snprintf(line, sizeof(line), "ROOT: %s", node->text);
-    } else {
-        snprintf(branch, sizeof(branch), "%s", isYesBranch ? "[YES]" : "[NO]");
-        snprintf(line, sizeof(line), "%s%s %s", prefix, branch, node->text);
+/* Move top back until a full page fits below it (or it is the root). */
+static int fill_page(const TreeView *v, ViewRow *top, int rows) {
+    ViewRow probe = *top;
+    int below = 1;
+    while (below < rows && view_next(v, &probe)) below++;
+    int moved = 0;
+    while (below < rows && view_prev(v, top)) {
+        below++;
+        moved++;
     }
-    
-    add_display_line(line, depth, node->isQuestion);
-    
-    if (node->isQuestion) {
-        char new_prefix[256];
-        snprintf(new_prefix, sizeof(new_prefix), "%s  ", prefix);
-        
-        if (node->yes) {
-            build_tree_display(node->yes, depth + 1, new_prefix, 1);
-        }
-        if (node->no) {
-            build_tree_display(node->no, depth + 1, new_prefix, 0);
+    return moved;
+}
+
+/* Make n visible and select it: expand its collapsed ancestors, then
+ * select it if it falls in the window from top, else put it half a page
+ * down a new one (whose row number is not known). Returns 1 if any fold
+ * changed, which shifts row numbers. */
+static int show_node(TreeView *v, ViewRow *top, long *topRow, int *sel, ViewRow *rows, int max, const Node *n) {
+    int depth = 0, toggled = 0;
+    for (const Node *a = n->parent; a; a = a->parent) {
+        depth++;
+        if (!view_expanded(v, a)) toggled = view_toggle(v, a) || toggled;
+    }
+    int shown = view_rows(v, *top, rows, max);
+    for (int i = 0; i < shown; i++) {
+        if (rows[i].node == n) {
+            *sel = i;
+            if (toggled) *topRow = -1;
+            return toggled;
         }
     }
+    top->node = (Node *)n;
+    top->depth = depth;
+    int up = 0;
+    while (up < max / 2 && view_prev(v, top)) up++;
+    *sel = up + fill_page(v, top, max);
+    *topRow = -1;
+    return toggled;
+}
+
+/* The view is split so a keypress only redraws what it can change: the
+ * title, box and legend go on stdscr once, the rows and the status line
+ * get windows of their own. Frames are composed with erase + wnoutrefresh
+ * and sent with one doupdate, which writes only the cells that differ
+ * from the terminal (and scrolls the box region for a one-row scroll)
+ * instead of clearing and repainting the whole screen. */
+typedef struct {
+    WINDOW *list;    /* the rows inside the box */
+    WINDOW *status;  /* the status line under it */
+    int height;      /* rows in list */
+} TreeScreen;
+
+static void close_screen(TreeScreen *ts) {
+    if (ts->list) delwin(ts->list);
+    if (ts->status) delwin(ts->status);
+    ts->list = ts->status = NULL;
+}
+
+/* Draw the static parts on stdscr and create the windows for the current
+ * terminal size. Returns 0 if the terminal is too small or out of memory. */
+static int open_screen(TreeScreen *ts) {
+    close_screen(ts);
+    ts->height = LINES - 6;
+    if (ts->height < 1 || COLS < 8) return 0;
+    erase();
+
+    /* Header */
+    attron(COLOR_PAIR(5) | A_BOLD);
+    mvprintw(0, 0, "%-80s", " Tree Visualization");
+    attroff(COLOR_PAIR(5) | A_BOLD);
+
+    /* Draw box */
+    int box_height = LINES - 4;
+    int box_width = COLS - 2;
+    attron(COLOR_PAIR(1));
+    mvhline(2, 1, ACS_HLINE, box_width);
+    mvhline(2 + box_height - 1, 1, ACS_HLINE, box_width);
+    mvvline(2, 1, ACS_VLINE, box_height);
+    mvvline(2, box_width, ACS_VLINE, box_height);
+    mvaddch(2, 1, ACS_ULCORNER);
+    mvaddch(2, box_width, ACS_URCORNER);
+    mvaddch(2 + box_height - 1, 1, ACS_LLCORNER);
+    mvaddch(2 + box_height - 1, box_width, ACS_LRCORNER);
+    attroff(COLOR_PAIR(1));
+
+    /* Legend */
+    attron(COLOR_PAIR(COLOR_TREE_Q) | A_BOLD);
+    mvprintw(LINES - 1, 2, "YELLOW=Questions");
+    attroff(COLOR_PAIR(COLOR_TREE_Q) | A_BOLD);
+
+    attron(COLOR_PAIR(COLOR_TREE_A));
+    mvprintw(LINES - 1, 22, "GREEN=Animals");
+    attroff(COLOR_PAIR(COLOR_TREE_A));
+    wnoutrefresh(stdscr);
+
+    ts->list = newwin(ts->height, COLS - 6, 3, 3);
+    ts->status = newwin(1, COLS - 3, LINES - 2, 2);
+    if (ts->list == NULL || ts->status == NULL) {
+        close_screen(ts);
+        return 0;
+    }
+    idlok(ts->list, TRUE);  // a one-row scroll may move lines instead of rewriting them
+    keypad(ts->list, TRUE);
+    return 1;
 }
 
 void draw_tree() {
     if (g_root == NULL) {
-        clear();
+        erase();
         attron(COLOR_PAIR(5) | A_BOLD);
         mvprintw(0, 0, "%-80s", " Tree Visualization");
         attroff(COLOR_PAIR(5) | A_BOLD);
-        
+
         attron(COLOR_PAIR(4));
         mvprintw(3, 2, "Error: No tree to display!");
         attroff(COLOR_PAIR(4));
@@ -75,123 +161,216 @@ void draw_tree() {
         getch();
         return;
     }
-    
+
     /* Initialize color pairs if not already done */
     init_pair(COLOR_TREE_Q, COLOR_YELLOW, COLOR_BLACK);
     init_pair(COLOR_TREE_A, COLOR_GREEN, COLOR_BLACK);
-    
-    /* Build display lines */
-    line_count = 0;
-    build_tree_display(g_root, 0, "", 0);
-    
-    int scroll_offset = 0;
-    int max_lines = LINES - 6;
-    int running = 1;
-    
+
+    TreeScreen ts = {NULL, NULL, 0};
+    if (!open_screen(&ts)) return;
+    TreeView view;
+    view_init(&view);
+    ViewRow top;
+    view_first(&top);
+    long topRow = 0;  /* row number of top, -1 when not known (after End) */
+    int sel = 0;      /* selected row, relative to top */
+    int max_lines = ts.height;
+    ViewRow *rows = malloc((size_t)max_lines * sizeof(ViewRow));
+    char text[MAX_ROW_BYTES];
+    int running = rows != NULL;
+
+    /* '/' search: every keystroke jumps from where the search began */
+    SearchQuery sq;
+    sq.words = 0;
+    char query[128] = "";
+    int searching = 0, found = 0, unfolded = 0;
+    Node *origin = NULL;
+    ViewRow originTop = top;
+    long originRow = 0;
+    int escDelay = ESCDELAY;
+    set_escdelay(25);  // ESC cancels a search without a noticeable wait
+
     while (running) {
-        clear();
-        
-        /* Header */
-        attron(COLOR_PAIR(5) | A_BOLD);
-        mvprintw(0, 0, "%-80s", " Tree Visualization");
-        attroff(COLOR_PAIR(5) | A_BOLD);
-        
-        /* Draw box */
-        int box_height = LINES - 4;
-        int box_width = COLS - 2;
-        attron(COLOR_PAIR(1));
-        mvhline(2, 1, ACS_HLINE, box_width);
-        mvhline(2 + box_height - 1, 1, ACS_HLINE, box_width);
-        mvvline(2, 1, ACS_VLINE, box_height);
-        mvvline(2, box_width, ACS_VLINE, box_height);
-        mvaddch(2, 1, ACS_ULCORNER);
-        mvaddch(2, box_width, ACS_URCORNER);
-        mvaddch(2 + box_height - 1, 1, ACS_LLCORNER);
-        mvaddch(2 + box_height - 1, box_width, ACS_LRCORNER);
-        attroff(COLOR_PAIR(1));
-        
-        /* Display tree lines */
-        for (int i = 0; i < max_lines && (i + scroll_offset) < line_count; i++) {
-            int line_idx = i + scroll_offset;
-            DisplayLine *dl = &lines[line_idx];
-            
-            int color = dl->isQuestion ? COLOR_TREE_Q : COLOR_TREE_A;
-            int attr = dl->isQuestion ? A_BOLD : A_NORMAL;
-            
-            attron(COLOR_PAIR(color) | attr);
-            
-            /* Truncate line if too long */
-            char display[256];
-            strncpy(display, dl->text, sizeof(display) - 1);
-            display[sizeof(display) - 1] = '\0';
-            
-            if (strlen(display) > (size_t)(COLS - 6)) {
-                display[COLS - 9] = '.';
-                display[COLS - 8] = '.';
-                display[COLS - 7] = '.';
-                display[COLS - 6] = '\0';
-            }
-            
-            mvprintw(3 + i, 3, "%s", display);
-            attroff(COLOR_PAIR(color) | attr);
+        int shown = view_rows(&view, top, rows, max_lines);
+        if (sel >= shown) sel = shown - 1;
+
+        /* Display the visible rows */
+        werase(ts.list);
+        for (int i = 0; i < shown; i++) {
+            const ViewRow *r = &rows[i];
+            int color = r->node->isQuestion ? COLOR_TREE_Q : COLOR_TREE_A;
+            int attr = (r->node->isQuestion ? A_BOLD : A_NORMAL) | (i == sel ? A_REVERSE : A_NORMAL);
+            format_row(&view, r, text, COLS - 6);
+            wattron(ts.list, COLOR_PAIR(color) | attr);
+            mvwaddstr(ts.list, i, 0, text);
+            wattroff(ts.list, COLOR_PAIR(color) | attr);
         }
-        
+
         /* Status bar */
-        attron(COLOR_PAIR(1));
-        mvprintw(LINES - 2, 2, "Lines %d-%d of %d | Use UP/DOWN arrows or j/k to scroll | Q to exit",
-                 scroll_offset + 1,
-                 (scroll_offset + max_lines < line_count) ? scroll_offset + max_lines : line_count,
-                 line_count);
-        attroff(COLOR_PAIR(1));
-        
-        /* Legend */
-        attron(COLOR_PAIR(COLOR_TREE_Q) | A_BOLD);
-        mvprintw(LINES - 1, 2, "YELLOW=Questions");
-        attroff(COLOR_PAIR(COLOR_TREE_Q) | A_BOLD);
-        
-        attron(COLOR_PAIR(COLOR_TREE_A));
-        mvprintw(LINES - 1, 22, "GREEN=Animals");
-        attroff(COLOR_PAIR(COLOR_TREE_A));
-        
-        refresh();
-        
+        werase(ts.status);
+        wattron(ts.status, COLOR_PAIR(1));
+        if (searching) {
+            mvwprintw(ts.status, 0, 0, "/%s", query);
+            if (query[0] && !found) wprintw(ts.status, "  (no match)");
+            else if (query[0] && sq.hits > 0) wprintw(ts.status, "  (%ld hits)", sq.hits);
+            wprintw(ts.status, " | ENTER keep, ESC cancel");
+        } else if (topRow >= 0) {
+            mvwprintw(ts.status, 0, 0, "Row %ld, depth %d | j/k scroll, ENTER fold, c/e fold, / n N find, Q exit",
+                      topRow + sel + 1, rows[sel].depth);
+        } else {
+            mvwprintw(ts.status, 0, 0, "Depth %d | j/k scroll, ENTER fold, c/e fold, / n N find, Q exit",
+                      rows[sel].depth);
+        }
+        wattroff(ts.status, COLOR_PAIR(1));
+
+        wnoutrefresh(ts.list);
+        wnoutrefresh(ts.status);
+        doupdate();
+
         /* Handle input */
-        int ch = getch();
+        int ch = wgetch(ts.list);
+        Node *cur = rows[sel].node;
+        if (searching && ch != KEY_RESIZE) {
+            size_t len = strlen(query);
+            if (ch == '\n' || ch == KEY_ENTER) {
+                searching = 0;
+                continue;
+            }
+            if (ch == 27) { // ESC: back to where the search began
+                searching = 0;
+                query[0] = '\0';
+            } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+                while (len > 0 && ((unsigned char)query[len - 1] & 0xC0) == 0x80) len--; // whole UTF-8 sequence
+                if (len > 0) query[len - 1] = '\0';
+            } else if (ch >= ' ' && ch < 256 && len + 1 < sizeof query) {
+                query[len] = (char)ch;
+                query[len + 1] = '\0';
+            } else {
+                continue;
+            }
+            Node *match = NULL;
+            if (query[0] && search_compile(&sq, query)) match = search_next(&sq, origin, 0);
+            else sq.words = 0;
+            found = match != NULL;
+            top = originTop;
+            topRow = unfolded ? -1 : originRow;
+            unfolded = show_node(&view, &top, &topRow, &sel, rows, max_lines, found ? match : origin) || unfolded;
+            continue;
+        }
         switch (ch) {
             case KEY_UP:
             case 'k':
-                if (scroll_offset > 0) scroll_offset--;
+                if (sel > 0) sel--;
+                else if (view_prev(&view, &top) && topRow >= 0) topRow--;
                 break;
             case KEY_DOWN:
             case 'j':
-                if (scroll_offset + max_lines < line_count) scroll_offset++;
+                if (sel + 1 < shown) {
+                    sel++;
+                } else {
+                    ViewRow below = rows[shown - 1];
+                    if (view_next(&view, &below) && view_next(&view, &top) && topRow >= 0) topRow++;
+                }
                 break;
             case KEY_PPAGE:  /* Page Up */
-                scroll_offset -= max_lines;
-                if (scroll_offset < 0) scroll_offset = 0;
+                for (int i = 0; i < max_lines && view_prev(&view, &top); i++) {
+                    if (topRow >= 0) topRow--;
+                }
+                break;
+            case KEY_NPAGE: { /* Page Down */
+                int moved = 0;
+                for (int i = 0; i < max_lines && view_next(&view, &top); i++) moved++;
+                moved -= fill_page(&view, &top, max_lines);
+                if (topRow >= 0) topRow += moved;
+                break;
+            }
+            case KEY_HOME:
+            case 'g':
+                view_first(&top);
+                topRow = 0;
+                sel = 0;
+                break;
+            case KEY_END:
+            case 'G':
+                view_last(&view, &top);
+                sel = fill_page(&view, &top, max_lines);
+                topRow = -1;
                 break;
-            case KEY_NPAGE:  /* Page Down */
-                scroll_offset += max_lines;
-                if (scroll_offset + max_lines > line_count) {
-                    scroll_offset = line_count - max_lines;
-                    if (scroll_offset < 0) scroll_offset = 0;
+            case '\n':
+            case KEY_ENTER:
+            case ' ':
+                view_toggle(&view, cur); // only rows below the selection change
+                break;
+            case KEY_RIGHT:
+            case 'l':
+                if (cur->isQuestion && !view_expanded(&view, cur)) view_toggle(&view, cur);
+                break;
+            case KEY_LEFT:
+            case 'h':
+                if (view_expanded(&view, cur)) {
+                    view_toggle(&view, cur);
+                } else if (cur->parent) { // select the parent
+                    int i = sel;
+                    while (i > 0 && rows[i].node != cur->parent) i--;
+                    if (rows[i].node == cur->parent) {
+                        sel = i;
+                    } else { // above the window: it becomes the top row
+                        top.node = cur->parent;
+                        top.depth = rows[sel].depth - 1;
+                        topRow = -1;
+                        sel = 0;
+                    }
                 }
                 break;
+            case 'c':
+                view_collapse_all(&view, 1);
+                view_first(&top);
+                topRow = 0;
+                sel = 0;
+                break;
+            case 'e':
+                view_collapse_all(&view, 0);
+                topRow = -1; // rows above top may have appeared
+                break;
+            case KEY_RESIZE: {
+                ViewRow *grown = NULL;
+                running = open_screen(&ts) &&
+                          (grown = realloc(rows, (size_t)ts.height * sizeof(ViewRow))) != NULL;
+                if (grown) rows = grown;
+                max_lines = ts.height;
+                break;
+            }
+            case '/':
+                werase(ts.status);
+                wattron(ts.status, COLOR_PAIR(1));
+                mvwprintw(ts.status, 0, 0, "Indexing the tree...");
+                wattroff(ts.status, COLOR_PAIR(1));
+                wrefresh(ts.status);
+                search_ready();  // built on first use and after edits
+                searching = 1;
+                found = unfolded = 0;
+                query[0] = '\0';
+                sq.words = 0;
+                origin = cur;
+                originTop = top;
+                originRow = topRow;
+                break;
+            case 'n':
+            case 'N': {
+                Node *match = sq.words > 0 ? search_next(&sq, cur, ch == 'N') : NULL;
+                if (match) show_node(&view, &top, &topRow, &sel, rows, max_lines, match);
+                break;
+            }
             case 'q':
             case 'Q':
                 running = 0;
                 break;
         }
     }
-    
-    /* Cleanup */
-    for (int i = 0; i < line_count; i++) {
-        free(lines[i].text);
-    }
-    if (lines) {
-        free(lines);
-        lines = NULL;
-    }
-    line_count = 0;
-    line_capacity = 0;
+
+    set_escdelay(escDelay);
+
+    free(rows);
+    view_free(&view);
+    close_screen(&ts);
 }